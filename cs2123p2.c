@@ -38,15 +38,15 @@ Returns:
     it returns boolean integer values (0 and 1) via the parameter
     queryResultM[].
 Notes:
-    1. This program only allows for 30 customers.
+    1. The number of customers is only limited by memory (see CustomerStore).
     2. A customer may have multiple occurrences of the same trait type.  For example,
        he/she may have multiple EXERCISE traits because he/she enjoys HIKE, 
        BIKE, and TENNIS.
-    3. The number of traits for a customer must not exceed 12.
-    4. This program uses an array to implement the stack.  It has a maximum of
-       MAX_STACK_ELEM elements. 
+    3. There is no limit on the number of traits for a customer.
+    4. This program uses an array to implement the stack.  It starts with
+       MAX_STACK_ELEM elements and doubles when it is full.
     5. This program uses an Out array for the resulting postfix expression.
-       It has a maximum of MAX_OUT_ITEM elements.
+       It starts with MAX_OUT_ITEM elements and doubles when it is full.
     6. On the command line, specifying p2 -? will provide the usage information.  
        In some unix shells, you will have to type p2 -\?
 ****************************************************************************************/
@@ -68,32 +68,60 @@ Parameters:
     I	Customer customerM[]	Customer structure array
 	I	int	     iNumCustomer	Number of elements in customerM[]
 Notes:
-    -Uses nested for loops to print each customer and their traits
+    -Prints each customer and their traits using writeCustomer
+    -Trait names are looked up in the global traitDict
+    -Customers removed by updates (p2 -u) aren't printed
+    -The customers are only printed in the text output format (-f).  The
+     csv format prints its heading row instead.
 ********************************************************************************/
 void printCustomerData(Customer customerM[], int iNumCustomer)
 {
     int i;
-    int j;
+    Writer writer = newWriter(stdout);
+    if (iOutputFormat == FORMAT_CSV)
+        writeCsvHeading(writer);
+    if (iOutputFormat != FORMAT_TEXT)
+    {
+        freeWriter(writer);
+        return;
+    }
     // Print a heading for the list of customers and traits
-    printf("ID         Customer Name\n"
+    writeString(writer, "ID         Customer Name\n"
 		   "                Trait      Value\n");
 	
     for (i = 0; i < iNumCustomer; i++)
-    {
-        // Print the customer information
-		printf("%-11s%s\n" 
-				, customerM[i].szCustomerId
-				, customerM[i].szCustomerName);
+        if (customerM[i].iNumberOfTraits != CUSTOMER_REMOVED)
+            writeCustomer(writer, &customerM[i]);
+    freeWriter(writer);
+}
+
+/******************** writeCustomer *****************************************
+void writeCustomer(Writer writer, Customer *pCustomer)
+Purpose:
+    Writes one customer and its traits like printCustomerData does.
+Parameters:
+    I/O	Writer writer			buffered output receiving the customer
+    I	Customer *pCustomer		the customer
+Notes:
+    -The columns are padded like "%-11s" without printf
+********************************************************************************/
+void writeCustomer(Writer writer, Customer *pCustomer)
+{
+    int j;
 
-        // Print each of the traits
-        for (j = 0; j < customerM[i].iNumberOfTraits; j++)
-        {
-            // Print a trait
-			printf("                %-11s%s\n"
-					, customerM[i].traitM[j].szTraitType
-					, customerM[i].traitM[j].szTraitValue);
+    // Write the customer information
+	writePadded(writer, pCustomer->szCustomerId, 11);
+	writeString(writer, pCustomer->szCustomerName);
+	writeText(writer, "\n", 1);
 
-        }
+    // Write each of the traits
+    for (j = 0; j < pCustomer->iNumberOfTraits; j++)
+    {
+        // Write a trait
+		writeText(writer, "                ", 16);
+		writePadded(writer, traitTypeName(traitDict, pCustomer->traitM[j].iTraitType), 11);
+		writeString(writer, traitValueName(traitDict, pCustomer->traitM[j].iTraitId));
+		writeText(writer, "\n", 1);
     }
 }
 
@@ -216,6 +244,17 @@ void processOperator(Stack stack, Element newValue, Out out)
 	
 	push(stack, newValue);
 }
+/******************** tokenRoom **************************************
+static int tokenRoom(Out out, Element element)
+Purpose:
+	Returns the most characters getToken may copy to an element's text in
+    out:  MAX_TOKEN, unless out's szTokens has less room.
+**************************************************************************/
+static int tokenRoom(Out out, Element element)
+{
+	int iRoom = out->iTokenSize - element.iToken - 1;
+	return iRoom < MAX_TOKEN ? iRoom : MAX_TOKEN;
+}
 /******************** convertToPostFix **************************************
 int convertToPostFix(char *pszInfix, Out out)
 Purpose:
@@ -233,25 +272,30 @@ Returns:
 Notes:
     - Uses a while loop to traverse a line of text until their are no
       more tokens.
+    - Each token's text is copied once, to out's szTokens.  The elements
+      on the stack and in out only have its offset (see OUT_TOKEN).
 **************************************************************************/
 int convertToPostFix(char *pszInfix, Out out)
 {
-	Stack stack = newStack();               // new dynamically allocated structure
-	                                        // of type StackImp stored in a pointer
-	                                        // named stack
+	Stack stack = newStack();               // in the query context, so an ErrExit
+	                                        // trapped by callTrapped doesn't
+	                                        // leak it
 	char *pszRemainingText;                 // stores address returned by getToken
 	                                        // which points to next token in string
 	                                        // after delimiter 
 	char szfromGetToken[MAX_TOKEN];         // stores token from getToken
-	Element element;                        // stores szfromGetToken 
+	Element element;                        // the token's text is in out
 	int bValid = FALSE;                     // stores TRUE or FALSE
 	
-	
-	pszRemainingText = getToken(pszInfix, element.szToken, sizeof(element.szToken) - 1);
+	// each token and its '\0' fit in the text, plus the empty last token
+	reserveOutTokens(out, (int) strlen(pszInfix) + 2);
+	element.iToken = 0;
+	pszRemainingText = getToken(pszInfix, OUT_TOKEN(out, element)
+		, tokenRoom(out, element));
 	
 	while(pszRemainingText != NULL)
 	{	
-		categorize(&element);                           // argument to categorize function
+		categorize(&element, OUT_TOKEN(out, element));  // argument to categorize function
 	                                                    // is a pointer to element
 		
 		// element can now be used to convert to postfix
@@ -282,14 +326,14 @@ int convertToPostFix(char *pszInfix, Out out)
 			{
 				// if bValid is FALSE
 				// left parenthesis was never found on stack
-				freeStack(stack);
 				return WARN_MISSING_LPAREN;
 			}
 		}
 
-		// retrieve next token
-		if (pszRemainingText != NULL)
-			pszRemainingText = getToken(pszRemainingText, element.szToken, sizeof(element.szToken) - 1);
+		// retrieve next token (its text follows this token's in out)
+		element.iToken += strlen(OUT_TOKEN(out, element)) + 1;
+		pszRemainingText = getToken(pszRemainingText, OUT_TOKEN(out, element)
+			, tokenRoom(out, element));
 	} // end while
 	
 	// end of input string is reached
@@ -297,8 +341,6 @@ int convertToPostFix(char *pszInfix, Out out)
 	// process remaining string
 	bValid = processRemString(stack, out);
 	
-	freeStack(stack);
-	
 	// if right parenthesis is missing return warnring
 	if (!bValid)
 		return WARN_MISSING_RPAREN;	
@@ -380,26 +422,26 @@ int only(Customer *pCustomer, Trait *pTrait)
 	int iCountOfTraitTypes = 0;               // will store the count of traitTypes
 	                                          // in customer trait array that match
 	                                          // pTrait 
+	int bFound = FALSE;                       // TRUE if the customer has pTrait
 	
     if (pCustomer == NULL)
         ErrExit(ERR_ALGORITHM
         , "received a NULL pointer");
 	
+	STATS_ADD(lTraitCompares, pCustomer->iNumberOfTraits);
 	for (i = 0; i < (pCustomer->iNumberOfTraits); i++)
 	{
-		// find if customer has pTrait
-		if (strcmp(pCustomer->traitM[i].szTraitType, pTrait->szTraitType) == 0)
+		// count the customer's traits of the same type as pTrait
+		// and find if customer has pTrait
+		if (pCustomer->traitM[i].iTraitType == pTrait->iTraitType)
+		{
 			iCountOfTraitTypes++;
+			if (pCustomer->traitM[i].iTraitId == pTrait->iTraitId)
+				bFound = TRUE;
+		}
 	}
 	
-	for (i = 0; i < (pCustomer->iNumberOfTraits); i++)
-	{
-		if (strcmp(pCustomer->traitM[i].szTraitType, pTrait->szTraitType) == 0)
-			if (strcmp(pCustomer->traitM[i].szTraitValue, pTrait->szTraitValue) == 0)
-				if(iCountOfTraitTypes == 1)
-					return TRUE;
-	}
-	return FALSE;
+	return (bFound && iCountOfTraitTypes == 1);
 }
 /******************** evaluatePostFix *******************************************************
 void evaluatePostFix(Out out, Customer customerM[], int iNumCustomer, QueryResult resultM[])
@@ -419,85 +461,77 @@ Returns:
     this function returns boolean values corresponding to TRUE or FALSE.  Each queryResultM[]
     element corresponds to a customerM structure at the same index.
 Notes:
-    -Uses two for loops nested together resulting in a computational complexity of order n^2.
+    -The query is compiled once (compileQuery) into instructions with resolved trait IDs
+     so that evaluating it for a customer (runProgram) does no string work.
+    -If the global customerIndex was built for customerM, the program is instead 
+     evaluated once over its bitmaps by evaluateProgramIndex.
+    -If the postfix can't be evaluated, a warning is printed and no customers are
+     included.
+    -If the global queryCache has the result of the same postfix, it is used instead
+     of compiling and evaluating the query.  New results are saved in it.
 ********************************************************************************************/
 void evaluatePostfix(Out out, Customer customerM[], int iNumCustomer, QueryResult resultM[])
 {
-	Stack stack = newStack();     // used to store operands from Out and resulting boolean values
-	Element evalElem;             // stores values used for evaluation
-	Element operand1;             // used to store operand elements 
-	Element operand2;             // which were popped from the stack
-	Trait trait;                  // store trait types and values popped from stack
-	int i;                        // used for outer for loop index
-	                              // traverses over customerM array
-	int j;                        // used for inner for loop index
+	evaluatePostfixWarn(out, customerM, iNumCustomer, resultM, stdout, 0);
+}
+/******************** countMatches *******************************************************
+static void countMatches(QueryResult resultM[], int iNumCustomer)
+Purpose:
+	Adds the customers satisfying a query to the counters of p2 -s.
+********************************************************************************************/
+static void countMatches(QueryResult resultM[], int iNumCustomer)
+{
+	int i;
+	for (i = 0; i < iNumCustomer; i++)
+		if (resultM[i])
+			pQueryStats->lMatched++;
+}
+/******************** evaluatePostfixWarn ***************************************************
+int evaluatePostfixWarn(Out out, Customer customerM[], int iNumCustomer
+    , QueryResult resultM[], FILE *pWarn, int iQueryCnt)
+Purpose:
+	Same as evaluatePostfix, but prints its warning (via fprintQueryCompiled) to
+    pWarn (e.g., the output buffer of a query worker thread).
+Returns:
+    TRUE - the query's result is printed:  it was evaluated, or it can't
+           be (WARN_BAD_QUERY) and the format prints its empty result
+    FALSE - the result isn't printed
+********************************************************************************************/
+int evaluatePostfixWarn(Out out, Customer customerM[], int iNumCustomer
+    , QueryResult resultM[], FILE *pWarn, int iQueryCnt)
+{
+	ProgramImp program;           // the query compiled from out
+	int i;                        // traverses over customerM array
 
-	for (i = 0; i < iNumCustomer; i++) 
+	if (queryCache != NULL
+		&& lookupQueryCache(queryCache, out, customerM, iNumCustomer, resultM))
 	{
-		for (j = 0; j < (out->iOutCount); j++)
-		{
-		    Element postElem = out->outM[j];        // stores element value from Out structure
-		    switch (postElem.iCategory)
-		    {
-		       case CAT_OPERAND:
-		            push(stack, postElem);
-		            break;
-		       case CAT_OPERATOR:
-		          // this string will make it clear that this
-		          // element in the stack is a boolean value
-		          strcpy(evalElem.szBoolean, "Boolean result of ");
-		          strcat(evalElem.szBoolean, postElem.szToken);
-				  operand2 = pop(stack);    // should be trait value or boolean value
-				  operand1 = pop(stack);    // should be trait type or boolean value             
-			     
-				 if (strcmp(postElem.szToken, "AND") == 0)
-				 { 
-					 // use evalElem popped from stack with logical AND
-					 // operation and then push the result back on the stack
-				    evalElem.bInclude = (operand1.bInclude && operand2.bInclude);
+		if (STATS_ON)
+			countMatches(resultM, iNumCustomer);
+		return TRUE;
+	}
 
-					push(stack, evalElem);
-					break;
-				 }
-				 
-				 if (strcmp(postElem.szToken, "OR") == 0)
-				 {
-					 // use evalElem popped from stack with logical OR
-					 // operation and push the result back on the stack
-					evalElem.bInclude = (operand1.bInclude || operand2.bInclude);
+	if (!compileQuery(out, &program))
+	{
+		memset(resultM, 0, sizeof(QueryResult) * iNumCustomer);
+		return fprintQueryCompiled(pWarn, iQueryCnt, FALSE);
+	}
 
-					push(stack, evalElem);
-					break;
-				 }
-				 // if values popped from stack are not boolean
-				 // i.e., value is a trait and trait type
-				 strcpy(trait.szTraitValue, operand2.szToken);              
-				 strcpy(trait.szTraitType, operand1.szToken);
-				 
-		         if (strcmp(postElem.szToken, "=") == 0)
-			     { 
-				    evalElem.bInclude = atLeastOne(&customerM[i], &trait);
-					push(stack, evalElem);
-				 }
-				 else if (strcmp(postElem.szToken, "NOTANY") == 0)
-			     { 
-				    evalElem.bInclude = notAny(&customerM[i], &trait);
-					push(stack, evalElem);
-			     }
-				 else if (strcmp(postElem.szToken, "ONLY") == 0)
-				 {
-				    evalElem.bInclude = only(&customerM[i], &trait);
-					push(stack, evalElem);
-				 }				  
-				 break;
-			   default: 
-			       printf("\t warning improperly formatted query\n");
-			} // end switch
-		} // end inner for
-		// take the result of the query and store it in QueryResult array at current index i
-		evalElem = pop(stack);
-		resultM[i] = evalElem.bInclude;
-	} // end outter for
-	  
-	  free(stack);
+	if (customerIndex != NULL && customerIndex->customerM == customerM
+		&& customerIndex->iNumCustomer == iNumCustomer)
+		evaluateProgramIndex(&program, customerIndex, resultM);
+	else
+	{
+		for (i = 0; i < iNumCustomer; i++) 
+			resultM[i] = runProgram(&program, &customerM[i]);
+	}
+
+	if (queryCache != NULL)
+		insertQueryCache(queryCache, out, customerM, iNumCustomer, resultM);
+	if (STATS_ON)
+	{
+		pQueryStats->lScanned += iNumCustomer;
+		countMatches(resultM, iNumCustomer);
+	}
+	return TRUE;
 }
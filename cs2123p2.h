@@ -14,8 +14,24 @@ Purpose:
        Stack    (pointer to a StackImp)
        OutImp   (out implementation)
        Out      (pointer to an OutImp)
-       Trait    (customer's trait type and trait value)
+       Trait    (customer's trait type ID and trait ID)
        Customer (customer id, name, and array of Trait entries)
+       Arena    (chunked bump allocator)
+       CustomerStore (pointer to a CustomerStoreImp of all customers)
+       TextFile (text of a file mapped into memory)
+       TraitDict (pointer to a TraitDictImp which interns trait names)
+       Instr    (instruction of a compiled query)
+       Program  (pointer to a ProgramImp which is a compiled query)
+       BitWord  (word of a customer bitmap)
+       BlockKernels (bitmap block operations for one instruction set)
+       CustomerIndex (pointer to a CustomerIndexImp of trait bitmaps)
+       QueryCache (pointer to the query result cache)
+       Writer   (pointer to a WriterImp which buffers output)
+       OutputBuffer (output of a query kept until it is printed)
+       QueryContext (memory a thread reuses for each query)
+       ResultMode (COUNT or LIMIT n OFFSET m suffix of a query)
+       QueryStats (counters and stage times of a query for p2 -s)
+       Options  (command switches other than the file names)
    Protypes
        Functions provided by student
        Stack functions provided by Larry
@@ -26,12 +42,14 @@ Notes:
 **********************************************************************/
 /*** constants ***/
 // Maximum constants
-#define MAX_STACK_ELEM 20       // Maximum number of elements in the stack array
+#define MAX_STACK_ELEM 20       // Initial number of elements in the stack array
 #define MAX_TOKEN 50            // Maximum number of actual characters for a token
-#define MAX_OUT_ITEM 50         // Maximum number of Out items
-#define MAX_CUSTOMERS 30         // Maximum number of customers
-#define MAX_TRAITS 12            // Maximum number of traits per customer       
-#define MAX_LINE_SIZE 100        // Maximum number of character per input line
+#define MAX_OUT_ITEM 50         // Initial number of Out items
+#define MAX_STORE_CUSTOMERS 0x40000000 // Maximum number of customers in a store
+#define MAX_LINE_SIZE 100        // Maximum number of character per customer
+                                 // line (query and update lines aren't limited)
+#define MAX_TRAIT_TYPE 10        // Maximum number of characters in a trait type
+#define MAX_TRAIT_VALUE 12       // Maximum number of characters in a trait value
 
 
 // Error constants (program exit values)
@@ -40,7 +58,6 @@ Notes:
 #define ERR_OUT_OVERFLOW    902    // Error in Out (overflow)
 #define ERR_ALGORITHM       903    // Error in algorithm - almost anything else
 #define ERR_TOO_MANY_CUST   501    // Too many customers
-#define ERR_TOO_MANY_TRAITS 502    // Too many traits
 #define ERR_BAD_INPUT       503    // Bad input 
 
 // Error Messages 
@@ -51,6 +68,7 @@ Notes:
 // Warning constants.  Warnings do not cause the program to exit.
 #define WARN_MISSING_RPAREN 801
 #define WARN_MISSING_LPAREN 802
+#define WARN_BAD_QUERY 803          // the postfix can't be evaluated
 
 // exitUsage control 
 #define USAGE_ONLY          0      // user only requested usage information
@@ -62,6 +80,34 @@ Notes:
 #define CAT_OPERATOR 3      // Operators are =, NOTANY, ONLY, AND, OR
 #define CAT_OPERAND 4       // These are trait types and trait values
 
+// trait dictionary lookup result for a name which isn't in the dictionary
+#define TRAIT_NOT_FOUND -1
+
+// findCustomer result for a customer ID which isn't in the store
+#define CUSTOMER_NOT_FOUND -1
+
+// iNumberOfTraits of a customer removed by an update (its tombstone)
+#define CUSTOMER_REMOVED -1
+
+// return codes of the customer updates (p2 -u)
+#define UPDATE_OK 0                 // the update was applied
+#define UPDATE_BAD_RECORD 1         // the record isn't an update
+#define UPDATE_NO_CUSTOMER 2        // the customer ID isn't in the store
+#define UPDATE_DUPLICATE 3          // ADD CUSTOMER of an ID in the store
+#define UPDATE_NO_TRAIT 4           // REMOVE TRAIT of a trait the customer doesn't have
+
+// output formats (p2 -f)
+#define FORMAT_TEXT 0       // report of the customers and the queries
+#define FORMAT_CSV 1        // a row per customer satisfying a query
+#define FORMAT_JSONL 2      // a JSON object per line
+#define FORMAT_BITMAP 3     // a binary record with a bitmap per query
+
+// result modes of a query (its suffix, e.g., "GENDER = F LIMIT 10 OFFSET 20")
+#define RESULT_ALL 0        // every customer satisfying the query
+#define RESULT_COUNT 1      // COUNT:  the number of customers satisfying it
+#define RESULT_LIMIT 2      // LIMIT n OFFSET m:  at most n of the customers
+                            // satisfying it after the first m
+
 // boolean constants
 #define FALSE 0
 #define TRUE 1
@@ -71,55 +117,61 @@ Notes:
 // Token typedef used for operators, operands, and parentheses
 typedef char Token[MAX_TOKEN + 1];
 
-// Element typedef used for Element values placed in the stack or out
-// The evaluation stack can have two types of data.
-typedef union 
-{
-    struct 
-    {
-        Token szToken;      // token from the query
-        int iCategory;      // category CAT_LPAREN, CAT_RPAREN, CAT_OPERATOR, CAT_OPERAND
-        int iPrecedence;    // operator precedence with 0 being lowest
-    };
-    struct 
-    {
-        char szBoolean[MAX_TOKEN]; // This is to aid in debugging
-        int bInclude;       // TRUE - intermediate include result, FALSE - intermediate don't include
-    };
+// Element typedef used for Element values placed in the stack or out.
+// The token's text is kept once in the Out (see OUT_TOKEN), so an element
+// is small enough to copy freely.  (The evaluation of a query uses a
+// stack of booleans, see runProgram.)
+typedef struct
+{
+    int iToken;         // offset of the token's text in the Out's szTokens
+    short iCategory;    // category CAT_LPAREN, CAT_RPAREN, CAT_OPERATOR, CAT_OPERAND
+    short iPrecedence;  // operator precedence with 0 being lowest
 } Element;
 
-// StackImp typedef defines how we implement a stack using an array
+// StackImp typedef defines how we implement a stack using an array.
+// The array is allocated from the thread's query context and doubles when
+// it is full, so a stack is only used while a query is processed.
 typedef struct
 {
     int iCount;  // number of elements in stack.  0 is empty 
-    Element stackElementM[MAX_STACK_ELEM];
+    int iMax;    // allocated size of stackElementM
+    Element *stackElementM;
 } StackImp;
 
 // Stack typedef defines a pointer to a stack
 typedef StackImp *Stack;
 
-// OutImp typedef defines how we implement out
+// OutImp typedef defines how we implement out.  outM and szTokens double
+// when they are full (see addOut and reserveOutTokens), and an Out is
+// reused for each query (see newOut).
 typedef struct
 {
     int iOutCount;
-    Element outM[MAX_OUT_ITEM];
+    int iMaxOut;                // allocated size of outM
+    Element *outM;
+    int iTokenSize;             // allocated size of szTokens
+    char *szTokens;             // text of the query's tokens (each ends with
+                                // a zero byte) set by convertToPostFix
 } OutImp;
 
+// text of an element of an Out (or of its conversion stack)
+#define OUT_TOKEN(out, element) ((out)->szTokens + (element).iToken)
+
 // Out typedef defines a pointer to out
 typedef OutImp *Out;
 
 /* Trait typedef defines a trait type (e.g., GENDER) and
-** corresponding trait value (e.g., M, F)
+** corresponding trait value (e.g., M, F) by their trait dictionary IDs
 */
 typedef struct
 {
-    char szTraitType[11];        // Trait Type can be one of:
+    int iTraitType;              // ID of the Trait Type which can be one of:
     //    GENDER
     //    SMOKING
     //    MOVIE
     //    BOOK
     //    EXERCISE 
-    char szTraitValue[13];       // This corresponds to the Trait Type:
+    int iTraitId;                // ID of the (Trait Type, Trait Value) pair:
     //    GENDER:   M, F
     //    SMOKING:  Y, N
     //    MOVIE:    ROMANCE, COMEDY, ACTION, FAMILY, HORROR
@@ -128,17 +180,315 @@ typedef struct
     //    EXERCISE: TENNIS, GOLF, JOG, RUN, YOGA, DANCE, HIKE, BIKE 
 } Trait;
 
+/* TraitDict typedef defines the trait dictionary which maps each trait type
+** and each (trait type, trait value) pair to a small integer ID.  The
+** hash tables hold ID + 1 so that 0 marks an empty slot.
+*/
+typedef struct
+{
+    char szTraitType[MAX_TRAIT_TYPE + 1];
+} TraitTypeDef;
+
+typedef struct
+{
+    int iTraitType;                         // trait type ID of this pair
+    char szTraitValue[MAX_TRAIT_VALUE + 1];
+} TraitValueDef;
+
+typedef struct
+{
+    int iNumTypes;              // number of trait types in typeM
+    int iMaxTypes;              // allocated size of typeM
+    TraitTypeDef *typeM;        // trait types subscripted by trait type ID
+    int iTypeHashSize;          // size of typeHashM (a power of 2)
+    int *typeHashM;             // hash table of trait type IDs + 1
+    int iNumTraits;             // number of (type, value) pairs in traitM
+    int iMaxTraits;             // allocated size of traitM
+    TraitValueDef *traitM;      // trait pairs subscripted by trait ID
+    int iTraitHashSize;         // size of traitHashM (a power of 2)
+    int *traitHashM;            // hash table of trait IDs + 1
+} TraitDictImp;
+
+// TraitDict typedef defines a pointer to a trait dictionary
+typedef TraitDictImp *TraitDict;
+
 /* Customer typedef contains customer Id, customer name, and an array of traits */
 typedef struct
 {
     char szCustomerId[7];               // Customer Identifier
     char szCustomerName[21];            // Customer Full Name
     int  iNumberOfTraits;               // The number of traits for each customer
-    Trait traitM[MAX_TRAITS];
+                                        // (CUSTOMER_REMOVED if it was removed)
+    Trait *traitM;                      // traits in the customer store's arena
 } Customer;
 
+/* Arena typedef defines a chunked bump allocator.  Each chunk is twice the
+** size of the previous one (up to a limit).  Memory is only freed by freeing
+** the whole arena.
+*/
+#define ARENA_ALIGN 8           // alignment of arena allocations
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *pPrev;   // previously allocated chunk
+    size_t iSize;               // number of bytes in dataM
+    size_t iUsed;               // number of bytes of dataM handed out
+    char dataM[];
+} ArenaChunk;
+
+typedef struct
+{
+    ArenaChunk *pChunk;         // current chunk (NULL if none yet)
+    size_t iNextSize;           // size of the next chunk
+} Arena;
+
+/* CustomerStoreImp typedef defines the customers.  customerM is doubled when
+** it is full and the customers' traits are allocated from traitArena.
+** When the customers are loaded from a snapshot, customerM and the traits
+** are in the snapshot's mapping (pSnapshot) instead.  A customer removed by
+** an update stays in customerM (as a tombstone) until the store is compacted.
+*/
+typedef struct
+{
+    int iNumCustomer;           // number of customers in customerM
+    int iMaxCustomer;           // allocated size of customerM
+    Customer *customerM;        // the customers in the order they were read
+    Arena traitArena;           // the traits of all of the customers
+    char *pszLoadWarnings;      // warnings printed while loading the customers
+    size_t iLoadWarningsSize;   // length of pszLoadWarnings
+    char *pSnapshot;            // mapped snapshot (NULL if not from a snapshot)
+    size_t iSnapshotSize;       // size of the mapped snapshot
+    int iNumRemoved;            // customers removed by updates (tombstones)
+    size_t iDeadTraitBytes;     // bytes of traits no customer uses any more
+    int iIdHashSize;            // size of idHashM (0 until it is built)
+    int *idHashM;               // hash table of customer subscripts + 1 by ID
+} CustomerStoreImp;
+
+// CustomerStore typedef defines a pointer to a customer store
+typedef CustomerStoreImp *CustomerStore;
+
+// TextFile typedef defines the text of a file mapped (or read) into memory
+typedef struct
+{
+    char *pszText;              // first character of the file (not zero-terminated)
+    size_t iSize;               // number of characters in the file
+    int bMapped;                // TRUE - mapped with mmap, FALSE - allocated
+} TextFile;
+
 typedef int QueryResult;
 
+// opcodes of the instructions of a compiled query
+#define OP_HAS      1       // =       push TRUE if the customer has the trait
+#define OP_NOTANY   2       // NOTANY  push TRUE if the customer doesn't have the trait
+#define OP_ONLY     3       // ONLY    push TRUE if it is the only trait of its type
+#define OP_AND      4       // AND     pop two values, push their logical AND
+#define OP_OR       5       // OR      pop two values, push their logical OR
+#define OP_TRUE     6       // push TRUE (an operand used as a boolean)
+#define OP_JFALSE   7       // jump to iTarget if the top value is FALSE (it stays)
+#define OP_JTRUE    8       // jump to iTarget if the top value is TRUE (it stays)
+
+// Instr typedef is one instruction of a compiled query
+typedef struct
+{
+    int iOpcode;        // OP_HAS, OP_NOTANY, OP_ONLY, OP_AND, OP_OR, OP_TRUE,
+                        // OP_JFALSE, OP_JTRUE
+    Trait trait;        // resolved trait of OP_HAS, OP_NOTANY and OP_ONLY
+    int iTarget;        // instruction OP_JFALSE and OP_JTRUE jump to
+} Instr;
+
+// ProgramImp typedef is a query compiled from its postfix by compileQuery
+typedef struct
+{
+    int iNumInstr;      // number of instructions in instrM
+    int iMaxDepth;      // maximum number of values on the evaluation stack
+    Instr *instrM;      // the instructions (from the query context, or after
+                        // the ProgramImp for a copy from keepProgram)
+} ProgramImp;
+
+// Program typedef defines a pointer to a compiled query
+typedef ProgramImp *Program;
+
+/* BitWord typedef is one word of a customer bitmap.  Bit i of a bitmap
+** (bit i % 64 of word i / 64) corresponds to customerM[i].
+*/
+typedef unsigned long long BitWord;
+#define BITS_PER_WORD 64
+#define BITMAP_WORDS(iNumBits) (((iNumBits) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+#define BITMAP_SET(bitsM, i) ((bitsM)[(i) / BITS_PER_WORD] |= (BitWord) 1 << ((i) % BITS_PER_WORD))
+#define BITMAP_TEST(bitsM, i) (((bitsM)[(i) / BITS_PER_WORD] >> ((i) % BITS_PER_WORD)) & 1)
+
+/* Queries are evaluated over blocks of BLOCK_WORDS words of the bitmaps
+** (512 customers) at a time.  BlockKernels typedef defines the block
+** operations implemented with one instruction set (AVX2, SSE2, scalar).
+*/
+#define BLOCK_WORDS 8
+typedef struct
+{
+    char *pszName;                                  // "avx2", "sse2", "scalar"
+    void (*copyBlock)(BitWord *pDst, const BitWord *pSrc);
+    void (*notBlock)(BitWord *pDst, const BitWord *pSrc);
+    void (*andBlock)(BitWord *pDst, const BitWord *pSrc1, const BitWord *pSrc2);
+    void (*orBlock)(BitWord *pDst, const BitWord *pSrc1, const BitWord *pSrc2);
+    int (*zeroBlock)(const BitWord *pSrc);          // TRUE if all bits are off
+    int (*onesBlock)(const BitWord *pSrc);          // TRUE if all bits are on
+} BlockKernels;
+
+/* CustomerIndexImp typedef defines the inverted bitmap index of the customers
+** built after getCustomerData.  Each bitmap has iNumWords words, which is
+** rounded up to whole blocks.  The words past iNumCustomer bits are zero.
+** Once an update removes a customer, liveBitsM has the customers which
+** weren't removed, and query results are ANDed with it.
+*/
+typedef struct
+{
+    Customer *customerM;        // customers which were indexed
+    int iNumCustomer;           // number of customers (bits) in each bitmap
+    int iNumWords;              // number of BitWords in each bitmap
+    int iNumBlocks;             // number of blocks of BLOCK_WORDS in each bitmap
+    BlockKernels *pKernels;     // block operations selected for this CPU
+    int iNumShards;             // threads evaluating each query (1 - no threads)
+    struct ShardPool *pShardPool;   // threads evaluating the shards (NULL
+                                // if iNumShards is 1)
+    int bMapped;                // TRUE - the bitmaps are in a mapped snapshot
+    int iNumTraits;             // number of trait bitmaps
+    int iNumTypes;              // number of trait type bitmaps
+    int iMaxTraits;             // trait bitmaps allocated (>= iNumTraits)
+    int iMaxTypes;              // trait type bitmaps allocated (>= iNumTypes)
+    BitWord *traitBitsM;        // customers having each trait ID
+    BitWord *onlyBitsM;         // customers having exactly one trait of each type
+    int *traitCountM;           // number of customers having each trait ID
+    int *onlyCountM;            // number of customers having exactly one trait
+                                // of each type
+    BitWord *liveBitsM;         // customers not removed (NULL if none were)
+} CustomerIndexImp;
+
+// CustomerIndex typedef defines a pointer to a customer index
+typedef CustomerIndexImp *CustomerIndex;
+
+// address of the bitmap of a trait ID and of the "exactly one" bitmap of a type
+#define TRAIT_BITS(index, iTraitId) ((index)->traitBitsM + (size_t) (iTraitId) * (index)->iNumWords)
+#define ONLY_BITS(index, iTraitType) ((index)->onlyBitsM + (size_t) (iTraitType) * (index)->iNumWords)
+
+/* QueryCache typedef defines a pointer to the query result cache.  Its
+** implementation is private to cs2123p2Cache.c.
+*/
+typedef struct QueryCacheImp *QueryCache;
+#define DEFAULT_CACHE_MB 64     // default byte budget (in MB) of the query cache
+
+/* WriterImp typedef defines output buffered in memory until it is flushed
+** to a stream (see cs2123p2Writer.c).
+*/
+#define WRITER_BUFFER (1 << 16) // bytes buffered by a Writer
+typedef struct
+{
+    FILE *pFile;                // stream receiving the output
+    int iFd;                    // its file descriptor (-1 if it has none)
+    size_t iUsed;               // bytes of bufferM filled
+    char bufferM[WRITER_BUFFER];    // the buffered output
+} WriterImp;
+
+// Writer typedef defines a pointer to a writer
+typedef WriterImp *Writer;
+
+/* OutputBuffer typedef defines the output of a query kept in memory until
+** it is printed (see openBufferStream).  Its memory is kept for the output
+** of the next query using it.
+*/
+typedef struct
+{
+    char *pszText;              // output (not zero terminated)
+    size_t iLength;             // bytes of output in pszText
+    size_t iMax;                // bytes allocated for pszText
+} OutputBuffer;
+
+/* QueryContext typedef defines the memory a thread reuses for each query it
+** processes (see cs2123p2Context.c):  an arena for the query's buffers,
+** which is emptied when the thread's next query starts, a scratch buffer
+** (in the arena) reused by each evaluation of the query, a Writer kept
+** by freeWriter for the next newWriter, and the stream which prints to
+** an OutputBuffer.
+*/
+typedef struct
+{
+    Arena arena;                // buffers of the thread's current query
+    void *pScratch;             // scratch buffer of queryScratch (NULL if none)
+    size_t iScratchSize;        // bytes of pScratch
+    Writer spareWriter;         // a freed Writer (NULL if none)
+    FILE *pBufferStream;        // stream of openBufferStream (NULL if none)
+    OutputBuffer *pBuffer;      // buffer receiving pBufferStream's output
+} QueryContext;
+
+// ResultMode typedef is the result requested by a query's suffix
+typedef struct
+{
+    int iMode;                  // RESULT_ALL, RESULT_COUNT, RESULT_LIMIT
+    int iLimit;                 // LIMIT n:  most customers printed
+    int iOffset;                // OFFSET m:  customers skipped before them
+} ResultMode;
+
+/* QueryStats typedef holds the counters and stage times of one query (or of
+** loading the customers) for p2 -s.  Building with -DP2_STATS=0 removes the
+** counting (see cs2123p2Stats.c).
+*/
+#ifndef P2_STATS
+#define P2_STATS 1
+#endif
+#define STAGE_LOAD 0            // getCustomerData
+#define STAGE_CONVERT 1         // convertToPostFix
+#define STAGE_EVALUATE 2        // evaluatePostfix
+#define STAGE_PRINT 3           // printQueryResult
+#define NUM_STAGES 4
+typedef struct
+{
+    long long lPushes;          // pushes on the conversion and evaluation stacks
+    long long lPops;            // pops from the conversion and evaluation stacks
+    long long lTraitCompares;   // customer traits compared with a query's trait
+    long long lScanned;         // customers the query was evaluated for
+    long long lMatched;         // customers satisfying the query
+    long long lStageNanosM[NUM_STAGES];     // time in each stage
+    int iStageCallsM[NUM_STAGES];           // times each stage was timed
+} QueryStats;
+
+// counters of the query the thread is processing (NULL if not counting)
+extern __thread QueryStats *pQueryStats;
+
+#if P2_STATS
+#define STATS_ON (pQueryStats != NULL)
+#define STATS_ONLY(...) __VA_ARGS__
+#else
+#define STATS_ON 0
+#define STATS_ONLY(...)
+#endif
+// adds n to a counter of the thread's query
+#define STATS_ADD(field, n) do { if (STATS_ON) pQueryStats->field += (n); } while (0)
+// starts timing a stage (lStart is a long long)
+#define STATS_START(lStart) ((lStart) = STATS_ON ? statsNanos() : 0)
+// adds the time since STATS_START to a stage of the thread's query
+#define STATS_STOP(iStage, lStart) do { if (STATS_ON) { \
+    pQueryStats->lStageNanosM[iStage] += statsNanos() - (lStart); \
+    pQueryStats->iStageCallsM[iStage]++; } } while (0)
+// starts counting for a query (if p2 -s) and records its counters
+#define STATS_BEGIN() STATS_ONLY(pQueryStats = newQueryStats())
+#define STATS_END(iQueryCnt) STATS_ONLY(recordQueryStats(iQueryCnt))
+
+// Options typedef holds the command switches other than the file names
+typedef struct
+{
+    int iQueryThreads;          // -t number of threads processing queries
+    int iShardThreads;          // -j number of threads evaluating each query
+    char *pszSnapshotOut;       // -S snapshot file to write (NULL if none)
+    char *pszSnapshotIn;        // -C snapshot file to load (NULL if none)
+    int iCacheMegabytes;        // -m query cache budget in MB (0 - no cache)
+    int bBatch;                 // -b TRUE to evaluate the queries in batches
+    int bNoIndex;               // -n TRUE to not build the customer index
+    int bStream;                // -r TRUE to stream the customer file
+    int iOutputFormat;          // -f output format (e.g., FORMAT_CSV)
+    char *pszBenchFile;         // -B file receiving the benchmark times (NULL
+                                // if not benchmarking)
+    int bStats;                 // -s TRUE to print statistics at the end
+    char *pszUpdateFile;        // -u file of customer updates (NULL if none)
+    char *pszSocketFile;        // -L socket of daemon mode (NULL if not a daemon)
+} Options;
+
 /**********   prototypes ***********/
 
 // functions that each student must implement
@@ -146,6 +496,7 @@ typedef int QueryResult;
 
 // your code from program #0
 void printCustomerData(Customer customerM[], int iNumCustomer);
+void writeCustomer(Writer writer, Customer *pCustomer);
 
 // your code from program #1 (and other functions for modularity)
 int convertToPostFix(char *pszInfix, Out out);
@@ -155,6 +506,8 @@ int processRemString(Stack stack, Out out);
 
 // your code for program #2
 void evaluatePostfix(Out out, Customer customerM[], int iNumCustomer, QueryResult resultM[]);
+int evaluatePostfixWarn(Out out, Customer customerM[], int iNumCustomer
+    , QueryResult resultM[], FILE *pWarn, int iQueryCnt);
 int atLeastOne(Customer *pCustomer, Trait *pTrait);
 int only(Customer *pCustomer, Trait *pTrait);
 
@@ -168,20 +521,226 @@ void freeStack(Stack stack);
 Element topElement(Stack stack);
 
 // Other functions that Larry provided
-void categorize(Element *pElement);
+void categorize(Element *pElement, char *pszToken);
 Out newOut();
+void freeOut(Out out);
 void addOut(Out out, Element element);
+void reserveOutTokens(Out out, int iSize);
 void printOut(Out out);
+void fprintOut(FILE *pFile, Out out);
 void printQueryResult(Customer customerM[], int iNumCustomer, QueryResult resultM[]);
+void fprintQueryResult(FILE *pFile, int iQueryCnt, Customer customerM[]
+    , int iNumCustomer, QueryResult resultM[]);
 int notAny(Customer *pCustomer, Trait *pTrait);
-void getCustomerData(Customer customerM[], int *piNumCustomer);
+void getCustomerData(CustomerStore store);
 void readAndProcessQueries(Customer customerM[], int iNumberOfCustomers);
+void processQuery(FILE *pFile, char *pszQuery, int iQueryCnt, Out out
+    , Customer customerM[], int iNumberOfCustomers, QueryResult resultM[]);
+
+// Query worker pool functions
+void readAndProcessQueriesParallel(Customer customerM[], int iNumberOfCustomers
+    , int iNumThreads);
+FILE *queryErrorFile();
+void trapQueryError(int iExitRC);
+int callTrapped(FILE *pFile, void (*pfnCall)(void *pArg), void *pArg);
+
+// Batch mode functions
+void readAndProcessQueriesBatch(Customer customerM[], int iNumberOfCustomers
+    , int iNumShards);
+
+// Streaming mode functions
+void readAndProcessQueriesStream();
+
+// Daemon mode functions
+void serveQueries(CustomerStore store, char *pszSocketFileNm, int iNumThreads);
+
+// Benchmark mode functions
+double benchSeconds();
+void readAndProcessQueriesBench(Customer customerM[], int iNumberOfCustomers
+    , FILE *pFileBench, double dLoadSeconds, double dDumpSeconds);
 
 // functions in most programs, but require modifications
 void processCommandSwitches(int argc, char *argv[], char **ppszCustomerFileName
-    , char **ppszQueryFileName);
+    , char **ppszQueryFileName, Options *pOptions);
 void exitUsage(int iArg, char *pszMessage, char *pszDiagnosticInfo);
 
+// Arena and customer store functions
+void arenaInit(Arena *pArena);
+void arenaFree(Arena *pArena);
+void arenaReset(Arena *pArena);
+void *arenaAlloc(Arena *pArena, size_t iSize);
+void *arenaGrowLast(Arena *pArena, void *pOld, size_t iOldSize, size_t iNewSize);
+void arenaAdopt(Arena *pArena, Arena *pFrom);
+CustomerStore newCustomerStore();
+void freeCustomerStore(CustomerStore store);
+Customer *addCustomer(CustomerStore store);
+void addCustomerTrait(CustomerStore store, Customer *pCustomer, Trait trait);
+void appendCustomerStore(CustomerStore store, CustomerStore from);
+size_t arenaUsed(Arena *pArena);
+int findCustomer(CustomerStore store, char *pszCustomerId);
+void addCustomerId(CustomerStore store, int iCustomer);
+void removeCustomer(CustomerStore store, int iCustomer);
+int removeCustomerTrait(CustomerStore store, Customer *pCustomer, Trait trait);
+void compactCustomerStore(CustomerStore store);
+
+// Customer update (p2 -u and daemon mode) functions
+int applyAddCustomer(CustomerStore store, char *pszCustomerId, char *pszName);
+int applyRemoveCustomer(CustomerStore store, char *pszCustomerId);
+int applyAddTrait(CustomerStore store, char *pszCustomerId, char *pszTraitType
+    , char *pszTraitValue);
+int applyRemoveTrait(CustomerStore store, char *pszCustomerId
+    , char *pszTraitType, char *pszTraitValue);
+int applyUpdate(CustomerStore store, char *pszRecord);
+int isUpdateRecord(char *pszRecord);
+char *updateMessage(int rc);
+int applyUpdateFile(CustomerStore store, FILE *pFileUpdate, FILE *pWarn);
+int finishUpdates(CustomerStore store);
+
+// Customer file loading functions
+int mapTextFile(FILE *pFile, TextFile *pText);
+void unmapTextFile(TextFile *pText);
+int parseCustomerText(CustomerStore store, TraitDict dict, char *pszText
+    , char *pszEnd, FILE *pWarn);
+int parseCustomerTextParallel(CustomerStore store, TraitDict dict
+    , char *pszText, char *pszEnd, int iNumThreads, FILE *pWarn);
+int loadThreadCount(size_t iSize);
+char *lastCustomerLine(char *pszText, char *pszEnd);
+
+// Snapshot functions
+int loadSnapshot(char *pszSnapshotFileNm, FILE *pFileSource, CustomerStore store
+    , TraitDict *pDict, CustomerIndex *pIndex);
+int writeSnapshot(char *pszSnapshotFileNm, FILE *pFileSource, CustomerStore store
+    , TraitDict dict, CustomerIndex index);
+
+// Query result cache functions
+QueryCache newQueryCache(size_t iBudget);
+void freeQueryCache(QueryCache cache);
+void invalidateQueryCache(QueryCache cache);
+void invalidateQueryCacheType(QueryCache cache, char *pszTraitType);
+void invalidateQueryCacheCustomer(QueryCache cache, int iCustomer);
+int lookupQueryCache(QueryCache cache, Out out, Customer customerM[]
+    , int iNumCustomer, QueryResult resultM[]);
+void insertQueryCache(QueryCache cache, Out out, Customer customerM[]
+    , int iNumCustomer, QueryResult resultM[]);
+void printQueryCacheStats(QueryCache cache, FILE *pFile);
+
+// Output writer functions
+Writer newWriter(FILE *pFile);
+void freeWriter(Writer writer);
+void flushWriter(Writer writer);
+void writeText(Writer writer, const char *pText, size_t iLen);
+void writeString(Writer writer, const char *pszText);
+void writeInteger(Writer writer, long long lValue);
+void writePadded(Writer writer, const char *pszText, int iWidth);
+
+// Query context functions
+QueryContext *queryContext();
+void resetQueryContext();
+void *queryAlloc(size_t iSize);
+void *queryGrow(void *pOld, size_t iOldSize, size_t iNewSize);
+void *queryScratch(size_t iSize);
+FILE *openBufferStream(OutputBuffer *pBuffer);
+void closeBufferStream(FILE *pFile);
+void freeOutputBuffer(OutputBuffer *pBuffer);
+
+// Output format functions
+int findOutputFormat(char *pszName);
+FILE *warningFile();
+void fprintQueryStart(FILE *pFile, int iQueryCnt, char *pszQuery);
+void fprintQueryPostfix(FILE *pFile, Out out);
+void fprintQueryWarning(FILE *pFile, int iQueryCnt, int iWarning);
+int fprintQueryCompiled(FILE *pFile, int iQueryCnt, int bCompiled);
+int readQueries(int (*pfnQuery)(void *pArg, char *pszQuery, int iQueryCnt)
+    , void *pArg);
+void writeCsvHeading(Writer writer);
+void writeResultHeading(Writer writer, int iQueryCnt, long long lNumCustomer
+    , long long lCount);
+void writeResultCount(Writer writer, int iQueryCnt, long long lNumCustomer
+    , long long lCount);
+void writeResultMatches(Writer writer, int iQueryCnt, Customer customerM[]
+    , int iNumCustomer, int matchM[], int iNumMatch);
+void writeQueryMatch(Writer writer, int iQueryCnt, Customer *pCustomer);
+void writeBitWords(Writer writer, BitWord bitsM[], size_t iNumWords);
+void writeResultBitmap(Writer writer, QueryResult resultM[], int iNumCustomer);
+
+// Result mode (COUNT and LIMIT) functions
+void splitResultMode(char *pszQuery, char szExpr[], ResultMode *pMode);
+int resultModeWanted(ResultMode *pMode, int iNumCustomer);
+long long resultModeCount(ResultMode *pMode, long long lNumMatches);
+void fprintQueryMode(FILE *pFile, int iQueryCnt, Out out, ResultMode *pMode
+    , Customer customerM[], int iNumCustomer);
+
+// Statistics (p2 -s) functions
+long long statsNanos();
+QueryStats *newQueryStats();
+void recordQueryStats(int iQueryCnt);
+QueryStats *getQueryStats(int iQueryCnt);
+void printStats(FILE *pFile);
+void freeStats();
+
+// Trait dictionary functions
+TraitDict newTraitDict();
+void freeTraitDict(TraitDict dict);
+int findTraitType(TraitDict dict, char *pszTraitType);
+int findTrait(TraitDict dict, int iTraitType, char *pszTraitValue);
+int addTraitType(TraitDict dict, char *pszTraitType);
+int addTrait(TraitDict dict, int iTraitType, char *pszTraitValue);
+int findTraitTypeLen(TraitDict dict, const char *pTraitType, int iLen);
+int findTraitLen(TraitDict dict, int iTraitType, const char *pTraitValue
+    , int iLen);
+int addTraitTypeLen(TraitDict dict, const char *pTraitType, int iLen);
+int addTraitLen(TraitDict dict, int iTraitType, const char *pTraitValue
+    , int iLen);
+char *traitTypeName(TraitDict dict, int iTraitType);
+char *traitValueName(TraitDict dict, int iTraitId);
+
+// Query compiler functions
+int compileQuery(Out out, Program program);
+int compileQueryAddTraits(Out out, Program program);
+Program keepProgram(Program program, Program kept);
+int runProgram(Program program, Customer *pCustomer);
+
+// Customer bitmap index functions
+CustomerIndex newCustomerIndex(Customer customerM[], int iNumCustomer
+    , TraitDict dict);
+void freeCustomerIndex(CustomerIndex index);
+void setIndexShards(CustomerIndex index, int iNumShards);
+void countCustomerIndex(CustomerIndex index);
+void resizeCustomerIndex(CustomerIndex index, Customer customerM[]
+    , int iNumCustomer, TraitDict dict);
+void updateCustomerIndex(CustomerIndex index, int iCustomer, Trait trait);
+void removeCustomerIndex(CustomerIndex index, int iCustomer);
+void evaluateProgramIndex(Program program, CustomerIndex index
+    , QueryResult resultM[]);
+int countProgramIndex(Program program, CustomerIndex index);
+int limitProgramIndex(Program program, CustomerIndex index, int matchM[]
+    , int iWanted);
+void evaluateProgramBits(Program program, CustomerIndex index
+    , BitWord resultBitsM[], int iFirstBlock, int iEndBlock);
+BlockKernels *selectBlockKernels();
+void bitmapFill(BitWord bitsM[], int iNumBits);
+void bitmapClearTail(BitWord bitsM[], int iNumBits);
+int bitmapCount(BitWord bitsM[], int iNumWords);
+int bitmapMatches(BitWord bitsM[], int iFirstWord, int iEndWord, int matchM[]
+    , int iFound, int iWanted);
+
+// The trait dictionary built by getCustomerData and the index of its customers
+extern TraitDict traitDict;
+extern CustomerIndex customerIndex;
+
+// The query result cache (NULL if queries aren't cached)
+extern QueryCache queryCache;
+
+// The output format (p2 -f)
+extern int iOutputFormat;
+
+// TRUE if statistics are collected (p2 -s or -B)
+extern int bStats;
+
+// The customer and query files opened by the driver
+extern FILE *pFileCustomer;
+extern FILE *pFileQuery;
+
 // Utility routines provided by Larry
 void ErrExit(int iexitRC, char szFmt[], ...);
 char * getToken(char *pszInputTxt, char szToken[], int iTokenSize);
@@ -223,3 +782,14 @@ char * getToken(char *pszInputTxt, char szToken[], int iTokenSize);
     printf(szFmt, __VA_ARGS__);     \
     printf("\n");                   \
     } while (0)
+
+/*
+  FWARNING macro
+  Same as WARNING, but prints to the stream pFile (e.g., a buffer of
+  warnings which are printed later).
+*/
+#define FWARNING(pFile, szFmt, ...) do {    \
+    fprintf(pFile, "\tWARNING: ");          \
+    fprintf(pFile, szFmt, __VA_ARGS__);     \
+    fprintf(pFile, "\n");                   \
+    } while (0)
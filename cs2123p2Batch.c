@@ -0,0 +1,752 @@
+/******************************************************************************
+cs2123p2Batch.c
+Purpose:
+    Implements batch mode (p2 -b).  Instead of evaluating each query on its
+    own, the queries of a batch are converted and compiled first and merged
+    into one DAG (directed acyclic graph) in which equal predicates and
+    equal subexpressions are a single node (hash consing).  Each node is
+    evaluated once over the bitmap index and its result is shared by every
+    query using it.  The queries' output is then printed in order.
+    Without an index (p2 -n), the batch's compiled queries are instead run
+    in a single pass over the customers (see note 6).
+Notes:
+    1. The DAG nodes are created from the compiled programs, so the
+       operands are resolved trait IDs.  The operands of AND and OR are
+       ordered by node number, so "A AND B" and "B AND A" are one node.
+    2. The DAG is evaluated one block (512 customers) at a time:  every
+       node's block is computed in node order (a node's operands are always
+       created before it) and each query's root block is copied to the
+       query's result bitmap.  The node blocks stay in the cache.
+    3. A batch holds as many queries as fit their result bitmaps in
+       BATCH_RESULT_BYTES, so a large query file is processed in several
+       batches.
+    4. With -j, the blocks are split into shards evaluated by their own
+       threads like evaluateProgramIndex does.
+    5. If converting a query calls ErrExit, the queries before it are
+       evaluated and printed before the program exits (see callTrapped).
+    6. Without an index, the customers are split into tiles which fit in
+       half of the L2 cache (the tile ends when the bytes of its Customers
+       and their traits reach the budget).  Every query of the batch is run
+       (runProgram) over a tile before moving to the next tile, so each
+       customer is read from memory once per batch instead of once per
+       query.  The results form a query x customer bit matrix (a result
+       bitmap per query).
+    7. A COUNT query is a popcount of its result bitmap and a LIMIT query
+       takes the customers of its window from it (see cs2123p2Limit.c).
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "cs2123p2.h"
+
+#define BATCH_RESULT_BYTES (64 << 20)   // bytes of the result bitmaps of a batch
+#define BATCH_MIN_BLOCKS 64             // minimum blocks per shard thread
+#define DAG_INITIAL_NODES 256           // initial size of the node array
+#define BATCH_DEFAULT_CACHE (256 << 10) // L2 cache size if it isn't known
+
+// DagNode typedef is a predicate or operator shared by the queries of a batch
+typedef struct
+{
+    int iOpcode;                // OP_HAS, OP_NOTANY, OP_ONLY, OP_AND, OP_OR, OP_TRUE
+    int iLeft;                  // first operand node of AND and OR (else -1)
+    int iRight;                 // second operand node of AND and OR (else -1)
+    Trait trait;                // resolved trait of OP_HAS, OP_NOTANY and OP_ONLY
+} DagNode;
+
+// QueryDag typedef is the hash-consed DAG of a batch
+typedef struct
+{
+    int iNumNodes;              // number of nodes in nodeM
+    int iMaxNodes;              // allocated size of nodeM
+    DagNode *nodeM;             // nodes in creation (topological) order
+    int iHashSize;              // size of hashM (a power of 2)
+    int *hashM;                 // hash table of node subscripts + 1
+} QueryDag;
+
+// BatchQuery typedef is one query of a batch
+typedef struct
+{
+    OutputBuffer output;        // output printed before the query's result
+                                // (reused by the slot's next query)
+    int iQueryCnt;              // number of the query in the query file
+    ResultMode mode;            // COUNT or LIMIT suffix of the query
+    int bPrintResult;           // TRUE if the query's result is printed
+    int bCompiled;              // TRUE if the query was compiled (else no customers)
+    int iRoot;                  // DAG node of the result (with an index)
+    Program program;            // the compiled query (without an index)
+    BitWord *bitsM;             // customers satisfying the query
+} BatchQuery;
+
+// Batch typedef is the queries of a batch and their DAG
+typedef struct
+{
+    QueryDag dag;               // the shared predicates and subexpressions
+    int iNumQueries;            // number of queries in queryM
+    int iMaxQueries;            // maximum number of queries in a batch
+    BatchQuery *queryM;         // the queries in file order
+    CustomerIndex index;        // bitmap index of the customers (or NULL)
+    Customer *customerM;        // customers being queried
+    int iNumCustomer;           // number of customers in customerM
+    int iNumBlocks;             // blocks of BLOCK_WORDS in each result bitmap
+    int iNumShards;             // threads evaluating a batch
+    size_t iTileBytes;          // bytes of customers in a tile (without an index)
+} Batch;
+
+// BatchShard typedef is the blocks evaluated by one thread
+typedef struct
+{
+    Batch *pBatch;
+    int iFirstBlock;            // first block of the shard
+    int iEndBlock;              // block after the shard
+} BatchShard;
+
+// BatchCall typedef is the arguments of convertBatchQuery for callTrapped
+typedef struct
+{
+    FILE *pFile;                // output of the query
+    Batch *pBatch;
+    BatchQuery *pQuery;
+    char *pszQuery;             // text line of the query
+    int iQueryCnt;              // number of the query in the query file
+    Out out;                    // receives the postfix form of the query
+} BatchCall;
+
+// BatchLoop typedef is the arguments of addBatchQuery for readQueries
+typedef struct
+{
+    Batch *pBatch;
+    Out out;                    // receives the postfix form of a query
+    QueryResult *resultM;       // TRUE or FALSE for each customer
+    size_t iBitmapBytes;        // bytes of a query's result bitmap
+} BatchLoop;
+
+/******************** hashNode **************************************
+static unsigned int hashNode(DagNode *pNode)
+Purpose:
+    Returns the hash of a node's opcode, operands and trait.
+**************************************************************************/
+static unsigned int hashNode(DagNode *pNode)
+{
+    unsigned int uiHash = 2166136261u;
+    uiHash = (uiHash ^ pNode->iOpcode) * 16777619u;
+    uiHash = (uiHash ^ pNode->iLeft) * 16777619u;
+    uiHash = (uiHash ^ pNode->iRight) * 16777619u;
+    uiHash = (uiHash ^ pNode->trait.iTraitType) * 16777619u;
+    uiHash = (uiHash ^ pNode->trait.iTraitId) * 16777619u;
+    return uiHash;
+}
+
+/******************** sameNode **************************************
+static int sameNode(DagNode *pNode1, DagNode *pNode2)
+Purpose:
+    Returns TRUE if two nodes compute the same result.
+**************************************************************************/
+static int sameNode(DagNode *pNode1, DagNode *pNode2)
+{
+    return pNode1->iOpcode == pNode2->iOpcode
+        && pNode1->iLeft == pNode2->iLeft
+        && pNode1->iRight == pNode2->iRight
+        && pNode1->trait.iTraitType == pNode2->trait.iTraitType
+        && pNode1->trait.iTraitId == pNode2->trait.iTraitId;
+}
+
+/******************** initDag **************************************
+static void initDag(QueryDag *pDag)
+Purpose:
+    Initializes an empty DAG.
+**************************************************************************/
+static void initDag(QueryDag *pDag)
+{
+    pDag->iNumNodes = 0;
+    pDag->iMaxNodes = DAG_INITIAL_NODES;
+    pDag->nodeM = malloc(sizeof(DagNode) * pDag->iMaxNodes);
+    pDag->iHashSize = DAG_INITIAL_NODES * 2;
+    pDag->hashM = calloc(pDag->iHashSize, sizeof(int));
+    if (pDag->nodeM == NULL || pDag->hashM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query DAG");
+}
+
+/******************** clearDag **************************************
+static void clearDag(QueryDag *pDag)
+Purpose:
+    Removes every node of a DAG.
+**************************************************************************/
+static void clearDag(QueryDag *pDag)
+{
+    pDag->iNumNodes = 0;
+    memset(pDag->hashM, 0, sizeof(int) * pDag->iHashSize);
+}
+
+/******************** growDag **************************************
+static void growDag(QueryDag *pDag)
+Purpose:
+    Doubles the node array and the hash table of a DAG.
+**************************************************************************/
+static void growDag(QueryDag *pDag)
+{
+    unsigned int uiMask;
+    unsigned int uiSlot;
+    int i;
+
+    pDag->iMaxNodes *= 2;
+    pDag->nodeM = realloc(pDag->nodeM, sizeof(DagNode) * pDag->iMaxNodes);
+    free(pDag->hashM);
+    pDag->iHashSize *= 2;
+    pDag->hashM = calloc(pDag->iHashSize, sizeof(int));
+    if (pDag->nodeM == NULL || pDag->hashM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query DAG");
+    uiMask = pDag->iHashSize - 1;
+    for (i = 0; i < pDag->iNumNodes; i++)
+    {
+        uiSlot = hashNode(&pDag->nodeM[i]) & uiMask;
+        while (pDag->hashM[uiSlot] != 0)
+            uiSlot = (uiSlot + 1) & uiMask;
+        pDag->hashM[uiSlot] = i + 1;
+    }
+}
+
+/******************** internNode **************************************
+static int internNode(QueryDag *pDag, int iOpcode, int iLeft, int iRight
+    , Trait trait)
+Purpose:
+    Returns the subscript of the node with the opcode, operands and trait,
+    adding it to the DAG if there isn't one.
+**************************************************************************/
+static int internNode(QueryDag *pDag, int iOpcode, int iLeft, int iRight
+    , Trait trait)
+{
+    DagNode node;
+    unsigned int uiMask = pDag->iHashSize - 1;
+    unsigned int uiSlot;
+    int iEntry;
+
+    // AND and OR are commutative, so order their operands
+    if (iLeft > iRight)
+    {
+        node.iLeft = iRight;
+        node.iRight = iLeft;
+    }
+    else
+    {
+        node.iLeft = iLeft;
+        node.iRight = iRight;
+    }
+    node.iOpcode = iOpcode;
+    node.trait = trait;
+
+    uiSlot = hashNode(&node) & uiMask;
+    while ((iEntry = pDag->hashM[uiSlot]) != 0)
+    {
+        if (sameNode(&pDag->nodeM[iEntry - 1], &node))
+            return iEntry - 1;
+        uiSlot = (uiSlot + 1) & uiMask;
+    }
+    if (pDag->iNumNodes >= pDag->iHashSize / 2)
+    {
+        growDag(pDag);
+        return internNode(pDag, iOpcode, iLeft, iRight, trait);
+    }
+    pDag->nodeM[pDag->iNumNodes] = node;
+    pDag->hashM[uiSlot] = ++pDag->iNumNodes;
+    return pDag->iNumNodes - 1;
+}
+
+/******************** addProgram **************************************
+static int addProgram(QueryDag *pDag, Program program)
+Purpose:
+    Adds the instructions of a compiled query to the DAG.
+Returns:
+    The node of the query's result.
+**************************************************************************/
+static int addProgram(QueryDag *pDag, Program program)
+{
+    int *iNodeStackM;                   // nodes of the values on the stack
+    int iCount = 0;
+    Trait noTrait = { TRAIT_NOT_FOUND, TRAIT_NOT_FOUND };
+    Instr *pInstr;
+    int i;
+
+    iNodeStackM = queryAlloc(sizeof(int) * (program->iMaxDepth + 1));
+    for (i = 0; i < program->iNumInstr; i++)
+    {
+        pInstr = &program->instrM[i];
+        switch (pInstr->iOpcode)
+        {
+            case OP_AND:
+            case OP_OR:
+                iCount--;
+                iNodeStackM[iCount - 1] = internNode(pDag, pInstr->iOpcode
+                    , iNodeStackM[iCount - 1], iNodeStackM[iCount], noTrait);
+                break;
+            case OP_TRUE:
+                iNodeStackM[iCount++] = internNode(pDag, OP_TRUE, -1, -1, noTrait);
+                break;
+            case OP_JFALSE:
+            case OP_JTRUE:
+                // every node is evaluated, so there is nothing to skip
+                break;
+            default:
+                iNodeStackM[iCount++] = internNode(pDag, pInstr->iOpcode, -1, -1
+                    , pInstr->trait);
+        }
+    }
+    return iNodeStackM[0];
+}
+
+/******************** evaluateBatchBlocks **************************************
+static void evaluateBatchBlocks(Batch *pBatch, int iFirstBlock, int iEndBlock)
+Purpose:
+    Evaluates every node of the batch's DAG for a range of blocks and
+    copies each query's result blocks to its result bitmap.
+**************************************************************************/
+static void evaluateBatchBlocks(Batch *pBatch, int iFirstBlock, int iEndBlock)
+{
+    QueryDag *pDag = &pBatch->dag;
+    CustomerIndex index = pBatch->index;
+    BlockKernels *pKernels = index->pKernels;
+    BitWord (*blockM)[BLOCK_WORDS];     // block of each node
+    BitWord zeroM[BLOCK_WORDS];         // block with no customers
+    BitWord onesM[BLOCK_WORDS];         // block with all customers
+    DagNode *pNode;
+    size_t iWord;
+    int b;
+    int n;
+    int q;
+
+    blockM = malloc(sizeof(*blockM) * (pDag->iNumNodes + 1));
+    if (blockM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory evaluating the query DAG");
+    memset(zeroM, 0, sizeof(zeroM));
+    memset(onesM, 0xff, sizeof(onesM));
+
+    for (b = iFirstBlock; b < iEndBlock; b++)
+    {
+        iWord = (size_t) b * BLOCK_WORDS;
+        for (n = 0; n < pDag->iNumNodes; n++)
+        {
+            pNode = &pDag->nodeM[n];
+            switch (pNode->iOpcode)
+            {
+                case OP_HAS:
+                    if (pNode->trait.iTraitId == TRAIT_NOT_FOUND)
+                        pKernels->copyBlock(blockM[n], zeroM);
+                    else
+                        pKernels->copyBlock(blockM[n]
+                            , TRAIT_BITS(index, pNode->trait.iTraitId) + iWord);
+                    break;
+                case OP_NOTANY:
+                    if (pNode->trait.iTraitId == TRAIT_NOT_FOUND)
+                        pKernels->copyBlock(blockM[n], onesM);
+                    else
+                        pKernels->notBlock(blockM[n]
+                            , TRAIT_BITS(index, pNode->trait.iTraitId) + iWord);
+                    break;
+                case OP_ONLY:
+                    if (pNode->trait.iTraitId == TRAIT_NOT_FOUND)
+                        pKernels->copyBlock(blockM[n], zeroM);
+                    else
+                        pKernels->andBlock(blockM[n]
+                            , TRAIT_BITS(index, pNode->trait.iTraitId) + iWord
+                            , ONLY_BITS(index, pNode->trait.iTraitType) + iWord);
+                    break;
+                case OP_AND:
+                    pKernels->andBlock(blockM[n], blockM[pNode->iLeft]
+                        , blockM[pNode->iRight]);
+                    break;
+                case OP_OR:
+                    pKernels->orBlock(blockM[n], blockM[pNode->iLeft]
+                        , blockM[pNode->iRight]);
+                    break;
+                case OP_TRUE:
+                    pKernels->copyBlock(blockM[n], onesM);
+                    break;
+            }
+        }
+        for (q = 0; q < pBatch->iNumQueries; q++)
+        {
+            if (!pBatch->queryM[q].bCompiled)
+                continue;
+            // customers removed by updates don't satisfy any query
+            if (index->liveBitsM != NULL)
+                pKernels->andBlock(pBatch->queryM[q].bitsM + iWord
+                    , blockM[pBatch->queryM[q].iRoot], index->liveBitsM + iWord);
+            else
+                pKernels->copyBlock(pBatch->queryM[q].bitsM + iWord
+                    , blockM[pBatch->queryM[q].iRoot]);
+        }
+    }
+    free(blockM);
+}
+
+/******************** evaluateBatchScan **************************************
+static void evaluateBatchScan(Batch *pBatch, int iFirstBlock, int iEndBlock)
+Purpose:
+    Runs every compiled query of the batch for the customers of a range
+    of blocks, one cache-sized tile of customers at a time, and sets the
+    customers' bits of each query's result bitmap.
+**************************************************************************/
+static void evaluateBatchScan(Batch *pBatch, int iFirstBlock, int iEndBlock)
+{
+    Customer *customerM = pBatch->customerM;
+    BatchQuery *pQuery;
+    int iFirst = iFirstBlock * BLOCK_WORDS * BITS_PER_WORD;
+    int iEnd = iEndBlock * BLOCK_WORDS * BITS_PER_WORD;
+    int iTileEnd;               // customer after the tile
+    size_t iBytes;              // bytes of the tile's customers and traits
+    int q;
+    int i;
+
+    if (iEnd > pBatch->iNumCustomer)
+        iEnd = pBatch->iNumCustomer;
+    for (q = 0; q < pBatch->iNumQueries; q++)
+        memset(pBatch->queryM[q].bitsM + (size_t) iFirstBlock * BLOCK_WORDS, 0
+            , sizeof(BitWord) * BLOCK_WORDS * (iEndBlock - iFirstBlock));
+
+    for (; iFirst < iEnd; iFirst = iTileEnd)
+    {
+        iBytes = 0;
+        for (iTileEnd = iFirst; iTileEnd < iEnd && iBytes < pBatch->iTileBytes
+            ; iTileEnd++)
+            iBytes += sizeof(Customer)
+                + sizeof(Trait) * customerM[iTileEnd].iNumberOfTraits;
+        for (q = 0; q < pBatch->iNumQueries; q++)
+        {
+            pQuery = &pBatch->queryM[q];
+            if (!pQuery->bCompiled)
+                continue;
+            for (i = iFirst; i < iTileEnd; i++)
+                if (runProgram(pQuery->program, &customerM[i]))
+                    BITMAP_SET(pQuery->bitsM, i);
+        }
+    }
+}
+
+/******************** evaluateBatchRange **************************************
+static void evaluateBatchRange(Batch *pBatch, int iFirstBlock, int iEndBlock)
+Purpose:
+    Evaluates the batch for a range of blocks using the index if there is
+    one, otherwise by running the queries over the customers.
+**************************************************************************/
+static void evaluateBatchRange(Batch *pBatch, int iFirstBlock, int iEndBlock)
+{
+    if (pBatch->index != NULL)
+        evaluateBatchBlocks(pBatch, iFirstBlock, iEndBlock);
+    else
+        evaluateBatchScan(pBatch, iFirstBlock, iEndBlock);
+}
+
+/******************** batchShardThread **************************************
+static void *batchShardThread(void *pArg)
+Purpose:
+    Thread which evaluates the blocks of one BatchShard.
+**************************************************************************/
+static void *batchShardThread(void *pArg)
+{
+    BatchShard *pShard = (BatchShard *) pArg;
+    evaluateBatchRange(pShard->pBatch, pShard->iFirstBlock, pShard->iEndBlock);
+    return NULL;
+}
+
+/******************** evaluateBatch **************************************
+static void evaluateBatch(Batch *pBatch)
+Purpose:
+    Evaluates the queries of a batch for all of the customers, using the
+    batch's number of shard threads.
+**************************************************************************/
+static void evaluateBatch(Batch *pBatch)
+{
+    BatchShard *shardM;             // work of each thread
+    pthread_t *threadM;             // thread of each shard
+    int iNumBlocks = pBatch->iNumBlocks;
+    int iNumShards = pBatch->iNumShards;
+    int s;
+
+    if (pBatch->iNumQueries == 0
+        || (pBatch->index != NULL && pBatch->dag.iNumNodes == 0))
+        return;
+    if (iNumShards > iNumBlocks / BATCH_MIN_BLOCKS)
+        iNumShards = iNumBlocks / BATCH_MIN_BLOCKS;
+    if (iNumShards <= 1)
+    {
+        evaluateBatchRange(pBatch, 0, iNumBlocks);
+        return;
+    }
+
+    shardM = malloc(sizeof(BatchShard) * iNumShards);
+    threadM = malloc(sizeof(pthread_t) * iNumShards);
+    if (shardM == NULL || threadM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for query shards");
+    for (s = 0; s < iNumShards; s++)
+    {
+        shardM[s].pBatch = pBatch;
+        shardM[s].iFirstBlock = (int) ((long long) iNumBlocks * s / iNumShards);
+        shardM[s].iEndBlock = (int) ((long long) iNumBlocks * (s + 1) / iNumShards);
+    }
+    // the calling thread evaluates the first shard
+    for (s = 1; s < iNumShards; s++)
+        if (pthread_create(&threadM[s], NULL, batchShardThread, &shardM[s]) != 0)
+            ErrExit(ERR_ALGORITHM, "unable to create a query shard thread");
+    evaluateBatchRange(pBatch, shardM[0].iFirstBlock, shardM[0].iEndBlock);
+    for (s = 1; s < iNumShards; s++)
+        pthread_join(threadM[s], NULL);
+    free(shardM);
+    free(threadM);
+}
+
+/******************** convertBatchQuery **************************************
+static void convertBatchQuery(void *pArg)
+Purpose:
+    Prints the first part of a query's output (like processQuery) and adds
+    the compiled query to the batch's DAG (or keeps it if there is no
+    index).
+**************************************************************************/
+static void convertBatchQuery(void *pArg)
+{
+    BatchCall *pCall = (BatchCall *) pArg;
+    BatchQuery *pQuery = pCall->pQuery;
+    char *szExpr;                   // the query without its suffix
+    ProgramImp program;             // the query compiled from out
+    int rc;
+
+    resetQueryContext();
+    pQuery->iQueryCnt = pCall->iQueryCnt;
+    pQuery->bPrintResult = FALSE;
+    pQuery->bCompiled = FALSE;
+    fprintQueryStart(pCall->pFile, pCall->iQueryCnt, pCall->pszQuery);
+    pCall->out->iOutCount = 0;
+    szExpr = queryAlloc(strlen(pCall->pszQuery) + 1);
+    splitResultMode(pCall->pszQuery, szExpr, &pQuery->mode);
+    rc = convertToPostFix(szExpr, pCall->out);
+    switch (rc)
+    {
+    case 0:   // Conversion was successful
+        fprintQueryPostfix(pCall->pFile, pCall->out);
+        pQuery->bCompiled = compileQuery(pCall->out, &program);
+        pQuery->program = keepProgram(&program, pQuery->program);
+        pQuery->bPrintResult = fprintQueryCompiled(pCall->pFile, pCall->iQueryCnt
+            , pQuery->bCompiled);
+        if (pQuery->bCompiled && pCall->pBatch->index != NULL)
+            pQuery->iRoot = addProgram(&pCall->pBatch->dag, pQuery->program);
+        break;
+    default:  // WARN_MISSING_LPAREN, WARN_MISSING_RPAREN
+        fprintQueryWarning(pCall->pFile, pCall->iQueryCnt, rc);
+    }
+}
+
+/******************** printBatchMode **************************************
+static void printBatchMode(Batch *pBatch, BatchQuery *pQuery)
+Purpose:
+    Prints the result of a COUNT or LIMIT query of an evaluated batch from
+    its result bitmap.
+**************************************************************************/
+static void printBatchMode(Batch *pBatch, BatchQuery *pQuery)
+{
+    Writer writer;
+    int *matchM;                // customers found for a LIMIT query
+    int iFound = 0;             // customers found satisfying the query
+    int iWanted;
+    int iSkip;                  // customers found before the LIMIT window
+    int iNumWords = BITMAP_WORDS(pBatch->iNumCustomer);
+
+    resetQueryContext();
+    if (pQuery->bCompiled)
+        bitmapClearTail(pQuery->bitsM, pBatch->iNumCustomer);
+    if (pQuery->mode.iMode == RESULT_COUNT)
+    {
+        if (pQuery->bCompiled)
+            iFound = bitmapCount(pQuery->bitsM, iNumWords);
+        writer = newWriter(stdout);
+        writeResultCount(writer, pQuery->iQueryCnt, pBatch->iNumCustomer, iFound);
+        freeWriter(writer);
+        return;
+    }
+    iWanted = resultModeWanted(&pQuery->mode, pBatch->iNumCustomer);
+    matchM = queryAlloc(sizeof(int) * (iWanted + 1));
+    if (pQuery->bCompiled)
+        iFound = bitmapMatches(pQuery->bitsM, 0, iNumWords, matchM, 0, iWanted);
+    iSkip = iFound < pQuery->mode.iOffset ? iFound : pQuery->mode.iOffset;
+    writer = newWriter(stdout);
+    writeResultMatches(writer, pQuery->iQueryCnt, pBatch->customerM
+        , pBatch->iNumCustomer, matchM + iSkip, iFound - iSkip);
+    freeWriter(writer);
+}
+
+/******************** printBatch **************************************
+static void printBatch(Batch *pBatch, QueryResult resultM[])
+Purpose:
+    Prints the output of each query of an evaluated batch.
+**************************************************************************/
+static void printBatch(Batch *pBatch, QueryResult resultM[])
+{
+    BatchQuery *pQuery;
+    Writer writer;
+    int q;
+    int i;
+
+    for (q = 0; q < pBatch->iNumQueries; q++)
+    {
+        pQuery = &pBatch->queryM[q];
+        fwrite(pQuery->output.pszText, 1, pQuery->output.iLength, stdout);
+        if (!pQuery->bPrintResult)
+            continue;
+        if (pQuery->mode.iMode != RESULT_ALL)
+        {
+            printBatchMode(pBatch, pQuery);
+            continue;
+        }
+        if (iOutputFormat == FORMAT_BITMAP)
+        {
+            // the result bitmap is already in the format
+            bitmapClearTail(pQuery->bitsM, pBatch->iNumCustomer);
+            writer = newWriter(stdout);
+            writeResultHeading(writer, pQuery->iQueryCnt, pBatch->iNumCustomer
+                , bitmapCount(pQuery->bitsM, BITMAP_WORDS(pBatch->iNumCustomer)));
+            writeBitWords(writer, pQuery->bitsM, BITMAP_WORDS(pBatch->iNumCustomer));
+            freeWriter(writer);
+            continue;
+        }
+        if (!pQuery->bCompiled)
+            memset(resultM, 0, sizeof(QueryResult) * pBatch->iNumCustomer);
+        else
+        {
+            // NOTANY turns on the bits past the last customer, but they aren't used
+            for (i = 0; i < pBatch->iNumCustomer; i++)
+                resultM[i] = BITMAP_TEST(pQuery->bitsM, i) ? TRUE : FALSE;
+        }
+        fprintQueryResult(stdout, pQuery->iQueryCnt, pBatch->customerM
+            , pBatch->iNumCustomer, resultM);
+    }
+    pBatch->iNumQueries = 0;
+    clearDag(&pBatch->dag);
+}
+
+/******************** addBatchQuery **************************************
+static int addBatchQuery(void *pArg, char *pszQuery, int iQueryCnt)
+Purpose:
+    Adds a query line read by readQueries to the batch of a BatchLoop,
+    evaluating and printing the batch when it is full.
+Returns:
+    TRUE (to read the next query)
+Notes:
+    - If converting the query calls ErrExit, the batch's queries and the
+      error are printed like the serial run would, and p2 exits.
+**************************************************************************/
+static int addBatchQuery(void *pArg, char *pszQuery, int iQueryCnt)
+{
+    BatchLoop *pLoop = (BatchLoop *) pArg;
+    Batch *pBatch = pLoop->pBatch;
+    BatchCall call;
+    int iExitRC;
+
+    call.pQuery = &pBatch->queryM[pBatch->iNumQueries];
+    if (call.pQuery->bitsM == NULL)
+    {
+        call.pQuery->bitsM = malloc(pLoop->iBitmapBytes);
+        if (call.pQuery->bitsM == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory for the query batch");
+    }
+    call.pFile = openBufferStream(&call.pQuery->output);
+    call.pBatch = pBatch;
+    call.pszQuery = pszQuery;
+    call.iQueryCnt = iQueryCnt;
+    call.out = pLoop->out;
+    iExitRC = callTrapped(call.pFile, convertBatchQuery, &call);
+    closeBufferStream(call.pFile);
+
+    if (iExitRC != 0)
+    {
+        // print the preceding queries and the error like the serial run
+        evaluateBatch(pBatch);
+        printBatch(pBatch, pLoop->resultM);
+        fwrite(call.pQuery->output.pszText, 1, call.pQuery->output.iLength, stdout);
+        exit(iExitRC);
+    }
+    pBatch->iNumQueries++;
+    if (pBatch->iNumQueries == pBatch->iMaxQueries)
+    {
+        evaluateBatch(pBatch);
+        printBatch(pBatch, pLoop->resultM);
+    }
+    return TRUE;
+}
+
+/******************** readAndProcessQueriesBatch **************************************
+void readAndProcessQueriesBatch(Customer customerM[], int iNumberOfCustomers
+    , int iNumShards)
+Purpose:
+    Does what readAndProcessQueries does, evaluating the queries in batches
+    which share their common predicates and subexpressions (with an index)
+    or a single pass over the customers (without one).
+Parameters:
+    I Customer customerM[]    array of customers and traits
+    I int iNumberOfCustomers  number of customers in customerM
+    I int iNumShards          number of threads evaluating a batch
+Notes:
+    - References the globals:  pFileQuery, customerIndex
+**************************************************************************/
+void readAndProcessQueriesBatch(Customer customerM[], int iNumberOfCustomers
+    , int iNumShards)
+{
+    Batch batch;
+    BatchLoop loop;
+    Out out = newOut();                   // postfix form of a query
+    QueryResult *resultM = malloc(sizeof(QueryResult) * (iNumberOfCustomers + 1));
+    size_t iBitmapBytes;                  // bytes of a query's result bitmap
+    long lCacheSize;                      // bytes of the L2 cache
+    int q;
+
+    if (resultM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query batch");
+
+    batch.index = customerIndex;
+    if (batch.index != NULL && (batch.index->customerM != customerM
+        || batch.index->iNumCustomer != iNumberOfCustomers))
+        batch.index = NULL;
+    batch.customerM = customerM;
+    batch.iNumCustomer = iNumberOfCustomers;
+    batch.iNumBlocks = (BITMAP_WORDS(iNumberOfCustomers) + BLOCK_WORDS - 1) / BLOCK_WORDS;
+    batch.iNumShards = iNumShards;
+    lCacheSize = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (lCacheSize <= 0)
+        lCacheSize = BATCH_DEFAULT_CACHE;
+    batch.iTileBytes = lCacheSize / 2;
+    iBitmapBytes = sizeof(BitWord) * BLOCK_WORDS * batch.iNumBlocks + sizeof(BitWord);
+    batch.iMaxQueries = BATCH_RESULT_BYTES / iBitmapBytes;
+    if (batch.iMaxQueries < 1)
+        batch.iMaxQueries = 1;
+    batch.iNumQueries = 0;
+    batch.queryM = malloc(sizeof(BatchQuery) * batch.iMaxQueries);
+    if (batch.queryM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query batch");
+    for (q = 0; q < batch.iMaxQueries; q++)
+    {
+        batch.queryM[q].bitsM = NULL;
+        batch.queryM[q].program = NULL;
+        memset(&batch.queryM[q].output, 0, sizeof(OutputBuffer));
+    }
+    initDag(&batch.dag);
+
+    loop.pBatch = &batch;
+    loop.out = out;
+    loop.resultM = resultM;
+    loop.iBitmapBytes = iBitmapBytes;
+    readQueries(addBatchQuery, &loop);
+    evaluateBatch(&batch);
+    printBatch(&batch, resultM);
+
+    for (q = 0; q < batch.iMaxQueries; q++)
+    {
+        free(batch.queryM[q].bitsM);
+        free(batch.queryM[q].program);
+        freeOutputBuffer(&batch.queryM[q].output);
+    }
+    free(batch.queryM);
+    free(batch.dag.nodeM);
+    free(batch.dag.hashM);
+    freeOut(out);
+    free(resultM);
+    if (iOutputFormat == FORMAT_TEXT)
+        printf("\n");
+}
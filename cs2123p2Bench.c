@@ -0,0 +1,256 @@
+/******************************************************************************
+cs2123p2Bench.c
+Purpose:
+    Implements benchmark mode (p2 -B benchFile).  The queries are processed
+    one at a time by processQuery like readAndProcessQueries, with the same
+    output, and the phases of each query are the stage times processQuery
+    records for p2 -s (see cs2123p2Stats.c):
+        convert     convertToPostFix
+        evaluate    evaluatePostfix (with the index and cache, if any)
+        print       printing its result
+    After the queries, a JSON object with the times is written to the
+    benchmark file:
+        {"customers":N,"queries":Q,
+         "load_s":...,"dump_s":...,
+         "queries_per_s":...,"customer_evals_per_s":...,
+         "terms":T,"convert_ns_per_term":...,"evaluate_ns_per_term":...,
+         "convert":{"total_s":...,"p50_us":...,"p99_us":...,"max_us":...},
+         "evaluate":{...},"print":{...},"query":{...},
+         "peak_rss_kb":...}
+    load_s is the time loading the customers (including the index or the
+    snapshot) and dump_s is the time printing them.  "query" is the total
+    time of each query (processQuery), which also has printing the query
+    and its postfix.  terms is the number of postfix terms (operands
+    and operators) of the queries which were converted, and the ns per
+    term are the convert and evaluate totals divided by it.
+Notes:
+    1. The times are from CLOCK_MONOTONIC.  The percentiles are nearest
+       rank over the queries.
+    2. The evaluation of a COUNT or LIMIT query includes printing its
+       result, since it is printed while it is evaluated.
+    3. peak_rss_kb is the maximum resident set size (getrusage) of the
+       whole run.
+    4. -t and -b are ignored (the queries are processed one at a time) and
+       -r can't be used with -B.
+    5. The per term times show how the cost of a query grows with its
+       length.  With queries of one width per file from p2gen -w, they
+       should be about the same for every width:
+           p2gen -Q 100 -w 1000 -q w1000.txt
+           p2 -c cust.txt -q w1000.txt -m 0 -B w1000.json > /dev/null
+       (see note 6 of cs2123p2Gen.c).
+    6. -B collects the statistics of p2 -s (and -s prints them as well),
+       so a build with -DP2_STATS=0 rejects -B like -s.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "cs2123p2.h"
+
+#define BENCH_INITIAL_QUERIES 1024  // initial size of a phase's time array
+
+// BenchPhase typedef is the time of each query in one phase
+typedef struct
+{
+    char *pszName;                  // name of the phase in the JSON
+    double *dSecondsM;              // time of each query
+    int iCount;                     // number of times in dSecondsM
+    int iMax;                       // allocated size of dSecondsM
+    double dTotal;                  // sum of the times
+} BenchPhase;
+
+// BenchRun typedef is the arguments of benchQuery for readQueries
+typedef struct
+{
+    Out out;                        // postfix form of a query
+    Customer *customerM;            // array of customers and traits
+    int iNumCustomer;               // number of customers in customerM
+    QueryResult *resultM;           // TRUE or FALSE for each customer
+    long long lNumTerms;            // postfix terms of the queries
+    BenchPhase convert;             // times of each phase of the queries
+    BenchPhase evaluate;
+    BenchPhase print;
+    BenchPhase query;
+} BenchRun;
+
+/******************** benchSeconds **************************************
+double benchSeconds()
+Purpose:
+    Returns the time in seconds of the monotonic clock.
+**************************************************************************/
+double benchSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************** initBenchPhase **************************************
+static void initBenchPhase(BenchPhase *pPhase, char *pszName)
+Purpose:
+    Initializes a phase without any times.
+**************************************************************************/
+static void initBenchPhase(BenchPhase *pPhase, char *pszName)
+{
+    pPhase->pszName = pszName;
+    pPhase->iCount = 0;
+    pPhase->iMax = BENCH_INITIAL_QUERIES;
+    pPhase->dTotal = 0;
+    pPhase->dSecondsM = malloc(sizeof(double) * pPhase->iMax);
+    if (pPhase->dSecondsM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the benchmark times");
+}
+
+/******************** addBenchTime **************************************
+static void addBenchTime(BenchPhase *pPhase, double dSeconds)
+Purpose:
+    Adds the time of a query to a phase.
+**************************************************************************/
+static void addBenchTime(BenchPhase *pPhase, double dSeconds)
+{
+    if (pPhase->iCount >= pPhase->iMax)
+    {
+        pPhase->iMax *= 2;
+        pPhase->dSecondsM = realloc(pPhase->dSecondsM, sizeof(double) * pPhase->iMax);
+        if (pPhase->dSecondsM == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory for the benchmark times");
+    }
+    pPhase->dSecondsM[pPhase->iCount++] = dSeconds;
+    pPhase->dTotal += dSeconds;
+}
+
+/******************** compareSeconds **************************************
+static int compareSeconds(const void *p1, const void *p2)
+Purpose:
+    qsort comparison of two times.
+**************************************************************************/
+static int compareSeconds(const void *p1, const void *p2)
+{
+    double d1 = *(const double *) p1;
+    double d2 = *(const double *) p2;
+    return d1 < d2 ? -1 : d1 > d2;
+}
+
+/******************** percentileMicros **************************************
+static double percentileMicros(BenchPhase *pPhase, int iPercent)
+Purpose:
+    Returns a percentile (nearest rank) of a phase's sorted times in
+    microseconds.
+**************************************************************************/
+static double percentileMicros(BenchPhase *pPhase, int iPercent)
+{
+    int iRank;
+
+    if (pPhase->iCount == 0)
+        return 0;
+    iRank = (int) (((long long) pPhase->iCount * iPercent + 99) / 100);
+    if (iRank < 1)
+        iRank = 1;
+    return pPhase->dSecondsM[iRank - 1] * 1e6;
+}
+
+/******************** fprintBenchPhase **************************************
+static void fprintBenchPhase(FILE *pFile, BenchPhase *pPhase)
+Purpose:
+    Prints a phase's total time and percentiles as a JSON member (and
+    frees its times).
+**************************************************************************/
+static void fprintBenchPhase(FILE *pFile, BenchPhase *pPhase)
+{
+    qsort(pPhase->dSecondsM, pPhase->iCount, sizeof(double), compareSeconds);
+    fprintf(pFile, "\"%s\":{\"total_s\":%.6f,\"p50_us\":%.3f,\"p99_us\":%.3f"
+        ",\"max_us\":%.3f},\n"
+        , pPhase->pszName, pPhase->dTotal, percentileMicros(pPhase, 50)
+        , percentileMicros(pPhase, 99), percentileMicros(pPhase, 100));
+    free(pPhase->dSecondsM);
+}
+
+/******************** benchQuery **************************************
+static int benchQuery(void *pArg, char *pszQuery, int iQueryCnt)
+Purpose:
+    Processes a query line read by readQueries and adds its times to the
+    phases of a BenchRun.
+Returns:
+    TRUE (to read the next query)
+**************************************************************************/
+static int benchQuery(void *pArg, char *pszQuery, int iQueryCnt)
+{
+    BenchRun *pRun = (BenchRun *) pArg;
+    QueryStats *pStats;                   // stage times of the query
+    double dStart = benchSeconds();       // start of the query
+
+    processQuery(stdout, pszQuery, iQueryCnt, pRun->out, pRun->customerM
+        , pRun->iNumCustomer, pRun->resultM);
+    addBenchTime(&pRun->query, benchSeconds() - dStart);
+
+    // a query whose conversion failed isn't evaluated
+    pStats = getQueryStats(iQueryCnt);
+    if (pStats->iStageCallsM[STAGE_EVALUATE] > 0)
+        pRun->lNumTerms += pRun->out->iOutCount;
+    addBenchTime(&pRun->convert, pStats->lStageNanosM[STAGE_CONVERT] / 1e9);
+    addBenchTime(&pRun->evaluate, pStats->lStageNanosM[STAGE_EVALUATE] / 1e9);
+    addBenchTime(&pRun->print, pStats->lStageNanosM[STAGE_PRINT] / 1e9);
+    return TRUE;
+}
+
+/******************** readAndProcessQueriesBench **************************************
+void readAndProcessQueriesBench(Customer customerM[], int iNumberOfCustomers
+    , FILE *pFileBench, double dLoadSeconds, double dDumpSeconds)
+Purpose:
+    Does what readAndProcessQueries does, keeping the stage times of each
+    query, and writes the times to the benchmark file.
+Parameters:
+    I   Customer customerM[]      array of customers and traits
+    I   int iNumberOfCustomers    number of customers in customerM
+    I/O FILE *pFileBench          receives the JSON of the times
+    I   double dLoadSeconds       time loading the customers
+    I   double dDumpSeconds       time printing the customers
+Notes:
+    - References the global:  pFileQuery (through readQueries)
+**************************************************************************/
+void readAndProcessQueriesBench(Customer customerM[], int iNumberOfCustomers
+    , FILE *pFileBench, double dLoadSeconds, double dDumpSeconds)
+{
+    BenchRun run;
+    struct rusage usage;
+
+    run.out = newOut();
+    run.customerM = customerM;
+    run.iNumCustomer = iNumberOfCustomers;
+    run.resultM = malloc(sizeof(QueryResult) * (iNumberOfCustomers + 1));
+    run.lNumTerms = 0;
+    if (run.resultM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the queries");
+    initBenchPhase(&run.convert, "convert");
+    initBenchPhase(&run.evaluate, "evaluate");
+    initBenchPhase(&run.print, "print");
+    initBenchPhase(&run.query, "query");
+
+    readQueries(benchQuery, &run);
+    freeOut(run.out);
+    free(run.resultM);
+    if (iOutputFormat == FORMAT_TEXT)
+        printf("\n");
+    fflush(stdout);
+
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(pFileBench, "{\"customers\":%d,\"queries\":%d,\n", iNumberOfCustomers
+        , run.query.iCount);
+    fprintf(pFileBench, "\"load_s\":%.6f,\"dump_s\":%.6f,\n", dLoadSeconds
+        , dDumpSeconds);
+    fprintf(pFileBench, "\"queries_per_s\":%.1f,\"customer_evals_per_s\":%.1f,\n"
+        , run.query.dTotal > 0 ? run.query.iCount / run.query.dTotal : 0.0
+        , run.evaluate.dTotal > 0
+            ? (double) run.query.iCount * iNumberOfCustomers / run.evaluate.dTotal
+            : 0.0);
+    fprintf(pFileBench, "\"terms\":%lld,\"convert_ns_per_term\":%.1f"
+        ",\"evaluate_ns_per_term\":%.1f,\n", run.lNumTerms
+        , run.lNumTerms > 0 ? run.convert.dTotal * 1e9 / run.lNumTerms : 0.0
+        , run.lNumTerms > 0 ? run.evaluate.dTotal * 1e9 / run.lNumTerms : 0.0);
+    fprintBenchPhase(pFileBench, &run.convert);
+    fprintBenchPhase(pFileBench, &run.evaluate);
+    fprintBenchPhase(pFileBench, &run.print);
+    fprintBenchPhase(pFileBench, &run.query);
+    fprintf(pFileBench, "\"peak_rss_kb\":%ld}\n", usage.ru_maxrss);
+}
@@ -0,0 +1,540 @@
+/******************************************************************************
+cs2123p2Cache.c
+Purpose:
+    Implements the query result cache.  The result of a query (a bitmap of
+    the customers satisfying it) is saved under a canonical key of its
+    postfix:  the Out tokens separated by one space.  Queries which differ
+    only in their spacing or redundant parentheses have the same postfix,
+    so they share an entry.  When a query is in the cache, evaluatePostfix
+    neither compiles nor evaluates it.
+Notes:
+    1. The entries are in a hash table (chained) and in an LRU list.  When
+       the total size of the entries exceeds the byte budget, the least
+       recently used entries are evicted.
+    2. The results are only valid for the customers they were computed for.
+       An entry is only used for the same customerM and number of
+       customers, and invalidateQueryCache discards every entry when the
+       customer data changes.
+    3. The cache is shared by the query worker threads, so it is protected
+       by a mutex.
+    4. The hits, misses and evictions are counted.  Setting the environment
+       variable P2_CACHE_STATS prints them to stderr at the end.
+    5. A customer update (p2 -u, or a daemon client's update) only
+       invalidates what it affects.  Adding or removing a customer's trait
+       discards the entries whose key has the trait's type as a token (a
+       query depends on the traits of the types it names).  Removing a
+       customer turns off its bit in every entry.  Adding a customer
+       changes the number of customers, which discards every entry
+       (note 2).
+    6. An entry which is evicted or discarded is kept on a free list and
+       reused (grown with realloc if it is too small) by the next insert,
+       so a full cache stops calling malloc.  The free entries and the
+       cached ones together stay within the budget.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cs2123p2.h"
+
+#define CACHE_INITIAL_SLOTS 256     // initial size of the hash table
+#define CACHE_ENTRY_ROUND 256       // entries are allocated in multiples of this
+
+// CacheEntry typedef is the result of one query
+typedef struct CacheEntry
+{
+    struct CacheEntry *pNext;       // next entry in the same hash slot
+    struct CacheEntry *pNewer;      // more recently used entry
+    struct CacheEntry *pOlder;      // less recently used entry
+    unsigned int uiHash;            // hash of szKey
+    size_t iBytes;                  // size of the entry counted in the budget
+    size_t iAlloc;                  // bytes allocated for the entry
+    BitWord *bitsM;                 // customers satisfying the query
+    char szKey[];                   // canonical postfix of the query
+} CacheEntry;
+
+// QueryCacheImp is the cache (QueryCache is a pointer to it)
+struct QueryCacheImp
+{
+    pthread_mutex_t lock;           // protects everything below
+    size_t iBudget;                 // maximum bytes of the entries
+    size_t iUsed;                   // bytes of the entries
+    int iNumSlots;                  // size of slotM (a power of 2)
+    int iNumEntries;                // number of entries
+    CacheEntry **slotM;             // hash table of entry chains
+    CacheEntry *pNewest;            // most recently used entry
+    CacheEntry *pOldest;            // least recently used entry
+    CacheEntry *pFreeEntries;       // entries to reuse (linked by pNext)
+    size_t iFreeBytes;              // bytes allocated for pFreeEntries
+    Customer *customerM;            // customers of the cached results
+    int iNumCustomer;               // number of customers in customerM
+    long lHits;                     // lookups which found the query
+    long lMisses;                   // lookups which didn't
+    long lEvictions;                // entries evicted for the budget
+};
+
+/******************** queryKey **************************************
+static char *queryKey(Out out, int *piLen)
+Purpose:
+    Builds the canonical key of a postfix query in the query context and
+    returns it (*piLen is its length).
+Notes:
+    - Each element's token and its '\0' are in out's szTokens, so the key
+      (the tokens separated by blanks) fits in iTokenSize bytes.
+**************************************************************************/
+static char *queryKey(Out out, int *piLen)
+{
+    char *szKey = queryAlloc(out->iTokenSize + 1);
+    int iLen = 0;
+    int iTokenLen;
+    int i;
+
+    for (i = 0; i < out->iOutCount; i++)
+    {
+        iTokenLen = strlen(OUT_TOKEN(out, out->outM[i]));
+        if (i > 0)
+            szKey[iLen++] = ' ';
+        memcpy(szKey + iLen, OUT_TOKEN(out, out->outM[i]), iTokenLen);
+        iLen += iTokenLen;
+    }
+    szKey[iLen] = '\0';
+    *piLen = iLen;
+    return szKey;
+}
+
+/******************** hashKey **************************************
+static unsigned int hashKey(char *pszKey, int iLen)
+Purpose:
+    Returns the FNV-1a hash of a key.
+**************************************************************************/
+static unsigned int hashKey(char *pszKey, int iLen)
+{
+    unsigned int uiHash = 2166136261u;
+    while (iLen-- > 0)
+    {
+        uiHash ^= (unsigned char) *pszKey++;
+        uiHash *= 16777619u;
+    }
+    return uiHash;
+}
+
+/******************** newQueryCache **************************************
+QueryCache newQueryCache(size_t iBudget)
+Purpose:
+    Allocates an empty query result cache.
+Parameters:
+    I size_t iBudget      maximum number of bytes of cached results
+**************************************************************************/
+QueryCache newQueryCache(size_t iBudget)
+{
+    QueryCache cache = (QueryCache) malloc(sizeof(struct QueryCacheImp));
+    if (cache == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query cache");
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->iBudget = iBudget;
+    cache->iUsed = 0;
+    cache->iNumSlots = CACHE_INITIAL_SLOTS;
+    cache->iNumEntries = 0;
+    cache->slotM = calloc(cache->iNumSlots, sizeof(CacheEntry *));
+    if (cache->slotM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query cache");
+    cache->pNewest = NULL;
+    cache->pOldest = NULL;
+    cache->pFreeEntries = NULL;
+    cache->iFreeBytes = 0;
+    cache->customerM = NULL;
+    cache->iNumCustomer = 0;
+    cache->lHits = 0;
+    cache->lMisses = 0;
+    cache->lEvictions = 0;
+    return cache;
+}
+
+/******************** unlinkLru **************************************
+static void unlinkLru(QueryCache cache, CacheEntry *pEntry)
+Purpose:
+    Removes an entry from the LRU list.
+**************************************************************************/
+static void unlinkLru(QueryCache cache, CacheEntry *pEntry)
+{
+    if (pEntry->pNewer != NULL)
+        pEntry->pNewer->pOlder = pEntry->pOlder;
+    else
+        cache->pNewest = pEntry->pOlder;
+    if (pEntry->pOlder != NULL)
+        pEntry->pOlder->pNewer = pEntry->pNewer;
+    else
+        cache->pOldest = pEntry->pNewer;
+}
+
+/******************** linkNewest **************************************
+static void linkNewest(QueryCache cache, CacheEntry *pEntry)
+Purpose:
+    Makes an entry the most recently used one.
+**************************************************************************/
+static void linkNewest(QueryCache cache, CacheEntry *pEntry)
+{
+    pEntry->pNewer = NULL;
+    pEntry->pOlder = cache->pNewest;
+    if (cache->pNewest != NULL)
+        cache->pNewest->pNewer = pEntry;
+    else
+        cache->pOldest = pEntry;
+    cache->pNewest = pEntry;
+}
+
+/******************** allocEntry **************************************
+static CacheEntry *allocEntry(QueryCache cache, size_t iBytes)
+Purpose:
+    Returns an entry of at least iBytes bytes, reusing a free entry if
+    there is one, or NULL if there is no memory for it.
+**************************************************************************/
+static CacheEntry *allocEntry(QueryCache cache, size_t iBytes)
+{
+    size_t iAlloc = (iBytes + CACHE_ENTRY_ROUND - 1) / CACHE_ENTRY_ROUND
+        * CACHE_ENTRY_ROUND;
+    CacheEntry *pEntry;
+    CacheEntry *pGrown;
+
+    pthread_mutex_lock(&cache->lock);
+    pEntry = cache->pFreeEntries;
+    if (pEntry != NULL)
+    {
+        cache->pFreeEntries = pEntry->pNext;
+        cache->iFreeBytes -= pEntry->iAlloc;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (pEntry != NULL && pEntry->iAlloc >= iBytes)
+        return pEntry;
+
+    pGrown = realloc(pEntry, iAlloc);
+    if (pGrown == NULL)
+    {
+        free(pEntry);
+        return NULL;
+    }
+    pGrown->iAlloc = iAlloc;
+    return pGrown;
+}
+
+/******************** releaseEntry **************************************
+static void releaseEntry(QueryCache cache, CacheEntry *pEntry)
+Purpose:
+    Keeps an entry which isn't in the cache on the free list, or frees it
+    if the free entries would exceed the budget.  The cache must be locked.
+**************************************************************************/
+static void releaseEntry(QueryCache cache, CacheEntry *pEntry)
+{
+    if (cache->iUsed + cache->iFreeBytes + pEntry->iAlloc > cache->iBudget)
+    {
+        free(pEntry);
+        return;
+    }
+    pEntry->pNext = cache->pFreeEntries;
+    cache->pFreeEntries = pEntry;
+    cache->iFreeBytes += pEntry->iAlloc;
+}
+
+/******************** removeEntry **************************************
+static void removeEntry(QueryCache cache, CacheEntry *pEntry)
+Purpose:
+    Removes an entry from the hash table and the LRU list and releases it.
+**************************************************************************/
+static void removeEntry(QueryCache cache, CacheEntry *pEntry)
+{
+    CacheEntry **ppEntry = &cache->slotM[pEntry->uiHash & (cache->iNumSlots - 1)];
+    while (*ppEntry != pEntry)
+        ppEntry = &(*ppEntry)->pNext;
+    *ppEntry = pEntry->pNext;
+    unlinkLru(cache, pEntry);
+    cache->iUsed -= pEntry->iBytes;
+    cache->iNumEntries--;
+    releaseEntry(cache, pEntry);
+}
+
+/******************** clearEntries **************************************
+static void clearEntries(QueryCache cache)
+Purpose:
+    Removes every entry of the cache.
+**************************************************************************/
+static void clearEntries(QueryCache cache)
+{
+    while (cache->pOldest != NULL)
+        removeEntry(cache, cache->pOldest);
+}
+
+/******************** freeQueryCache **************************************
+void freeQueryCache(QueryCache cache)
+Purpose:
+    Frees the cache and its entries.
+**************************************************************************/
+void freeQueryCache(QueryCache cache)
+{
+    CacheEntry *pEntry;
+
+    if (cache == NULL)
+        return;
+    clearEntries(cache);
+    while ((pEntry = cache->pFreeEntries) != NULL)
+    {
+        cache->pFreeEntries = pEntry->pNext;
+        free(pEntry);
+    }
+    free(cache->slotM);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/******************** invalidateQueryCache **************************************
+void invalidateQueryCache(QueryCache cache)
+Purpose:
+    Discards every cached result.  It must be called whenever the customer
+    data changes.
+**************************************************************************/
+void invalidateQueryCache(QueryCache cache)
+{
+    if (cache == NULL)
+        return;
+    pthread_mutex_lock(&cache->lock);
+    clearEntries(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/******************** keyHasToken **************************************
+static int keyHasToken(char *pszKey, char *pszToken)
+Purpose:
+    Returns TRUE if one of the tokens of a key is pszToken.
+**************************************************************************/
+static int keyHasToken(char *pszKey, char *pszToken)
+{
+    int iLen = strlen(pszToken);
+    char *p;
+
+    for (p = strstr(pszKey, pszToken); p != NULL; p = strstr(p + 1, pszToken))
+    {
+        if ((p == pszKey || p[-1] == ' ') && (p[iLen] == ' ' || p[iLen] == '\0'))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/******************** invalidateQueryCacheType **************************************
+void invalidateQueryCacheType(QueryCache cache, char *pszTraitType)
+Purpose:
+    Discards the cached results of the queries naming a trait type.  It
+    must be called when a customer's trait of that type is added or
+    removed.
+**************************************************************************/
+void invalidateQueryCacheType(QueryCache cache, char *pszTraitType)
+{
+    CacheEntry *pEntry;
+    CacheEntry *pNewer;
+
+    if (cache == NULL)
+        return;
+    pthread_mutex_lock(&cache->lock);
+    for (pEntry = cache->pOldest; pEntry != NULL; pEntry = pNewer)
+    {
+        pNewer = pEntry->pNewer;
+        if (keyHasToken(pEntry->szKey, pszTraitType))
+            removeEntry(cache, pEntry);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/******************** invalidateQueryCacheCustomer **************************************
+void invalidateQueryCacheCustomer(QueryCache cache, int iCustomer)
+Purpose:
+    Removes a customer from every cached result.  It must be called when
+    the customer is removed (a removed customer doesn't satisfy any query).
+**************************************************************************/
+void invalidateQueryCacheCustomer(QueryCache cache, int iCustomer)
+{
+    CacheEntry *pEntry;
+
+    if (cache == NULL)
+        return;
+    pthread_mutex_lock(&cache->lock);
+    if (iCustomer < cache->iNumCustomer)
+    {
+        for (pEntry = cache->pOldest; pEntry != NULL; pEntry = pEntry->pNewer)
+            pEntry->bitsM[iCustomer / BITS_PER_WORD] &=
+                ~((BitWord) 1 << (iCustomer % BITS_PER_WORD));
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/******************** findEntry **************************************
+static CacheEntry *findEntry(QueryCache cache, char *pszKey, unsigned int uiHash)
+Purpose:
+    Returns the entry with the key or NULL.
+**************************************************************************/
+static CacheEntry *findEntry(QueryCache cache, char *pszKey, unsigned int uiHash)
+{
+    CacheEntry *pEntry = cache->slotM[uiHash & (cache->iNumSlots - 1)];
+    for (; pEntry != NULL; pEntry = pEntry->pNext)
+    {
+        if (pEntry->uiHash == uiHash && strcmp(pEntry->szKey, pszKey) == 0)
+            return pEntry;
+    }
+    return NULL;
+}
+
+/******************** lookupQueryCache **************************************
+int lookupQueryCache(QueryCache cache, Out out, Customer customerM[]
+    , int iNumCustomer, QueryResult resultM[])
+Purpose:
+    Looks up the result of a postfix query.
+Parameters:
+    I/O QueryCache cache        the cache
+    I   Out out                 the postfix query
+    I   Customer customerM[]    the customers being queried
+    I   int iNumCustomer        number of customers in customerM
+    O   QueryResult resultM[]   TRUE or FALSE for each customer (if found)
+Returns:
+    TRUE  - the result was in the cache and was stored in resultM
+    FALSE - the query must be evaluated
+**************************************************************************/
+int lookupQueryCache(QueryCache cache, Out out, Customer customerM[]
+    , int iNumCustomer, QueryResult resultM[])
+{
+    int iLen;
+    char *szKey = queryKey(out, &iLen);
+    unsigned int uiHash = hashKey(szKey, iLen);
+    CacheEntry *pEntry;
+    int i;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->customerM != customerM || cache->iNumCustomer != iNumCustomer)
+    {
+        // the results are for other customers
+        clearEntries(cache);
+        cache->customerM = customerM;
+        cache->iNumCustomer = iNumCustomer;
+    }
+    pEntry = findEntry(cache, szKey, uiHash);
+    if (pEntry == NULL)
+    {
+        cache->lMisses++;
+        pthread_mutex_unlock(&cache->lock);
+        return FALSE;
+    }
+    cache->lHits++;
+    unlinkLru(cache, pEntry);
+    linkNewest(cache, pEntry);
+    for (i = 0; i < iNumCustomer; i++)
+        resultM[i] = BITMAP_TEST(pEntry->bitsM, i) ? TRUE : FALSE;
+    pthread_mutex_unlock(&cache->lock);
+    return TRUE;
+}
+
+/******************** rehashCache **************************************
+static void rehashCache(QueryCache cache)
+Purpose:
+    Doubles the hash table and relinks every entry.
+**************************************************************************/
+static void rehashCache(QueryCache cache)
+{
+    int iNumSlots = cache->iNumSlots * 2;
+    CacheEntry **slotM = calloc(iNumSlots, sizeof(CacheEntry *));
+    CacheEntry *pEntry;
+    CacheEntry *pNext;
+    int s;
+
+    if (slotM == NULL)
+        return;                     // keep the longer chains
+    for (s = 0; s < cache->iNumSlots; s++)
+    {
+        for (pEntry = cache->slotM[s]; pEntry != NULL; pEntry = pNext)
+        {
+            pNext = pEntry->pNext;
+            pEntry->pNext = slotM[pEntry->uiHash & (iNumSlots - 1)];
+            slotM[pEntry->uiHash & (iNumSlots - 1)] = pEntry;
+        }
+    }
+    free(cache->slotM);
+    cache->slotM = slotM;
+    cache->iNumSlots = iNumSlots;
+}
+
+/******************** insertQueryCache **************************************
+void insertQueryCache(QueryCache cache, Out out, Customer customerM[]
+    , int iNumCustomer, QueryResult resultM[])
+Purpose:
+    Saves the result of a postfix query, evicting the least recently used
+    results to stay within the budget.
+Parameters:
+    I/O QueryCache cache        the cache
+    I   Out out                 the postfix query
+    I   Customer customerM[]    the customers which were queried
+    I   int iNumCustomer        number of customers in customerM
+    I   QueryResult resultM[]   TRUE or FALSE for each customer
+Notes:
+    - A result larger than the whole budget isn't saved.
+**************************************************************************/
+void insertQueryCache(QueryCache cache, Out out, Customer customerM[]
+    , int iNumCustomer, QueryResult resultM[])
+{
+    int iLen;
+    char *szKey = queryKey(out, &iLen);
+    unsigned int uiHash = hashKey(szKey, iLen);
+    size_t iKeyBytes = (iLen + 1 + sizeof(BitWord) - 1) / sizeof(BitWord) * sizeof(BitWord);
+    size_t iBytes = sizeof(CacheEntry) + iKeyBytes
+        + sizeof(BitWord) * BITMAP_WORDS(iNumCustomer);
+    CacheEntry *pEntry;
+    int iSlot;
+    int i;
+
+    if (iBytes > cache->iBudget)
+        return;
+    pEntry = allocEntry(cache, iBytes);
+    if (pEntry == NULL)
+        return;
+    pEntry->uiHash = uiHash;
+    pEntry->iBytes = iBytes;
+    memcpy(pEntry->szKey, szKey, iLen + 1);
+    pEntry->bitsM = (BitWord *) (pEntry->szKey + iKeyBytes);
+    memset(pEntry->bitsM, 0, sizeof(BitWord) * BITMAP_WORDS(iNumCustomer));
+    for (i = 0; i < iNumCustomer; i++)
+        if (resultM[i])
+            BITMAP_SET(pEntry->bitsM, i);
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->customerM != customerM || cache->iNumCustomer != iNumCustomer
+        || findEntry(cache, szKey, uiHash) != NULL)
+    {
+        // the customers changed, or another thread saved the query
+        releaseEntry(cache, pEntry);
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    while (cache->iUsed + iBytes > cache->iBudget && cache->pOldest != NULL)
+    {
+        removeEntry(cache, cache->pOldest);
+        cache->lEvictions++;
+    }
+    if (cache->iNumEntries >= cache->iNumSlots)
+        rehashCache(cache);
+    iSlot = uiHash & (cache->iNumSlots - 1);
+    pEntry->pNext = cache->slotM[iSlot];
+    cache->slotM[iSlot] = pEntry;
+    linkNewest(cache, pEntry);
+    cache->iUsed += iBytes;
+    cache->iNumEntries++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/******************** printQueryCacheStats **************************************
+void printQueryCacheStats(QueryCache cache, FILE *pFile)
+Purpose:
+    Prints the hit, miss and eviction counts of the cache.
+**************************************************************************/
+void printQueryCacheStats(QueryCache cache, FILE *pFile)
+{
+    if (cache == NULL)
+        return;
+    fprintf(pFile, "Query cache: %ld hits, %ld misses, %ld evictions, "
+        "%d entries, %lu bytes\n"
+        , cache->lHits, cache->lMisses, cache->lEvictions
+        , cache->iNumEntries, (unsigned long) cache->iUsed);
+}
@@ -0,0 +1,199 @@
+/******************************************************************************
+cs2123p2Client.c
+Purpose:
+    p2client sends the queries of a query file to a p2 daemon (p2 -L) and
+    writes the daemon's output to stdout.
+Command Parameters:
+    p2client -L socketFile [-q queryFile]
+        -L file     Unix domain socket file of the daemon
+        -q file     query file (default stdin)
+Notes:
+    1. Build it on its own and use it with a daemon:
+           gcc -O2 -o p2client cs2123p2Client.c
+           p2 -c big.txt -L /tmp/p2.sock -t 4 &
+           p2client -L /tmp/p2.sock -q bigq.txt
+    2. The output is the same as p2 -c big.txt -q bigq.txt prints after the
+       customers.
+    3. The queries are written while the output is read (with poll), since
+       the daemon stops reading a client whose output isn't read.  After
+       the last query, p2client shuts down writing and reads the output
+       until the daemon closes the connection.
+    4. The query file may also have updates (the lines of an update file),
+       which the daemon applies between the queries (see note 6 of
+       cs2123p2Server.c and its sample p2daemon.txt).
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "cs2123p2.h"
+
+#define CLIENT_BUFFER_SIZE 65536    // bytes read or written at a time
+
+static void clientUsage(char *pszMessage, char *pszDiagnosticInfo);
+
+/******************** connectDaemon **************************************
+static int connectDaemon(char *pszSocketFileNm)
+Purpose:
+    Returns a socket connected to the daemon listening on the socket file.
+**************************************************************************/
+static int connectDaemon(char *pszSocketFileNm)
+{
+    struct sockaddr_un addr;
+    int iSocket;
+
+    if (strlen(pszSocketFileNm) >= sizeof(addr.sun_path))
+        clientUsage("socket file name is too long, found", pszSocketFileNm);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, pszSocketFileNm);
+    iSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (iSocket < 0 || connect(iSocket, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "Error: unable to connect to %s: %s\n", pszSocketFileNm
+            , strerror(errno));
+        exit(ERR_BAD_INPUT);
+    }
+    return iSocket;
+}
+
+/******************** writeAll **************************************
+static void writeAll(int iFd, char *pszBuffer, size_t iSize)
+Purpose:
+    Writes a buffer to a descriptor (e.g., stdout), exiting if it can't.
+**************************************************************************/
+static void writeAll(int iFd, char *pszBuffer, size_t iSize)
+{
+    ssize_t iWritten;
+
+    while (iSize > 0)
+    {
+        iWritten = write(iFd, pszBuffer, iSize);
+        if (iWritten < 0 && errno == EINTR)
+            continue;
+        if (iWritten < 0)
+        {
+            fprintf(stderr, "Error: unable to write the output: %s\n"
+                , strerror(errno));
+            exit(ERR_ALGORITHM);
+        }
+        pszBuffer += iWritten;
+        iSize -= iWritten;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    char *pszSocketFileNm = NULL;
+    FILE *pFileQuery = stdin;
+    char *pszQueryM = malloc(CLIENT_BUFFER_SIZE);   // queries read, not yet sent
+    char *pszOutputM = malloc(CLIENT_BUFFER_SIZE);  // output of the daemon
+    size_t iQueryLen = 0;               // bytes in pszQueryM
+    size_t iQuerySent = 0;              // bytes of pszQueryM sent
+    int bQueryEof = FALSE;              // TRUE when the queries are sent
+    struct pollfd pollSocket;
+    ssize_t iCount;
+    int iSocket;
+    int i;
+
+    if (pszQueryM == NULL || pszOutputM == NULL)
+        clientUsage("out of memory for the", "buffers");
+    for (i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0')
+            clientUsage("expected switch, found", argv[i]);
+        switch (argv[i][1])
+        {
+        case 'L':
+        case 'q':
+            if (i + 1 >= argc)
+                clientUsage("missing argument for", argv[i]);
+            if (argv[i][1] == 'L')
+                pszSocketFileNm = argv[++i];
+            else
+            {
+                pFileQuery = fopen(argv[++i], "r");
+                if (pFileQuery == NULL)
+                    clientUsage("Invalid query file name, found", argv[i]);
+            }
+            break;
+        case '?':
+            clientUsage(NULL, NULL);
+            break;
+        default:
+            clientUsage("expected switch, found", argv[i]);
+        }
+    }
+    if (pszSocketFileNm == NULL)
+        clientUsage("missing switch", "-L");
+
+    iSocket = connectDaemon(pszSocketFileNm);
+    pollSocket.fd = iSocket;
+    for (;;)
+    {
+        // read more queries once the ones read are sent
+        if (!bQueryEof && iQuerySent == iQueryLen)
+        {
+            iQueryLen = fread(pszQueryM, 1, CLIENT_BUFFER_SIZE, pFileQuery);
+            iQuerySent = 0;
+            if (iQueryLen == 0)
+            {
+                bQueryEof = TRUE;
+                shutdown(iSocket, SHUT_WR);
+            }
+        }
+        pollSocket.events = POLLIN;
+        if (!bQueryEof)
+            pollSocket.events |= POLLOUT;
+        if (poll(&pollSocket, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pollSocket.revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            iCount = recv(iSocket, pszOutputM, CLIENT_BUFFER_SIZE, MSG_DONTWAIT);
+            if (iCount == 0)
+                break;
+            if (iCount > 0)
+                writeAll(STDOUT_FILENO, pszOutputM, iCount);
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                break;
+        }
+        if (!bQueryEof && (pollSocket.revents & POLLOUT))
+        {
+            iCount = send(iSocket, pszQueryM + iQuerySent, iQueryLen - iQuerySent
+                , MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (iCount > 0)
+                iQuerySent += iCount;
+            else if (iCount < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+                && errno != EINTR)
+                break;
+        }
+    }
+    close(iSocket);
+    if (pFileQuery != stdin)
+        fclose(pFileQuery);
+    free(pszQueryM);
+    free(pszOutputM);
+    return EXIT_SUCCESS;
+}
+
+/******************** clientUsage **************************************
+static void clientUsage(char *pszMessage, char *pszDiagnosticInfo)
+Purpose:
+    Prints an error (unless pszMessage is NULL) and the usage of p2client,
+    and exits.
+**************************************************************************/
+static void clientUsage(char *pszMessage, char *pszDiagnosticInfo)
+{
+    if (pszMessage != NULL)
+        fprintf(stderr, "Error: %s %s\n", pszMessage, pszDiagnosticInfo);
+    fprintf(stderr, "p2client -L socketFile [-q queryFile]\n");
+    exit(pszMessage == NULL ? USAGE_ONLY : ERR_COMMAND_LINE);
+}
@@ -0,0 +1,576 @@
+/******************************************************************************
+cs2123p2Compile.c
+Purpose:
+    Compiles a postfix query (Out) into a Program: an array of instructions
+    with integer opcodes and trait operands already resolved to trait
+    dictionary IDs.  All of the string work of a query (comparing operator
+    tokens, looking up trait names) is done once by compileQuery.
+    runProgram then evaluates the program for one customer using a small
+    stack of booleans, and evaluateProgramIndex evaluates it for all
+    customers at once using the bitmap index.
+Notes:
+    1. compileQuery first builds an expression tree from the postfix (one
+       node per Out element) and then emits the instructions from the tree.
+       The operands of =, NOTANY and ONLY don't become instructions; they
+       become the resolved trait of the operator's instruction.
+    2. The program keeps the results of the postfix evaluation of malformed,
+       but evaluable, queries:
+       - an operand used as a boolean operand of AND or OR is TRUE
+       - =, NOTANY and ONLY with a boolean operand are evaluated with a
+         trait which doesn't exist (FALSE, TRUE, FALSE respectively)
+       - if the postfix leaves several values, the last one is the result
+    3. The tree is optimized as it is emitted.  A chain of the same
+       operator (A AND B AND C, however it is parenthesized) is flattened
+       into one list of operands which is sorted by estimated cost:
+       AND operands which are cheap and usually FALSE come first, OR
+       operands which are cheap and usually TRUE come first.  Between the
+       operands is an OP_JFALSE (AND) or OP_JTRUE (OR) which skips the
+       rest of the chain once its value is decided, both per customer
+       (runProgram) and per bitmap block (evaluateProgramBits).
+    4. The selectivity (fraction of the customers satisfying it) of a
+       predicate comes from the counts of the customer index (see
+       countCustomerIndex).  Predicates are assumed to be independent.
+       Without an index, every predicate is estimated to be 50% selective,
+       so the operands are only sorted by their number of predicates.
+    5. The arrays of a compilation (the tree, the node stack, the
+       instructions and the operands of each chain) are allocated from the
+       query context for the size of the query, so a query may have any
+       number of terms.  A chain is flattened without recursion (see
+       flattenChain) and sorted with qsort, so compiling a query takes
+       O(n log n) time for n terms.  The instructions are emitted with a
+       stack of the chains being emitted (see emitTree) rather than by
+       recursion, so a query alternating AND and OR (a chain per operator)
+       can't overflow the thread's stack.
+    6. p2deep.txt has three deep queries:  104,393 terms alternating AND
+       and OR (a chain per operator), 50,000 nested parentheses, and the
+       first query with AND and OR exchanged.  Each line is less than the
+       daemon's SERVER_MAX_LINE, and deepOutput.txt is what
+       p2 -c p2customer.txt -q p2deep.txt -f csv prints for it.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cs2123p2.h"
+
+// opcode of an expression tree node which is an operand (trait type or value)
+#define OP_OPERAND 0
+
+#define UNKNOWN_SELECTIVITY 0.5   // selectivity of a predicate without an index
+
+// QueryNode typedef is a node of the expression tree of a query
+typedef struct
+{
+    int iOpcode;        // OP_OPERAND or the opcode of the operator
+    int iLeft;          // subscript of the first operand's node
+    int iRight;         // subscript of the second operand's node
+    int iOut;           // subscript of the Out element of this node
+    int iParent;        // subscript of the node this node is an operand of
+    Trait trait;        // resolved trait of =, NOTANY and ONLY
+    double dSelectivity;    // estimated fraction of customers which are TRUE
+    int iCost;          // number of predicates evaluated by the node
+} QueryNode;
+
+// ChainOperand typedef is an operand of an AND or OR chain being sorted
+typedef struct
+{
+    double dRank;       // rank of the operand (see chainRank)
+    int iPosition;      // position of the operand in the query
+    int iNode;          // subscript of the operand's node
+} ChainOperand;
+
+// EmitFrame typedef is an AND or OR chain whose operands are being emitted
+typedef struct
+{
+    int iOpcode;        // OP_AND or OP_OR
+    int iDepth;         // values on the stack before the chain
+    int iNumChain;      // number of operands in chainM
+    int iNext;          // subscript in chainM of the next operand to emit
+    ChainOperand *chainM;   // operands in rank order
+    int *iJumpM;        // jump instruction before each operand
+} EmitFrame;
+
+/******************** operatorOpcode **************************************
+static int operatorOpcode(char *pszToken)
+Purpose:
+    Returns the opcode of an operator token or OP_OPERAND if it isn't one
+    of the query operators.
+**************************************************************************/
+static int operatorOpcode(char *pszToken)
+{
+    if (strcmp(pszToken, "=") == 0)
+        return OP_HAS;
+    if (strcmp(pszToken, "NOTANY") == 0)
+        return OP_NOTANY;
+    if (strcmp(pszToken, "ONLY") == 0)
+        return OP_ONLY;
+    if (strcmp(pszToken, "AND") == 0)
+        return OP_AND;
+    if (strcmp(pszToken, "OR") == 0)
+        return OP_OR;
+    return OP_OPERAND;
+}
+
+/******************** traitSelectivity **************************************
+static double traitSelectivity(QueryNode *pNode)
+Purpose:
+    Returns the estimated fraction of the customers having the trait of
+    an =, NOTANY or ONLY node (ONLY:  as the only trait of its type).
+Notes:
+    - References the global customerIndex.
+**************************************************************************/
+static double traitSelectivity(QueryNode *pNode)
+{
+    CustomerIndex index = customerIndex;
+    double dHas;
+
+    if (pNode->trait.iTraitId == TRAIT_NOT_FOUND)
+        return 0.0;
+    if (index == NULL || index->iNumCustomer == 0
+        || pNode->trait.iTraitId >= index->iNumTraits)
+        return UNKNOWN_SELECTIVITY;
+    dHas = (double) index->traitCountM[pNode->trait.iTraitId] / index->iNumCustomer;
+    if (pNode->iOpcode != OP_ONLY)
+        return dHas;
+    if (pNode->trait.iTraitType >= index->iNumTypes)
+        return dHas * UNKNOWN_SELECTIVITY;
+    return dHas * index->onlyCountM[pNode->trait.iTraitType] / index->iNumCustomer;
+}
+
+/******************** resolveTrait **************************************
+static void resolveTrait(char *pszTraitType, char *pszTraitValue
+    , int bAddTraits, Trait *pTrait)
+Purpose:
+    Looks up the IDs of a trait type and value in the global traitDict.
+    If bAddTraits, they are added to it if they aren't there.
+Notes:
+    - A name longer than a customer's trait type or value can't match one,
+      so it is never added (the dictionary would truncate it).
+**************************************************************************/
+static void resolveTrait(char *pszTraitType, char *pszTraitValue
+    , int bAddTraits, Trait *pTrait)
+{
+    pTrait->iTraitType = findTraitType(traitDict, pszTraitType);
+    if (pTrait->iTraitType == TRAIT_NOT_FOUND && bAddTraits
+        && strlen(pszTraitType) <= MAX_TRAIT_TYPE)
+        pTrait->iTraitType = addTraitType(traitDict, pszTraitType);
+    pTrait->iTraitId = findTrait(traitDict, pTrait->iTraitType, pszTraitValue);
+    if (pTrait->iTraitId == TRAIT_NOT_FOUND && bAddTraits
+        && pTrait->iTraitType != TRAIT_NOT_FOUND
+        && strlen(pszTraitValue) <= MAX_TRAIT_VALUE)
+        pTrait->iTraitId = addTrait(traitDict, pTrait->iTraitType, pszTraitValue);
+}
+
+/******************** estimateNode **************************************
+static void estimateNode(Out out, QueryNode nodeM[], int iNode, int bAddTraits)
+Purpose:
+    Resolves the trait of an operator node and estimates its selectivity
+    and cost from its operands' estimates.  If bAddTraits, a trait which
+    isn't in the trait dictionary is added to it.
+**************************************************************************/
+static void estimateNode(Out out, QueryNode nodeM[], int iNode, int bAddTraits)
+{
+    QueryNode *pNode = &nodeM[iNode];
+    QueryNode *pLeft = &nodeM[pNode->iLeft];
+    QueryNode *pRight = &nodeM[pNode->iRight];
+
+    switch (pNode->iOpcode)
+    {
+        case OP_AND:
+            pNode->dSelectivity = pLeft->dSelectivity * pRight->dSelectivity;
+            pNode->iCost = pLeft->iCost + pRight->iCost;
+            break;
+        case OP_OR:
+            pNode->dSelectivity = 1.0 - (1.0 - pLeft->dSelectivity)
+                * (1.0 - pRight->dSelectivity);
+            pNode->iCost = pLeft->iCost + pRight->iCost;
+            break;
+        default:
+            // =, NOTANY and ONLY:  resolve the trait type and value
+            pNode->iCost = 1;
+            if (pLeft->iOpcode != OP_OPERAND || pRight->iOpcode != OP_OPERAND)
+            {
+                pNode->trait.iTraitType = TRAIT_NOT_FOUND;
+                pNode->trait.iTraitId = TRAIT_NOT_FOUND;
+            }
+            else
+                resolveTrait(OUT_TOKEN(out, out->outM[pLeft->iOut])
+                    , OUT_TOKEN(out, out->outM[pRight->iOut]), bAddTraits
+                    , &pNode->trait);
+            pNode->dSelectivity = traitSelectivity(pNode);
+            if (pNode->iOpcode == OP_NOTANY)
+                pNode->dSelectivity = 1.0 - pNode->dSelectivity;
+    }
+}
+
+/******************** chainRank **************************************
+static double chainRank(QueryNode *pNode, int iOpcode)
+Purpose:
+    Returns the rank of an operand of an AND or OR chain:  its cost per
+    chance of deciding the chain (FALSE for AND, TRUE for OR).  The
+    operands are evaluated in increasing rank.
+**************************************************************************/
+static double chainRank(QueryNode *pNode, int iOpcode)
+{
+    double dDecides;        // probability that the operand decides the chain
+
+    if (iOpcode == OP_AND)
+        dDecides = 1.0 - pNode->dSelectivity;
+    else
+        dDecides = pNode->dSelectivity;
+    if (dDecides < 1e-9)
+        dDecides = 1e-9;
+    return pNode->iCost / dDecides;
+}
+
+/******************** compareChainOperand **************************************
+static int compareChainOperand(const void *pLeft, const void *pRight)
+Purpose:
+    qsort comparison of two ChainOperands:  by rank, and by their position
+    in the query when the ranks are the same (so the sort is stable).
+**************************************************************************/
+static int compareChainOperand(const void *pLeft, const void *pRight)
+{
+    const ChainOperand *pA = (const ChainOperand *) pLeft;
+    const ChainOperand *pB = (const ChainOperand *) pRight;
+
+    if (pA->dRank != pB->dRank)
+        return pA->dRank < pB->dRank ? -1 : 1;
+    return pA->iPosition - pB->iPosition;
+}
+
+/******************** flattenChain **************************************
+static int flattenChain(QueryNode nodeM[], int iNode, int iOpcode
+    , ChainOperand chainM[])
+Purpose:
+    Stores the operands of a chain of iOpcode operators (AND or OR) rooted
+    at iNode in chainM, in their order in the query, and returns their
+    number.  If chainM is NULL, they are only counted.
+Notes:
+    - The chain is walked using the iParent of its nodes rather than by
+      recursion, since a long chain (A AND B AND C ...) is a tree as deep
+      as its number of operands.
+**************************************************************************/
+static int flattenChain(QueryNode nodeM[], int iNode, int iOpcode
+    , ChainOperand chainM[])
+{
+    int iNumChain = 0;
+    int i = iNode;
+
+    for (;;)
+    {
+        // the first operand of the subtree at i
+        while (nodeM[i].iOpcode == iOpcode)
+            i = nodeM[i].iLeft;
+        if (chainM != NULL)
+        {
+            chainM[iNumChain].dRank = chainRank(&nodeM[i], iOpcode);
+            chainM[iNumChain].iPosition = iNumChain;
+            chainM[iNumChain].iNode = i;
+        }
+        iNumChain++;
+
+        // up to the first node whose left subtree i is in, then its right
+        while (i != iNode && nodeM[nodeM[i].iParent].iRight == i)
+            i = nodeM[i].iParent;
+        if (i == iNode)
+            return iNumChain;
+        i = nodeM[nodeM[i].iParent].iRight;
+    }
+}
+
+/******************** emitInstr **************************************
+static void emitInstr(Program program, int iOpcode, Trait trait, int iDepth)
+Purpose:
+    Appends an instruction to the program.  iDepth is the number of values
+    on the evaluation stack after the instruction executes.
+**************************************************************************/
+static void emitInstr(Program program, int iOpcode, Trait trait, int iDepth)
+{
+    Instr *pInstr = &program->instrM[program->iNumInstr++];
+    pInstr->iOpcode = iOpcode;
+    pInstr->trait = trait;
+    pInstr->iTarget = 0;
+    if (iDepth > program->iMaxDepth)
+        program->iMaxDepth = iDepth;
+}
+
+/******************** emitLeaf **************************************
+static void emitLeaf(QueryNode *pNode, Program program, int iDepth)
+Purpose:
+    Emits the instruction which leaves the boolean value of a node which
+    isn't an AND or OR on the evaluation stack.  iDepth is the number of
+    values on the stack before the instruction.
+**************************************************************************/
+static void emitLeaf(QueryNode *pNode, Program program, int iDepth)
+{
+    Trait noTrait = { TRAIT_NOT_FOUND, TRAIT_NOT_FOUND };
+
+    if (pNode->iOpcode == OP_OPERAND)
+        // an operand used as a boolean is TRUE
+        emitInstr(program, OP_TRUE, noTrait, iDepth + 1);
+    else
+        // =, NOTANY and ONLY
+        emitInstr(program, pNode->iOpcode, pNode->trait, iDepth + 1);
+}
+
+/******************** emitTree **************************************
+static void emitTree(QueryNode nodeM[], int iRoot, Program program
+    , EmitFrame frameM[])
+Purpose:
+    Emits the instructions which leave the boolean value of the expression
+    tree rooted at iRoot on the evaluation stack.
+Parameters:
+    I QueryNode nodeM[]     the expression tree
+    I int iRoot             subscript of its root node
+    O Program program       receives the instructions
+    I EmitFrame frameM[]    work stack with an element per operator node
+Notes:
+    - An AND or OR chain is emitted as its operands in rank order, each
+      followed by the chain's operator and preceded by a jump past the
+      chain if the value is already decided.
+    - The chains being emitted are a stack of EmitFrames rather than
+      recursive calls, since a query alternating AND and OR is a tree
+      with a chain per operator.
+**************************************************************************/
+static void emitTree(QueryNode nodeM[], int iRoot, Program program
+    , EmitFrame frameM[])
+{
+    Trait noTrait = { TRAIT_NOT_FOUND, TRAIT_NOT_FOUND };
+    EmitFrame *pFrame;
+    int iNumFrames = 0;                 // number of chains in frameM
+    int iNode = iRoot;                  // node to emit next
+    int iDepth = 0;                     // values on the stack before it
+    int i;
+
+    for (;;)
+    {
+        // start the chains whose first operand is iNode, then emit it
+        while (nodeM[iNode].iOpcode == OP_AND || nodeM[iNode].iOpcode == OP_OR)
+        {
+            pFrame = &frameM[iNumFrames++];
+            pFrame->iOpcode = nodeM[iNode].iOpcode;
+            pFrame->iDepth = iDepth;
+            pFrame->iNumChain = flattenChain(nodeM, iNode, pFrame->iOpcode, NULL);
+            pFrame->chainM = queryAlloc(sizeof(ChainOperand) * pFrame->iNumChain);
+            pFrame->iJumpM = queryAlloc(sizeof(int) * pFrame->iNumChain);
+            flattenChain(nodeM, iNode, pFrame->iOpcode, pFrame->chainM);
+            // sort by rank (ties keep the query's order)
+            qsort(pFrame->chainM, pFrame->iNumChain, sizeof(ChainOperand)
+                , compareChainOperand);
+            pFrame->iNext = 1;
+            iNode = pFrame->chainM[0].iNode;
+        }
+        emitLeaf(&nodeM[iNode], program, iDepth);
+
+        // finish the chains whose last operand was emitted
+        for (;;)
+        {
+            if (iNumFrames == 0)
+                return;
+            pFrame = &frameM[iNumFrames - 1];
+            if (pFrame->iNext > 1)
+                emitInstr(program, pFrame->iOpcode, noTrait, pFrame->iDepth + 1);
+            if (pFrame->iNext < pFrame->iNumChain)
+                break;
+            for (i = 1; i < pFrame->iNumChain; i++)
+                program->instrM[pFrame->iJumpM[i]].iTarget = program->iNumInstr;
+            iNumFrames--;
+        }
+
+        // the chain's next operand
+        i = pFrame->iNext++;
+        pFrame->iJumpM[i] = program->iNumInstr;
+        emitInstr(program, pFrame->iOpcode == OP_AND ? OP_JFALSE : OP_JTRUE
+            , noTrait, pFrame->iDepth + 1);
+        iNode = pFrame->chainM[i].iNode;
+        iDepth = pFrame->iDepth + 1;
+    }
+}
+
+static int compileOut(Out out, Program program, int bAddTraits);
+
+/******************** compileQuery **************************************
+int compileQuery(Out out, Program program)
+Purpose:
+    Compiles a postfix query into a program of instructions.
+Parameters:
+    I Out out              Contains a query converted to postfix
+    O Program program      The compiled query
+Returns:
+    TRUE  - the query was compiled
+    FALSE - the postfix can't be evaluated (an operator is missing an
+            operand, there is nothing to evaluate, or there is an element
+            which isn't an operator or operand)
+Notes:
+    - Trait names are resolved using the global traitDict.  Selectivities
+      are estimated using the global customerIndex (if there is one).
+**************************************************************************/
+int compileQuery(Out out, Program program)
+{
+    return compileOut(out, program, FALSE);
+}
+
+/******************** compileQueryAddTraits **************************************
+int compileQueryAddTraits(Out out, Program program)
+Purpose:
+    Does what compileQuery does, but adds the query's trait types and
+    values which aren't in the global traitDict to it.
+Notes:
+    - Used when a query is compiled before the customers are read (p2 -r).
+      A trait no customer has gives the same result as one which isn't in
+      the dictionary.
+**************************************************************************/
+int compileQueryAddTraits(Out out, Program program)
+{
+    return compileOut(out, program, TRUE);
+}
+
+/******************** compileOut **************************************
+static int compileOut(Out out, Program program, int bAddTraits)
+Purpose:
+    Compiles a postfix query (see compileQuery).  If bAddTraits, traits
+    which aren't in the trait dictionary are added to it.
+**************************************************************************/
+static int compileOut(Out out, Program program, int bAddTraits)
+{
+    QueryNode *nodeM;                   // expression tree node of each Out element
+    int *iNodeStackM;                   // stack of subscripts of the tree nodes
+    EmitFrame *frameM;                  // chains being emitted (see emitTree)
+    int iCount = 0;                     // number of entries in iNodeStackM
+    int j;
+
+    nodeM = queryAlloc(sizeof(QueryNode) * (out->iOutCount + 1));
+    iNodeStackM = queryAlloc(sizeof(int) * (out->iOutCount + 1));
+    // each element gives at most an instruction and a jump
+    program->instrM = queryAlloc(sizeof(Instr) * (2 * out->iOutCount + 1));
+    program->iNumInstr = 0;
+    program->iMaxDepth = 0;
+
+    for (j = 0; j < out->iOutCount; j++)
+    {
+        nodeM[j].iOut = j;
+        switch (out->outM[j].iCategory)
+        {
+            case CAT_OPERAND:
+                nodeM[j].iOpcode = OP_OPERAND;
+                nodeM[j].dSelectivity = 1.0;
+                nodeM[j].iCost = 0;
+                break;
+            case CAT_OPERATOR:
+                nodeM[j].iOpcode = operatorOpcode(OUT_TOKEN(out, out->outM[j]));
+                if (nodeM[j].iOpcode == OP_OPERAND || iCount < 2)
+                    return FALSE;
+                nodeM[j].iRight = iNodeStackM[--iCount];
+                nodeM[j].iLeft = iNodeStackM[--iCount];
+                nodeM[nodeM[j].iLeft].iParent = j;
+                nodeM[nodeM[j].iRight].iParent = j;
+                estimateNode(out, nodeM, j, bAddTraits);
+                break;
+            default:
+                return FALSE;
+        }
+        iNodeStackM[iCount++] = j;
+    }
+    if (iCount == 0)
+        return FALSE;
+
+    // a chain has at least one operator, so there are fewer than iOutCount
+    frameM = queryAlloc(sizeof(EmitFrame) * (out->iOutCount + 1));
+    emitTree(nodeM, iNodeStackM[iCount - 1], program, frameM);
+    return TRUE;
+}
+
+/******************** keepProgram **************************************
+Program keepProgram(Program program, Program kept)
+Purpose:
+    Copies a compiled query out of the query context, so it can be used
+    after the next query.  The copy is one malloc block (its instructions
+    follow the ProgramImp), freed with free.
+Parameters:
+    I Program program      The compiled query (e.g., in the query context)
+    I Program kept         A copy from keepProgram to reuse, or NULL
+Returns:
+    The copy (kept may have moved).
+**************************************************************************/
+Program keepProgram(Program program, Program kept)
+{
+    kept = realloc(kept, sizeof(ProgramImp) + sizeof(Instr) * program->iNumInstr);
+    if (kept == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for a compiled query");
+    kept->iNumInstr = program->iNumInstr;
+    kept->iMaxDepth = program->iMaxDepth;
+    kept->instrM = (Instr *) (kept + 1);
+    memcpy(kept->instrM, program->instrM, sizeof(Instr) * program->iNumInstr);
+    return kept;
+}
+
+/******************** runProgram **************************************
+int runProgram(Program program, Customer *pCustomer)
+Purpose:
+    Evaluates a compiled query for one customer.
+Parameters:
+    I Program program        The compiled query
+    I Customer *pCustomer    The customer
+Returns:
+    TRUE  - the customer satisfies the query
+    FALSE - the customer doesn't satisfy the query
+**************************************************************************/
+int runProgram(Program program, Customer *pCustomer)
+{
+    char bLocalStackM[MAX_OUT_ITEM];    // evaluation stack of most programs
+    char *bStackM = bLocalStackM;       // evaluation stack of booleans
+    int iCount = 0;                     // number of values in bStackM
+    Instr *pInstr = program->instrM;
+    Instr *pEnd = program->instrM + program->iNumInstr;
+    STATS_ONLY(int iLeaves = 0;)        // values pushed by operands (p2 -s)
+    STATS_ONLY(int iCombines = 0;)      // ANDs and ORs (pop two, push one)
+
+    // a customer removed by an update doesn't satisfy any query
+    if (pCustomer->iNumberOfTraits == CUSTOMER_REMOVED)
+        return FALSE;
+    if (program->iMaxDepth > MAX_OUT_ITEM)
+        bStackM = queryScratch(program->iMaxDepth);
+    for (; pInstr < pEnd; pInstr++)
+    {
+        switch (pInstr->iOpcode)
+        {
+            case OP_HAS:
+                STATS_ONLY(iLeaves++;)
+                bStackM[iCount++] = atLeastOne(pCustomer, &pInstr->trait);
+                break;
+            case OP_NOTANY:
+                STATS_ONLY(iLeaves++;)
+                bStackM[iCount++] = notAny(pCustomer, &pInstr->trait);
+                break;
+            case OP_ONLY:
+                STATS_ONLY(iLeaves++;)
+                bStackM[iCount++] = only(pCustomer, &pInstr->trait);
+                break;
+            case OP_AND:
+                STATS_ONLY(iCombines++;)
+                iCount--;
+                bStackM[iCount - 1] = bStackM[iCount - 1] && bStackM[iCount];
+                break;
+            case OP_OR:
+                STATS_ONLY(iCombines++;)
+                iCount--;
+                bStackM[iCount - 1] = bStackM[iCount - 1] || bStackM[iCount];
+                break;
+            case OP_TRUE:
+                STATS_ONLY(iLeaves++;)
+                bStackM[iCount++] = TRUE;
+                break;
+            case OP_JFALSE:
+                if (!bStackM[iCount - 1])
+                    pInstr = program->instrM + pInstr->iTarget - 1;
+                break;
+            case OP_JTRUE:
+                if (bStackM[iCount - 1])
+                    pInstr = program->instrM + pInstr->iTarget - 1;
+                break;
+        }
+    }
+    STATS_ONLY(STATS_ADD(lPushes, iLeaves + iCombines);)
+    STATS_ONLY(STATS_ADD(lPops, 2 * iCombines);)
+    return bStackM[0];
+}
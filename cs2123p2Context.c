@@ -0,0 +1,265 @@
+/******************************************************************************
+cs2123p2Context.c
+Purpose:
+    Implements the query context of each thread, so processing a query
+    doesn't call malloc once the thread has processed a query as large.
+    The buffers a query needs only while it is processed (the conversion
+    stack, the query without its suffix, the compiled program and the
+    compiler's tree, the cache key, the result bitmap of the index, the
+    shards of p2 -j, the customers found by a LIMIT query and the bitmap
+    of its result) are allocated from the context's arena with queryAlloc
+    (or grown with queryGrow).  resetQueryContext empties the arena
+    when the thread starts its next query (processQuery, benchmark mode,
+    and each query converted or printed by batch and streaming mode),
+    keeping its memory.  The
+    context also keeps a freed Writer for the next newWriter and a stream
+    which prints a query's output to an OutputBuffer (openBufferStream).
+Notes:
+    1. The context is created the first time a thread uses it and freed
+       when the thread exits (by the destructor of a pthread key), so the
+       worker threads of p2 -t and p2 -L and the shard threads of p2 -j
+       each have their own.
+    2. arenaReset replaces several chunks by one chunk of their total
+       size, so after the largest query the arena is one chunk which is
+       reused by every query.
+    3. Memory from queryAlloc is never freed on its own, so a query which
+       calls ErrExit (trapped by a worker) can't leak it.
+    4. The Out and the result array are allocated once per thread and
+       reused for each query.  The output of a query which is kept until
+       it is printed in the order of the queries (p2 -t, -L and -b) is
+       printed to an OutputBuffer of the query's slot or job, which keeps
+       its memory for the next query.  The thread's stream is created
+       once and only switched to the next buffer, so the output doesn't
+       need a memory stream (open_memstream) per query.
+    5. A compiled query kept after its query (batch and streaming mode) is
+       copied out of the arena by keepProgram.
+******************************************************************************/
+#define _GNU_SOURCE                 // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cs2123p2.h"
+
+// the thread's context (NULL until the thread uses it)
+static __thread QueryContext *pThreadContext = NULL;
+
+// key whose destructor frees a thread's context when the thread exits
+static pthread_key_t contextKey;
+static pthread_once_t contextKeyOnce = PTHREAD_ONCE_INIT;
+
+/******************** freeQueryContext **************************************
+static void freeQueryContext(void *pArg)
+Purpose:
+    Frees a thread's context (the destructor of contextKey).
+**************************************************************************/
+static void freeQueryContext(void *pArg)
+{
+    QueryContext *pContext = (QueryContext *) pArg;
+
+    // the buffer may be gone, so output which isn't flushed is dropped
+    pContext->pBuffer = NULL;
+    if (pContext->pBufferStream != NULL)
+        fclose(pContext->pBufferStream);
+    arenaFree(&pContext->arena);
+    free(pContext->spareWriter);
+    free(pContext);
+    pThreadContext = NULL;
+}
+
+/******************** createContextKey **************************************
+static void createContextKey()
+Purpose:
+    Creates contextKey (once, by pthread_once).
+**************************************************************************/
+static void createContextKey()
+{
+    if (pthread_key_create(&contextKey, freeQueryContext) != 0)
+        ErrExit(ERR_ALGORITHM, "unable to create the query context key");
+}
+
+/******************** queryContext **************************************
+QueryContext *queryContext()
+Purpose:
+    Returns the calling thread's context, creating it if the thread
+    doesn't have one yet.
+**************************************************************************/
+QueryContext *queryContext()
+{
+    QueryContext *pContext = pThreadContext;
+
+    if (pContext != NULL)
+        return pContext;
+    pthread_once(&contextKeyOnce, createContextKey);
+    pContext = malloc(sizeof(QueryContext));
+    if (pContext == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for a query context");
+    arenaInit(&pContext->arena);
+    pContext->pScratch = NULL;
+    pContext->iScratchSize = 0;
+    pContext->spareWriter = NULL;
+    pContext->pBufferStream = NULL;
+    pContext->pBuffer = NULL;
+    pthread_setspecific(contextKey, pContext);
+    pThreadContext = pContext;
+    return pContext;
+}
+
+/******************** resetQueryContext **************************************
+void resetQueryContext()
+Purpose:
+    Empties the arena of the thread's context for its next query.  The
+    memory allocated by queryAlloc for the previous query must no longer
+    be used.
+**************************************************************************/
+void resetQueryContext()
+{
+    QueryContext *pContext = queryContext();
+
+    arenaReset(&pContext->arena);
+    pContext->pScratch = NULL;
+    pContext->iScratchSize = 0;
+}
+
+/******************** queryAlloc **************************************
+void *queryAlloc(size_t iSize)
+Purpose:
+    Allocates iSize bytes for the thread's current query.  They are
+    released by the next resetQueryContext (there is no free).
+Notes:
+    - Like arenaAlloc, this exits if memory is exhausted.
+**************************************************************************/
+void *queryAlloc(size_t iSize)
+{
+    return arenaAlloc(&queryContext()->arena, iSize);
+}
+
+/******************** queryGrow **************************************
+void *queryGrow(void *pOld, size_t iOldSize, size_t iNewSize)
+Purpose:
+    Grows an allocation of the thread's current query from iOldSize to
+    iNewSize bytes (see arenaGrowLast) and returns its address.
+Notes:
+    - If it isn't the last allocation, it is copied and the old bytes stay
+      in the arena until the next resetQueryContext.
+**************************************************************************/
+void *queryGrow(void *pOld, size_t iOldSize, size_t iNewSize)
+{
+    return arenaGrowLast(&queryContext()->arena, pOld, iOldSize, iNewSize);
+}
+
+/******************** queryScratch **************************************
+void *queryScratch(size_t iSize)
+Purpose:
+    Returns a scratch buffer of at least iSize bytes for the thread's
+    current query.  Each call may return the same buffer, so it is only
+    for memory used until the caller returns (e.g., the evaluation stack
+    of a deep query, which runProgram needs for each customer).
+Notes:
+    - The buffer is from the arena, so it is only allocated again for a
+      larger size or after resetQueryContext.
+**************************************************************************/
+void *queryScratch(size_t iSize)
+{
+    QueryContext *pContext = queryContext();
+
+    if (iSize > pContext->iScratchSize)
+    {
+        pContext->pScratch = arenaAlloc(&pContext->arena, iSize);
+        pContext->iScratchSize = iSize;
+    }
+    return pContext->pScratch;
+}
+
+/******************** writeBufferStream **************************************
+static ssize_t writeBufferStream(void *pCookie, const char *pBuf, size_t iSize)
+Purpose:
+    fopencookie write function of openBufferStream's stream.  Appends the
+    bytes to the context's buffer, growing it if necessary.
+Returns:
+    iSize - the bytes were appended
+    0 - there is no buffer or no memory (the stream's error)
+**************************************************************************/
+static ssize_t writeBufferStream(void *pCookie, const char *pBuf, size_t iSize)
+{
+    QueryContext *pContext = (QueryContext *) pCookie;
+    OutputBuffer *pBuffer = pContext->pBuffer;
+    size_t iMax;
+    char *pszText;
+
+    if (pBuffer == NULL)
+        return 0;
+    if (pBuffer->iLength + iSize > pBuffer->iMax)
+    {
+        iMax = pBuffer->iMax > 0 ? pBuffer->iMax * 2 : BUFSIZ;
+        while (iMax < pBuffer->iLength + iSize)
+            iMax *= 2;
+        pszText = realloc(pBuffer->pszText, iMax);
+        if (pszText == NULL)
+            return 0;
+        pBuffer->pszText = pszText;
+        pBuffer->iMax = iMax;
+    }
+    memcpy(pBuffer->pszText + pBuffer->iLength, pBuf, iSize);
+    pBuffer->iLength += iSize;
+    return iSize;
+}
+
+/******************** openBufferStream **************************************
+FILE *openBufferStream(OutputBuffer *pBuffer)
+Purpose:
+    Empties the buffer and returns the thread's stream which prints to it
+    (like open_memstream).  The output is in the buffer when the stream
+    is closed by closeBufferStream.
+Notes:
+    - The stream is created the first time the thread uses it and is
+      reused, so only one buffer of a thread is open at a time.
+**************************************************************************/
+FILE *openBufferStream(OutputBuffer *pBuffer)
+{
+    QueryContext *pContext = queryContext();
+    cookie_io_functions_t functions = { NULL, writeBufferStream, NULL, NULL };
+
+    if (pContext->pBufferStream == NULL)
+    {
+        pContext->pBufferStream = fopencookie(pContext, "w", functions);
+        if (pContext->pBufferStream == NULL)
+            ErrExit(ERR_ALGORITHM, "unable to buffer the output of a query");
+    }
+    pBuffer->iLength = 0;
+    pContext->pBuffer = pBuffer;
+    return pContext->pBufferStream;
+}
+
+/******************** closeBufferStream **************************************
+void closeBufferStream(FILE *pFile)
+Purpose:
+    Flushes the stream returned by openBufferStream to its buffer.  The
+    stream is kept for the thread's next openBufferStream.
+Notes:
+    - Exits if the buffer couldn't be grown for the output.
+**************************************************************************/
+void closeBufferStream(FILE *pFile)
+{
+    QueryContext *pContext = queryContext();
+
+    if (fflush(pFile) != 0 || ferror(pFile))
+    {
+        clearerr(pFile);
+        ErrExit(ERR_ALGORITHM, "out of memory for the output of a query");
+    }
+    pContext->pBuffer = NULL;
+}
+
+/******************** freeOutputBuffer **************************************
+void freeOutputBuffer(OutputBuffer *pBuffer)
+Purpose:
+    Frees the memory of a buffer, leaving it empty.
+**************************************************************************/
+void freeOutputBuffer(OutputBuffer *pBuffer)
+{
+    free(pBuffer->pszText);
+    pBuffer->pszText = NULL;
+    pBuffer->iLength = 0;
+    pBuffer->iMax = 0;
+}
@@ -0,0 +1,336 @@
+/******************************************************************************
+cs2123p2Dict.c
+Purpose:
+    Implements the trait dictionary.  Every trait type (e.g., GENDER) and
+    every (trait type, trait value) pair (e.g., GENDER F) found while loading
+    the customer file is interned once and given a small integer ID.  The
+    customer traits and the resolved query operands store these IDs so that
+    matching a trait is an integer compare instead of two strcmp calls.
+Notes:
+    1. Trait type IDs run from 0 to iNumTypes - 1 and trait IDs from 0 to
+       iNumTraits - 1.  A name that is not in the dictionary resolves to
+       TRAIT_NOT_FOUND, which never matches a customer's trait.
+    2. Both name tables use open addressing with linear probing.  The hash
+       tables hold the ID + 1 so that 0 marks an empty slot.  They are
+       doubled when they become half full.
+    3. The ...Len functions take a name which isn't zero-terminated (e.g., a
+       view into the mapped customer file) and its length.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cs2123p2.h"
+
+#define DICT_INITIAL_SIZE 64    // initial number of entries and hash slots
+
+/******************** hashBytes **************************************
+static unsigned int hashBytes(const char *p, int iLen, unsigned int uiSeed)
+Purpose:
+    Returns the FNV-1a hash of iLen characters.  The seed lets the trait
+    table mix in the trait type ID.
+**************************************************************************/
+static unsigned int hashBytes(const char *p, int iLen, unsigned int uiSeed)
+{
+    unsigned int uiHash = 2166136261u ^ uiSeed;
+    while (iLen-- > 0)
+    {
+        uiHash ^= (unsigned char) *p++;
+        uiHash *= 16777619u;
+    }
+    return uiHash;
+}
+
+/******************** nameEquals **************************************
+static int nameEquals(char *pszName, const char *p, int iLen)
+Purpose:
+    Returns TRUE if a zero-terminated name equals the iLen characters at p.
+**************************************************************************/
+static int nameEquals(char *pszName, const char *p, int iLen)
+{
+    // strncmp stops at the end of pszName, so a longer p never reads past it
+    return strncmp(pszName, p, iLen) == 0 && pszName[iLen] == '\0';
+}
+
+/******************** allocOrExit **************************************
+static void *allocOrExit(void *pOld, size_t iSize)
+Purpose:
+    realloc which exits the program when memory is exhausted.
+**************************************************************************/
+static void *allocOrExit(void *pOld, size_t iSize)
+{
+    void *pNew = realloc(pOld, iSize);
+    if (pNew == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the trait dictionary");
+    return pNew;
+}
+
+/******************** newTraitDict **************************************
+TraitDict newTraitDict()
+Purpose:
+    Allocates an empty trait dictionary.
+**************************************************************************/
+TraitDict newTraitDict()
+{
+    TraitDict dict = (TraitDict) allocOrExit(NULL, sizeof(TraitDictImp));
+    dict->iNumTypes = 0;
+    dict->iMaxTypes = DICT_INITIAL_SIZE;
+    dict->typeM = allocOrExit(NULL, sizeof(TraitTypeDef) * DICT_INITIAL_SIZE);
+    dict->iTypeHashSize = DICT_INITIAL_SIZE * 2;
+    dict->typeHashM = calloc(dict->iTypeHashSize, sizeof(int));
+    dict->iNumTraits = 0;
+    dict->iMaxTraits = DICT_INITIAL_SIZE;
+    dict->traitM = allocOrExit(NULL, sizeof(TraitValueDef) * DICT_INITIAL_SIZE);
+    dict->iTraitHashSize = DICT_INITIAL_SIZE * 2;
+    dict->traitHashM = calloc(dict->iTraitHashSize, sizeof(int));
+    if (dict->typeHashM == NULL || dict->traitHashM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the trait dictionary");
+    return dict;
+}
+
+/******************** freeTraitDict **************************************
+void freeTraitDict(TraitDict dict)
+Purpose:
+    Frees a trait dictionary and its tables.
+**************************************************************************/
+void freeTraitDict(TraitDict dict)
+{
+    if (dict == NULL)
+        return;
+    free(dict->typeM);
+    free(dict->typeHashM);
+    free(dict->traitM);
+    free(dict->traitHashM);
+    free(dict);
+}
+
+/******************** findTraitType **************************************
+int findTraitType(TraitDict dict, char *pszTraitType)
+int findTraitTypeLen(TraitDict dict, const char *pTraitType, int iLen)
+Purpose:
+    Returns the ID of a trait type or TRAIT_NOT_FOUND.
+**************************************************************************/
+int findTraitType(TraitDict dict, char *pszTraitType)
+{
+    return findTraitTypeLen(dict, pszTraitType, strlen(pszTraitType));
+}
+int findTraitTypeLen(TraitDict dict, const char *pTraitType, int iLen)
+{
+    unsigned int uiMask = dict->iTypeHashSize - 1;
+    unsigned int uiSlot = hashBytes(pTraitType, iLen, 0) & uiMask;
+    int iEntry;
+
+    while ((iEntry = dict->typeHashM[uiSlot]) != 0)
+    {
+        if (nameEquals(dict->typeM[iEntry - 1].szTraitType, pTraitType, iLen))
+            return iEntry - 1;
+        uiSlot = (uiSlot + 1) & uiMask;
+    }
+    return TRAIT_NOT_FOUND;
+}
+
+/******************** findTrait **************************************
+int findTrait(TraitDict dict, int iTraitType, char *pszTraitValue)
+int findTraitLen(TraitDict dict, int iTraitType, const char *pTraitValue
+    , int iLen)
+Purpose:
+    Returns the trait ID of a (trait type ID, trait value) pair or
+    TRAIT_NOT_FOUND.
+**************************************************************************/
+int findTrait(TraitDict dict, int iTraitType, char *pszTraitValue)
+{
+    return findTraitLen(dict, iTraitType, pszTraitValue, strlen(pszTraitValue));
+}
+int findTraitLen(TraitDict dict, int iTraitType, const char *pTraitValue
+    , int iLen)
+{
+    unsigned int uiMask = dict->iTraitHashSize - 1;
+    unsigned int uiSlot;
+    int iEntry;
+
+    if (iTraitType == TRAIT_NOT_FOUND)
+        return TRAIT_NOT_FOUND;
+    uiSlot = hashBytes(pTraitValue, iLen, iTraitType) & uiMask;
+    while ((iEntry = dict->traitHashM[uiSlot]) != 0)
+    {
+        if (dict->traitM[iEntry - 1].iTraitType == iTraitType
+            && nameEquals(dict->traitM[iEntry - 1].szTraitValue, pTraitValue, iLen))
+            return iEntry - 1;
+        uiSlot = (uiSlot + 1) & uiMask;
+    }
+    return TRAIT_NOT_FOUND;
+}
+
+/******************** rehashTypes **************************************
+static void rehashTypes(TraitDict dict)
+Purpose:
+    Doubles the trait type hash table and reinserts every type.
+**************************************************************************/
+static void rehashTypes(TraitDict dict)
+{
+    unsigned int uiMask;
+    unsigned int uiSlot;
+    int i;
+
+    free(dict->typeHashM);
+    dict->iTypeHashSize *= 2;
+    dict->typeHashM = calloc(dict->iTypeHashSize, sizeof(int));
+    if (dict->typeHashM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the trait dictionary");
+    uiMask = dict->iTypeHashSize - 1;
+    for (i = 0; i < dict->iNumTypes; i++)
+    {
+        uiSlot = hashBytes(dict->typeM[i].szTraitType
+            , strlen(dict->typeM[i].szTraitType), 0) & uiMask;
+        while (dict->typeHashM[uiSlot] != 0)
+            uiSlot = (uiSlot + 1) & uiMask;
+        dict->typeHashM[uiSlot] = i + 1;
+    }
+}
+
+/******************** rehashTraits **************************************
+static void rehashTraits(TraitDict dict)
+Purpose:
+    Doubles the trait hash table and reinserts every trait.
+**************************************************************************/
+static void rehashTraits(TraitDict dict)
+{
+    unsigned int uiMask;
+    unsigned int uiSlot;
+    int i;
+
+    free(dict->traitHashM);
+    dict->iTraitHashSize *= 2;
+    dict->traitHashM = calloc(dict->iTraitHashSize, sizeof(int));
+    if (dict->traitHashM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the trait dictionary");
+    uiMask = dict->iTraitHashSize - 1;
+    for (i = 0; i < dict->iNumTraits; i++)
+    {
+        uiSlot = hashBytes(dict->traitM[i].szTraitValue
+            , strlen(dict->traitM[i].szTraitValue), dict->traitM[i].iTraitType) & uiMask;
+        while (dict->traitHashM[uiSlot] != 0)
+            uiSlot = (uiSlot + 1) & uiMask;
+        dict->traitHashM[uiSlot] = i + 1;
+    }
+}
+
+/******************** addTraitType **************************************
+int addTraitType(TraitDict dict, char *pszTraitType)
+int addTraitTypeLen(TraitDict dict, const char *pTraitType, int iLen)
+Purpose:
+    Interns a trait type, returning its (possibly new) ID.
+Notes:
+    - The name is truncated to MAX_TRAIT_TYPE characters.
+**************************************************************************/
+int addTraitType(TraitDict dict, char *pszTraitType)
+{
+    return addTraitTypeLen(dict, pszTraitType, strlen(pszTraitType));
+}
+int addTraitTypeLen(TraitDict dict, const char *pTraitType, int iLen)
+{
+    int iTraitType;
+    unsigned int uiMask;
+    unsigned int uiSlot;
+
+    if (iLen > MAX_TRAIT_TYPE)
+        iLen = MAX_TRAIT_TYPE;
+    iTraitType = findTraitTypeLen(dict, pTraitType, iLen);
+    if (iTraitType != TRAIT_NOT_FOUND)
+        return iTraitType;
+
+    if (dict->iNumTypes >= dict->iMaxTypes)
+    {
+        dict->iMaxTypes *= 2;
+        dict->typeM = allocOrExit(dict->typeM
+            , sizeof(TraitTypeDef) * dict->iMaxTypes);
+    }
+    iTraitType = dict->iNumTypes++;
+    memcpy(dict->typeM[iTraitType].szTraitType, pTraitType, iLen);
+    dict->typeM[iTraitType].szTraitType[iLen] = '\0';
+
+    if (dict->iNumTypes * 2 > dict->iTypeHashSize)
+        rehashTypes(dict);
+    else
+    {
+        uiMask = dict->iTypeHashSize - 1;
+        uiSlot = hashBytes(pTraitType, iLen, 0) & uiMask;
+        while (dict->typeHashM[uiSlot] != 0)
+            uiSlot = (uiSlot + 1) & uiMask;
+        dict->typeHashM[uiSlot] = iTraitType + 1;
+    }
+    return iTraitType;
+}
+
+/******************** addTrait **************************************
+int addTrait(TraitDict dict, int iTraitType, char *pszTraitValue)
+int addTraitLen(TraitDict dict, int iTraitType, const char *pTraitValue
+    , int iLen)
+Purpose:
+    Interns a (trait type ID, trait value) pair, returning its (possibly
+    new) trait ID.
+Notes:
+    - The value is truncated to MAX_TRAIT_VALUE characters.
+**************************************************************************/
+int addTrait(TraitDict dict, int iTraitType, char *pszTraitValue)
+{
+    return addTraitLen(dict, iTraitType, pszTraitValue, strlen(pszTraitValue));
+}
+int addTraitLen(TraitDict dict, int iTraitType, const char *pTraitValue
+    , int iLen)
+{
+    int iTraitId;
+    unsigned int uiMask;
+    unsigned int uiSlot;
+
+    if (iLen > MAX_TRAIT_VALUE)
+        iLen = MAX_TRAIT_VALUE;
+    iTraitId = findTraitLen(dict, iTraitType, pTraitValue, iLen);
+    if (iTraitId != TRAIT_NOT_FOUND)
+        return iTraitId;
+    if (iTraitType < 0 || iTraitType >= dict->iNumTypes)
+        ErrExit(ERR_ALGORITHM, "addTrait received an invalid trait type %d"
+            , iTraitType);
+
+    if (dict->iNumTraits >= dict->iMaxTraits)
+    {
+        dict->iMaxTraits *= 2;
+        dict->traitM = allocOrExit(dict->traitM
+            , sizeof(TraitValueDef) * dict->iMaxTraits);
+    }
+    iTraitId = dict->iNumTraits++;
+    dict->traitM[iTraitId].iTraitType = iTraitType;
+    memcpy(dict->traitM[iTraitId].szTraitValue, pTraitValue, iLen);
+    dict->traitM[iTraitId].szTraitValue[iLen] = '\0';
+
+    if (dict->iNumTraits * 2 > dict->iTraitHashSize)
+        rehashTraits(dict);
+    else
+    {
+        uiMask = dict->iTraitHashSize - 1;
+        uiSlot = hashBytes(pTraitValue, iLen, iTraitType) & uiMask;
+        while (dict->traitHashM[uiSlot] != 0)
+            uiSlot = (uiSlot + 1) & uiMask;
+        dict->traitHashM[uiSlot] = iTraitId + 1;
+    }
+    return iTraitId;
+}
+
+/******************** traitTypeName **************************************
+char *traitTypeName(TraitDict dict, int iTraitType)
+Purpose:
+    Returns the name of a trait type ID.
+**************************************************************************/
+char *traitTypeName(TraitDict dict, int iTraitType)
+{
+    return dict->typeM[iTraitType].szTraitType;
+}
+
+/******************** traitValueName **************************************
+char *traitValueName(TraitDict dict, int iTraitId)
+Purpose:
+    Returns the trait value of a trait ID.
+**************************************************************************/
+char *traitValueName(TraitDict dict, int iTraitId)
+{
+    return dict->traitM[iTraitId].szTraitValue;
+}
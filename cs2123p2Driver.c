@@ -5,7 +5,38 @@ Purpose:
     executes the queries. It uses a stack for converting from infix to postfix
     and the execution of the postfix expression.
 Command Parameters:
-    p2 -c customerFile -q queryFile
+    p2 -c customerFile -q queryFile [-t threads] [-j threads]
+       [-S snapshotFile] [-C snapshotFile] [-m megabytes] [-b] [-n] [-r]
+       [-f format] [-B benchFile] [-s] [-u updateFile]
+    p2 -c customerFile -L socketFile [other switches]
+        -t threads  number of threads processing queries (default 1)
+        -j threads  number of threads evaluating each query (default 1)
+        -S file     write a snapshot of the loaded customers to the file
+        -C file     load the customers from a snapshot instead of the
+                    customer file (unless it is stale)
+        -m megabytes  budget of the query result cache (default 64, 0 turns
+                    the cache off)
+        -b          evaluate the queries in batches sharing their common
+                    subexpressions
+        -n          don't build the customer index (for a one-time run on
+                    a customer file, where building it costs more than it
+                    saves)
+        -r          stream the customer file instead of loading it (for a
+                    customer file which doesn't fit in memory)
+        -f format   output format:  text (the default), csv, jsonl or
+                    bitmap
+        -B file     time loading the customers and each phase of the
+                    queries, writing the times to the file as JSON
+        -s          print the time of each stage, the stack, trait and
+                    customer counters, and those of each query to stderr
+                    at the end
+        -u file     apply the customer updates of the file (ADD CUSTOMER,
+                    REMOVE CUSTOMER, ADD TRAIT, REMOVE TRAIT) after
+                    loading the customers
+        -L file     daemon mode:  instead of a query file, answer the
+                    queries of clients connecting to the Unix domain
+                    socket file until SIGINT or SIGTERM (-t is the number
+                    of threads processing them)
 Input:
     Customer File:
         Input file stream which contains two types of records:
@@ -25,6 +56,9 @@ Input:
             SMOKING = N AND EXERCISE = HIKE OR EXERCISE = BIKE
             ( BOOK = SCIFI )
             ( ( ( BOOK ONLY SCIFI ) ) )
+        A query may end with COUNT or LIMIT n [OFFSET m] (see note 16):
+            GENDER = F AND BOOK = SCIFI COUNT
+            SMOKING = N LIMIT 10 OFFSET 20
 Results:
     Print the customers and their traits.
     For each query: 
@@ -39,21 +73,81 @@ Returns:
     902 - Out overflow
     903 - algorithm error (see message for details)
     501 - boundary condition - too many customers
-    502 - boundary condition - too many traits
     503 - bad input
     
 Notes:
-    1. This program only allows for 30 customers.
+    1. The customers are kept in a CustomerStore which grows as needed.
     2. A customer may have multiple occurrences of the same trait type.  For example,
        he/she may have multiple EXERCISE traits because he/she enjoys HIKE, 
        BIKE, and TENNIS.
-    3. The number of traits for a customer must not exceed 12.
-    4. This program uses an array to implement the stack.  It has a maximum of
-       MAX_STACK_ELEM elements. 
+    3. There is no limit on the number of traits for a customer.
+    4. This program uses an array to implement the stack.  It starts with
+       MAX_STACK_ELEM elements and doubles when it is full.
     5. This program uses an Out array for the resulting postfix expression.
-       It has a maximum of MAX_OUT_ITEM elements.
+       It starts with MAX_OUT_ITEM elements and doubles when it is full.
+       The query lines are read with getline, so a query isn't limited to
+       MAX_LINE_SIZE characters.
     6. On the command line, specifying p2 -? will provide the usage information.  
        In some unix shells, you will have to type p2 -\?
+    7. Build by compiling all of the sources together:
+           gcc -pthread -o p2 cs2123p2.c cs2123p2Driver.c cs2123p2Dict.c cs2123p2Index.c \
+               cs2123p2Compile.c cs2123p2Simd.c cs2123p2Store.c \
+               cs2123p2Load.c cs2123p2Pool.c cs2123p2Snap.c \
+               cs2123p2Cache.c cs2123p2Batch.c cs2123p2Stream.c \
+               cs2123p2Writer.c cs2123p2Format.c cs2123p2Limit.c \
+               cs2123p2Bench.c cs2123p2Stats.c cs2123p2Update.c \
+               cs2123p2Server.c cs2123p2Context.c
+    8. With -t, the queries are processed by a pool of worker threads (see
+       cs2123p2Pool.c).  The output is the same as with one thread.
+    9. With -j, each query's customers are split into shards evaluated by
+       their own threads (see cs2123p2Index.c).  This helps a single query
+       on a large customer file.
+   10. A snapshot (see cs2123p2Snap.c) holds the loaded customers, trait
+       dictionary and index.  Loading one is a mmap instead of parsing the
+       customer file.  If it doesn't match the customer file, the customer
+       file is loaded.
+   11. The results of queries are cached by their postfix (see
+       cs2123p2Cache.c), so a repeated query isn't evaluated again.
+   12. With -b, the queries are evaluated in batches (see cs2123p2Batch.c)
+       in which each distinct predicate and subexpression is evaluated
+       once.  -t and the query cache aren't used.  With -n as well, the
+       queries of a batch are run in one pass over the customers.
+   13. With -r, the queries are compiled first and the customer file is
+       streamed through a bounded buffer (see cs2123p2Stream.c).  The
+       output is the same, but the memory used doesn't grow with the
+       number of customers.
+   14. The customer dump and the query results are formatted by hand into
+       a large buffer which is written with one write (see
+       cs2123p2Writer.c), rather than printf for each line.
+   15. With -f, the output is csv, jsonl or bitmap (see cs2123p2Format.c)
+       for programs reading it.  These formats don't print the customers.
+   16. A query ending with COUNT prints the number of customers satisfying
+       it, and one ending with LIMIT n OFFSET m prints at most n of them
+       after skipping the first m (see cs2123p2Limit.c).  Evaluating a
+       LIMIT query stops once it has found enough customers.
+   17. With -B, the queries are processed one at a time and the time of
+       each phase is measured (see cs2123p2Bench.c).  p2gen (see
+       cs2123p2Gen.c) writes large customer and query files to run it on.
+   18. With -s, the stages of each query are timed and its stack pushes
+       and pops, trait compares and customers scanned and matched are
+       counted (see cs2123p2Stats.c).  Building with -DP2_STATS=0 removes
+       the counting.  -s can't be used with -r or -b, which don't process
+       the queries one at a time.
+   19. With -u, the updates are applied to the loaded customers (which may
+       be from a snapshot) in place, including the index, before they are
+       printed (see cs2123p2Update.c).  A snapshot (-S) is written before
+       the updates.
+   20. With -L, p2 is a daemon which keeps the loaded customers, index and
+       query cache while answering the queries of its clients (see
+       cs2123p2Server.c).  The customers aren't printed.  A query which
+       would make p2 exit prints its ERROR to the client instead.
+       p2client (see cs2123p2Client.c) sends a query file to the daemon.
+       A client may also send updates (the lines of an update file, see
+       note 19), which are applied between the queries.
+   21. The buffers of a query are allocated from its thread's query context
+       (see cs2123p2Context.c), whose memory is reused by the thread's next
+       query, so a query doesn't call malloc once the thread has processed
+       one as large.
 *******************************************************************************/
 // If compiling using visual studio, tell the compiler not to give its warnings
 // about the safety of scanf and printf
@@ -87,10 +181,14 @@ static struct
 // Stack implementation using arrays.  You are not required to document these.
 void push(Stack stack, Element value)
 {
-    if (stack->iCount >= MAX_STACK_ELEM)
-        ErrExit(ERR_STACK_USAGE
-            , "Attempt to PUSH more than %d values on the array stack"
-            , MAX_STACK_ELEM);
+    if (stack->iCount >= stack->iMax)
+    {
+        // double the array (it is in the query context)
+        stack->stackElementM = queryGrow(stack->stackElementM
+            , sizeof(Element) * stack->iMax, sizeof(Element) * stack->iMax * 2);
+        stack->iMax *= 2;
+    }
+    STATS_ADD(lPushes, 1);
     stack->stackElementM[stack->iCount] = value;
     stack->iCount++;
 }
@@ -99,6 +197,7 @@ Element pop(Stack stack)
     if (isEmpty(stack))
         ErrExit(ERR_STACK_USAGE
             , "Attempt to POP an empty array stack");
+    STATS_ADD(lPops, 1);
     stack->iCount--;
     return stack->stackElementM[stack->iCount];
 }
@@ -113,15 +212,19 @@ int isEmpty(Stack stack)
 {
     return stack->iCount <= 0;
 }
+// The stack and its array are in the query context, so they are released
+// by the next resetQueryContext (freeStack doesn't free anything).
 Stack newStack()
 {
-    Stack stack = (Stack) malloc(sizeof(StackImp));
+    Stack stack = (Stack) queryAlloc(sizeof(StackImp));
     stack->iCount = 0;
+    stack->iMax = MAX_STACK_ELEM;
+    stack->stackElementM = queryAlloc(sizeof(Element) * MAX_STACK_ELEM);
     return stack;
 }
 void freeStack(Stack stack)
 {
-    free (stack);
+    stack->iCount = 0;
 }
 
 // File pointers for the customer file and the query file
@@ -129,17 +232,40 @@ void freeStack(Stack stack)
 FILE *pFileCustomer;    // Used with the -c Customer File
 FILE *pFileQuery;       // Used with the -q Query File
 
+// Trait dictionary which interns the trait types and values of the customers
+TraitDict traitDict = NULL;
+
+// Inverted bitmap index of the customers built after loading them
+CustomerIndex customerIndex = NULL;
+
+// Cache of query results
+QueryCache queryCache = NULL;
+
+// Format of the output (-f)
+int iOutputFormat = FORMAT_TEXT;
+
 // Main program for the driver
 
 int main(int argc, char *argv[])
 {
-    Customer customerM[MAX_CUSTOMERS];  // customer array
-    int iNumberOfCustomers = 0;         // number of customers in customerM
+    CustomerStore store;                // customers and their traits
     char *pszCustomerFileNm = NULL;     // Pointer to an argv[] for customer file name
     char *pszQueryFileNm = NULL;        // Pointer to an argv[] for query file name
+    Options options = { 1, 1, NULL, NULL, DEFAULT_CACHE_MB, FALSE, FALSE, FALSE
+        , FORMAT_TEXT, NULL, FALSE, NULL, NULL }; // other command switches
+    FILE *pFileBench = NULL;            // Used with the -B benchmark file
+    FILE *pFileUpdate = NULL;           // Used with the -u update file
+    double dStart;                      // start of loading or printing the customers
+    double dLoadSeconds;                // time loading the customers
+    double dDumpSeconds;                // time printing the customers
+    long long lStart;                   // start of loading the customers (p2 -s)
 
     // get the file names from the command argument switches
-    processCommandSwitches(argc, argv, &pszCustomerFileNm, &pszQueryFileNm);
+    processCommandSwitches(argc, argv, &pszCustomerFileNm, &pszQueryFileNm
+        , &options);
+    iOutputFormat = options.iOutputFormat;
+    // the benchmark reads the stage times of the statistics
+    bStats = options.bStats || options.pszBenchFile != NULL;
 
     // Open the Customer File if a file name was provided
     
@@ -151,29 +277,170 @@ int main(int argc, char *argv[])
         exitUsage(USAGE_ERR, "Invalid customer file name, found "
             , pszCustomerFileNm);
 
-    // Open the Query file if a file name was provided
+    // Open the Query file if a file name was provided (a daemon has none)
 
-    if (pszQueryFileNm == NULL)
+    if (options.pszSocketFile != NULL)
+    {
+        if (pszQueryFileNm != NULL)
+            exitUsage(USAGE_ERR, "-L can't be used with", "-q");
+        if (options.bStream || options.bBatch || options.pszBenchFile != NULL)
+            exitUsage(USAGE_ERR, "-L can't be used with", "-r, -b or -B");
+    }
+    else if (pszQueryFileNm == NULL)
         exitUsage(USAGE_ERR, ERR_MISSING_SWITCH, "-q");
+    else
+    {
+        pFileQuery = fopen(pszQueryFileNm, "r");
+        if (pFileQuery == NULL)
+            exitUsage(USAGE_ERR, "Invalid query file name, found "
+                , pszQueryFileNm);
+    }
 
-    pFileQuery = fopen(pszQueryFileNm, "r");
-    if (pFileQuery == NULL)
-        exitUsage(USAGE_ERR, "Invalid query file name, found "
-            , pszQueryFileNm);
+    // Open the benchmark file if a file name was provided
+
+    if (options.pszBenchFile != NULL)
+    {
+        if (options.bStream)
+            exitUsage(USAGE_ERR, "-B can't be used with", "-r");
+        pFileBench = fopen(options.pszBenchFile, "w");
+        if (pFileBench == NULL)
+            exitUsage(USAGE_ERR, "Invalid benchmark file name, found "
+                , options.pszBenchFile);
+    }
+
+    // Open the update file if a file name was provided
+
+    if (options.pszUpdateFile != NULL)
+    {
+        if (options.bStream)
+            exitUsage(USAGE_ERR, "-u can't be used with", "-r");
+        pFileUpdate = fopen(options.pszUpdateFile, "r");
+        if (pFileUpdate == NULL)
+            exitUsage(USAGE_ERR, "Invalid update file name, found "
+                , options.pszUpdateFile);
+    }
+
+    // only the queries processed by processQuery have statistics
+
+    if (options.bStats && (options.bStream || options.bBatch))
+        exitUsage(USAGE_ERR, "-s can't be used with", "-r or -b");
+
+    // a snapshot is of loaded customers
+
+    if (options.bStream && (options.pszSnapshotOut != NULL
+        || options.pszSnapshotIn != NULL))
+        exitUsage(USAGE_ERR, "-S and -C can't be used with", "-r");
+
+    // with -r, the customers are streamed while the queries are evaluated
+    if (options.bStream)
+    {
+        readAndProcessQueriesStream();
+        fclose(pFileCustomer);
+        fclose(pFileQuery);
+        freeTraitDict(traitDict);
+        return (EXIT_SUCCESS);
+    }
 
     // get and print the customer data including traits
-    getCustomerData(customerM, &iNumberOfCustomers);
+    dStart = benchSeconds();
+    store = newCustomerStore();
+    if (options.pszSnapshotIn == NULL
+        || !loadSnapshot(options.pszSnapshotIn, pFileCustomer, store
+            , &traitDict, &customerIndex))
+    {
+        STATS_BEGIN();
+        STATS_START(lStart);
+        getCustomerData(store);
+        STATS_STOP(STAGE_LOAD, lStart);
+        STATS_END(0);
+        // a snapshot needs the index
+        if (!options.bNoIndex || options.pszSnapshotOut != NULL)
+            customerIndex = newCustomerIndex(store->customerM, store->iNumCustomer
+                , traitDict);
+    }
+    if (customerIndex != NULL)
+        setIndexShards(customerIndex, options.iShardThreads);
+    dLoadSeconds = benchSeconds() - dStart;
+    if (options.pszSnapshotOut != NULL)
+        writeSnapshot(options.pszSnapshotOut, pFileCustomer, store, traitDict
+            , customerIndex);
+
+    // the cache exists before the updates, which invalidate its entries
+    if (options.iCacheMegabytes > 0)
+        queryCache = newQueryCache((size_t) options.iCacheMegabytes << 20);
+    if (pFileUpdate != NULL)
+    {
+        applyUpdateFile(store, pFileUpdate, warningFile());
+        fclose(pFileUpdate);
+    }
 
-    printCustomerData(customerM, iNumberOfCustomers);
+    // a daemon doesn't print the customers
+    dStart = benchSeconds();
+    if (options.pszSocketFile == NULL)
+        printCustomerData(store->customerM, store->iNumCustomer);
+    dDumpSeconds = benchSeconds() - dStart;
 
-    // Read and process the queries
-    readAndProcessQueries(customerM, iNumberOfCustomers);
+    // Read and process the queries (a daemon's are from its clients)
+    if (options.pszSocketFile != NULL)
+        serveQueries(store, options.pszSocketFile, options.iQueryThreads);
+    else if (pFileBench != NULL)
+    {
+        readAndProcessQueriesBench(store->customerM, store->iNumCustomer
+            , pFileBench, dLoadSeconds, dDumpSeconds);
+        fclose(pFileBench);
+    }
+    else if (options.bBatch)
+        readAndProcessQueriesBatch(store->customerM, store->iNumCustomer
+            , options.iShardThreads);
+    else if (options.iQueryThreads > 1)
+        readAndProcessQueriesParallel(store->customerM, store->iNumCustomer
+            , options.iQueryThreads);
+    else
+        readAndProcessQueries(store->customerM, store->iNumCustomer);
 	
 	fclose(pFileCustomer);
-	fclose(pFileQuery);
+	if (pFileQuery != NULL)
+		fclose(pFileQuery);
+	if (options.bStats)
+		printStats(stderr);
+	else
+		freeStats();
+	if (getenv("P2_CACHE_STATS") != NULL || options.bStats)
+		printQueryCacheStats(queryCache, stderr);
+	freeQueryCache(queryCache);
+	freeCustomerIndex(customerIndex);
+	freeCustomerStore(store);
+	freeTraitDict(traitDict);
 	
 	return (EXIT_SUCCESS);
 }
+
+// QueryLoop typedef is the arguments of processQueryLine for readQueries
+typedef struct
+{
+    Out out;                    // postfix form of a query
+    Customer *customerM;        // array of customers and traits
+    int iNumCustomer;           // number of customers in customerM
+    QueryResult *resultM;       // TRUE or FALSE for each customer
+} QueryLoop;
+
+/******************** processQueryLine **************************************
+static int processQueryLine(void *pArg, char *pszQuery, int iQueryCnt)
+Purpose:
+    Processes a query line read by readQueries with the arguments in a
+    QueryLoop, printing its output to stdout.
+Returns:
+    TRUE (to read the next query)
+**************************************************************************/
+static int processQueryLine(void *pArg, char *pszQuery, int iQueryCnt)
+{
+    QueryLoop *pLoop = (QueryLoop *) pArg;
+
+    processQuery(stdout, pszQuery, iQueryCnt, pLoop->out, pLoop->customerM
+        , pLoop->iNumCustomer, pLoop->resultM);
+    return TRUE;
+}
+
 /******************** readAndProcessQueries **************************************
    void readAndProcessQueries(Customer customerM[], int iNumberOfCustomers)
 Purpose:
@@ -188,61 +455,113 @@ Notes:
 **************************************************************************/
 void readAndProcessQueries(Customer customerM[], int iNumberOfCustomers)
 {
-    Out out = malloc(sizeof(OutImp));     // postfix form of a query
+    QueryLoop loop;
 
     // array (which corresponds to customerM via subscript) of booleans 
     // showing which customers satisfied a query
 	//QueryResult is a typedef for int (i.e., queryResultM is an integer array)
-    QueryResult queryResultM[MAX_CUSTOMERS];
+    QueryResult *queryResultM = malloc(sizeof(QueryResult) * (iNumberOfCustomers + 1));
+
+    loop.out = newOut();                  // postfix form of a query
+    loop.customerM = customerM;
+    loop.iNumCustomer = iNumberOfCustomers;
+    loop.resultM = queryResultM;
 
-    char szInputBuffer[MAX_LINE_SIZE];    // entire input line
-    int rc;                               // return code from convertToPostfix
-    int iQueryCnt = 1;                    
-    
     // read text lines containing queries until EOF
-    while (fgets(szInputBuffer, MAX_LINE_SIZE, pFileQuery) != NULL)
-    {
-        printf("Query # %d: %s", iQueryCnt, szInputBuffer);
-        out->iOutCount = 0;                             // reset out to empty
-        memset(queryResultM, 0, sizeof(queryResultM));  // reset query result
+    readQueries(processQueryLine, &loop);
+    freeOut(loop.out);
+    free(queryResultM);
+    if (iOutputFormat == FORMAT_TEXT)
+        printf("\n");
+}
+
+/******************** processQuery **************************************
+void processQuery(FILE *pFile, char *pszQuery, int iQueryCnt, Out out
+    , Customer customerM[], int iNumberOfCustomers, QueryResult resultM[])
+Purpose:
+    Converts one query to postfix, evaluates it and prints the query, its
+    postfix and the customers satisfying it (or a warning).
+Parameters:
+    I/O FILE *pFile               stream receiving the output of the query
+    I   char *pszQuery            text line of the query
+    I   int iQueryCnt             number of the query in the query file
+    I/O Out out                   receives the postfix form of the query
+    I   Customer customerM[]      array of customers and traits
+    I   int iNumberOfCustomers    number of customers in customerM
+    I/O QueryResult resultM[]     receives the result for each customer
+Notes:
+    - Only out and resultM are modified, so queries can be processed
+      concurrently with their own out and resultM.
+**************************************************************************/
+void processQuery(FILE *pFile, char *pszQuery, int iQueryCnt, Out out
+    , Customer customerM[], int iNumberOfCustomers, QueryResult resultM[])
+{
+    int rc;                               // return code from convertToPostfix
+    ResultMode mode;                      // COUNT or LIMIT suffix of the query
+    char *szExpr;                         // the query without its suffix
+    int bPrintResult;                     // TRUE if the result is printed
+    long long lStart;                     // start of a stage (p2 -s)
+
+    STATS_BEGIN();
+    resetQueryContext();
+    fprintQueryStart(pFile, iQueryCnt, pszQuery);
+    out->iOutCount = 0;                             // reset out to empty
+    memset(resultM, 0, sizeof(QueryResult) * iNumberOfCustomers);  // reset query result
+    szExpr = queryAlloc(strlen(pszQuery) + 1);
 
-        // Convert query from infix to postfix and check the rc for success
-        rc = convertToPostFix(szInputBuffer, out);
-        switch (rc)
+    // Convert query from infix to postfix and check the rc for success
+    splitResultMode(pszQuery, szExpr, &mode);
+    STATS_START(lStart);
+    rc = convertToPostFix(szExpr, out);
+    STATS_STOP(STAGE_CONVERT, lStart);
+    switch (rc)
+    {
+    case 0:   // Conversion was successful
+        fprintQueryPostfix(pFile, out);
+        STATS_START(lStart);
+        if (mode.iMode != RESULT_ALL)
         {
-        case 0:   // Conversion was successful
-            printOut(out);
-            evaluatePostfix(out, customerM, iNumberOfCustomers, queryResultM);
-            printQueryResult(customerM, iNumberOfCustomers, queryResultM);
-            break;
-        case WARN_MISSING_LPAREN:
-            printf("\tWarning: missing left parenthesis\n");
+            // COUNT and LIMIT print their result while evaluating it
+            fprintQueryMode(pFile, iQueryCnt, out, &mode, customerM
+                , iNumberOfCustomers);
+            STATS_STOP(STAGE_EVALUATE, lStart);
             break;
-        case WARN_MISSING_RPAREN:
-            printf("\tWarning: missing right parenthesis\n");
-            break;
-        default:
-            printf("\t warning = %d\n", rc);
         }
-        iQueryCnt++;
+        bPrintResult = evaluatePostfixWarn(out, customerM, iNumberOfCustomers
+            , resultM, pFile, iQueryCnt);
+        STATS_STOP(STAGE_EVALUATE, lStart);
+        if (bPrintResult)
+        {
+            STATS_START(lStart);
+            fprintQueryResult(pFile, iQueryCnt, customerM, iNumberOfCustomers
+                , resultM);
+            STATS_STOP(STAGE_PRINT, lStart);
+        }
+        break;
+    default:  // WARN_MISSING_LPAREN, WARN_MISSING_RPAREN
+        fprintQueryWarning(pFile, iQueryCnt, rc);
     }
-    free(out);
-    printf("\n");
+    STATS_END(iQueryCnt);
 }
 
 /******************** getCustomerData **************************************
-void getCustomerData(Customer customerM[], int *piNumCustomer)
+void getCustomerData(CustomerStore store)
 Purpose:
     Gets customer data and their corresponding traits (type and values).  
 Parameters:
-    O Customer customerM[]      an array of customers to be returned  
-    O int *piNumCustomer        the number of customers is returned via
-                                this pointer 
+    I/O CustomerStore store     customer store to which the customers and
+                                their traits are added
 Notes:
     - This function attempts to give warnings for minor errors found in 
       reading customer data (e.g., bad command, bad format of data); 
-      however, some problems cause termination (e.g., too many 
-      traits for a customer).
+      however, some problems cause termination (e.g., a TRAIT before
+      any CUSTOMER).
+    - Each trait type and trait value is interned in the global traitDict
+      which is created if it doesn't exist yet.
+    - The file is mapped into memory and its records are scanned in place
+      by parseCustomerTextParallel which uses a thread per CPU for large
+      files.
+    - The warnings are also kept in the store (for a snapshot).
     - It reads a customer file using the global pFileCustomer
         Contains two types of records (terminated
         by EOF).  CUSTOMER records are followed by zero to many TRAIT records 
@@ -252,94 +571,31 @@ Notes:
         TRAIT    szTraitType  szTraitValue
           8s          10s        12s
 **************************************************************************/
-void getCustomerData(Customer customerM[], int *piNumCustomer)
+void getCustomerData(CustomerStore store)
 {
-    char szInputBuffer[MAX_LINE_SIZE + 1];  // input buffer for fgets
-
-    int iNumTrait = 0;                      // Number of traits for the current customer
-    char szRecordType[11];                  // record type of either CUSTOMER or TRAIT
-    int i = -1;                             // current customer subscript. -1 indicates 
-    // not on a customer yet
-    int iScanfCnt;                          // scanf returns the number of successful inputs
-    char *pszRemainingTxt;                  // After grabbing a token, this is the next
-                                            // position.  This will be after the delimiter
-                                            // unless the string was terminated by a zero
-                                            // byte, then it will be on the zero byte.
-
-    // read data input lines of text until EOF.  fgets returns NULL at EOF
-    while (fgets(szInputBuffer, MAX_LINE_SIZE, pFileCustomer) != NULL)
-    {
-        // if the line is just a line feed, skip it.
-        if (szInputBuffer[0] == '\n')
-            continue;
+    TextFile text;                          // the customer file in memory
+    int bValid;                             // FALSE if a TRAIT preceded any CUSTOMER
+    FILE *pWarn;                            // buffer of the warnings
 
-        // get the CUSTOMER or TRAIT command
-        pszRemainingTxt = getToken(szInputBuffer, szRecordType, sizeof(szRecordType)-1);
+    if (traitDict == NULL)
+        traitDict = newTraitDict();
 
-        // see if getting a customer or a trait
-        if (strcmp(szRecordType, "CUSTOMER") == 0)
-        {
-            i++;
-            // see if we have too many customers to fit in the array
-            if (i >= MAX_CUSTOMERS)
-                ErrExit(ERR_TOO_MANY_CUST
-                , "Invalid input file, max customers is %d"
-                , MAX_CUSTOMERS);
-
-            iNumTrait = 0;   // since we have a new customer, reset his/her number of traits
-            customerM[i].iNumberOfTraits = iNumTrait;
-            iScanfCnt = sscanf(pszRemainingTxt, "%6s %20[^\n]\n"
-                , customerM[i].szCustomerId
-                , customerM[i].szCustomerName);
-
-            // Check for bad input.  scanf returns the number of valid conversions
-            if (iScanfCnt < 2)
-            {
-                printf(">> %s", szInputBuffer);
-                WARNING("Expected ID and name, received %d successful values"
-                    , iScanfCnt);
-                continue;
-            }
-        }
-        else if (strcmp(szRecordType, "TRAIT") == 0)
-        {
-            // what if we haven't received a CUSTOMER record yet
-            if (i < 0)
-                ErrExit(ERR_BAD_INPUT
-                , "TRAIT record without CUSTOMER");
-
-            // what if we have too many traits 
-            if (iNumTrait >= MAX_TRAITS)
-                ErrExit(ERR_BAD_INPUT
-                , "Too many traits for Customer ID %s, only %d traits allowed"
-                , customerM[i].szCustomerId
-                , MAX_TRAITS);
-
-            iScanfCnt = sscanf(pszRemainingTxt, "%10s %12s"
-                , customerM[i].traitM[iNumTrait].szTraitType
-                , customerM[i].traitM[iNumTrait].szTraitValue);
-
-            // Check for bad input.  scanf returns the number of valid conversions
-            if (iScanfCnt < 2)
-            {
-                printf(">> %s", szInputBuffer);
-                WARNING(
-                    "Expected trait type and value, received %d successful values"
-                    , iScanfCnt);
-                continue;
-            }
-            iNumTrait++;
-            customerM[i].iNumberOfTraits = iNumTrait;
-        }
-        else
-        {
-            printf(">> %s", szInputBuffer);
-            WARNING("Bad Command in input, found '%s'"
-                , szRecordType);
-            continue;
-        }
-    }
-    *piNumCustomer = i + 1;
+    // map the whole file and scan its records in place (in parallel if large)
+    if (!mapTextFile(pFileCustomer, &text))
+        ErrExit(ERR_BAD_INPUT, "unable to read the customer file");
+    pWarn = open_memstream(&store->pszLoadWarnings, &store->iLoadWarningsSize);
+    if (pWarn == NULL)
+        ErrExit(ERR_ALGORITHM, "unable to buffer customer file warnings");
+    bValid = parseCustomerTextParallel(store, traitDict, text.pszText
+        , text.pszText + text.iSize, loadThreadCount(text.iSize), pWarn);
+    fclose(pWarn);
+    unmapTextFile(&text);
+    fwrite(store->pszLoadWarnings, 1, store->iLoadWarningsSize, warningFile());
+
+    // what if we haven't received a CUSTOMER record yet
+    if (!bValid)
+        ErrExit(ERR_BAD_INPUT
+        , "TRAIT record without CUSTOMER");
 }
 /******************** printQueryResult **************************************
 void printQueryResult(Customer customerM[], int iNumCustomer, QueryResult resultM[])
@@ -352,21 +608,41 @@ Parameters:
     i QueryResult resultM[]   array (which corresponds to customerM via subscript)
                               of booleans showing which customers satisfied a query
 Notes:
-    
+    - fprintQueryResult prints the same to a stream in the output format
+      (-f).  It also receives the number of the query (which is 0 for
+      printQueryResult).
+    - The customers are written with a Writer (see cs2123p2Writer.c)
+      rather than printf.
 **************************************************************************/
 void printQueryResult(Customer customerM[], int iNumCustomer, QueryResult resultM[])
+{
+    fprintQueryResult(stdout, 0, customerM, iNumCustomer, resultM);
+}
+void fprintQueryResult(FILE *pFile, int iQueryCnt, Customer customerM[]
+    , int iNumCustomer, QueryResult resultM[])
 {
     int i;
-    printf("\tQuery Result:\n");
-    printf("\t%-6s  %-20s\n", "ID", "Customer Name");
-    // Loop through each customer
-    for (i = 0; i < iNumCustomer; i++)
+    long long lCount = 0;
+    Writer writer = newWriter(pFile);
+    if (iOutputFormat == FORMAT_BITMAP)
     {
-        // Print customers having a corresponding result boolean which is TRUE
-        if (resultM[i])
-            printf("\t%-6s  %-20s\n", customerM[i].szCustomerId
-                , customerM[i].szCustomerName);
+        for (i = 0; i < iNumCustomer; i++)
+            lCount += resultM[i] ? 1 : 0;
+        writeResultHeading(writer, iQueryCnt, iNumCustomer, lCount);
+        writeResultBitmap(writer, resultM, iNumCustomer);
     }
+    else
+    {
+        writeResultHeading(writer, iQueryCnt, iNumCustomer, 0);
+        // Loop through each customer
+        for (i = 0; i < iNumCustomer; i++)
+        {
+            // Write customers having a corresponding result boolean which is TRUE
+            if (resultM[i])
+                writeQueryMatch(writer, iQueryCnt, &customerM[i]);
+        }
+    }
+    freeWriter(writer);
 }
 /******************** notAny **************************************
 int notAny(Customer *pCustomer, Trait *pTrait)
@@ -381,6 +657,8 @@ Parameters:
                              customer to have.
 Notes:
     This function could be used by the function atLeast().
+    The trait ID identifies the (type, value) pair, so one integer compare
+    per customer trait is enough.
 Return value:
     TRUE - customer didn't have the specified trait
     FALSE - customer did have it
@@ -393,10 +671,13 @@ int notAny(Customer *pCustomer, Trait *pTrait)
         , "received a NULL pointer");
     for (i = 0; i < (pCustomer->iNumberOfTraits); i++)
     {
-        if (strcmp(pCustomer->traitM[i].szTraitType, pTrait->szTraitType) == 0
-            && strcmp(pCustomer->traitM[i].szTraitValue, pTrait->szTraitValue) == 0)
+        if (pCustomer->traitM[i].iTraitId == pTrait->iTraitId)
+        {
+            STATS_ADD(lTraitCompares, i + 1);
             return FALSE;
+        }
     }
+    STATS_ADD(lTraitCompares, pCustomer->iNumberOfTraits);
     return TRUE;
 }
 
@@ -408,16 +689,79 @@ Parameters:
     I/O Out out                 Stores the postfix expression 
     I Element element           Element structure to be added to out. 
 Notes:
-    - Since out uses an array, addOut does a boundary check for overflow. 
+    - Since out uses an array, addOut doubles it when it is full. 
 **************************************************************************/
 void addOut(Out out, Element element)
 {
-    if (out->iOutCount >= MAX_OUT_ITEM)
-        ErrExit(ERR_OUT_OVERFLOW
-        , "Overflow in the out array");
+    Element *outM;
+
+    if (out->iOutCount >= out->iMaxOut)
+    {
+        outM = realloc(out->outM, sizeof(Element) * out->iMaxOut * 2);
+        if (outM == NULL)
+            ErrExit(ERR_OUT_OVERFLOW
+            , "out of memory for the out array");
+        out->outM = outM;
+        out->iMaxOut *= 2;
+    }
     out->outM[out->iOutCount++] = element;
 }
 
+/******************** newOut **************************************
+Out newOut()
+Purpose:
+    Allocates an empty out (freed by freeOut).  Its arrays grow as needed
+    and are kept for the next query.
+**************************************************************************/
+Out newOut()
+{
+    Out out = malloc(sizeof(OutImp));
+    if (out == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for an out array");
+    out->iOutCount = 0;
+    out->iMaxOut = MAX_OUT_ITEM;
+    out->outM = malloc(sizeof(Element) * out->iMaxOut);
+    out->iTokenSize = MAX_LINE_SIZE + 1;
+    out->szTokens = malloc(out->iTokenSize);
+    if (out->outM == NULL || out->szTokens == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for an out array");
+    return out;
+}
+
+/******************** freeOut **************************************
+void freeOut(Out out)
+Purpose:
+    Frees an out and its arrays.
+**************************************************************************/
+void freeOut(Out out)
+{
+    free(out->outM);
+    free(out->szTokens);
+    free(out);
+}
+
+/******************** reserveOutTokens **************************************
+void reserveOutTokens(Out out, int iSize)
+Purpose:
+    Makes szTokens of out at least iSize bytes, doubling it until it is.
+    The tokens already in it are kept (their elements have offsets).
+**************************************************************************/
+void reserveOutTokens(Out out, int iSize)
+{
+    int iNewSize = out->iTokenSize;
+    char *szTokens;
+
+    if (out->iTokenSize >= iSize)
+        return;
+    while (iNewSize < iSize)
+        iNewSize *= 2;
+    szTokens = realloc(out->szTokens, iNewSize);
+    if (szTokens == NULL)
+        ErrExit(ERR_OUT_OVERFLOW, "out of memory for the out array");
+    out->szTokens = szTokens;
+    out->iTokenSize = iNewSize;
+}
+
 /******************** printOut **************************************
 void printOut(Out out)
 Purpose:
@@ -426,23 +770,28 @@ Parameters:
     I Out out                 The postfx expression  
 Notes:
     - Prints 6 tokens from out per line
+    - fprintOut prints the same to a stream.
 **************************************************************************/
 void printOut(Out out)
+{
+    fprintOut(stdout, out);
+}
+void fprintOut(FILE *pFile, Out out)
 {
     int i;
-    printf("\t");
+    fprintf(pFile, "\t");
     // loop through each element in the out array
     for (i = 0; i < out->iOutCount; i++)
     {
-        printf("%s ", out->outM[i].szToken);
+        fprintf(pFile, "%s ", OUT_TOKEN(out, out->outM[i]));
         if ((i + 1) % 6 == 0)
-            printf("\n\t");
+            fprintf(pFile, "\n\t");
     }
-    printf("\n");
+    fprintf(pFile, "\n");
 }
 
 /******************** categorize **************************************
-void categorize(Element *pElement)
+void categorize(Element *pElement, char *pszToken)
 Purpose:
     Categorizes a token providing its precedence (0 is low, higher 
     integers are a higher precedence) and category (operator, operand,
@@ -451,10 +800,11 @@ Purpose:
 Parameters:
     I/O Element *pElement       pointer to an element structure which
                                 will be modified by this function
+    I   char *pszToken          text of the element's token
 Notes:
     - Uses the symbolDefM array to help categorize tokens 
 **************************************************************************/
-void categorize(Element *pElement)
+void categorize(Element *pElement, char *pszToken)
 {
     int i;
     // loop through the symbolDefM array until an empty symbol value is found
@@ -462,7 +812,7 @@ void categorize(Element *pElement)
     for (i = 0; symbolDefM[i].szSymbol[0] != '\0'; i++) 
     {
         // does the element's token match the symbol in the symbolDefM array?
-        if (strcmp(pElement->szToken, symbolDefM[i].szSymbol) == 0)
+        if (strcmp(pszToken, symbolDefM[i].szSymbol) == 0)
         {   // matched, so use its precedence and category
             pElement->iPrecedence = symbolDefM[i].iPrecedence;
             pElement->iCategory = symbolDefM[i].iCategory;
@@ -475,7 +825,7 @@ void categorize(Element *pElement)
 }
 /******************** processCommandSwitches *****************************
     void processCommandSwitches(int argc, char *argv[], char **ppszCustomerFileName
-        , char **ppszQueryFileName)
+        , char **ppszQueryFileName, Options *pOptions)
 Purpose:
     Checks the syntax of command line arguments and returns the filenames.  
     If any switches are unknown, it exits with an error.
@@ -484,6 +834,8 @@ Parameters:
     I   char *argv[]                    array of command line arguments
     O   char **ppszCustomerFileName     Customer File Name to return
     O   char **ppszQueryFileName        Query File Name to return 
+    I/O Options *pOptions               other switches (initialized to their
+                                        defaults by the caller)
 Notes:
     If a -? switch is passed, the usage is printed and the program exits
     with USAGE_ONLY.
@@ -491,7 +843,7 @@ Notes:
     prints a message to stderr and exits with ERR_COMMAND_LINE_SYNTAX.
 **************************************************************************/
 void processCommandSwitches(int argc, char *argv[], char **ppszCustomerFileName
-    , char **ppszQueryFileName)
+    , char **ppszQueryFileName, Options *pOptions)
 {
     int i;
     // Examine each of the command arguments other than the name of the program.
@@ -516,6 +868,79 @@ void processCommandSwitches(int argc, char *argv[], char **ppszCustomerFileName
             else
                 *ppszQueryFileName = argv[i];
             break;
+        case 't':                   // number of query threads
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+            pOptions->iQueryThreads = atoi(argv[i]);
+            if (pOptions->iQueryThreads < 1)
+                exitUsage(i, "invalid thread count, found", argv[i]);
+            break;
+        case 'j':                   // number of threads per query
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+            pOptions->iShardThreads = atoi(argv[i]);
+            if (pOptions->iShardThreads < 1)
+                exitUsage(i, "invalid thread count, found", argv[i]);
+            break;
+        case 'S':                   // snapshot to write
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+            pOptions->pszSnapshotOut = argv[i];
+            break;
+        case 'C':                   // snapshot to load
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+            pOptions->pszSnapshotIn = argv[i];
+            break;
+        case 'm':                   // query cache budget
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+            pOptions->iCacheMegabytes = atoi(argv[i]);
+            if (pOptions->iCacheMegabytes < 0)
+                exitUsage(i, "invalid cache size, found", argv[i]);
+            break;
+        case 'b':                   // batch mode
+            pOptions->bBatch = TRUE;
+            break;
+        case 'n':                   // no customer index
+            pOptions->bNoIndex = TRUE;
+            break;
+        case 'r':                   // stream the customer file
+            pOptions->bStream = TRUE;
+            break;
+        case 'B':                   // benchmark file
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+#if P2_STATS
+            pOptions->pszBenchFile = argv[i];
+#else
+            exitUsage(i - 1, "statistics were compiled out, found", argv[i - 1]);
+#endif
+            break;
+        case 'u':                   // update file
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+            pOptions->pszUpdateFile = argv[i];
+            break;
+        case 'L':                   // daemon's socket file
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+            pOptions->pszSocketFile = argv[i];
+            break;
+        case 'f':                   // output format
+            if (++i >= argc)
+                exitUsage(i, ERR_MISSING_ARGUMENT, argv[i - 1]);
+            pOptions->iOutputFormat = findOutputFormat(argv[i]);
+            if (pOptions->iOutputFormat < 0)
+                exitUsage(i, "invalid output format, found", argv[i]);
+            break;
+        case 's':                   // print statistics
+#if P2_STATS
+            pOptions->bStats = TRUE;
+#else
+            exitUsage(i, "statistics were compiled out, found", argv[i]);
+#endif
+            break;
         case '?':
             exitUsage(USAGE_ONLY, "", "");
             break;
@@ -548,20 +973,26 @@ Notes:
     - Prints the file path and file name of the program having the error.
       This is the file that contains this routine.
     - Requires including <stdarg.h>
+    - In a query worker thread, the message is printed to the query's
+      output and the exit is deferred until the preceding queries' output
+      is printed (see trapQueryError).
 Returns:
     Returns a program exit return code:  the value of iexitRC.
 **************************************************************************/
 void ErrExit(int iexitRC, char szFmt[], ... )
 {
     va_list args;               // This is the standard C variable argument list type
+    FILE *pFile = queryErrorFile(); // stdout unless in a query worker thread
     va_start(args, szFmt);      // This tells the compiler where the variable arguments
                                 // begins.  They begin after szFmt.
-    printf("ERROR: ");
-    vprintf(szFmt, args);       // vprintf receives a printf format string and  a
+    fprintf(pFile, "ERROR: ");
+    vfprintf(pFile, szFmt, args); // vfprintf receives a printf format string and  a
                                 // va_list argument
     va_end(args);               // let the C environment know we are finished with the
                                 // va_list argument
-    printf("\n");
+    fprintf(pFile, "\n");
+    if (pFile != stdout)
+        trapQueryError(iexitRC);
     exit(iexitRC);
 }
 /******************** exitUsage *****************************
@@ -609,7 +1040,10 @@ void exitUsage(int iArg, char *pszMessage, char *pszDiagnosticInfo)
                 , pszDiagnosticInfo);
     }
     // print the usage information for any type of command line error
-    fprintf(stderr, "p2 -c customerFileName -q queryFileName\n");
+    fprintf(stderr, "p2 -c customerFileName -q queryFileName [-t threads] [-j threads]\n"
+        "    [-S snapshotFile] [-C snapshotFile] [-m megabytes] [-b] [-n] [-r]\n"
+        "    [-f text|csv|jsonl|bitmap] [-B benchFile] [-s]\n"
+        "    [-u updateFile] [-L socketFile]\n");
     if (iArg == USAGE_ONLY)
         exit(USAGE_ONLY); 
     else 
@@ -0,0 +1,617 @@
+/******************************************************************************
+cs2123p2Format.c
+Purpose:
+    Implements the output formats selected by p2 -f format.  The output of
+    a query is printed in pieces (by processQuery, batch mode and streaming
+    mode):  its start, its postfix or a warning, and its result.  Each
+    piece is printed in the format in iOutputFormat:
+        text    the report (the default)
+        csv     a row "query,id,name,warning,count" per customer satisfying
+                a query (with an empty warning and count), per warning of a
+                query (with an empty id, name and count) and per COUNT
+                query (with only the query and count), after a heading row
+        jsonl   a JSON object per line:
+                    {"query":1,"text":"...","postfix":["GENDER","F","="]}
+                    {"query":1,"id":"111","name":"..."}
+                    {"query":2,"text":"...","warning":"..."}
+                    {"query":3,"count":42}
+                A query's line is followed by a line per customer
+                satisfying it (or its count).  A warning evaluating a query
+                is a line of its own (with "query" and "warning").
+        bitmap  a binary record per query which can be mapped (mmap):
+                a BitmapHeader followed by lNumBytes bytes of bitmap.  Bit
+                i % 64 of 64-bit word i / 64 is customer i of the customer
+                file.  The numbers and words are little-endian.  A query
+                with a warning has no bitmap and iWarning is its warning.
+                lCount is the number of bits which are on.  A COUNT query
+                has no bitmap, and a LIMIT query's bitmap only has the
+                customers in its window.
+Notes:
+    1. Only text prints the customer dump (printCustomerData) and the blank
+       line at the end.
+    2. In the other formats, the warnings of the customer file are printed
+       to stderr (see warningFile).
+    3. The records of the bitmap format are multiples of 8 bytes, so each
+       bitmap is aligned for 64-bit words in the mapping.
+    4. Every mode reads the query file with readQueries and decides with
+       fprintQueryCompiled whether the result of a query is printed, so
+       they print the same output for the same queries.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cs2123p2.h"
+
+#define BITMAP_MAGIC "P2BITS\n"     // first 8 bytes of a record (including the zero byte)
+#define JSON_ESCAPE_SIZE 8          // size of an escaped character's buffer
+
+// BitmapHeader typedef starts the record of each query in the bitmap format
+typedef struct
+{
+    char szMagic[8];                // BITMAP_MAGIC
+    int iQueryCnt;                  // number of the query in the query file
+    int iWarning;                   // 0 or the warning (e.g., WARN_MISSING_LPAREN)
+    long long lNumCustomer;         // number of bits in the bitmap
+    long long lNumBytes;            // bytes of the bitmap after the header
+    long long lCount;               // customers satisfying the query
+} BitmapHeader;
+
+// names of the formats subscripted by FORMAT_TEXT, etc.
+static char *pszFormatNameM[] = { "text", "csv", "jsonl", "bitmap", NULL };
+
+/******************** findOutputFormat **************************************
+int findOutputFormat(char *pszName)
+Purpose:
+    Returns the format (e.g., FORMAT_CSV) of a format name (e.g., "csv")
+    or -1 if the name isn't a format.
+**************************************************************************/
+int findOutputFormat(char *pszName)
+{
+    int i;
+    for (i = 0; pszFormatNameM[i] != NULL; i++)
+    {
+        if (strcmp(pszName, pszFormatNameM[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/******************** warningFile **************************************
+FILE *warningFile()
+Purpose:
+    Returns the stream which receives the warnings of the customer file:
+    stdout for the text format, otherwise stderr (so that stdout only has
+    the results).
+**************************************************************************/
+FILE *warningFile()
+{
+    if (iOutputFormat == FORMAT_TEXT)
+        return stdout;
+    return stderr;
+}
+
+/******************** escapeJsonChar **************************************
+static char *escapeJsonChar(char c, char szEscaped[])
+Purpose:
+    Returns the escape sequence of a character which can't be in a JSON
+    string as is, or NULL if it can.
+**************************************************************************/
+static char *escapeJsonChar(char c, char szEscaped[])
+{
+    switch (c)
+    {
+    case '"':
+        return "\\\"";
+    case '\\':
+        return "\\\\";
+    case '\n':
+        return "\\n";
+    case '\r':
+        return "\\r";
+    case '\t':
+        return "\\t";
+    }
+    if ((unsigned char) c >= ' ')
+        return NULL;
+    snprintf(szEscaped, JSON_ESCAPE_SIZE, "\\u%04x", (unsigned char) c);
+    return szEscaped;
+}
+
+/******************** writeJsonString **************************************
+static void writeJsonString(Writer writer, const char *pszText, size_t iLen)
+Purpose:
+    Writes iLen characters as a quoted JSON string.
+**************************************************************************/
+static void writeJsonString(Writer writer, const char *pszText, size_t iLen)
+{
+    char szEscaped[JSON_ESCAPE_SIZE];
+    char *pszEscape;
+    size_t iStart = 0;              // start of the characters not written yet
+    size_t i;
+
+    writeText(writer, "\"", 1);
+    for (i = 0; i < iLen; i++)
+    {
+        pszEscape = escapeJsonChar(pszText[i], szEscaped);
+        if (pszEscape == NULL)
+            continue;
+        writeText(writer, pszText + iStart, i - iStart);
+        writeString(writer, pszEscape);
+        iStart = i + 1;
+    }
+    writeText(writer, pszText + iStart, iLen - iStart);
+    writeText(writer, "\"", 1);
+}
+
+/******************** fprintJsonString **************************************
+static void fprintJsonString(FILE *pFile, const char *pszText, size_t iLen)
+Purpose:
+    Prints iLen characters as a quoted JSON string.
+**************************************************************************/
+static void fprintJsonString(FILE *pFile, const char *pszText, size_t iLen)
+{
+    char szEscaped[JSON_ESCAPE_SIZE];
+    char *pszEscape;
+    size_t i;
+
+    fputc('"', pFile);
+    for (i = 0; i < iLen; i++)
+    {
+        pszEscape = escapeJsonChar(pszText[i], szEscaped);
+        if (pszEscape == NULL)
+            fputc(pszText[i], pFile);
+        else
+            fputs(pszEscape, pFile);
+    }
+    fputc('"', pFile);
+}
+
+/******************** writeCsvField **************************************
+static void writeCsvField(Writer writer, const char *pszText)
+Purpose:
+    Writes a CSV field, quoting it if it has a comma, quote or line break.
+**************************************************************************/
+static void writeCsvField(Writer writer, const char *pszText)
+{
+    const char *pszQuote;
+
+    if (strpbrk(pszText, ",\"\r\n") == NULL)
+    {
+        writeString(writer, pszText);
+        return;
+    }
+    writeText(writer, "\"", 1);
+    // a quote in the field is doubled
+    while ((pszQuote = strchr(pszText, '"')) != NULL)
+    {
+        writeText(writer, pszText, pszQuote + 1 - pszText);
+        writeText(writer, "\"", 1);
+        pszText = pszQuote + 1;
+    }
+    writeString(writer, pszText);
+    writeText(writer, "\"", 1);
+}
+
+/******************** warningMessage **************************************
+static char *warningMessage(int iWarning, char szMessage[], int iSize)
+Purpose:
+    Returns the message of a query's warning (without the text format's
+    punctuation).
+**************************************************************************/
+static char *warningMessage(int iWarning, char szMessage[], int iSize)
+{
+    switch (iWarning)
+    {
+    case WARN_MISSING_LPAREN:
+        return "missing left parenthesis";
+    case WARN_MISSING_RPAREN:
+        return "missing right parenthesis";
+    case WARN_BAD_QUERY:
+        return "improperly formatted query";
+    }
+    snprintf(szMessage, iSize, "warning = %d", iWarning);
+    return szMessage;
+}
+
+/******************** setBitmapHeader **************************************
+static void setBitmapHeader(BitmapHeader *pHeader, int iQueryCnt, int iWarning
+    , long long lNumCustomer, long long lCount, int bBitmap)
+Purpose:
+    Sets the header of a query's record in the bitmap format.  If there
+    is a warning, the record has no bitmap.
+Parameters:
+    O BitmapHeader *pHeader   the header
+    I int iQueryCnt           number of the query in the query file
+    I int iWarning            0 or the warning of the query
+    I long long lNumCustomer  number of customers queried
+    I long long lCount        number of customers satisfying the query
+    I int bBitmap             TRUE if the bitmap follows the header
+**************************************************************************/
+static void setBitmapHeader(BitmapHeader *pHeader, int iQueryCnt, int iWarning
+    , long long lNumCustomer, long long lCount, int bBitmap)
+{
+    memset(pHeader, 0, sizeof(*pHeader));
+    strcpy(pHeader->szMagic, BITMAP_MAGIC);
+    pHeader->iQueryCnt = iQueryCnt;
+    pHeader->iWarning = iWarning;
+    if (iWarning == 0)
+    {
+        pHeader->lNumCustomer = lNumCustomer;
+        if (bBitmap)
+            pHeader->lNumBytes = BITMAP_WORDS(lNumCustomer) * sizeof(BitWord);
+        pHeader->lCount = lCount;
+    }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    pHeader->iQueryCnt = __builtin_bswap32(pHeader->iQueryCnt);
+    pHeader->iWarning = __builtin_bswap32(pHeader->iWarning);
+    pHeader->lNumCustomer = __builtin_bswap64(pHeader->lNumCustomer);
+    pHeader->lNumBytes = __builtin_bswap64(pHeader->lNumBytes);
+    pHeader->lCount = __builtin_bswap64(pHeader->lCount);
+#endif
+}
+
+/******************** fprintQueryStart **************************************
+void fprintQueryStart(FILE *pFile, int iQueryCnt, char *pszQuery)
+Purpose:
+    Prints the start of a query's output:  the query (text and jsonl).
+Parameters:
+    I/O FILE *pFile               stream receiving the output of the query
+    I   int iQueryCnt             number of the query in the query file
+    I   char *pszQuery            text line of the query
+Notes:
+    - The jsonl line is ended by fprintQueryPostfix or fprintQueryWarning.
+**************************************************************************/
+void fprintQueryStart(FILE *pFile, int iQueryCnt, char *pszQuery)
+{
+    size_t iLen;
+
+    switch (iOutputFormat)
+    {
+    case FORMAT_TEXT:
+        fprintf(pFile, "Query # %d: %s", iQueryCnt, pszQuery);
+        break;
+    case FORMAT_JSONL:
+        // without the line's new line
+        iLen = strcspn(pszQuery, "\r\n");
+        fprintf(pFile, "{\"query\":%d,\"text\":", iQueryCnt);
+        fprintJsonString(pFile, pszQuery, iLen);
+        break;
+    }
+}
+
+/******************** fprintQueryPostfix **************************************
+void fprintQueryPostfix(FILE *pFile, Out out)
+Purpose:
+    Prints the postfix of a query which was converted (text and jsonl).
+**************************************************************************/
+void fprintQueryPostfix(FILE *pFile, Out out)
+{
+    int i;
+
+    switch (iOutputFormat)
+    {
+    case FORMAT_TEXT:
+        fprintOut(pFile, out);
+        break;
+    case FORMAT_JSONL:
+        fprintf(pFile, ",\"postfix\":[");
+        for (i = 0; i < out->iOutCount; i++)
+        {
+            if (i > 0)
+                fputc(',', pFile);
+            fprintJsonString(pFile, OUT_TOKEN(out, out->outM[i])
+                , strlen(OUT_TOKEN(out, out->outM[i])));
+        }
+        fprintf(pFile, "]}\n");
+        break;
+    }
+}
+
+/******************** fprintQueryWarning **************************************
+void fprintQueryWarning(FILE *pFile, int iQueryCnt, int iWarning)
+Purpose:
+    Prints a warning converting a query (e.g., WARN_MISSING_LPAREN) or
+    evaluating it (WARN_BAD_QUERY).
+Parameters:
+    I/O FILE *pFile               stream receiving the output of the query
+    I   int iQueryCnt             number of the query in the query file
+    I   int iWarning              the warning
+Notes:
+    - After WARN_BAD_QUERY, the query's (empty) result is only printed in
+      the text format.
+**************************************************************************/
+void fprintQueryWarning(FILE *pFile, int iQueryCnt, int iWarning)
+{
+    char szMessage[MAX_TOKEN];
+    BitmapHeader header;
+    char *pszMessage = warningMessage(iWarning, szMessage, sizeof(szMessage));
+
+    switch (iOutputFormat)
+    {
+    case FORMAT_TEXT:
+        if (iWarning == WARN_MISSING_LPAREN)
+            fprintf(pFile, "\tWarning: missing left parenthesis\n");
+        else if (iWarning == WARN_MISSING_RPAREN)
+            fprintf(pFile, "\tWarning: missing right parenthesis\n");
+        else if (iWarning == WARN_BAD_QUERY)
+            fprintf(pFile, "\t warning improperly formatted query\n");
+        else
+            fprintf(pFile, "\t warning = %d\n", iWarning);
+        break;
+    case FORMAT_CSV:
+        fprintf(pFile, "%d,,,%s,\n", iQueryCnt, pszMessage);
+        break;
+    case FORMAT_JSONL:
+        // a conversion warning ends the query's line
+        if (iWarning == WARN_BAD_QUERY)
+            fprintf(pFile, "{\"query\":%d", iQueryCnt);
+        fprintf(pFile, ",\"warning\":\"%s\"}\n", pszMessage);
+        break;
+    case FORMAT_BITMAP:
+        setBitmapHeader(&header, iQueryCnt, iWarning, 0, 0, FALSE);
+        fwrite(&header, sizeof(header), 1, pFile);
+        break;
+    }
+}
+
+/******************** fprintQueryCompiled **************************************
+int fprintQueryCompiled(FILE *pFile, int iQueryCnt, int bCompiled)
+Purpose:
+    Prints the warning of a query which couldn't be compiled
+    (WARN_BAD_QUERY) and returns whether the query's result is printed.
+Parameters:
+    I/O FILE *pFile               stream receiving the output of the query
+    I   int iQueryCnt             number of the query in the query file
+    I   int bCompiled             TRUE if the query was compiled
+Returns:
+    TRUE - the result is printed (only the text format prints the empty
+           result of a bad query)
+    FALSE - the result isn't printed
+**************************************************************************/
+int fprintQueryCompiled(FILE *pFile, int iQueryCnt, int bCompiled)
+{
+    if (bCompiled)
+        return TRUE;
+    fprintQueryWarning(pFile, iQueryCnt, WARN_BAD_QUERY);
+    return iOutputFormat == FORMAT_TEXT;
+}
+
+/******************** readQueries **************************************
+int readQueries(int (*pfnQuery)(void *pArg, char *pszQuery, int iQueryCnt)
+    , void *pArg)
+Purpose:
+    Reads the query lines of the query file and calls pfnQuery for each
+    of them with its number (starting at 1), until the end of the file or
+    pfnQuery returns FALSE.
+Parameters:
+    I   int (*pfnQuery)(...)      function processing a query line
+    I   void *pArg                its first argument
+Returns:
+    The number of query lines read.
+Notes:
+    - The lines are read with getline, so a query may be any length.  The
+      line is only valid until pfnQuery returns.
+    - References the global:  pFileQuery
+**************************************************************************/
+int readQueries(int (*pfnQuery)(void *pArg, char *pszQuery, int iQueryCnt)
+    , void *pArg)
+{
+    char *pszInputBuffer = NULL;          // entire input line (from getline)
+    size_t iInputSize = 0;                // size of pszInputBuffer
+    int iQueryCnt = 0;
+
+    while (getline(&pszInputBuffer, &iInputSize, pFileQuery) != -1)
+    {
+        if (!pfnQuery(pArg, pszInputBuffer, ++iQueryCnt))
+            break;
+    }
+    free(pszInputBuffer);
+    return iQueryCnt;
+}
+
+/******************** writeResultHeading **************************************
+void writeResultHeading(Writer writer, int iQueryCnt, long long lNumCustomer
+    , long long lCount)
+Purpose:
+    Writes the start of a query's result (text and bitmap).
+Parameters:
+    I/O Writer writer             buffered output of the query
+    I   int iQueryCnt             number of the query in the query file
+    I   long long lNumCustomer    number of customers queried
+    I   long long lCount          number of customers in the result (only
+                                  used by the bitmap format)
+**************************************************************************/
+void writeResultHeading(Writer writer, int iQueryCnt, long long lNumCustomer
+    , long long lCount)
+{
+    BitmapHeader header;
+
+    switch (iOutputFormat)
+    {
+    case FORMAT_TEXT:
+        writeString(writer, "\tQuery Result:\n");
+        writeText(writer, "\t", 1);
+        writePadded(writer, "ID", 6);
+        writeText(writer, "  ", 2);
+        writePadded(writer, "Customer Name", 20);
+        writeText(writer, "\n", 1);
+        break;
+    case FORMAT_BITMAP:
+        setBitmapHeader(&header, iQueryCnt, 0, lNumCustomer, lCount, TRUE);
+        writeText(writer, (char *) &header, sizeof(header));
+        break;
+    }
+}
+
+/******************** writeResultCount **************************************
+void writeResultCount(Writer writer, int iQueryCnt, long long lNumCustomer
+    , long long lCount)
+Purpose:
+    Writes the result of a COUNT query.
+Parameters:
+    I/O Writer writer             buffered output of the query
+    I   int iQueryCnt             number of the query in the query file
+    I   long long lNumCustomer    number of customers queried
+    I   long long lCount          number of customers satisfying the query
+**************************************************************************/
+void writeResultCount(Writer writer, int iQueryCnt, long long lNumCustomer
+    , long long lCount)
+{
+    BitmapHeader header;
+
+    switch (iOutputFormat)
+    {
+    case FORMAT_TEXT:
+        writeString(writer, "\tQuery Count: ");
+        writeInteger(writer, lCount);
+        writeText(writer, "\n", 1);
+        break;
+    case FORMAT_CSV:
+        writeInteger(writer, iQueryCnt);
+        writeText(writer, ",,,,", 4);
+        writeInteger(writer, lCount);
+        writeText(writer, "\n", 1);
+        break;
+    case FORMAT_JSONL:
+        writeString(writer, "{\"query\":");
+        writeInteger(writer, iQueryCnt);
+        writeString(writer, ",\"count\":");
+        writeInteger(writer, lCount);
+        writeString(writer, "}\n");
+        break;
+    case FORMAT_BITMAP:
+        setBitmapHeader(&header, iQueryCnt, 0, lNumCustomer, lCount, FALSE);
+        writeText(writer, (char *) &header, sizeof(header));
+        break;
+    }
+}
+
+/******************** writeResultMatches **************************************
+void writeResultMatches(Writer writer, int iQueryCnt, Customer customerM[]
+    , int iNumCustomer, int matchM[], int iNumMatch)
+Purpose:
+    Writes the result of a query given the subscripts of the customers in
+    it (e.g., the window of a LIMIT query).
+Parameters:
+    I/O Writer writer             buffered output of the query
+    I   int iQueryCnt             number of the query in the query file
+    I   Customer customerM[]      array of customers and traits
+    I   int iNumCustomer          number of customers in customerM
+    I   int matchM[]              subscripts of the customers in the result
+    I   int iNumMatch             number of subscripts in matchM
+**************************************************************************/
+void writeResultMatches(Writer writer, int iQueryCnt, Customer customerM[]
+    , int iNumCustomer, int matchM[], int iNumMatch)
+{
+    BitWord *bitsM;
+    int i;
+
+    if (iOutputFormat != FORMAT_BITMAP)
+    {
+        writeResultHeading(writer, iQueryCnt, iNumCustomer, iNumMatch);
+        for (i = 0; i < iNumMatch; i++)
+            writeQueryMatch(writer, iQueryCnt, &customerM[matchM[i]]);
+        return;
+    }
+    bitsM = queryAlloc(sizeof(BitWord) * (BITMAP_WORDS(iNumCustomer) + 1));
+    memset(bitsM, 0, sizeof(BitWord) * (BITMAP_WORDS(iNumCustomer) + 1));
+    for (i = 0; i < iNumMatch; i++)
+        BITMAP_SET(bitsM, matchM[i]);
+    writeResultHeading(writer, iQueryCnt, iNumCustomer, iNumMatch);
+    writeBitWords(writer, bitsM, BITMAP_WORDS(iNumCustomer));
+}
+
+/******************** writeQueryMatch **************************************
+void writeQueryMatch(Writer writer, int iQueryCnt, Customer *pCustomer)
+Purpose:
+    Writes the line of a query's result for a customer satisfying it (text,
+    csv and jsonl).
+Notes:
+    - The text columns are padded like "\t%-6s  %-20s\n" without printf.
+**************************************************************************/
+void writeQueryMatch(Writer writer, int iQueryCnt, Customer *pCustomer)
+{
+    switch (iOutputFormat)
+    {
+    case FORMAT_TEXT:
+        writeText(writer, "\t", 1);
+        writePadded(writer, pCustomer->szCustomerId, 6);
+        writeText(writer, "  ", 2);
+        writePadded(writer, pCustomer->szCustomerName, 20);
+        writeText(writer, "\n", 1);
+        break;
+    case FORMAT_CSV:
+        writeInteger(writer, iQueryCnt);
+        writeText(writer, ",", 1);
+        writeCsvField(writer, pCustomer->szCustomerId);
+        writeText(writer, ",", 1);
+        writeCsvField(writer, pCustomer->szCustomerName);
+        writeText(writer, ",,\n", 3);
+        break;
+    case FORMAT_JSONL:
+        writeString(writer, "{\"query\":");
+        writeInteger(writer, iQueryCnt);
+        writeString(writer, ",\"id\":");
+        writeJsonString(writer, pCustomer->szCustomerId
+            , strlen(pCustomer->szCustomerId));
+        writeString(writer, ",\"name\":");
+        writeJsonString(writer, pCustomer->szCustomerName
+            , strlen(pCustomer->szCustomerName));
+        writeString(writer, "}\n");
+        break;
+    }
+}
+
+/******************** writeCsvHeading **************************************
+void writeCsvHeading(Writer writer)
+Purpose:
+    Writes the heading row of the csv format.
+**************************************************************************/
+void writeCsvHeading(Writer writer)
+{
+    writeString(writer, "query,id,name,warning,count\n");
+}
+
+/******************** writeBitWords **************************************
+void writeBitWords(Writer writer, BitWord bitsM[], size_t iNumWords)
+Purpose:
+    Writes the words of a bitmap in the little-endian byte order of the
+    bitmap format.
+**************************************************************************/
+void writeBitWords(Writer writer, BitWord bitsM[], size_t iNumWords)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    BitWord word;
+    size_t i;
+    for (i = 0; i < iNumWords; i++)
+    {
+        word = __builtin_bswap64(bitsM[i]);
+        writeText(writer, (char *) &word, sizeof(word));
+    }
+#else
+    writeText(writer, (char *) bitsM, iNumWords * sizeof(BitWord));
+#endif
+}
+
+/******************** writeResultBitmap **************************************
+void writeResultBitmap(Writer writer, QueryResult resultM[], int iNumCustomer)
+Purpose:
+    Writes a query's result array as the bitmap of the bitmap format.
+**************************************************************************/
+void writeResultBitmap(Writer writer, QueryResult resultM[], int iNumCustomer)
+{
+    BitWord word;
+    int i;
+    int b;
+
+    for (i = 0; i < iNumCustomer; i += BITS_PER_WORD)
+    {
+        word = 0;
+        for (b = 0; b < BITS_PER_WORD && i + b < iNumCustomer; b++)
+        {
+            if (resultM[i + b])
+                word |= (BitWord) 1 << b;
+        }
+        writeBitWords(writer, &word, 1);
+    }
+}
@@ -0,0 +1,511 @@
+/******************************************************************************
+cs2123p2Gen.c
+Purpose:
+    p2gen writes synthetic customer and query files for measuring p2 on
+    realistic sizes (the sample files have 10 customers and 12 queries).
+Command Parameters:
+    p2gen [-c customerFile] [-q queryFile] [-n customers] [-T types]
+          [-V values] [-z skew] [-k minTraits] [-K maxTraits] [-Q queries]
+          [-d depth] [-a andPercent] [-p parenPercent] [-e eq,notany,only]
+          [-w terms] [-s seed]
+        -c file     customer file to write
+        -q file     query file to write
+        -n count    number of customers (default 10000)
+        -T count    number of trait types TYPE00, TYPE01, ... (default 8)
+        -V count    number of values V0000, V0001, ... of each trait type
+                    (default 16)
+        -z skew     Zipf exponent of the values:  value k (from 1) of a type
+                    is chosen with a probability proportional to 1 / k^skew.
+                    0 is uniform (default 1.0).
+        -k count    fewest traits of a customer (default 0)
+        -K count    most traits of a customer (default 8).  The number of
+                    traits of each customer is uniform from -k to -K.
+        -Q count    number of queries (default 100)
+        -d depth    deepest nesting of AND and OR in a query (default 3)
+        -a percent  percent of the operators which are AND (the rest are
+                    OR, default 50)
+        -p percent  percent of the subexpressions in parentheses (default 30)
+        -e weights  relative weights of the =, NOTANY and ONLY predicates
+                    (default 60,25,15)
+        -w terms    each query is terms predicates joined by AND and OR
+                    (-a) without parentheses, instead of an expression of
+                    -d levels (see note 6)
+        -s seed     seed of the random numbers (default 1), so a run can
+                    be repeated
+Notes:
+    1. Build it on its own and use it with p2's benchmark mode:
+           gcc -O2 -o p2gen cs2123p2Gen.c -lm
+           p2gen -n 1000000 -c big.txt -Q 1000 -q bigq.txt
+           p2 -c big.txt -q bigq.txt -B bench.json > /dev/null
+    2. The random numbers are a xorshift64* generator rather than rand, so
+       a seed gives the same files on every platform.
+    3. The customer IDs are 100000, 100001, ... while they fit in six
+       digits, then six base 36 digits.
+    4. A customer's traits are a uniform trait type and a Zipf value of it.
+       The queries' predicates use the same distribution, so they mostly
+       ask for the common values.
+    5. Without -w, a query which is longer than MAX_LINE_SIZE is generated
+       again, so the queries are about as long as the sample's.
+    6. The queries of -w are as long as they need to be (p2 reads a query
+       line of any length).  Files of several widths show whether the cost
+       per term of a query stays the same as the queries get longer:
+           p2gen -n 100000 -c cust.txt
+           for w in 10 100 1000 10000; do
+               p2gen -Q 100 -w $w -q w$w.txt
+               p2 -c cust.txt -q w$w.txt -m 0 -B w$w.json > /dev/null
+           done
+       and compare convert_ns_per_term and evaluate_ns_per_term of the
+       JSON files (-m 0 turns off the cache, so each query is evaluated).
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cs2123p2.h"
+
+#define GEN_MAX_TRIES 1000          // tries to generate a query which fits a line
+#define GEN_ID_DECIMAL 900000       // customers with decimal IDs
+#define GEN_ID_DIGITS 6             // characters of a customer ID
+#define GEN_MAX_TYPES 100           // TYPE00 to TYPE99
+#define GEN_MAX_VALUES 10000        // V0000 to V9999
+
+// GenOptions typedef holds the command switches of p2gen
+typedef struct
+{
+    char *pszCustomerFileNm;        // -c customer file (NULL - none)
+    char *pszQueryFileNm;           // -q query file (NULL - none)
+    long lNumCustomer;              // -n number of customers
+    int iNumTypes;                  // -T number of trait types
+    int iNumValues;                 // -V number of values of each type
+    double dSkew;                   // -z Zipf exponent of the values
+    int iMinTraits;                 // -k fewest traits of a customer
+    int iMaxTraits;                 // -K most traits of a customer
+    long lNumQueries;               // -Q number of queries
+    int iDepth;                     // -d deepest nesting of AND and OR
+    int iAndPercent;                // -a percent of AND operators
+    int iParenPercent;              // -p percent of parenthesized subexpressions
+    int iWeightM[3];                // -e weights of =, NOTANY, ONLY
+    int iWidth;                     // -w predicates of a query (0 - use -d)
+    unsigned long long ulSeed;      // -s seed
+} GenOptions;
+
+// Gen typedef is the state of the generator
+typedef struct
+{
+    GenOptions *pOptions;
+    unsigned long long ulState;     // xorshift64* state
+    double *dZipfM;                 // cumulative probability of each value
+} Gen;
+
+static char *pszPredicateM[] = { "=", "NOTANY", "ONLY" };
+
+static void genUsage(char *pszMessage, char *pszDiagnosticInfo);
+
+/******************** genRandom **************************************
+static unsigned long long genRandom(Gen *pGen)
+Purpose:
+    Returns the next 64-bit random number (xorshift64*).
+**************************************************************************/
+static unsigned long long genRandom(Gen *pGen)
+{
+    pGen->ulState ^= pGen->ulState >> 12;
+    pGen->ulState ^= pGen->ulState << 25;
+    pGen->ulState ^= pGen->ulState >> 27;
+    return pGen->ulState * 0x2545F4914F6CDD1DULL;
+}
+
+/******************** genBelow **************************************
+static int genBelow(Gen *pGen, int iBound)
+Purpose:
+    Returns a uniform random number from 0 to iBound - 1.
+**************************************************************************/
+static int genBelow(Gen *pGen, int iBound)
+{
+    return (int) ((genRandom(pGen) >> 11) % (unsigned long long) iBound);
+}
+
+/******************** genUnit **************************************
+static double genUnit(Gen *pGen)
+Purpose:
+    Returns a uniform random number in [0, 1).
+**************************************************************************/
+static double genUnit(Gen *pGen)
+{
+    return (genRandom(pGen) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/******************** genValue **************************************
+static int genValue(Gen *pGen)
+Purpose:
+    Returns a value number (0 is the most common) of the Zipf distribution.
+**************************************************************************/
+static int genValue(Gen *pGen)
+{
+    double dUnit = genUnit(pGen);
+    int iLow = 0;
+    int iHigh = pGen->pOptions->iNumValues - 1;
+    int iMid;
+
+    // the first value whose cumulative probability exceeds dUnit
+    while (iLow < iHigh)
+    {
+        iMid = (iLow + iHigh) / 2;
+        if (pGen->dZipfM[iMid] > dUnit)
+            iHigh = iMid;
+        else
+            iLow = iMid + 1;
+    }
+    return iLow;
+}
+
+/******************** initZipf **************************************
+static void initZipf(Gen *pGen)
+Purpose:
+    Computes the cumulative probabilities of the values.
+**************************************************************************/
+static void initZipf(Gen *pGen)
+{
+    int iNumValues = pGen->pOptions->iNumValues;
+    double dTotal = 0;
+    int k;
+
+    pGen->dZipfM = malloc(sizeof(double) * iNumValues);
+    if (pGen->dZipfM == NULL)
+        genUsage("out of memory for", "the values");
+    for (k = 0; k < iNumValues; k++)
+    {
+        dTotal += 1.0 / pow(k + 1, pGen->pOptions->dSkew);
+        pGen->dZipfM[k] = dTotal;
+    }
+    for (k = 0; k < iNumValues; k++)
+        pGen->dZipfM[k] /= dTotal;
+    pGen->dZipfM[iNumValues - 1] = 1.0;
+}
+
+/******************** formatId **************************************
+static void formatId(long lCustomer, char szId[])
+Purpose:
+    Formats the ID of a customer (see note 3).
+**************************************************************************/
+static void formatId(long lCustomer, char szId[])
+{
+    static const char szDigits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    int i;
+
+    if (lCustomer < GEN_ID_DECIMAL)
+    {
+        sprintf(szId, "%ld", 100000 + lCustomer);
+        return;
+    }
+    for (i = GEN_ID_DIGITS - 1; i >= 0; i--)
+    {
+        szId[i] = szDigits[lCustomer % 36];
+        lCustomer /= 36;
+    }
+    szId[GEN_ID_DIGITS] = '\0';
+}
+
+/******************** writeCustomers **************************************
+static void writeCustomers(Gen *pGen, FILE *pFile)
+Purpose:
+    Writes the customer file.
+**************************************************************************/
+static void writeCustomers(Gen *pGen, FILE *pFile)
+{
+    GenOptions *pOptions = pGen->pOptions;
+    char szId[GEN_ID_DIGITS + 1];
+    int iTypeM[GEN_MAX_TYPES * 4];      // the customer's traits (type and value)
+    int iValueM[GEN_MAX_TYPES * 4];
+    int iNumTraits;
+    int iTraits;
+    int iTries;
+    int t;
+    int j;
+    long i;
+
+    for (i = 0; i < pOptions->lNumCustomer; i++)
+    {
+        formatId(i, szId);
+        fprintf(pFile, "CUSTOMER %s NAME %ld\n", szId, i);
+        iTraits = pOptions->iMinTraits
+            + genBelow(pGen, pOptions->iMaxTraits - pOptions->iMinTraits + 1);
+        iNumTraits = 0;
+        // a customer doesn't have the same trait twice
+        for (iTries = 0; iNumTraits < iTraits && iTries < iTraits * 4; iTries++)
+        {
+            iTypeM[iNumTraits] = genBelow(pGen, pOptions->iNumTypes);
+            iValueM[iNumTraits] = genValue(pGen);
+            for (j = 0; j < iNumTraits; j++)
+                if (iTypeM[j] == iTypeM[iNumTraits] && iValueM[j] == iValueM[iNumTraits])
+                    break;
+            if (j == iNumTraits)
+                iNumTraits++;
+        }
+        for (t = 0; t < iNumTraits; t++)
+            fprintf(pFile, "TRAIT TYPE%02d V%04d\n", iTypeM[t], iValueM[t]);
+    }
+}
+
+/******************** genPredicate **************************************
+static void genPredicate(Gen *pGen, char szQuery[], size_t iSize)
+Purpose:
+    Appends a random predicate (e.g., "TYPE03 NOTANY V0001") to a query.
+**************************************************************************/
+static void genPredicate(Gen *pGen, char szQuery[], size_t iSize)
+{
+    int *iWeightM = pGen->pOptions->iWeightM;
+    int iPick = genBelow(pGen, iWeightM[0] + iWeightM[1] + iWeightM[2]);
+    int p;
+    size_t iLen = strlen(szQuery);
+
+    for (p = 0; iPick >= iWeightM[p]; p++)
+        iPick -= iWeightM[p];
+    snprintf(szQuery + iLen, iSize - iLen, "TYPE%02d %s V%04d"
+        , genBelow(pGen, pGen->pOptions->iNumTypes), pszPredicateM[p]
+        , genValue(pGen));
+}
+
+/******************** genExpression **************************************
+static void genExpression(Gen *pGen, int iDepth, char szQuery[], size_t iSize)
+Purpose:
+    Appends a random expression with at most iDepth levels of AND and OR
+    to a query.
+**************************************************************************/
+static void genExpression(Gen *pGen, int iDepth, char szQuery[], size_t iSize)
+{
+    GenOptions *pOptions = pGen->pOptions;
+    int bParen;
+    size_t iLen;
+
+    // a quarter of the branches end before the deepest level
+    if (iDepth == 0 || genBelow(pGen, 4) == 0)
+    {
+        genPredicate(pGen, szQuery, iSize);
+        return;
+    }
+    bParen = genBelow(pGen, 100) < pOptions->iParenPercent;
+    iLen = strlen(szQuery);
+    if (bParen)
+        snprintf(szQuery + iLen, iSize - iLen, "( ");
+    genExpression(pGen, iDepth - 1, szQuery, iSize);
+    iLen = strlen(szQuery);
+    snprintf(szQuery + iLen, iSize - iLen, " %s "
+        , genBelow(pGen, 100) < pOptions->iAndPercent ? "AND" : "OR");
+    genExpression(pGen, iDepth - 1, szQuery, iSize);
+    iLen = strlen(szQuery);
+    if (bParen)
+        snprintf(szQuery + iLen, iSize - iLen, " )");
+}
+
+/******************** writeWideQuery **************************************
+static void writeWideQuery(Gen *pGen, FILE *pFile)
+Purpose:
+    Writes a query of -w predicates joined by AND and OR (see note 6).
+**************************************************************************/
+static void writeWideQuery(Gen *pGen, FILE *pFile)
+{
+    GenOptions *pOptions = pGen->pOptions;
+    char szPredicate[MAX_LINE_SIZE];
+    int t;
+
+    for (t = 0; t < pOptions->iWidth; t++)
+    {
+        if (t > 0)
+            fprintf(pFile, " %s "
+                , genBelow(pGen, 100) < pOptions->iAndPercent ? "AND" : "OR");
+        szPredicate[0] = '\0';
+        genPredicate(pGen, szPredicate, sizeof(szPredicate));
+        fputs(szPredicate, pFile);
+    }
+    fprintf(pFile, "\n");
+}
+
+/******************** writeQueries **************************************
+static void writeQueries(Gen *pGen, FILE *pFile)
+Purpose:
+    Writes the query file.
+**************************************************************************/
+static void writeQueries(Gen *pGen, FILE *pFile)
+{
+    char szQuery[MAX_LINE_SIZE * 8];
+    int iTries;
+    long i;
+
+    for (i = 0; i < pGen->pOptions->lNumQueries; i++)
+    {
+        if (pGen->pOptions->iWidth > 0)
+        {
+            writeWideQuery(pGen, pFile);
+            continue;
+        }
+        for (iTries = 0; iTries < GEN_MAX_TRIES; iTries++)
+        {
+            szQuery[0] = '\0';
+            genExpression(pGen, pGen->pOptions->iDepth, szQuery, sizeof(szQuery));
+            // as long as the sample's queries (see note 5)
+            if (strlen(szQuery) + 2 <= MAX_LINE_SIZE)
+                break;
+        }
+        if (iTries == GEN_MAX_TRIES)
+        {
+            szQuery[0] = '\0';
+            genPredicate(pGen, szQuery, sizeof(szQuery));
+        }
+        fprintf(pFile, "%s\n", szQuery);
+    }
+}
+
+/******************** switchNumber **************************************
+static long switchNumber(int argc, char *argv[], int *pi, long lMin, long lMax)
+Purpose:
+    Returns the numeric argument of a switch, which must be from lMin to
+    lMax.
+**************************************************************************/
+static long switchNumber(int argc, char *argv[], int *pi, long lMin, long lMax)
+{
+    char *pszEnd;
+    long lValue;
+
+    if (++*pi >= argc)
+        genUsage("missing argument for", argv[*pi - 1]);
+    lValue = strtol(argv[*pi], &pszEnd, 10);
+    if (*pszEnd != '\0' || lValue < lMin || lValue > lMax)
+        genUsage("invalid number, found", argv[*pi]);
+    return lValue;
+}
+
+/******************** openOutput **************************************
+static FILE *openOutput(char *pszFileNm)
+Purpose:
+    Opens a file to write.
+**************************************************************************/
+static FILE *openOutput(char *pszFileNm)
+{
+    FILE *pFile = fopen(pszFileNm, "w");
+    if (pFile == NULL)
+        genUsage("unable to write, found", pszFileNm);
+    return pFile;
+}
+
+int main(int argc, char *argv[])
+{
+    GenOptions options = { NULL, NULL, 10000, 8, 16, 1.0, 0, 8, 100, 3, 50, 30
+        , { 60, 25, 15 }, 0, 1 };
+    Gen gen;
+    FILE *pFile;
+    char *pszEnd;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0')
+            genUsage("expected switch, found", argv[i]);
+        switch (argv[i][1])
+        {
+        case 'c':
+        case 'q':
+            if (i + 1 >= argc)
+                genUsage("missing argument for", argv[i]);
+            if (argv[i][1] == 'c')
+                options.pszCustomerFileNm = argv[++i];
+            else
+                options.pszQueryFileNm = argv[++i];
+            break;
+        case 'n':
+            options.lNumCustomer = switchNumber(argc, argv, &i, 0, MAX_STORE_CUSTOMERS);
+            break;
+        case 'T':
+            options.iNumTypes = switchNumber(argc, argv, &i, 1, GEN_MAX_TYPES);
+            break;
+        case 'V':
+            options.iNumValues = switchNumber(argc, argv, &i, 1, GEN_MAX_VALUES);
+            break;
+        case 'z':
+            if (++i >= argc)
+                genUsage("missing argument for", argv[i - 1]);
+            options.dSkew = strtod(argv[i], &pszEnd);
+            if (*pszEnd != '\0' || options.dSkew < 0)
+                genUsage("invalid skew, found", argv[i]);
+            break;
+        case 'k':
+            options.iMinTraits = switchNumber(argc, argv, &i, 0, GEN_MAX_TYPES);
+            break;
+        case 'K':
+            options.iMaxTraits = switchNumber(argc, argv, &i, 0, GEN_MAX_TYPES);
+            break;
+        case 'Q':
+            options.lNumQueries = switchNumber(argc, argv, &i, 0, 1L << 30);
+            break;
+        case 'd':
+            options.iDepth = switchNumber(argc, argv, &i, 0, 16);
+            break;
+        case 'a':
+            options.iAndPercent = switchNumber(argc, argv, &i, 0, 100);
+            break;
+        case 'p':
+            options.iParenPercent = switchNumber(argc, argv, &i, 0, 100);
+            break;
+        case 'e':
+            if (++i >= argc)
+                genUsage("missing argument for", argv[i - 1]);
+            if (sscanf(argv[i], "%d,%d,%d", &options.iWeightM[0]
+                    , &options.iWeightM[1], &options.iWeightM[2]) != 3
+                || options.iWeightM[0] < 0 || options.iWeightM[1] < 0
+                || options.iWeightM[2] < 0
+                || options.iWeightM[0] + options.iWeightM[1] + options.iWeightM[2] == 0)
+                genUsage("invalid predicate weights, found", argv[i]);
+            break;
+        case 'w':
+            options.iWidth = switchNumber(argc, argv, &i, 1, 1L << 24);
+            break;
+        case 's':
+            options.ulSeed = switchNumber(argc, argv, &i, 0, 0x7fffffffL);
+            break;
+        case '?':
+            genUsage(NULL, NULL);
+            break;
+        default:
+            genUsage("expected switch, found", argv[i]);
+        }
+    }
+    if (options.pszCustomerFileNm == NULL && options.pszQueryFileNm == NULL)
+        genUsage("missing switch", "-c or -q");
+    if (options.iMinTraits > options.iMaxTraits)
+        genUsage("-k is more than", "-K");
+
+    gen.pOptions = &options;
+    // xorshift needs a state which isn't zero
+    gen.ulState = (options.ulSeed + 1) * 0x9E3779B97F4A7C15ULL;
+    initZipf(&gen);
+    if (options.pszCustomerFileNm != NULL)
+    {
+        pFile = openOutput(options.pszCustomerFileNm);
+        writeCustomers(&gen, pFile);
+        fclose(pFile);
+    }
+    if (options.pszQueryFileNm != NULL)
+    {
+        pFile = openOutput(options.pszQueryFileNm);
+        writeQueries(&gen, pFile);
+        fclose(pFile);
+    }
+    free(gen.dZipfM);
+    return EXIT_SUCCESS;
+}
+
+/******************** genUsage **************************************
+static void genUsage(char *pszMessage, char *pszDiagnosticInfo)
+Purpose:
+    Prints an error (unless pszMessage is NULL) and the usage of p2gen,
+    and exits.
+**************************************************************************/
+static void genUsage(char *pszMessage, char *pszDiagnosticInfo)
+{
+    if (pszMessage != NULL)
+        fprintf(stderr, "Error: %s %s\n", pszMessage, pszDiagnosticInfo);
+    fprintf(stderr, "p2gen [-c customerFile] [-q queryFile] [-n customers] [-T types]\n"
+        "    [-V values] [-z skew] [-k minTraits] [-K maxTraits] [-Q queries]\n"
+        "    [-d depth] [-a andPercent] [-p parenPercent] [-e eq,notany,only]\n"
+        "    [-w terms] [-s seed]\n");
+    exit(pszMessage == NULL ? USAGE_ONLY : ERR_COMMAND_LINE);
+}
@@ -0,0 +1,834 @@
+/******************************************************************************
+cs2123p2Index.c
+Purpose:
+    Implements the inverted bitmap index of the customers.  For each trait
+    ID in the trait dictionary there is a bitmap with one bit per customer
+    (bit i is customer i in customerM) which is on if the customer has that
+    trait.  For each trait type there is a bitmap of the customers having
+    exactly one trait of that type, which is what ONLY needs.
+    evaluateProgramIndex runs a compiled query once over these bitmaps
+    instead of once per customer:
+        =       loads the trait's bitmap
+        NOTANY  complements the trait's bitmap
+        ONLY    ANDs the trait's bitmap with the "exactly one" bitmap of its type
+        AND, OR word-wise and / or of the two operand bitmaps
+Notes:
+    1. The bits past iNumCustomer are always kept off in the index and in
+       query results.
+    2. The whole program is run for one block of BLOCK_WORDS words (512
+       customers) before moving to the next block, so the intermediate
+       values stay in the L1 cache.  The evaluation uses one block per
+       stack position.  An operator leaves its result in the block of the
+       position of its first operand.
+    3. The block operations are the BlockKernels (AVX2, SSE2 or scalar)
+       selected for the CPU when the index is built.
+    4. If iNumShards > 1 (p2 -j), evaluateProgramIndex splits the blocks
+       into that many shards of contiguous blocks, each evaluated by its own
+       thread with its own stack blocks.  A shard writes only its words of
+       the result bitmap and its customers' elements of resultM, so the
+       threads share nothing.  Shards have at least SHARD_MIN_BLOCKS blocks
+       since handing a shard to a thread costs more than evaluating a few
+       blocks.  The calling thread evaluates the first shard, and the
+       others are queued for the index's ShardPool:  iNumShards - 1
+       threads started by setIndexShards which live (with their query
+       contexts) as long as the index, so a query doesn't create threads.
+       The pool is separate from the query workers of p2 -t, which wait
+       for their shards.
+    5. The OP_JFALSE and OP_JTRUE instructions compileQuery puts between
+       the operands of AND and OR skip the rest of the operands for a
+       block whose value is already all zeros or all ones, so the operands
+       which are usually decisive are all that is read for most blocks.
+    6. countCustomerIndex counts the customers of each bitmap.  compileQuery
+       uses the counts to estimate the selectivity of a query's predicates.
+    7. countProgramIndex (a query with COUNT) is evaluateProgramIndex with
+       a popcount of each shard's words instead of storing resultM.
+       limitProgramIndex (a query with LIMIT) evaluates one block at a time
+       and stops at the block holding the last customer it needs.
+    8. Customer updates (p2 -u) change the index in place:
+       updateCustomerIndex recomputes one customer's bit of a trait and of
+       its type's "exactly one" bitmap, and removeCustomerIndex turns off
+       the bits of a removed customer.  Since NOTANY (and a boolean
+       operand) would still be TRUE for a removed customer, the first
+       removal creates liveBitsM, which each block of a result is ANDed
+       with.  resizeCustomerIndex adds bitmaps for new trait IDs and types
+       and grows the bitmaps for added customers.  The number of blocks
+       and the bitmaps allocated for trait IDs and types (iMaxTraits,
+       iMaxTypes) grow by a quarter, so adding customers or traits one at
+       a time copies the bitmaps only now and then.  The counts are kept
+       up to date as bits change.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include "cs2123p2.h"
+
+#define SHARD_MIN_BLOCKS 64         // minimum blocks (32768 customers) per shard
+#define INDEX_GROWTH_DIVISOR 4      // the bitmaps grow by 1/4 when full
+
+// IndexShard typedef is the work of one thread of evaluateProgramIndex
+typedef struct IndexShard
+{
+    struct IndexShard *pNextQueued; // next shard waiting for a pool thread
+    int *piPending;                 // shards of the query not done yet
+    Program program;                // the compiled query
+    CustomerIndex index;            // bitmap index of the customers
+    BitWord *resultBitsM;           // bitmap receiving the query's customers
+    QueryResult *resultM;           // TRUE or FALSE for each customer (NULL
+                                    // to only count the customers)
+    int iFirstBlock;                // first block of the shard
+    int iEndBlock;                  // block after the shard
+    int iCount;                     // customers satisfying the query (if
+                                    // resultM is NULL)
+} IndexShard;
+
+// ShardPool typedef is the threads evaluating the shards of an index's queries
+typedef struct ShardPool
+{
+    pthread_mutex_t lock;           // protects the queue, the queries'
+                                    // pending counts and bStop
+    pthread_cond_t shardReady;      // signaled when a shard is queued (or bStop)
+    pthread_cond_t shardDone;       // broadcast when a query's shards are done
+    IndexShard *pFirstQueued;       // shards waiting for a thread
+    int bStop;                      // TRUE when the threads must exit
+    int iNumThreads;                // number of threads in threadM
+    pthread_t *threadM;             // the threads
+} ShardPool;
+
+static int evaluateShards(Program program, CustomerIndex index
+    , QueryResult resultM[]);
+static void evaluateShard(IndexShard *pShard);
+static void *shardThread(void *pArg);
+
+/******************** newCustomerIndex **************************************
+CustomerIndex newCustomerIndex(Customer customerM[], int iNumCustomer
+    , TraitDict dict)
+Purpose:
+    Builds the bitmap index of the customers.
+Parameters:
+    I Customer customerM[]    array of customers and traits
+    I int iNumCustomer        number of customers in customerM
+    I TraitDict dict          dictionary of the customers' trait IDs
+Returns:
+    The new index which should be freed using freeCustomerIndex.
+Notes:
+    - Counts each customer's traits per type using iTypeCountM which is
+      reset for only the types the customer used.
+**************************************************************************/
+CustomerIndex newCustomerIndex(Customer customerM[], int iNumCustomer
+    , TraitDict dict)
+{
+    CustomerIndex index = (CustomerIndex) malloc(sizeof(CustomerIndexImp));
+    int *iTypeCountM;           // number of traits of each type for a customer
+    int i;
+    int j;
+    int iType;
+
+    if (index == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer index");
+    index->customerM = customerM;
+    index->iNumCustomer = iNumCustomer;
+    index->iNumBlocks = (BITMAP_WORDS(iNumCustomer) + BLOCK_WORDS - 1) / BLOCK_WORDS;
+    index->iNumWords = index->iNumBlocks * BLOCK_WORDS;
+    index->pKernels = selectBlockKernels();
+    index->iNumShards = 1;
+    index->pShardPool = NULL;
+    index->bMapped = FALSE;
+    index->iNumTraits = dict->iNumTraits;
+    index->iNumTypes = dict->iNumTypes;
+    index->iMaxTraits = index->iNumTraits;
+    index->iMaxTypes = index->iNumTypes;
+    index->liveBitsM = NULL;
+    index->traitBitsM = calloc((size_t) index->iNumTraits * index->iNumWords + 1
+        , sizeof(BitWord));
+    index->onlyBitsM = calloc((size_t) index->iNumTypes * index->iNumWords + 1
+        , sizeof(BitWord));
+    iTypeCountM = calloc(index->iNumTypes + 1, sizeof(int));
+    if (index->traitBitsM == NULL || index->onlyBitsM == NULL || iTypeCountM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer index");
+
+    for (i = 0; i < iNumCustomer; i++)
+    {
+        for (j = 0; j < customerM[i].iNumberOfTraits; j++)
+        {
+            BITMAP_SET(TRAIT_BITS(index, customerM[i].traitM[j].iTraitId), i);
+            iTypeCountM[customerM[i].traitM[j].iTraitType]++;
+        }
+        for (j = 0; j < customerM[i].iNumberOfTraits; j++)
+        {
+            iType = customerM[i].traitM[j].iTraitType;
+            if (iTypeCountM[iType] == 1)
+                BITMAP_SET(ONLY_BITS(index, iType), i);
+        }
+        for (j = 0; j < customerM[i].iNumberOfTraits; j++)
+            iTypeCountM[customerM[i].traitM[j].iTraitType] = 0;
+    }
+    free(iTypeCountM);
+    countCustomerIndex(index);
+    return index;
+}
+
+/******************** freeCustomerIndex **************************************
+void freeCustomerIndex(CustomerIndex index)
+Purpose:
+    Frees the bitmap index.  Bitmaps in a mapped snapshot are unmapped with
+    the customer store instead.
+**************************************************************************/
+void freeCustomerIndex(CustomerIndex index)
+{
+    if (index == NULL)
+        return;
+    setIndexShards(index, 1);
+    if (!index->bMapped)
+    {
+        free(index->traitBitsM);
+        free(index->onlyBitsM);
+    }
+    free(index->traitCountM);
+    free(index->onlyCountM);
+    free(index->liveBitsM);
+    free(index);
+}
+
+/******************** setIndexShards **************************************
+void setIndexShards(CustomerIndex index, int iNumShards)
+Purpose:
+    Sets the number of threads evaluating each query of the index (p2 -j),
+    stopping the index's shard threads and starting iNumShards - 1 new
+    ones.
+Notes:
+    - No query may be evaluated with the index while the threads change.
+    - The shard threads block every signal, so a signal (e.g., the SIGTERM
+      of a daemon) goes to a thread expecting it.
+**************************************************************************/
+void setIndexShards(CustomerIndex index, int iNumShards)
+{
+    ShardPool *pPool = index->pShardPool;
+    sigset_t allSignals;
+    sigset_t oldSignals;            // signal mask of the calling thread
+    int t;
+
+    if (pPool != NULL)
+    {
+        pthread_mutex_lock(&pPool->lock);
+        pPool->bStop = TRUE;
+        pthread_cond_broadcast(&pPool->shardReady);
+        pthread_mutex_unlock(&pPool->lock);
+        for (t = 0; t < pPool->iNumThreads; t++)
+            pthread_join(pPool->threadM[t], NULL);
+        pthread_mutex_destroy(&pPool->lock);
+        pthread_cond_destroy(&pPool->shardReady);
+        pthread_cond_destroy(&pPool->shardDone);
+        free(pPool->threadM);
+        free(pPool);
+        index->pShardPool = NULL;
+    }
+    index->iNumShards = iNumShards;
+    if (iNumShards <= 1)
+        return;
+
+    pPool = malloc(sizeof(ShardPool));
+    if (pPool != NULL)
+        pPool->threadM = malloc(sizeof(pthread_t) * (iNumShards - 1));
+    if (pPool == NULL || pPool->threadM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query shard threads");
+    pthread_mutex_init(&pPool->lock, NULL);
+    pthread_cond_init(&pPool->shardReady, NULL);
+    pthread_cond_init(&pPool->shardDone, NULL);
+    pPool->pFirstQueued = NULL;
+    pPool->bStop = FALSE;
+    pPool->iNumThreads = iNumShards - 1;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+    for (t = 0; t < pPool->iNumThreads; t++)
+        if (pthread_create(&pPool->threadM[t], NULL, shardThread, pPool) != 0)
+            ErrExit(ERR_ALGORITHM, "unable to create a query shard thread");
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+    index->pShardPool = pPool;
+}
+
+/******************** countCustomerIndex **************************************
+void countCustomerIndex(CustomerIndex index)
+Purpose:
+    Counts the customers in each trait bitmap and each "exactly one"
+    bitmap of the index (traitCountM and onlyCountM).
+Notes:
+    - Called when the index is built or loaded from a snapshot.
+**************************************************************************/
+void countCustomerIndex(CustomerIndex index)
+{
+    int i;
+
+    index->traitCountM = malloc(sizeof(int) * (index->iNumTraits + 1));
+    index->onlyCountM = malloc(sizeof(int) * (index->iNumTypes + 1));
+    if (index->traitCountM == NULL || index->onlyCountM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer index");
+    for (i = 0; i < index->iNumTraits; i++)
+        index->traitCountM[i] = bitmapCount(TRAIT_BITS(index, i), index->iNumWords);
+    for (i = 0; i < index->iNumTypes; i++)
+        index->onlyCountM[i] = bitmapCount(ONLY_BITS(index, i), index->iNumWords);
+}
+
+/******************** resizeBitmaps **************************************
+static BitWord *resizeBitmaps(BitWord *oldBitsM, int iOldCount, int iNewCount
+    , int iOldWords, int iNewWords, int bMapped)
+Purpose:
+    Copies iOldCount bitmaps of iOldWords words to iNewCount zeroed bitmaps
+    of iNewWords words and frees the old ones (unless they are mapped).
+**************************************************************************/
+static BitWord *resizeBitmaps(BitWord *oldBitsM, int iOldCount, int iNewCount
+    , int iOldWords, int iNewWords, int bMapped)
+{
+    BitWord *newBitsM = calloc((size_t) iNewCount * iNewWords + 1, sizeof(BitWord));
+    int i;
+
+    if (newBitsM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer index");
+    for (i = 0; i < iOldCount; i++)
+        memcpy(newBitsM + (size_t) i * iNewWords, oldBitsM + (size_t) i * iOldWords
+            , sizeof(BitWord) * iOldWords);
+    if (!bMapped)
+        free(oldBitsM);
+    return newBitsM;
+}
+
+/******************** resizeCounts **************************************
+static int *resizeCounts(int *countM, int iOldCount, int iNewCount)
+Purpose:
+    Grows a count array, zeroing the new counts.
+**************************************************************************/
+static int *resizeCounts(int *countM, int iOldCount, int iNewCount)
+{
+    countM = realloc(countM, sizeof(int) * (iNewCount + 1));
+    if (countM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer index");
+    memset(countM + iOldCount, 0, sizeof(int) * (iNewCount - iOldCount));
+    return countM;
+}
+
+/******************** growCapacity **************************************
+static int growCapacity(int iMax, int iNeeded)
+Purpose:
+    Returns iMax grown by a quarter (INDEX_GROWTH_DIVISOR) as many times
+    as needed to be at least iNeeded.
+**************************************************************************/
+static int growCapacity(int iMax, int iNeeded)
+{
+    while (iMax < iNeeded)
+        iMax += iMax / INDEX_GROWTH_DIVISOR + 1;
+    return iMax;
+}
+
+/******************** resizeCustomerIndex **************************************
+void resizeCustomerIndex(CustomerIndex index, Customer customerM[]
+    , int iNumCustomer, TraitDict dict)
+Purpose:
+    Makes the index cover customers added to the end of customerM and
+    trait IDs and types added to the dictionary.
+Parameters:
+    I/O CustomerIndex index     bitmap index of the customers
+    I   Customer customerM[]    the customers (customerM may have moved)
+    I   int iNumCustomer        number of customers (at least as many as
+                                the index has)
+    I   TraitDict dict          dictionary of the customers' trait IDs
+Notes:
+    - The added customers' bits are off (they don't have any traits yet)
+      except in liveBitsM.
+    - Bitmaps in a mapped snapshot are copied to allocated memory when
+      they must grow.
+**************************************************************************/
+void resizeCustomerIndex(CustomerIndex index, Customer customerM[]
+    , int iNumCustomer, TraitDict dict)
+{
+    int iNumBlocks = growCapacity(index->iNumBlocks
+        , (BITMAP_WORDS(iNumCustomer) + BLOCK_WORDS - 1) / BLOCK_WORDS);
+    int iMaxTraits = growCapacity(index->iMaxTraits, dict->iNumTraits);
+    int iMaxTypes = growCapacity(index->iMaxTypes, dict->iNumTypes);
+    int iNumWords = iNumBlocks * BLOCK_WORDS;
+    int i;
+
+    // the allocated bitmaps past iNumTraits and iNumTypes are zero
+    if (iNumBlocks != index->iNumBlocks || iMaxTraits != index->iMaxTraits
+        || iMaxTypes != index->iMaxTypes)
+    {
+        index->traitBitsM = resizeBitmaps(index->traitBitsM, index->iNumTraits
+            , iMaxTraits, index->iNumWords, iNumWords, index->bMapped);
+        index->onlyBitsM = resizeBitmaps(index->onlyBitsM, index->iNumTypes
+            , iMaxTypes, index->iNumWords, iNumWords, index->bMapped);
+        if (index->liveBitsM != NULL)
+            index->liveBitsM = resizeBitmaps(index->liveBitsM, 1, 1
+                , index->iNumWords, iNumWords, FALSE);
+        index->traitCountM = resizeCounts(index->traitCountM, index->iNumTraits
+            , iMaxTraits);
+        index->onlyCountM = resizeCounts(index->onlyCountM, index->iNumTypes
+            , iMaxTypes);
+        index->bMapped = FALSE;
+        index->iMaxTraits = iMaxTraits;
+        index->iMaxTypes = iMaxTypes;
+        index->iNumBlocks = iNumBlocks;
+        index->iNumWords = iNumWords;
+    }
+    index->iNumTraits = dict->iNumTraits;
+    index->iNumTypes = dict->iNumTypes;
+    if (index->liveBitsM != NULL)
+    {
+        for (i = index->iNumCustomer; i < iNumCustomer; i++)
+            BITMAP_SET(index->liveBitsM, i);
+    }
+    index->customerM = customerM;
+    index->iNumCustomer = iNumCustomer;
+}
+
+/******************** setIndexBit **************************************
+static void setIndexBit(BitWord bitsM[], int *piCount, int i, int bOn)
+Purpose:
+    Turns bit i of a bitmap on or off, adjusting the bitmap's count.
+**************************************************************************/
+static void setIndexBit(BitWord bitsM[], int *piCount, int i, int bOn)
+{
+    if ((int) BITMAP_TEST(bitsM, i) == (bOn != 0))
+        return;
+    bitsM[i / BITS_PER_WORD] ^= (BitWord) 1 << (i % BITS_PER_WORD);
+    *piCount += bOn ? 1 : -1;
+}
+
+/******************** updateCustomerIndex **************************************
+void updateCustomerIndex(CustomerIndex index, int iCustomer, Trait trait)
+Purpose:
+    Recomputes a customer's bit of a trait's bitmap and of the "exactly
+    one" bitmap of its type after the trait was added to or removed from
+    the customer.
+Parameters:
+    I/O CustomerIndex index     bitmap index of the customers
+    I   int iCustomer           subscript of the customer
+    I   Trait trait             the trait which was added or removed (its
+                                IDs must be in the index)
+**************************************************************************/
+void updateCustomerIndex(CustomerIndex index, int iCustomer, Trait trait)
+{
+    Customer *pCustomer = &index->customerM[iCustomer];
+    int bHas = FALSE;           // TRUE if the customer still has the trait
+    int iOfType = 0;            // customer's traits of the trait's type
+    int j;
+
+    for (j = 0; j < pCustomer->iNumberOfTraits; j++)
+    {
+        if (pCustomer->traitM[j].iTraitId == trait.iTraitId)
+            bHas = TRUE;
+        if (pCustomer->traitM[j].iTraitType == trait.iTraitType)
+            iOfType++;
+    }
+    setIndexBit(TRAIT_BITS(index, trait.iTraitId)
+        , &index->traitCountM[trait.iTraitId], iCustomer, bHas);
+    setIndexBit(ONLY_BITS(index, trait.iTraitType)
+        , &index->onlyCountM[trait.iTraitType], iCustomer, iOfType == 1);
+}
+
+/******************** removeCustomerIndex **************************************
+void removeCustomerIndex(CustomerIndex index, int iCustomer)
+Purpose:
+    Turns off every bit of a customer which is being removed (it must
+    still have its traits) including its bit of liveBitsM, which is
+    created for the first removal.
+**************************************************************************/
+void removeCustomerIndex(CustomerIndex index, int iCustomer)
+{
+    Customer *pCustomer = &index->customerM[iCustomer];
+    Trait *pTrait;
+    int j;
+
+    for (j = 0; j < pCustomer->iNumberOfTraits; j++)
+    {
+        pTrait = &pCustomer->traitM[j];
+        setIndexBit(TRAIT_BITS(index, pTrait->iTraitId)
+            , &index->traitCountM[pTrait->iTraitId], iCustomer, FALSE);
+        setIndexBit(ONLY_BITS(index, pTrait->iTraitType)
+            , &index->onlyCountM[pTrait->iTraitType], iCustomer, FALSE);
+    }
+    if (index->liveBitsM == NULL)
+    {
+        index->liveBitsM = calloc((size_t) index->iNumWords + 1, sizeof(BitWord));
+        if (index->liveBitsM == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory for the customer index");
+        bitmapFill(index->liveBitsM, index->iNumCustomer);
+    }
+    index->liveBitsM[iCustomer / BITS_PER_WORD] &=
+        ~((BitWord) 1 << (iCustomer % BITS_PER_WORD));
+}
+
+/******************** evaluateProgramIndex *********************************
+void evaluateProgramIndex(Program program, CustomerIndex index
+    , QueryResult resultM[])
+Purpose:
+    Evaluates a compiled query for all of the customers at once using the
+    bitmap index.
+Parameters:
+    I Program program         The compiled query
+    I CustomerIndex index     bitmap index of the customers
+    O QueryResult resultM[]   TRUE or FALSE for each customer in the index
+Notes:
+    - The blocks are split into shards evaluated by their own threads when
+      index->iNumShards > 1 and there are enough blocks.
+**************************************************************************/
+void evaluateProgramIndex(Program program, CustomerIndex index
+    , QueryResult resultM[])
+{
+    evaluateShards(program, index, resultM);
+}
+
+/******************** countProgramIndex *********************************
+int countProgramIndex(Program program, CustomerIndex index)
+Purpose:
+    Returns the number of customers satisfying a compiled query using the
+    bitmap index (a popcount of the result bitmap).
+Parameters:
+    I Program program         The compiled query
+    I CustomerIndex index     bitmap index of the customers
+Notes:
+    - Like evaluateProgramIndex, the blocks are split into shards.
+**************************************************************************/
+int countProgramIndex(Program program, CustomerIndex index)
+{
+    return evaluateShards(program, index, NULL);
+}
+
+/******************** evaluateShards *********************************
+static int evaluateShards(Program program, CustomerIndex index
+    , QueryResult resultM[])
+Purpose:
+    Evaluates a compiled query with the bitmap index, splitting the blocks
+    into shards evaluated by the index's shard threads when
+    index->iNumShards > 1 and there are enough blocks.
+Returns:
+    The number of customers satisfying the query if resultM is NULL (it
+    receives the result otherwise).
+**************************************************************************/
+static int evaluateShards(Program program, CustomerIndex index
+    , QueryResult resultM[])
+{
+    BitWord *resultBitsM;           // bitmap of the customers satisfying the query
+    IndexShard *shardM;             // work of each thread
+    ShardPool *pPool = index->pShardPool;
+    int iNumShards = index->iNumShards;
+    int iPending;                   // shards queued for the pool not done yet
+    int iCount = 0;
+    int s;
+
+    resultBitsM = queryAlloc(sizeof(BitWord) * index->iNumWords + 1);
+    if (iNumShards > index->iNumBlocks / SHARD_MIN_BLOCKS)
+        iNumShards = index->iNumBlocks / SHARD_MIN_BLOCKS;
+    if (iNumShards <= 1)
+    {
+        IndexShard shard = { NULL, NULL, program, index, resultBitsM, resultM
+            , 0, index->iNumBlocks, 0 };
+        evaluateShard(&shard);
+        return shard.iCount;
+    }
+
+    shardM = queryAlloc(sizeof(IndexShard) * iNumShards);
+    for (s = 0; s < iNumShards; s++)
+    {
+        shardM[s].piPending = &iPending;
+        shardM[s].program = program;
+        shardM[s].index = index;
+        shardM[s].resultBitsM = resultBitsM;
+        shardM[s].resultM = resultM;
+        shardM[s].iFirstBlock = (int) ((long long) index->iNumBlocks * s / iNumShards);
+        shardM[s].iEndBlock = (int) ((long long) index->iNumBlocks * (s + 1) / iNumShards);
+        shardM[s].iCount = 0;
+    }
+    // the calling thread evaluates the first shard
+    pthread_mutex_lock(&pPool->lock);
+    iPending = iNumShards - 1;
+    for (s = 1; s < iNumShards; s++)
+    {
+        shardM[s].pNextQueued = pPool->pFirstQueued;
+        pPool->pFirstQueued = &shardM[s];
+    }
+    pthread_cond_broadcast(&pPool->shardReady);
+    pthread_mutex_unlock(&pPool->lock);
+    evaluateShard(&shardM[0]);
+    pthread_mutex_lock(&pPool->lock);
+    while (iPending > 0)
+        pthread_cond_wait(&pPool->shardDone, &pPool->lock);
+    pthread_mutex_unlock(&pPool->lock);
+    for (s = 0; s < iNumShards; s++)
+        iCount += shardM[s].iCount;
+    return iCount;
+}
+
+/******************** evaluateShard *********************************
+static void evaluateShard(IndexShard *pShard)
+Purpose:
+    Evaluates a query for a shard's blocks and stores the result of each
+    of the shard's customers in resultM (or counts them if it is NULL).
+**************************************************************************/
+static void evaluateShard(IndexShard *pShard)
+{
+    int iFirst = pShard->iFirstBlock * BLOCK_WORDS * BITS_PER_WORD;
+    int iEnd = pShard->iEndBlock * BLOCK_WORDS * BITS_PER_WORD;
+    int i;
+
+    if (iEnd > pShard->index->iNumCustomer)
+        iEnd = pShard->index->iNumCustomer;
+    evaluateProgramBits(pShard->program, pShard->index, pShard->resultBitsM
+        , pShard->iFirstBlock, pShard->iEndBlock);
+    if (pShard->resultM == NULL)
+    {
+        pShard->iCount = bitmapCount(pShard->resultBitsM
+            + (size_t) pShard->iFirstBlock * BLOCK_WORDS
+            , (pShard->iEndBlock - pShard->iFirstBlock) * BLOCK_WORDS);
+        return;
+    }
+
+    // store the result of the query for each customer
+    for (i = iFirst; i < iEnd; i++)
+        pShard->resultM[i] = BITMAP_TEST(pShard->resultBitsM, i) ? TRUE : FALSE;
+}
+
+/******************** shardThread *********************************
+static void *shardThread(void *pArg)
+Purpose:
+    Thread of a ShardPool which evaluates queued shards until the pool
+    stops.
+**************************************************************************/
+static void *shardThread(void *pArg)
+{
+    ShardPool *pPool = (ShardPool *) pArg;
+    IndexShard *pShard;
+
+    pthread_mutex_lock(&pPool->lock);
+    for (;;)
+    {
+        while (pPool->pFirstQueued == NULL && !pPool->bStop)
+            pthread_cond_wait(&pPool->shardReady, &pPool->lock);
+        if (pPool->bStop)
+            break;
+        pShard = pPool->pFirstQueued;
+        pPool->pFirstQueued = pShard->pNextQueued;
+        pthread_mutex_unlock(&pPool->lock);
+
+        resetQueryContext();
+        evaluateShard(pShard);
+
+        pthread_mutex_lock(&pPool->lock);
+        if (--*pShard->piPending == 0)
+            pthread_cond_broadcast(&pPool->shardDone);
+    }
+    pthread_mutex_unlock(&pPool->lock);
+    return NULL;
+}
+
+/******************** limitProgramIndex *********************************
+int limitProgramIndex(Program program, CustomerIndex index, int matchM[]
+    , int iWanted)
+Purpose:
+    Finds the first iWanted customers satisfying a compiled query using the
+    bitmap index.  The blocks are evaluated in order, stopping when enough
+    customers have been found.
+Parameters:
+    I Program program         The compiled query
+    I CustomerIndex index     bitmap index of the customers
+    O int matchM[]            subscripts of the customers found (in order)
+    I int iWanted             number of customers wanted
+Returns:
+    The number of customers in matchM (less than iWanted if there aren't
+    that many).
+**************************************************************************/
+int limitProgramIndex(Program program, CustomerIndex index, int matchM[]
+    , int iWanted)
+{
+    BitWord *resultBitsM;           // bitmap of the customers satisfying the query
+    int iFound = 0;
+    int b;
+
+    resultBitsM = queryAlloc(sizeof(BitWord) * index->iNumWords + 1);
+    for (b = 0; b < index->iNumBlocks && iFound < iWanted; b++)
+    {
+        evaluateProgramBits(program, index, resultBitsM, b, b + 1);
+        iFound = bitmapMatches(resultBitsM, b * BLOCK_WORDS, (b + 1) * BLOCK_WORDS
+            , matchM, iFound, iWanted);
+    }
+    // customers in the blocks evaluated (p2 -s)
+    STATS_ADD(lScanned, b * BLOCK_WORDS * BITS_PER_WORD < index->iNumCustomer
+        ? b * BLOCK_WORDS * BITS_PER_WORD : index->iNumCustomer);
+    return iFound;
+}
+
+/******************** evaluateProgramBits *********************************
+void evaluateProgramBits(Program program, CustomerIndex index
+    , BitWord resultBitsM[], int iFirstBlock, int iEndBlock)
+Purpose:
+    Evaluates a compiled query for the customers of a range of blocks of
+    the bitmap index.
+Parameters:
+    I Program program         The compiled query
+    I CustomerIndex index     bitmap index of the customers
+    O BitWord resultBitsM[]   bitmap (of index->iNumWords words) receiving the
+                              customers satisfying the query.  Only the words
+                              of the range of blocks are set.
+    I int iFirstBlock         first block to evaluate
+    I int iEndBlock           block after the last block to evaluate
+Notes:
+    - The stack blocks are local so that they stay in the L1 cache.  Only
+      a program deeper than MAX_OUT_ITEM values gets them from the query
+      context (queryScratch, so evaluating each block of a LIMIT query
+      reuses them).
+**************************************************************************/
+void evaluateProgramBits(Program program, CustomerIndex index
+    , BitWord resultBitsM[], int iFirstBlock, int iEndBlock)
+{
+    BitWord localStackM[MAX_OUT_ITEM][BLOCK_WORDS]; // stack of most programs
+    BitWord (*stackM)[BLOCK_WORDS] = localStackM;   // block of each stack position
+    BitWord zeroM[BLOCK_WORDS];                // block with no customers
+    BitWord onesM[BLOCK_WORDS];                // block with all customers
+    BlockKernels *pKernels = index->pKernels;
+    Instr *pInstr;
+    Instr *pEnd = program->instrM + program->iNumInstr;
+    int iCount;                                // number of values on the stack
+    size_t iWord;                              // first word of the block
+    int iLastWord;                             // last word holding a customer
+    int b;
+    int w;
+
+    if (program->iMaxDepth > MAX_OUT_ITEM)
+        stackM = queryScratch(sizeof(localStackM[0]) * program->iMaxDepth);
+    memset(zeroM, 0, sizeof(zeroM));
+    memset(onesM, 0xff, sizeof(onesM));
+
+    for (b = iFirstBlock; b < iEndBlock; b++)
+    {
+        iWord = (size_t) b * BLOCK_WORDS;
+        iCount = 0;
+        for (pInstr = program->instrM; pInstr < pEnd; pInstr++)
+        {
+            switch (pInstr->iOpcode)
+            {
+                case OP_HAS:
+                    if (pInstr->trait.iTraitId == TRAIT_NOT_FOUND)
+                        pKernels->copyBlock(stackM[iCount], zeroM);
+                    else
+                        pKernels->copyBlock(stackM[iCount]
+                            , TRAIT_BITS(index, pInstr->trait.iTraitId) + iWord);
+                    iCount++;
+                    break;
+                case OP_NOTANY:
+                    if (pInstr->trait.iTraitId == TRAIT_NOT_FOUND)
+                        pKernels->copyBlock(stackM[iCount], onesM);
+                    else
+                        pKernels->notBlock(stackM[iCount]
+                            , TRAIT_BITS(index, pInstr->trait.iTraitId) + iWord);
+                    iCount++;
+                    break;
+                case OP_ONLY:
+                    if (pInstr->trait.iTraitId == TRAIT_NOT_FOUND)
+                        pKernels->copyBlock(stackM[iCount], zeroM);
+                    else
+                        pKernels->andBlock(stackM[iCount]
+                            , TRAIT_BITS(index, pInstr->trait.iTraitId) + iWord
+                            , ONLY_BITS(index, pInstr->trait.iTraitType) + iWord);
+                    iCount++;
+                    break;
+                case OP_AND:
+                    iCount--;
+                    pKernels->andBlock(stackM[iCount - 1], stackM[iCount - 1]
+                        , stackM[iCount]);
+                    break;
+                case OP_OR:
+                    iCount--;
+                    pKernels->orBlock(stackM[iCount - 1], stackM[iCount - 1]
+                        , stackM[iCount]);
+                    break;
+                case OP_TRUE:
+                    pKernels->copyBlock(stackM[iCount++], onesM);
+                    break;
+                case OP_JFALSE:
+                    if (pKernels->zeroBlock(stackM[iCount - 1]))
+                        pInstr = program->instrM + pInstr->iTarget - 1;
+                    break;
+                case OP_JTRUE:
+                    if (pKernels->onesBlock(stackM[iCount - 1]))
+                        pInstr = program->instrM + pInstr->iTarget - 1;
+                    break;
+            }
+        }
+        if (index->liveBitsM != NULL)
+            pKernels->andBlock(resultBitsM + iWord, stackM[0]
+                , index->liveBitsM + iWord);
+        else
+            pKernels->copyBlock(resultBitsM + iWord, stackM[0]);
+    }
+
+    // NOTANY turns on the bits past the last customer, so turn them off
+    if (iEndBlock == index->iNumBlocks && index->iNumCustomer > 0)
+    {
+        iLastWord = (index->iNumCustomer - 1) / BITS_PER_WORD;
+        bitmapClearTail(resultBitsM, index->iNumCustomer);
+        for (w = iLastWord + 1; w < index->iNumWords; w++)
+            resultBitsM[w] = 0;
+    }
+}
+
+/******************** bitmapFill **************************************
+void bitmapFill(BitWord bitsM[], int iNumBits)
+Purpose:
+    Turns on the first iNumBits bits of a bitmap and turns off the rest
+    of its last word.
+**************************************************************************/
+void bitmapFill(BitWord bitsM[], int iNumBits)
+{
+    memset(bitsM, 0xff, sizeof(BitWord) * BITMAP_WORDS(iNumBits));
+    bitmapClearTail(bitsM, iNumBits);
+}
+
+/******************** bitmapClearTail **************************************
+void bitmapClearTail(BitWord bitsM[], int iNumBits)
+Purpose:
+    Turns off the bits past iNumBits in the last word of a bitmap.
+**************************************************************************/
+void bitmapClearTail(BitWord bitsM[], int iNumBits)
+{
+    if (iNumBits % BITS_PER_WORD != 0)
+        bitsM[iNumBits / BITS_PER_WORD] &=
+            ((BitWord) 1 << (iNumBits % BITS_PER_WORD)) - 1;
+}
+
+/******************** bitmapCount **************************************
+int bitmapCount(BitWord bitsM[], int iNumWords)
+Purpose:
+    Returns the number of bits which are on in iNumWords words of a bitmap.
+**************************************************************************/
+int bitmapCount(BitWord bitsM[], int iNumWords)
+{
+    int iCount = 0;
+    int w;
+    for (w = 0; w < iNumWords; w++)
+        iCount += __builtin_popcountll(bitsM[w]);
+    return iCount;
+}
+
+/******************** bitmapMatches **************************************
+int bitmapMatches(BitWord bitsM[], int iFirstWord, int iEndWord, int matchM[]
+    , int iFound, int iWanted)
+Purpose:
+    Adds the subscripts of the bits which are on in words iFirstWord up to
+    iEndWord of a bitmap to matchM (which has iFound of them) until it has
+    iWanted.
+Returns:
+    The number of subscripts in matchM.
+**************************************************************************/
+int bitmapMatches(BitWord bitsM[], int iFirstWord, int iEndWord, int matchM[]
+    , int iFound, int iWanted)
+{
+    BitWord word;
+    int w;
+
+    for (w = iFirstWord; w < iEndWord && iFound < iWanted; w++)
+    {
+        // each iteration removes the lowest bit which is on
+        for (word = bitsM[w]; word != 0 && iFound < iWanted; word &= word - 1)
+            matchM[iFound++] = w * BITS_PER_WORD + __builtin_ctzll(word);
+    }
+    return iFound;
+}
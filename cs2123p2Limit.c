@@ -0,0 +1,270 @@
+/******************************************************************************
+cs2123p2Limit.c
+Purpose:
+    Implements the result modes of a query, which are a suffix at the end
+    of the query:
+        ... COUNT                 prints the number of customers satisfying
+                                  the query instead of the customers
+        ... LIMIT n               prints the first n customers satisfying it
+        ... LIMIT n OFFSET m      prints at most n customers satisfying it
+                                  after skipping the first m
+    The customers are in the order of the customer file.
+Notes:
+    1. COUNT, LIMIT and OFFSET are only a suffix when they follow an operand
+       or a right parenthesis, so a query can still use them as a trait
+       type or value (e.g., "RANK = COUNT").  A suffix which doesn't have
+       the above form is left in the query (which gives a warning).
+    2. With the index, COUNT is a popcount of the result bitmap (see
+       countProgramIndex), so the customers are never visited.  LIMIT
+       evaluates the index a block at a time and stops at the block with
+       the last customer it needs (see limitProgramIndex).  Without the
+       index, LIMIT stops running the query once it has enough customers.
+    3. The results of COUNT and LIMIT queries aren't cached.
+    4. For p2 -s, a LIMIT query only counts the customers it evaluated
+       before stopping (with the index, those in the blocks it evaluated).
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "cs2123p2.h"
+
+#define SUFFIX_TOKENS 5      // tokens of the longest suffix plus the one before it
+
+// QueryToken typedef is the position of a token in the text of a query
+typedef struct
+{
+    char *pszStart;             // first character of the token
+    int iLen;                   // number of characters in the token
+} QueryToken;
+
+/******************** sameToken **************************************
+static int sameToken(QueryToken *pToken, char *pszWord)
+Purpose:
+    Returns TRUE if a token of the query is the word.
+**************************************************************************/
+static int sameToken(QueryToken *pToken, char *pszWord)
+{
+    return pToken->iLen == (int) strlen(pszWord)
+        && memcmp(pToken->pszStart, pszWord, pToken->iLen) == 0;
+}
+
+/******************** tokenNumber **************************************
+static int tokenNumber(QueryToken *pToken, int *piValue)
+Purpose:
+    Converts a token of decimal digits to a number (at most INT_MAX).
+Returns:
+    TRUE - *piValue is the number
+    FALSE - the token isn't a number
+**************************************************************************/
+static int tokenNumber(QueryToken *pToken, int *piValue)
+{
+    long long lValue = 0;
+    int i;
+
+    for (i = 0; i < pToken->iLen; i++)
+    {
+        if (pToken->pszStart[i] < '0' || pToken->pszStart[i] > '9')
+            return FALSE;
+        lValue = lValue * 10 + (pToken->pszStart[i] - '0');
+        if (lValue > INT_MAX)
+            return FALSE;
+    }
+    *piValue = (int) lValue;
+    return pToken->iLen > 0;
+}
+
+/******************** endsOperand **************************************
+static int endsOperand(QueryToken *pToken)
+Purpose:
+    Returns TRUE if a token can end an expression (an operand or a right
+    parenthesis), so a suffix may follow it.
+**************************************************************************/
+static int endsOperand(QueryToken *pToken)
+{
+    Element element;
+    char szToken[MAX_TOKEN + 1];
+
+    if (pToken->iLen > MAX_TOKEN)
+        return TRUE;
+    memcpy(szToken, pToken->pszStart, pToken->iLen);
+    szToken[pToken->iLen] = '\0';
+    categorize(&element, szToken);
+    return element.iCategory == CAT_OPERAND || element.iCategory == CAT_RPAREN;
+}
+
+/******************** splitResultMode **************************************
+void splitResultMode(char *pszQuery, char szExpr[], ResultMode *pMode)
+Purpose:
+    Separates a query's COUNT or LIMIT n [OFFSET m] suffix from its
+    expression.
+Parameters:
+    I char *pszQuery          text line of the query
+    O char szExpr[]           the query without the suffix (its size must be
+                              at least the length of pszQuery plus one)
+    O ResultMode *pMode       the result mode (RESULT_ALL if there isn't
+                              a suffix)
+**************************************************************************/
+void splitResultMode(char *pszQuery, char szExpr[], ResultMode *pMode)
+{
+    QueryToken lastM[SUFFIX_TOKENS];    // the last tokens of the query
+    QueryToken *tokenM;         // tokenM[n - 1] is the query's last token
+    int iNumTokens = 0;
+    int iSuffix = -1;           // first token of the suffix
+    char *pszText = pszQuery;
+    int iLimit = 0;
+    int iOffset = 0;
+    int n;
+
+    pMode->iMode = RESULT_ALL;
+    pMode->iLimit = 0;
+    pMode->iOffset = 0;
+    strcpy(szExpr, pszQuery);
+
+    // find the tokens (like getToken, separated by blanks), keeping the
+    // last SUFFIX_TOKENS in order at the end of lastM
+    for (;;)
+    {
+        pszText += strspn(pszText, " \n\r");
+        if (*pszText == '\0')
+            break;
+        memmove(&lastM[0], &lastM[1], sizeof(QueryToken) * (SUFFIX_TOKENS - 1));
+        lastM[SUFFIX_TOKENS - 1].pszStart = pszText;
+        lastM[SUFFIX_TOKENS - 1].iLen = strcspn(pszText, " \n\r");
+        pszText += lastM[SUFFIX_TOKENS - 1].iLen;
+        iNumTokens++;
+    }
+    n = iNumTokens < SUFFIX_TOKENS ? iNumTokens : SUFFIX_TOKENS;
+    tokenM = lastM + SUFFIX_TOKENS - n;
+
+    if (n >= 2 && sameToken(&tokenM[n - 1], "COUNT"))
+    {
+        iSuffix = n - 1;
+        pMode->iMode = RESULT_COUNT;
+    }
+    else if (n >= 3 && sameToken(&tokenM[n - 2], "LIMIT")
+        && tokenNumber(&tokenM[n - 1], &iLimit))
+        iSuffix = n - 2;
+    else if (n >= 5 && sameToken(&tokenM[n - 4], "LIMIT")
+        && tokenNumber(&tokenM[n - 3], &iLimit)
+        && sameToken(&tokenM[n - 2], "OFFSET")
+        && tokenNumber(&tokenM[n - 1], &iOffset))
+        iSuffix = n - 4;
+    if (iSuffix < 0 || !endsOperand(&tokenM[iSuffix - 1]))
+    {
+        pMode->iMode = RESULT_ALL;
+        return;
+    }
+    if (pMode->iMode != RESULT_COUNT)
+    {
+        pMode->iMode = RESULT_LIMIT;
+        pMode->iLimit = iLimit;
+        pMode->iOffset = iOffset;
+    }
+    szExpr[tokenM[iSuffix].pszStart - pszQuery] = '\0';
+}
+
+/******************** resultModeWanted **************************************
+int resultModeWanted(ResultMode *pMode, int iNumCustomer)
+Purpose:
+    Returns the number of customers satisfying a query which must be found
+    for its result:  OFFSET plus LIMIT for a LIMIT query (but not more than
+    the customers), otherwise all of them.
+**************************************************************************/
+int resultModeWanted(ResultMode *pMode, int iNumCustomer)
+{
+    long long lWanted = (long long) pMode->iOffset + pMode->iLimit;
+
+    if (pMode->iMode != RESULT_LIMIT || lWanted > iNumCustomer)
+        return iNumCustomer;
+    return (int) lWanted;
+}
+
+/******************** resultModeCount **************************************
+long long resultModeCount(ResultMode *pMode, long long lNumMatches)
+Purpose:
+    Returns the number of customers in the result of a query which
+    lNumMatches customers satisfy (those in the window of a LIMIT query).
+**************************************************************************/
+long long resultModeCount(ResultMode *pMode, long long lNumMatches)
+{
+    if (pMode->iMode != RESULT_LIMIT)
+        return lNumMatches;
+    if (lNumMatches <= pMode->iOffset)
+        return 0;
+    lNumMatches -= pMode->iOffset;
+    return lNumMatches < pMode->iLimit ? lNumMatches : pMode->iLimit;
+}
+
+/******************** fprintQueryMode **************************************
+void fprintQueryMode(FILE *pFile, int iQueryCnt, Out out, ResultMode *pMode
+    , Customer customerM[], int iNumCustomer)
+Purpose:
+    Evaluates a converted COUNT or LIMIT query and prints its result (or a
+    warning).
+Parameters:
+    I/O FILE *pFile               stream receiving the output of the query
+    I   int iQueryCnt             number of the query in the query file
+    I   Out out                   the postfix form of the query
+    I   ResultMode *pMode         the query's COUNT or LIMIT
+    I   Customer customerM[]      array of customers and traits
+    I   int iNumCustomer          number of customers in customerM
+Notes:
+    - Uses the index (the global customerIndex) if it is the index of
+      customerM.
+**************************************************************************/
+void fprintQueryMode(FILE *pFile, int iQueryCnt, Out out, ResultMode *pMode
+    , Customer customerM[], int iNumCustomer)
+{
+    ProgramImp program;         // the query compiled from out
+    Writer writer;
+    int *matchM;                // customers found for a LIMIT query
+    int iFound = 0;             // customers found satisfying the query
+    int iWanted;
+    int iSkip;                  // customers found before the LIMIT window
+    int bCompiled;
+    int bIndexed = customerIndex != NULL && customerIndex->customerM == customerM
+        && customerIndex->iNumCustomer == iNumCustomer;
+    int i;
+
+    bCompiled = compileQuery(out, &program);
+    if (!fprintQueryCompiled(pFile, iQueryCnt, bCompiled))
+        return;
+
+    if (pMode->iMode == RESULT_COUNT)
+    {
+        if (bCompiled && bIndexed)
+            iFound = countProgramIndex(&program, customerIndex);
+        else if (bCompiled)
+        {
+            for (i = 0; i < iNumCustomer; i++)
+                if (runProgram(&program, &customerM[i]))
+                    iFound++;
+        }
+        if (bCompiled)
+            STATS_ADD(lScanned, iNumCustomer);
+        STATS_ADD(lMatched, iFound);
+        writer = newWriter(pFile);
+        writeResultCount(writer, iQueryCnt, iNumCustomer, iFound);
+        freeWriter(writer);
+        return;
+    }
+
+    iWanted = resultModeWanted(pMode, iNumCustomer);
+    matchM = queryAlloc(sizeof(int) * (iWanted + 1));
+    if (bCompiled && bIndexed)
+        iFound = limitProgramIndex(&program, customerIndex, matchM, iWanted);
+    else if (bCompiled)
+    {
+        for (i = 0; i < iNumCustomer && iFound < iWanted; i++)
+            if (runProgram(&program, &customerM[i]))
+                matchM[iFound++] = i;
+        STATS_ADD(lScanned, i);
+    }
+    STATS_ADD(lMatched, iFound);
+    iSkip = iFound < pMode->iOffset ? iFound : pMode->iOffset;
+    writer = newWriter(pFile);
+    writeResultMatches(writer, iQueryCnt, customerM, iNumCustomer
+        , matchM + iSkip, iFound - iSkip);
+    freeWriter(writer);
+}
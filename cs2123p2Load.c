@@ -0,0 +1,549 @@
+/******************************************************************************
+cs2123p2Load.c
+Purpose:
+    Implements the customer file loader.  The file is mapped into memory
+    (mmap) and its CUSTOMER and TRAIT records are scanned in place by a
+    hand-written tokenizer.  The record type, ID, name, trait type and
+    trait value are views (pointer and length) into the mapping; nothing
+    is copied until the ID and name are stored in the Customer and the
+    trait type and value are interned in the trait dictionary.
+Notes:
+    1. The tokenizer gives the same results as the original fgets, getToken
+       and sscanf parsing:
+           record type   ends at a space or carriage return; more than 10
+                         characters never match CUSTOMER or TRAIT
+           CUSTOMER      "%6s %20[^\n]" - an ID of up to 6 non-blank
+                         characters, then blanks, then up to 20 characters
+                         of name (which may contain blanks)
+           TRAIT         "%10s %12s" - a trait type of up to 10 non-blank
+                         characters, blanks, a trait value of up to 12
+       The count of scanned values is the same as sscanf's (including -1
+       when a line ends before the first value), so warnings are unchanged.
+    2. Whole lines are scanned, so a line longer than MAX_LINE_SIZE is no
+       longer split into several records.
+    3. If the file can't be mapped (e.g., it is a pipe), it is read into
+       memory instead.
+    4. parseCustomerTextParallel splits a large file into one byte range per
+       thread.  Each range after the first starts at a line beginning with
+       a CUSTOMER record.  Each thread parses its range into its own
+       customer store and trait dictionary and buffers its warnings.  The
+       dictionaries are then merged in file order, which gives the same
+       trait IDs as parsing serially, and each thread remaps its customers'
+       trait IDs.  The customers are appended in file order and the
+       warnings are printed in file order.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cs2123p2.h"
+
+#define READ_CHUNK 65536            // bytes read at a time when not mapping
+#define LOAD_RANGE_MIN (1 << 20)    // minimum bytes of a parallel parse range
+#define LOAD_MAX_THREADS 64         // maximum number of parse threads
+
+// LoadRange typedef is the work of one thread of parseCustomerTextParallel
+typedef struct
+{
+    char *pszBegin;             // first character of the range
+    char *pszEnd;               // position after the range
+    CustomerStore store;        // customers parsed from the range
+    TraitDict dict;             // trait types and values of the range
+    int *typeMapM;              // global trait type ID of each local type ID
+    int *traitMapM;             // global trait ID of each local trait ID
+    int bValid;                 // FALSE if a TRAIT preceded any CUSTOMER
+    char *pszWarnings;          // warnings printed while parsing
+    size_t iWarningsSize;       // length of pszWarnings
+} LoadRange;
+
+/******************** isBlank **************************************
+static int isBlank(char c)
+Purpose:
+    Returns TRUE for the white space characters skipped by scanf.
+**************************************************************************/
+static int isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f'
+        || c == '\r';
+}
+
+/******************** scanWord **************************************
+static char *scanWord(char *p, char *pEnd, int iMax, char **ppWord, int *piLen)
+Purpose:
+    Does what scanf's "%Ns" does for a view:  skips blanks and returns the
+    view of up to iMax non-blank characters.
+Returns:
+    The position after the word or NULL if the line ends before a word.
+**************************************************************************/
+static char *scanWord(char *p, char *pEnd, int iMax, char **ppWord, int *piLen)
+{
+    int iLen = 0;
+    while (p < pEnd && isBlank(*p))
+        p++;
+    if (p >= pEnd)
+        return NULL;
+    *ppWord = p;
+    while (p < pEnd && !isBlank(*p) && iLen < iMax)
+    {
+        p++;
+        iLen++;
+    }
+    *piLen = iLen;
+    return p;
+}
+
+/******************** copyView **************************************
+static void copyView(char szTarget[], char *p, int iLen)
+Purpose:
+    Copies a view into a zero-terminated string.
+**************************************************************************/
+static void copyView(char szTarget[], char *p, int iLen)
+{
+    memcpy(szTarget, p, iLen);
+    szTarget[iLen] = '\0';
+}
+
+/******************** scanCustomer **************************************
+static int scanCustomer(char *p, char *pEnd, Customer *pCustomer)
+Purpose:
+    Scans the ID and name of a CUSTOMER record into the customer.
+Returns:
+    The number of values scanned like sscanf returns it (-1 if the line
+    ends before the ID).
+**************************************************************************/
+static int scanCustomer(char *p, char *pEnd, Customer *pCustomer)
+{
+    char *pWord;
+    int iLen;
+
+    p = scanWord(p, pEnd, sizeof(pCustomer->szCustomerId) - 1, &pWord, &iLen);
+    if (p == NULL)
+        return -1;
+    copyView(pCustomer->szCustomerId, pWord, iLen);
+
+    // the name is the rest of the line (up to 20 characters) after blanks
+    while (p < pEnd && isBlank(*p))
+        p++;
+    if (p >= pEnd)
+        return 1;
+    iLen = pEnd - p;
+    if (iLen > (int) sizeof(pCustomer->szCustomerName) - 1)
+        iLen = sizeof(pCustomer->szCustomerName) - 1;
+    copyView(pCustomer->szCustomerName, p, iLen);
+    return 2;
+}
+
+/******************** mapTextFile **************************************
+int mapTextFile(FILE *pFile, TextFile *pText)
+Purpose:
+    Maps an open file into memory.  If it can't be mapped, it is read into
+    an allocated buffer.
+Parameters:
+    I FILE *pFile          the open file
+    O TextFile *pText      receives the address and size of the text
+Returns:
+    TRUE  - the file's text is available
+    FALSE - the file couldn't be read
+Notes:
+    - The text must be released with unmapTextFile.
+**************************************************************************/
+int mapTextFile(FILE *pFile, TextFile *pText)
+{
+    struct stat statBuf;
+    size_t iMax;
+    size_t iRead;
+
+    pText->pszText = NULL;
+    pText->iSize = 0;
+    pText->bMapped = FALSE;
+
+    if (fstat(fileno(pFile), &statBuf) == 0 && S_ISREG(statBuf.st_mode))
+    {
+        if (statBuf.st_size == 0)
+            return TRUE;
+        pText->pszText = mmap(NULL, statBuf.st_size, PROT_READ, MAP_PRIVATE
+            , fileno(pFile), 0);
+        if (pText->pszText != MAP_FAILED)
+        {
+            pText->iSize = statBuf.st_size;
+            pText->bMapped = TRUE;
+            madvise(pText->pszText, pText->iSize, MADV_SEQUENTIAL);
+            return TRUE;
+        }
+        pText->pszText = NULL;
+    }
+
+    // read the file since it couldn't be mapped
+    iMax = READ_CHUNK;
+    pText->pszText = malloc(iMax);
+    if (pText->pszText == NULL)
+        return FALSE;
+    while ((iRead = fread(pText->pszText + pText->iSize, 1, iMax - pText->iSize
+        , pFile)) > 0)
+    {
+        pText->iSize += iRead;
+        if (pText->iSize == iMax)
+        {
+            char *pszNew = realloc(pText->pszText, iMax * 2);
+            if (pszNew == NULL)
+                return FALSE;
+            pText->pszText = pszNew;
+            iMax *= 2;
+        }
+    }
+    return !ferror(pFile);
+}
+
+/******************** unmapTextFile **************************************
+void unmapTextFile(TextFile *pText)
+Purpose:
+    Releases the text of a file returned by mapTextFile.
+**************************************************************************/
+void unmapTextFile(TextFile *pText)
+{
+    if (pText->bMapped)
+        munmap(pText->pszText, pText->iSize);
+    else
+        free(pText->pszText);
+    pText->pszText = NULL;
+    pText->iSize = 0;
+}
+
+/******************** parseCustomerText **************************************
+int parseCustomerText(CustomerStore store, TraitDict dict, char *pszText
+    , char *pszEnd, FILE *pWarn)
+Purpose:
+    Parses CUSTOMER and TRAIT records of customer file text, adding the
+    customers and their traits to a customer store.
+Parameters:
+    I/O CustomerStore store   customers are added to this store
+    I/O TraitDict dict        trait types and values are interned here
+    I   char *pszText         first character of the text
+    I   char *pszEnd          position after the last character of the text
+    I/O FILE *pWarn           stream receiving the warnings
+Returns:
+    TRUE  - the text was parsed
+    FALSE - parsing stopped at a TRAIT record which preceded any CUSTOMER
+            record (the caller reports the error)
+Notes:
+    - Warnings for bad records are formatted like getCustomerData always
+      printed them.
+**************************************************************************/
+int parseCustomerText(CustomerStore store, TraitDict dict, char *pszText
+    , char *pszEnd, FILE *pWarn)
+{
+    char *pLine;                    // start of the current line
+    char *pEol;                     // end of the current line (its line feed)
+    char *pNext;                    // start of the next line
+    char *p;                        // scanning position in the line
+    char *pType;                    // view of the trait type
+    char *pValue;                   // view of the trait value
+    int iTypeLen;
+    int iValueLen;
+    int iRecordLen;                 // length of the record type
+    int iScanCnt;                   // number of values scanned
+    Customer *pCustomer = NULL;     // current customer. NULL until the first one
+    Trait trait;
+
+    for (pLine = pszText; pLine < pszEnd; pLine = pNext)
+    {
+        pEol = memchr(pLine, '\n', pszEnd - pLine);
+        if (pEol == NULL)
+        {
+            pEol = pszEnd;
+            pNext = pszEnd;
+        }
+        else
+            pNext = pEol + 1;
+
+        // if the line is just a line feed, skip it.
+        if (pEol == pLine)
+            continue;
+
+        // get the CUSTOMER or TRAIT record type which ends at a space or CR
+        for (p = pLine; p < pEol && *p != ' ' && *p != '\r'; p++)
+            ;
+        iRecordLen = p - pLine;
+        if (p < pEol)
+            p++;                    // skip the delimiter
+
+        if (iRecordLen == 8 && memcmp(pLine, "CUSTOMER", 8) == 0)
+        {
+            pCustomer = addCustomer(store);
+            iScanCnt = scanCustomer(p, pEol, pCustomer);
+            if (iScanCnt < 2)
+            {
+                fprintf(pWarn, ">> %.*s", (int) (pNext - pLine), pLine);
+                FWARNING(pWarn, "Expected ID and name, received %d successful values"
+                    , iScanCnt);
+            }
+        }
+        else if (iRecordLen == 5 && memcmp(pLine, "TRAIT", 5) == 0)
+        {
+            // what if we haven't received a CUSTOMER record yet
+            if (pCustomer == NULL)
+                return FALSE;
+
+            iScanCnt = 0;
+            p = scanWord(p, pEol, MAX_TRAIT_TYPE, &pType, &iTypeLen);
+            if (p == NULL)
+                iScanCnt = -1;
+            else if (scanWord(p, pEol, MAX_TRAIT_VALUE, &pValue, &iValueLen) == NULL)
+                iScanCnt = 1;
+            else
+                iScanCnt = 2;
+
+            if (iScanCnt < 2)
+            {
+                fprintf(pWarn, ">> %.*s", (int) (pNext - pLine), pLine);
+                FWARNING(pWarn
+                    , "Expected trait type and value, received %d successful values"
+                    , iScanCnt);
+                continue;
+            }
+            trait.iTraitType = addTraitTypeLen(dict, pType, iTypeLen);
+            trait.iTraitId = addTraitLen(dict, trait.iTraitType, pValue, iValueLen);
+            addCustomerTrait(store, pCustomer, trait);
+        }
+        else
+        {
+            fprintf(pWarn, ">> %.*s", (int) (pNext - pLine), pLine);
+            FWARNING(pWarn, "Bad Command in input, found '%.*s'"
+                , iRecordLen > 10 ? 10 : iRecordLen, pLine);
+        }
+    }
+    return TRUE;
+}
+
+/******************** loadThreadCount **************************************
+int loadThreadCount(size_t iSize)
+Purpose:
+    Returns the number of threads to use for parsing iSize bytes of customer
+    file text:  one per online CPU, but at least LOAD_RANGE_MIN bytes each.
+**************************************************************************/
+int loadThreadCount(size_t iSize)
+{
+    long lCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t iThreads = iSize / LOAD_RANGE_MIN;
+
+    if (lCpus < 1)
+        lCpus = 1;
+    if (iThreads > (size_t) lCpus)
+        iThreads = lCpus;
+    if (iThreads > LOAD_MAX_THREADS)
+        iThreads = LOAD_MAX_THREADS;
+    return iThreads < 1 ? 1 : (int) iThreads;
+}
+
+/******************** isCustomerLine **************************************
+static int isCustomerLine(char *p, char *pszEnd)
+Purpose:
+    Returns TRUE if the line starting at p has a CUSTOMER record type.
+**************************************************************************/
+static int isCustomerLine(char *p, char *pszEnd)
+{
+    return pszEnd - p >= 8 && memcmp(p, "CUSTOMER", 8) == 0
+        && (pszEnd - p == 8 || p[8] == ' ' || p[8] == '\r' || p[8] == '\n');
+}
+
+/******************** nextCustomerLine **************************************
+static char *nextCustomerLine(char *p, char *pszEnd)
+Purpose:
+    Returns the start of the first line beginning with a CUSTOMER record at
+    or after p which is at the start of a line, or pszEnd if there is none.
+**************************************************************************/
+static char *nextCustomerLine(char *p, char *pszEnd)
+{
+    while (p < pszEnd && !isCustomerLine(p, pszEnd))
+    {
+        p = memchr(p, '\n', pszEnd - p);
+        if (p == NULL)
+            return pszEnd;
+        p++;
+    }
+    return p;
+}
+
+/******************** lastCustomerLine **************************************
+char *lastCustomerLine(char *pszText, char *pszEnd)
+Purpose:
+    Returns the start of the last line after pszText which begins with a
+    CUSTOMER record, or NULL if there is none.
+Notes:
+    - The text before it holds whole customers (with all their traits), so
+      it can be parsed on its own.  Used to split a streamed customer file.
+    - pszEnd needn't be the end of the file, so the character after
+      CUSTOMER must be in the text (else it may be, e.g., CUSTOMERX).
+**************************************************************************/
+char *lastCustomerLine(char *pszText, char *pszEnd)
+{
+    char *p;
+
+    if (pszEnd - pszText <= 9)
+        return NULL;
+    for (p = pszEnd - 9; p > pszText; p--)
+    {
+        if (p[-1] == '\n' && isCustomerLine(p, pszEnd))
+            return p;
+    }
+    return NULL;
+}
+
+/******************** parseRangeThread **************************************
+static void *parseRangeThread(void *pArg)
+Purpose:
+    Thread which parses one LoadRange into its own store and dictionary.
+**************************************************************************/
+static void *parseRangeThread(void *pArg)
+{
+    LoadRange *pRange = (LoadRange *) pArg;
+    FILE *pWarn = open_memstream(&pRange->pszWarnings, &pRange->iWarningsSize);
+
+    if (pWarn == NULL)
+        ErrExit(ERR_ALGORITHM, "unable to buffer customer file warnings");
+    pRange->bValid = parseCustomerText(pRange->store, pRange->dict
+        , pRange->pszBegin, pRange->pszEnd, pWarn);
+    fclose(pWarn);
+    return NULL;
+}
+
+/******************** remapRangeThread **************************************
+static void *remapRangeThread(void *pArg)
+Purpose:
+    Thread which replaces the local trait IDs of a LoadRange's customers
+    with the global IDs.
+**************************************************************************/
+static void *remapRangeThread(void *pArg)
+{
+    LoadRange *pRange = (LoadRange *) pArg;
+    Customer *pCustomer;
+    Customer *pEnd = pRange->store->customerM + pRange->store->iNumCustomer;
+    int j;
+
+    for (pCustomer = pRange->store->customerM; pCustomer < pEnd; pCustomer++)
+    {
+        for (j = 0; j < pCustomer->iNumberOfTraits; j++)
+        {
+            pCustomer->traitM[j].iTraitType =
+                pRange->typeMapM[pCustomer->traitM[j].iTraitType];
+            pCustomer->traitM[j].iTraitId =
+                pRange->traitMapM[pCustomer->traitM[j].iTraitId];
+        }
+    }
+    return NULL;
+}
+
+/******************** parseCustomerTextParallel ********************************
+int parseCustomerTextParallel(CustomerStore store, TraitDict dict
+    , char *pszText, char *pszEnd, int iNumThreads, FILE *pWarn)
+Purpose:
+    Parses customer file text using several threads.  The result (the
+    customers, their trait IDs and the warnings printed to pWarn) is the
+    same as parseCustomerText's.
+Parameters:
+    I/O CustomerStore store   customers are added to this store
+    I/O TraitDict dict        trait types and values are interned here
+    I   char *pszText         first character of the text
+    I   char *pszEnd          position after the last character of the text
+    I   int iNumThreads       number of ranges (threads) to split the text into
+    I/O FILE *pWarn           stream receiving the warnings
+Returns:
+    TRUE  - the text was parsed
+    FALSE - a TRAIT record preceded any CUSTOMER record.  Like
+            parseCustomerText, the customers and warnings before it are kept.
+Notes:
+    - Ranges may be empty if the file has few CUSTOMER records.
+**************************************************************************/
+int parseCustomerTextParallel(CustomerStore store, TraitDict dict
+    , char *pszText, char *pszEnd, int iNumThreads, FILE *pWarn)
+{
+    LoadRange rangeM[LOAD_MAX_THREADS];
+    pthread_t threadM[LOAD_MAX_THREADS];
+    size_t iRangeSize;
+    char *p = pszText;
+    int iNumRanges;
+    int bValid = TRUE;
+    int r;
+    int i;
+
+    if (iNumThreads > LOAD_MAX_THREADS)
+        iNumThreads = LOAD_MAX_THREADS;
+    if (iNumThreads <= 1)
+        return parseCustomerText(store, dict, pszText, pszEnd, pWarn);
+
+    // split the text into ranges which (after the first) begin at a CUSTOMER line
+    iRangeSize = (pszEnd - pszText) / iNumThreads;
+    for (r = 0; r < iNumThreads; r++)
+    {
+        rangeM[r].pszBegin = p;
+        if (r == iNumThreads - 1)
+            p = pszEnd;
+        else if (p < pszText + (r + 1) * iRangeSize)
+            p = nextCustomerLine(pszText + (r + 1) * iRangeSize, pszEnd);
+        // realign a range which starts in the middle of a line
+        if (p < pszEnd && p > pszText && p[-1] != '\n')
+            p = nextCustomerLine(p, pszEnd);
+        rangeM[r].pszEnd = p;
+        rangeM[r].store = newCustomerStore();
+        rangeM[r].dict = newTraitDict();
+        rangeM[r].pszWarnings = NULL;
+        rangeM[r].iWarningsSize = 0;
+    }
+    iNumRanges = iNumThreads;
+
+    for (r = 0; r < iNumRanges; r++)
+        if (pthread_create(&threadM[r], NULL, parseRangeThread, &rangeM[r]) != 0)
+            ErrExit(ERR_ALGORITHM, "unable to create a parse thread");
+    for (r = 0; r < iNumRanges; r++)
+        pthread_join(threadM[r], NULL);
+
+    // a TRAIT before any CUSTOMER can only be in the first range.  Like the
+    // serial parse, stop after its warnings and customers.
+    if (!rangeM[0].bValid)
+    {
+        bValid = FALSE;
+        iNumRanges = 1;
+    }
+
+    // merge the dictionaries in file order to get the serial trait IDs
+    for (r = 0; r < iNumRanges; r++)
+    {
+        rangeM[r].typeMapM = malloc(sizeof(int) * (rangeM[r].dict->iNumTypes + 1));
+        rangeM[r].traitMapM = malloc(sizeof(int) * (rangeM[r].dict->iNumTraits + 1));
+        if (rangeM[r].typeMapM == NULL || rangeM[r].traitMapM == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory merging trait dictionaries");
+        for (i = 0; i < rangeM[r].dict->iNumTypes; i++)
+            rangeM[r].typeMapM[i] = addTraitType(dict
+                , rangeM[r].dict->typeM[i].szTraitType);
+        for (i = 0; i < rangeM[r].dict->iNumTraits; i++)
+            rangeM[r].traitMapM[i] = addTrait(dict
+                , rangeM[r].typeMapM[rangeM[r].dict->traitM[i].iTraitType]
+                , rangeM[r].dict->traitM[i].szTraitValue);
+    }
+
+    for (r = 0; r < iNumRanges; r++)
+        if (pthread_create(&threadM[r], NULL, remapRangeThread, &rangeM[r]) != 0)
+            ErrExit(ERR_ALGORITHM, "unable to create a parse thread");
+    for (r = 0; r < iNumRanges; r++)
+        pthread_join(threadM[r], NULL);
+
+    // append the customers and print the warnings in file order
+    for (r = 0; r < iNumThreads; r++)
+    {
+        if (r < iNumRanges)
+        {
+            fwrite(rangeM[r].pszWarnings, 1, rangeM[r].iWarningsSize, pWarn);
+            appendCustomerStore(store, rangeM[r].store);
+            free(rangeM[r].typeMapM);
+            free(rangeM[r].traitMapM);
+        }
+        else
+            freeCustomerStore(rangeM[r].store);
+        free(rangeM[r].pszWarnings);
+        freeTraitDict(rangeM[r].dict);
+    }
+    return bValid;
+}
@@ -0,0 +1,320 @@
+/******************************************************************************
+cs2123p2Pool.c
+Purpose:
+    Implements the query worker pool used by p2 -t threads.  The main
+    thread reads the query file and places each query in a slot of a ring
+    of QueryJobs.  Each worker thread takes the next unprocessed job and
+    processes it (processQuery) with its own Out and result array, printing
+    the job's output to the slot's OutputBuffer.  The main thread prints the
+    buffers in query order (the ring is the reorder buffer), so the output
+    is the same as processing the queries one at a time.
+Notes:
+    1. The queries only read the customers, the trait dictionary and the
+       customer index, so they need no locking.
+    2. The ring has POOL_JOBS_PER_THREAD slots per worker.  When every slot
+       holds a query which hasn't been printed, the main thread waits for
+       the oldest one before reading more queries.
+    3. An ErrExit in a worker (e.g., out of memory for a query) doesn't
+       exit immediately.  The error message is added to the query's output,
+       and the program exits (with the same return code) when that output
+       is printed.  The preceding queries are printed as if the queries
+       had been processed one at a time.  callTrapped provides this to
+       other code which buffers the output of queries (e.g., batch mode).
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include "cs2123p2.h"
+
+#define POOL_JOBS_PER_THREAD 4      // ring slots per worker thread
+
+// QueryJob typedef is one query and its output
+typedef struct
+{
+    char *pszQuery;                 // text line of the query (from getline,
+                                    // reused by the slot's next query)
+    size_t iQuerySize;              // size of pszQuery
+    int iQueryCnt;                  // number of the query in the query file
+    int bDone;                      // TRUE when the output is complete
+    int iExitRC;                    // 0 or the return code of an ErrExit
+    OutputBuffer output;            // output of the query (reused by the
+                                    // slot's next query)
+} QueryJob;
+
+// QueryPool typedef is the state shared by the main thread and the workers
+typedef struct
+{
+    pthread_mutex_t lock;           // protects the counters and bDone
+    pthread_cond_t jobReady;        // signaled when a job is read (or at EOF)
+    pthread_cond_t jobDone;         // signaled when a job is done
+    QueryJob *jobM;                 // ring of iNumJobs jobs
+    int iNumJobs;                   // number of slots in jobM
+    long lNextRead;                 // number of jobs read
+    long lNextTake;                 // number of jobs taken by workers
+    long lNextPrint;                // number of jobs printed
+    int bEof;                       // TRUE when there are no more queries
+    Customer *customerM;            // customers being queried
+    int iNumCustomer;               // number of customers in customerM
+} QueryPool;
+
+// ErrTrap typedef lets a worker catch an ErrExit for the query it processes
+typedef struct
+{
+    jmp_buf jmpBuf;                 // where processing the query resumes
+    FILE *pFile;                    // output of the query
+    int iExitRC;                    // return code passed to ErrExit
+} ErrTrap;
+
+// ErrExit trap of the current thread (NULL when not processing a query)
+static __thread ErrTrap *pErrTrap = NULL;
+
+/******************** queryErrorFile **************************************
+FILE *queryErrorFile()
+Purpose:
+    Returns the stream ErrExit should print its message to:  the output of
+    the query if the current thread is a worker processing a query,
+    otherwise stdout.
+**************************************************************************/
+FILE *queryErrorFile()
+{
+    if (pErrTrap == NULL)
+        return stdout;
+    return pErrTrap->pFile;
+}
+
+/******************** trapQueryError **************************************
+void trapQueryError(int iExitRC)
+Purpose:
+    Called by ErrExit in a worker thread.  Records the return code and
+    resumes the worker after the query (it does not return).
+**************************************************************************/
+void trapQueryError(int iExitRC)
+{
+    if (pErrTrap == NULL)
+        exit(iExitRC);
+    pErrTrap->iExitRC = iExitRC;
+    longjmp(pErrTrap->jmpBuf, 1);
+}
+
+/******************** callTrapped **************************************
+int callTrapped(FILE *pFile, void (*pfnCall)(void *pArg), void *pArg)
+Purpose:
+    Calls pfnCall(pArg) with ErrExit trapped:  if it calls ErrExit, the
+    error message is printed to pFile and callTrapped returns instead of
+    the program exiting.
+Parameters:
+    I/O FILE *pFile                   stream receiving an error message
+    I   void (*pfnCall)(void *pArg)   function to call
+    I   void *pArg                    its argument
+Returns:
+    0 - pfnCall returned
+    otherwise - the return code ErrExit would have exited with
+Notes:
+    - The caller should exit with the return code after printing the
+      output which precedes pFile's.
+**************************************************************************/
+int callTrapped(FILE *pFile, void (*pfnCall)(void *pArg), void *pArg)
+{
+    ErrTrap trap;
+    ErrTrap *pSaveTrap = pErrTrap;
+
+    trap.pFile = pFile;
+    trap.iExitRC = 0;
+    pErrTrap = &trap;
+    if (setjmp(trap.jmpBuf) == 0)
+        pfnCall(pArg);
+    pErrTrap = pSaveTrap;
+    return trap.iExitRC;
+}
+
+// QueryCall typedef is the arguments of processQuery for callTrapped
+typedef struct
+{
+    FILE *pFile;
+    QueryPool *pPool;
+    QueryJob *pJob;
+    Out out;
+    QueryResult *resultM;
+} QueryCall;
+
+/******************** callProcessQuery **************************************
+static void callProcessQuery(void *pArg)
+Purpose:
+    Calls processQuery with the arguments in a QueryCall.
+**************************************************************************/
+static void callProcessQuery(void *pArg)
+{
+    QueryCall *pCall = (QueryCall *) pArg;
+    processQuery(pCall->pFile, pCall->pJob->pszQuery, pCall->pJob->iQueryCnt
+        , pCall->out, pCall->pPool->customerM, pCall->pPool->iNumCustomer
+        , pCall->resultM);
+}
+
+/******************** runQueryJob **************************************
+static void runQueryJob(QueryPool *pPool, QueryJob *pJob, Out out
+    , QueryResult resultM[])
+Purpose:
+    Processes one query, printing its output to the job's OutputBuffer.
+**************************************************************************/
+static void runQueryJob(QueryPool *pPool, QueryJob *pJob, Out out
+    , QueryResult resultM[])
+{
+    QueryCall call;
+
+    call.pFile = openBufferStream(&pJob->output);
+    call.pPool = pPool;
+    call.pJob = pJob;
+    call.out = out;
+    call.resultM = resultM;
+    pJob->iExitRC = callTrapped(call.pFile, callProcessQuery, &call);
+    closeBufferStream(call.pFile);
+}
+
+/******************** queryWorker **************************************
+static void *queryWorker(void *pArg)
+Purpose:
+    Worker thread which processes jobs until there are no more queries.
+**************************************************************************/
+static void *queryWorker(void *pArg)
+{
+    QueryPool *pPool = (QueryPool *) pArg;
+    Out out = newOut();                         // postfix form of a query
+    QueryResult *resultM = malloc(sizeof(QueryResult) * (pPool->iNumCustomer + 1));
+    QueryJob *pJob;
+
+    if (resultM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for a query worker");
+    pthread_mutex_lock(&pPool->lock);
+    for (;;)
+    {
+        while (pPool->lNextTake == pPool->lNextRead && !pPool->bEof)
+            pthread_cond_wait(&pPool->jobReady, &pPool->lock);
+        if (pPool->lNextTake == pPool->lNextRead)
+            break;
+        pJob = &pPool->jobM[pPool->lNextTake % pPool->iNumJobs];
+        pPool->lNextTake++;
+        pthread_mutex_unlock(&pPool->lock);
+
+        runQueryJob(pPool, pJob, out, resultM);
+
+        pthread_mutex_lock(&pPool->lock);
+        pJob->bDone = TRUE;
+        pthread_cond_signal(&pPool->jobDone);
+    }
+    pthread_mutex_unlock(&pPool->lock);
+    freeOut(out);
+    free(resultM);
+    return NULL;
+}
+
+/******************** readAndProcessQueriesParallel ***************************
+void readAndProcessQueriesParallel(Customer customerM[], int iNumberOfCustomers
+    , int iNumThreads)
+Purpose:
+    Does what readAndProcessQueries does using iNumThreads worker threads.
+Parameters:
+    I Customer customerM[]    array of customers and traits
+    I int iNumberOfCustomers  number of customers in customerM
+    I int iNumThreads         number of worker threads
+Notes:
+    - References the global:  pFileQuery
+    - The main thread reads the queries and prints their output in order.
+**************************************************************************/
+void readAndProcessQueriesParallel(Customer customerM[], int iNumberOfCustomers
+    , int iNumThreads)
+{
+    QueryPool pool;
+    pthread_t *threadM = malloc(sizeof(pthread_t) * iNumThreads);
+    QueryJob *pJob;
+    int iQueryCnt = 1;
+    int iExitRC;
+    int t;
+
+    pool.iNumJobs = iNumThreads * POOL_JOBS_PER_THREAD;
+    pool.jobM = malloc(sizeof(QueryJob) * pool.iNumJobs);
+    if (threadM == NULL || pool.jobM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query workers");
+    for (t = 0; t < pool.iNumJobs; t++)
+    {
+        pool.jobM[t].pszQuery = NULL;
+        pool.jobM[t].iQuerySize = 0;
+        memset(&pool.jobM[t].output, 0, sizeof(OutputBuffer));
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.jobReady, NULL);
+    pthread_cond_init(&pool.jobDone, NULL);
+    pool.lNextRead = 0;
+    pool.lNextTake = 0;
+    pool.lNextPrint = 0;
+    pool.bEof = FALSE;
+    pool.customerM = customerM;
+    pool.iNumCustomer = iNumberOfCustomers;
+
+    // the customer dump must precede the queries' output
+    fflush(stdout);
+    for (t = 0; t < iNumThreads; t++)
+        if (pthread_create(&threadM[t], NULL, queryWorker, &pool) != 0)
+            ErrExit(ERR_ALGORITHM, "unable to create a query worker");
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;)
+    {
+        // print the completed jobs in query order
+        pJob = &pool.jobM[pool.lNextPrint % pool.iNumJobs];
+        if (pool.lNextPrint < pool.lNextRead && pJob->bDone)
+        {
+            pthread_mutex_unlock(&pool.lock);
+            fwrite(pJob->output.pszText, 1, pJob->output.iLength, stdout);
+            iExitRC = pJob->iExitRC;
+            if (iExitRC != 0)
+                exit(iExitRC);
+            pthread_mutex_lock(&pool.lock);
+            pool.lNextPrint++;
+            continue;
+        }
+        if (pool.bEof && pool.lNextPrint == pool.lNextRead)
+            break;
+
+        // read the next query if there is a free slot
+        if (!pool.bEof && pool.lNextRead - pool.lNextPrint < pool.iNumJobs)
+        {
+            pJob = &pool.jobM[pool.lNextRead % pool.iNumJobs];
+            pthread_mutex_unlock(&pool.lock);
+            if (getline(&pJob->pszQuery, &pJob->iQuerySize, pFileQuery) != -1)
+            {
+                pJob->iQueryCnt = iQueryCnt++;
+                pJob->bDone = FALSE;
+                pJob->iExitRC = 0;
+                pthread_mutex_lock(&pool.lock);
+                pool.lNextRead++;
+                pthread_cond_signal(&pool.jobReady);
+            }
+            else
+            {
+                pthread_mutex_lock(&pool.lock);
+                pool.bEof = TRUE;
+                pthread_cond_broadcast(&pool.jobReady);
+            }
+            continue;
+        }
+        pthread_cond_wait(&pool.jobDone, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    for (t = 0; t < iNumThreads; t++)
+        pthread_join(threadM[t], NULL);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.jobReady);
+    pthread_cond_destroy(&pool.jobDone);
+    for (t = 0; t < pool.iNumJobs; t++)
+    {
+        free(pool.jobM[t].pszQuery);
+        freeOutputBuffer(&pool.jobM[t].output);
+    }
+    free(pool.jobM);
+    free(threadM);
+    if (iOutputFormat == FORMAT_TEXT)
+        printf("\n");
+}
@@ -0,0 +1,885 @@
+/******************************************************************************
+cs2123p2Server.c
+Purpose:
+    Implements daemon mode (p2 -c customerFile -L socketFile).  The customers
+    are loaded (and indexed) once, and the queries of any number of clients
+    are answered over a Unix domain socket until p2 receives SIGINT or
+    SIGTERM.  A client writes queries to the socket, one per line like the
+    query file, and reads the output of each query in the output format
+    (-f).  The output to a client is what p2 -q prints for a query file of
+    its queries (without the customer dump).  A client may also write
+    updates, the lines of an update file (see cs2123p2Update.c), which
+    change the customers for the queries after them (see note 6).
+    The main thread runs an epoll event loop which:
+        - accepts the clients
+        - reads the clients' queries and queues them as ServerJobs for the
+          worker threads (-t, default 1)
+        - applies the queued updates when the workers are idle
+        - writes the output of each client's jobs in query order as they
+          are done
+    Each worker processes a job (processQuery) with its own Out and result
+    array, printing its output to the job's OutputBuffer, and wakes the
+    main thread through an eventfd.  A job whose output is written is kept
+    (with its query and output buffers) for a later query, so the daemon
+    stops allocating memory once it has served as many queries at once.
+Notes:
+    1. A query which would make p2 exit (e.g., the ERROR of addOut when
+       there is no memory for the Out) is processed with ErrExit trapped
+       (see callTrapped).  The ERROR is the query's output and the daemon
+       continues.
+    2. A query line may be of any length up to SERVER_MAX_LINE bytes
+       (with its new line), so a client can't make the daemon buffer a
+       line without bound.  A longer line is one query whose output is an
+       ERROR (see rejectClientLine), and the rest of it is discarded.  A
+       last line without a new line is a query when the client shuts down
+       its writing.
+    3. A client's socket isn't read while it has SERVER_MAX_PENDING queries
+       whose output hasn't been written, so a client which doesn't read its
+       output can't make the daemon buffer without bound.  A client should
+       read while writing (like p2client, see cs2123p2Client.c).
+    4. The csv heading row is the first output to each client, and the
+       blank line at the end of the text format is written after the
+       client shuts down its writing.  Then the connection is closed.
+    5. An existing socket file is only replaced if nothing accepts
+       connections on it.  The socket file is removed when p2 exits.
+    6. A line starting with ADD or REMOVE and CUSTOMER or TRAIT is an
+       update (see isUpdateRecord).  It is queued like a query, but the
+       workers don't take the jobs behind it.  When no worker is processing
+       a job, the main thread applies the updates at the front of the queue
+       (applyUpdate, then finishUpdates after the last one) and the workers
+       continue.  So the queries before an update (of any client) see the
+       customers without it, and the queries after it see them with it.
+       The cached results are invalidated like p2 -u does (see
+       cs2123p2Cache.c).  An update isn't counted as a query, and one which
+       can't be applied is printed with its warning like p2 -u prints it:
+       to the client for the text format, otherwise to stderr.
+       p2daemon.txt is the input of a client which queries p2customer.txt,
+       updates it and repeats the queries, and daemonOutput.txt is what
+       p2client prints for it.  With P2_CACHE_STATS set, the daemon prints
+       "3 hits, 5 misses" when it exits:  ADD TRAIT 22222 BOOK SCIFI only
+       discards the BOOK query, and REMOVE CUSTOMER 33333 only turns off
+       the customer's bit in the cached results.
+    7. With -s, the statistics are printed when p2 exits.  The query
+       numbers are per client, so a query number's statistics are those of
+       the last query processed with that number.
+******************************************************************************/
+#define _GNU_SOURCE                 // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include "cs2123p2.h"
+
+#define SERVER_BACKLOG 64           // connections waiting to be accepted
+#define SERVER_MAX_EVENTS 64        // epoll events handled per wait
+#define SERVER_READ_SIZE 4096       // bytes read from a client at a time
+#define SERVER_MAX_PENDING 64       // queries of a client not yet written
+#define SERVER_MAX_LINE (1 << 20)   // longest query line (longer ones are rejected)
+
+typedef struct ServerClient ServerClient;
+
+// ServerJob typedef is one query of a client and its output
+typedef struct ServerJob
+{
+    struct ServerJob *pNext;        // next job of the client (in query order)
+    struct ServerJob *pNextQueued;  // next job waiting for a worker or done
+    ServerClient *pClient;          // client which sent the query
+    char *pszQuery;                 // text line of the query (or update)
+    int iQueryMax;                  // bytes allocated for pszQuery
+    int bUpdate;                    // TRUE if pszQuery is an update
+    int iQueryCnt;                  // number of the query for the client
+    int bDone;                      // TRUE when the output is complete
+    OutputBuffer output;            // output of the query
+} ServerJob;
+
+// ServerClient is a connection to a client (only used by the main thread)
+struct ServerClient
+{
+    ServerClient *pNext;            // next client of the server
+    int iSocket;                    // connected socket
+    char *pszLine;                  // query line being read (doubles as
+    int iLineMax;                   // needed, up to SERVER_MAX_LINE bytes)
+    int iLineLen;                   // characters in pszLine
+    int iQueryCnt;                  // number of queries read
+    int bSkipLine;                  // TRUE while discarding a rejected line
+    ServerJob *pFirstJob;           // jobs whose output isn't written yet
+    ServerJob *pLastJob;            // (in query order)
+    int iNumJobs;                   // number of jobs in the list
+    int iNumRunning;                // jobs queued for or run by the workers
+    size_t iWritten;                // bytes of the first job's output written
+    unsigned int iEvents;           // epoll events of the socket
+    int bEof;                       // TRUE when the client shut down writing
+    int bClosed;                    // TRUE when the socket is closed
+};
+
+// Server typedef is the state shared by the main thread and the workers
+typedef struct
+{
+    pthread_mutex_t lock;           // protects the queue, iNumActive, pDone
+                                    // and bStop
+    pthread_cond_t jobReady;        // signaled when a job is queued (or bStop)
+    ServerJob *pFirstQueued;        // jobs waiting for a worker
+    ServerJob *pLastQueued;
+    int iNumActive;                 // jobs taken by the workers but not done
+    ServerJob *pDone;               // jobs done which the main thread hasn't seen
+    int bStop;                      // TRUE when the workers must exit
+    int iEpoll;                     // epoll instance of the main thread
+    int iListen;                    // listening socket
+    int iDoneEvent;                 // eventfd signaled when a job is done
+    int iSignal;                    // signalfd of SIGINT and SIGTERM
+    ServerClient *pClients;         // connected clients
+    ServerClient *pReleased;        // closed clients to free after the events
+    ServerJob *pFreeJobs;           // written jobs kept for later queries
+    CustomerStore store;            // customers being queried and updated
+} Server;
+
+// ServerCall typedef is the arguments of processQuery for callTrapped
+typedef struct
+{
+    FILE *pFile;
+    Server *pServer;
+    ServerJob *pJob;
+    Out out;
+    QueryResult *resultM;
+} ServerCall;
+
+/******************** callServerQuery **************************************
+static void callServerQuery(void *pArg)
+Purpose:
+    Calls processQuery with the arguments in a ServerCall.
+**************************************************************************/
+static void callServerQuery(void *pArg)
+{
+    ServerCall *pCall = (ServerCall *) pArg;
+    processQuery(pCall->pFile, pCall->pJob->pszQuery, pCall->pJob->iQueryCnt
+        , pCall->out, pCall->pServer->store->customerM
+        , pCall->pServer->store->iNumCustomer, pCall->resultM);
+}
+
+/******************** runServerJob **************************************
+static void runServerJob(Server *pServer, ServerJob *pJob, Out out
+    , QueryResult resultM[])
+Purpose:
+    Processes one query, printing its output to the job's OutputBuffer.
+Notes:
+    - The return code of a trapped ErrExit is ignored:  its ERROR is the
+      query's output, and the daemon continues.
+**************************************************************************/
+static void runServerJob(Server *pServer, ServerJob *pJob, Out out
+    , QueryResult resultM[])
+{
+    ServerCall call;
+
+    call.pFile = openBufferStream(&pJob->output);
+    call.pServer = pServer;
+    call.pJob = pJob;
+    call.out = out;
+    call.resultM = resultM;
+    callTrapped(call.pFile, callServerQuery, &call);
+    closeBufferStream(call.pFile);
+}
+
+/******************** serverWorker **************************************
+static void *serverWorker(void *pArg)
+Purpose:
+    Worker thread which processes queued jobs until the server stops.
+Notes:
+    - A job behind an update isn't taken until the main thread has
+      applied the update.  The customers don't change while a job is
+      taken, so the result array grows when a job is taken if customers
+      were added.
+**************************************************************************/
+static void *serverWorker(void *pArg)
+{
+    Server *pServer = (Server *) pArg;
+    Out out = newOut();                         // postfix form of a query
+    QueryResult *resultM = NULL;
+    int iMaxResult = 0;                         // elements of resultM
+    ServerJob *pJob;
+    int iNumCustomer;
+    uint64_t lOne = 1;
+
+    pthread_mutex_lock(&pServer->lock);
+    for (;;)
+    {
+        while ((pServer->pFirstQueued == NULL || pServer->pFirstQueued->bUpdate)
+            && !pServer->bStop)
+            pthread_cond_wait(&pServer->jobReady, &pServer->lock);
+        if (pServer->bStop)
+            break;
+        pJob = pServer->pFirstQueued;
+        pServer->pFirstQueued = pJob->pNextQueued;
+        pServer->iNumActive++;
+        iNumCustomer = pServer->store->iNumCustomer;
+        pthread_mutex_unlock(&pServer->lock);
+
+        if (iNumCustomer + 1 > iMaxResult)
+        {
+            iMaxResult = iNumCustomer + 1;
+            resultM = realloc(resultM, sizeof(QueryResult) * iMaxResult);
+            if (resultM == NULL)
+                ErrExit(ERR_ALGORITHM, "out of memory for a query worker");
+        }
+        runServerJob(pServer, pJob, out, resultM);
+
+        pthread_mutex_lock(&pServer->lock);
+        pServer->iNumActive--;
+        pJob->pNextQueued = pServer->pDone;
+        pServer->pDone = pJob;
+        // the main thread reads the count, so a failed write only delays it
+        if (write(pServer->iDoneEvent, &lOne, sizeof(lOne)) < 0)
+            continue;
+    }
+    pthread_mutex_unlock(&pServer->lock);
+    freeOut(out);
+    free(resultM);
+    return NULL;
+}
+
+/******************** openServerSocket **************************************
+static int openServerSocket(char *pszSocketFileNm)
+Purpose:
+    Creates the nonblocking socket listening on the socket file.
+Returns:
+    The listening socket.
+Notes:
+    - A socket file which nothing accepts connections on (e.g., left by a
+      daemon which was killed) is replaced.
+**************************************************************************/
+static int openServerSocket(char *pszSocketFileNm)
+{
+    struct sockaddr_un addr;
+    struct stat statBuf;
+    int iListen;
+    int iProbe;
+
+    if (strlen(pszSocketFileNm) >= sizeof(addr.sun_path))
+        ErrExit(ERR_ALGORITHM, "socket file name is too long: %s", pszSocketFileNm);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, pszSocketFileNm);
+
+    if (stat(pszSocketFileNm, &statBuf) == 0 && S_ISSOCK(statBuf.st_mode))
+    {
+        iProbe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (iProbe >= 0 && connect(iProbe, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+            ErrExit(ERR_ALGORITHM, "a daemon is using the socket file %s"
+                , pszSocketFileNm);
+        if (iProbe >= 0)
+            close(iProbe);
+        unlink(pszSocketFileNm);
+    }
+
+    iListen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (iListen < 0
+        || bind(iListen, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(iListen, SERVER_BACKLOG) != 0)
+        ErrExit(ERR_ALGORITHM, "unable to listen on the socket file %s: %s"
+            , pszSocketFileNm, strerror(errno));
+    return iListen;
+}
+
+/******************** watchEvents **************************************
+static void watchEvents(Server *pServer, int iOp, int iFd, unsigned int iEvents
+    , void *pData)
+Purpose:
+    Adds, modifies or deletes (iOp) the events of a descriptor in the
+    server's epoll instance.  pData identifies the descriptor in the events.
+**************************************************************************/
+static void watchEvents(Server *pServer, int iOp, int iFd, unsigned int iEvents
+    , void *pData)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = iEvents;
+    event.data.ptr = pData;
+    if (epoll_ctl(pServer->iEpoll, iOp, iFd, &event) != 0 && iOp != EPOLL_CTL_DEL)
+        ErrExit(ERR_ALGORITHM, "unable to watch a descriptor: %s", strerror(errno));
+}
+
+/******************** addClientJob **************************************
+static ServerJob *addClientJob(Server *pServer, ServerClient *pClient)
+Purpose:
+    Adds an empty job to the end of a client's jobs.  A job kept by
+    releaseJob is reused (with its buffers) if there is one.
+**************************************************************************/
+static ServerJob *addClientJob(Server *pServer, ServerClient *pClient)
+{
+    ServerJob *pJob = pServer->pFreeJobs;
+
+    if (pJob != NULL)
+    {
+        pServer->pFreeJobs = pJob->pNext;
+        pJob->pNext = NULL;
+        pJob->pNextQueued = NULL;
+        pJob->iQueryCnt = 0;
+        pJob->bDone = FALSE;
+        pJob->output.iLength = 0;
+    }
+    else
+    {
+        pJob = calloc(1, sizeof(ServerJob));
+        if (pJob == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory for a query");
+    }
+    pJob->pClient = pClient;
+    if (pClient->pLastJob == NULL)
+        pClient->pFirstJob = pJob;
+    else
+        pClient->pLastJob->pNext = pJob;
+    pClient->pLastJob = pJob;
+    pClient->iNumJobs++;
+    return pJob;
+}
+
+/******************** releaseJob **************************************
+static void releaseJob(Server *pServer, ServerJob *pJob)
+Purpose:
+    Keeps a job whose output is written for a later query.
+**************************************************************************/
+static void releaseJob(Server *pServer, ServerJob *pJob)
+{
+    pJob->pClient = NULL;
+    pJob->pNext = pServer->pFreeJobs;
+    pServer->pFreeJobs = pJob;
+}
+
+/******************** freeJob **************************************
+static void freeJob(ServerJob *pJob)
+Purpose:
+    Frees a job and its buffers.
+**************************************************************************/
+static void freeJob(ServerJob *pJob)
+{
+    free(pJob->pszQuery);
+    freeOutputBuffer(&pJob->output);
+    free(pJob);
+}
+
+/******************** openClientOutput **************************************
+static FILE *openClientOutput(Server *pServer, ServerClient *pClient)
+Purpose:
+    Adds a job which is done to the end of a client's jobs and returns a
+    stream which receives its output (e.g., the csv heading row).  The
+    output is complete when the stream is closed by closeBufferStream.
+**************************************************************************/
+static FILE *openClientOutput(Server *pServer, ServerClient *pClient)
+{
+    ServerJob *pJob = addClientJob(pServer, pClient);
+
+    pJob->bDone = TRUE;
+    return openBufferStream(&pJob->output);
+}
+
+/******************** queueClientQuery **************************************
+static void queueClientQuery(Server *pServer, ServerClient *pClient)
+Purpose:
+    Queues the client's query line (pszLine) for the workers, or an update
+    line to be applied by applyQueuedUpdates.
+**************************************************************************/
+static void queueClientQuery(Server *pServer, ServerClient *pClient)
+{
+    ServerJob *pJob = addClientJob(pServer, pClient);
+
+    if (pJob->iQueryMax < pClient->iLineLen + 1)
+    {
+        pJob->iQueryMax = pClient->iLineLen + 1;
+        pJob->pszQuery = realloc(pJob->pszQuery, pJob->iQueryMax);
+        if (pJob->pszQuery == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory for a query");
+    }
+    memcpy(pJob->pszQuery, pClient->pszLine, pClient->iLineLen);
+    pJob->pszQuery[pClient->iLineLen] = '\0';
+    pClient->iLineLen = 0;
+    pJob->bUpdate = isUpdateRecord(pJob->pszQuery);
+    if (!pJob->bUpdate)
+        pJob->iQueryCnt = ++pClient->iQueryCnt;
+    pClient->iNumRunning++;
+
+    pthread_mutex_lock(&pServer->lock);
+    if (pServer->pFirstQueued == NULL)
+        pServer->pFirstQueued = pJob;
+    else
+        pServer->pLastQueued->pNextQueued = pJob;
+    pServer->pLastQueued = pJob;
+    pthread_cond_signal(&pServer->jobReady);
+    pthread_mutex_unlock(&pServer->lock);
+}
+
+/******************** rejectClientLine **************************************
+static void rejectClientLine(Server *pServer, ServerClient *pClient)
+Purpose:
+    Rejects the client's query line which is longer than SERVER_MAX_LINE:
+    it is counted as a query whose output is an ERROR, and the rest of the
+    line is discarded as it is read.
+**************************************************************************/
+static void rejectClientLine(Server *pServer, ServerClient *pClient)
+{
+    FILE *pFile = openClientOutput(pServer, pClient);
+
+    pClient->pLastJob->iQueryCnt = ++pClient->iQueryCnt;
+    fprintf(pFile, "ERROR: query line is longer than %d bytes\n", SERVER_MAX_LINE);
+    closeBufferStream(pFile);
+    pClient->iLineLen = 0;
+    pClient->bSkipLine = TRUE;
+}
+
+/******************** applyServerUpdate **************************************
+static void applyServerUpdate(Server *pServer, ServerJob *pJob)
+Purpose:
+    Applies an update job.  If it can't be applied, the update and its
+    warning are the job's output (text format) or printed to stderr.
+**************************************************************************/
+static void applyServerUpdate(Server *pServer, ServerJob *pJob)
+{
+    FILE *pFile = openBufferStream(&pJob->output);
+    FILE *pWarn = iOutputFormat == FORMAT_TEXT ? pFile : warningFile();
+    int rc = applyUpdate(pServer->store, pJob->pszQuery);
+
+    if (rc != UPDATE_OK)
+    {
+        fprintf(pWarn, ">> %.*s\n", (int) strcspn(pJob->pszQuery, "\r\n")
+            , pJob->pszQuery);
+        FWARNING(pWarn, "%s", updateMessage(rc));
+    }
+    closeBufferStream(pFile);
+}
+
+
+/******************** freeClient **************************************
+static void freeClient(ServerClient *pClient)
+Purpose:
+    Frees a client and its jobs, closing its socket if it is open.
+**************************************************************************/
+static void freeClient(ServerClient *pClient)
+{
+    ServerJob *pJob;
+
+    while (pClient->pFirstJob != NULL)
+    {
+        pJob = pClient->pFirstJob;
+        pClient->pFirstJob = pJob->pNext;
+        freeJob(pJob);
+    }
+    if (!pClient->bClosed)
+        close(pClient->iSocket);
+    free(pClient->pszLine);
+    free(pClient);
+}
+
+/******************** releaseClient **************************************
+static void releaseClient(Server *pServer, ServerClient *pClient)
+Purpose:
+    Moves a closed client which the workers are done with from the
+    server's clients to the clients freed after the events being handled
+    (which may refer to it).
+**************************************************************************/
+static void releaseClient(Server *pServer, ServerClient *pClient)
+{
+    ServerClient **ppClient = &pServer->pClients;
+
+    while (*ppClient != pClient)
+        ppClient = &(*ppClient)->pNext;
+    *ppClient = pClient->pNext;
+    pClient->pNext = pServer->pReleased;
+    pServer->pReleased = pClient;
+}
+
+/******************** closeClient **************************************
+static void closeClient(Server *pServer, ServerClient *pClient)
+Purpose:
+    Closes a client's socket.  The client is released once the workers
+    are done with its jobs.
+**************************************************************************/
+static void closeClient(Server *pServer, ServerClient *pClient)
+{
+    if (pClient->bClosed)
+        return;
+    watchEvents(pServer, EPOLL_CTL_DEL, pClient->iSocket, 0, NULL);
+    close(pClient->iSocket);
+    pClient->bClosed = TRUE;
+    if (pClient->iNumRunning == 0)
+        releaseClient(pServer, pClient);
+}
+
+/******************** writeClient **************************************
+static void writeClient(Server *pServer, ServerClient *pClient)
+Purpose:
+    Writes the output of a client's jobs which are done, in query order,
+    until one isn't done or the socket is full.  Then it closes the client
+    if it shut down writing and all of its output is written, otherwise it
+    updates the events watched for the client:
+        EPOLLIN     unless it shut down writing or has SERVER_MAX_PENDING
+                    jobs
+        EPOLLOUT    if the socket was full
+**************************************************************************/
+static void writeClient(Server *pServer, ServerClient *pClient)
+{
+    ServerJob *pJob;
+    ssize_t iSent;
+    unsigned int iEvents = 0;
+
+    while ((pJob = pClient->pFirstJob) != NULL && pJob->bDone)
+    {
+        if (pClient->iWritten < pJob->output.iLength)
+        {
+            iSent = send(pClient->iSocket, pJob->output.pszText + pClient->iWritten
+                , pJob->output.iLength - pClient->iWritten, MSG_NOSIGNAL);
+            if (iSent < 0 && errno == EINTR)
+                continue;
+            if (iSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (iSent < 0)
+            {
+                closeClient(pServer, pClient);
+                return;
+            }
+            pClient->iWritten += iSent;
+            continue;
+        }
+        // the job's output is written
+        pClient->pFirstJob = pJob->pNext;
+        if (pClient->pFirstJob == NULL)
+            pClient->pLastJob = NULL;
+        pClient->iNumJobs--;
+        pClient->iWritten = 0;
+        releaseJob(pServer, pJob);
+    }
+
+    if (pClient->bEof && pClient->pFirstJob == NULL)
+    {
+        closeClient(pServer, pClient);
+        return;
+    }
+    if (!pClient->bEof && pClient->iNumJobs < SERVER_MAX_PENDING)
+        iEvents |= EPOLLIN;
+    if (pJob != NULL && pJob->bDone)
+        iEvents |= EPOLLOUT;
+    if (iEvents != pClient->iEvents)
+    {
+        watchEvents(pServer, EPOLL_CTL_MOD, pClient->iSocket, iEvents, pClient);
+        pClient->iEvents = iEvents;
+    }
+}
+
+/******************** readClient **************************************
+static void readClient(Server *pServer, ServerClient *pClient)
+Purpose:
+    Reads what a client has written and queues each query line.  When the
+    client shuts down writing, its last line (if it doesn't end with a new
+    line) is queued and the text format's blank line is added to its
+    output.
+**************************************************************************/
+static void readClient(Server *pServer, ServerClient *pClient)
+{
+    char szBuffer[SERVER_READ_SIZE];
+    ssize_t iRead;
+    ssize_t i;
+    FILE *pFile;
+
+    iRead = recv(pClient->iSocket, szBuffer, sizeof(szBuffer), 0);
+    if (iRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (iRead < 0)
+    {
+        closeClient(pServer, pClient);
+        return;
+    }
+    if (iRead == 0)
+    {
+        if (pClient->iLineLen > 0)
+            queueClientQuery(pServer, pClient);
+        if (iOutputFormat == FORMAT_TEXT)
+        {
+            pFile = openClientOutput(pServer, pClient);
+            fprintf(pFile, "\n");
+            closeBufferStream(pFile);
+        }
+        pClient->bEof = TRUE;
+        writeClient(pServer, pClient);
+        return;
+    }
+    for (i = 0; i < iRead; i++)
+    {
+        if (pClient->bSkipLine)
+        {
+            pClient->bSkipLine = szBuffer[i] != '\n';
+            continue;
+        }
+        // like getline, but a line can't be longer than SERVER_MAX_LINE
+        if (szBuffer[i] != '\n' && pClient->iLineLen == SERVER_MAX_LINE - 1)
+        {
+            rejectClientLine(pServer, pClient);
+            continue;
+        }
+        if (pClient->iLineLen == pClient->iLineMax)
+        {
+            pClient->iLineMax = pClient->iLineMax > 0
+                ? pClient->iLineMax * 2 : SERVER_READ_SIZE;
+            pClient->pszLine = realloc(pClient->pszLine, pClient->iLineMax);
+            if (pClient->pszLine == NULL)
+                ErrExit(ERR_ALGORITHM, "out of memory for a query line");
+        }
+        pClient->pszLine[pClient->iLineLen++] = szBuffer[i];
+        if (szBuffer[i] == '\n')
+            queueClientQuery(pServer, pClient);
+    }
+    // stops reading the client if it has too many queries
+    writeClient(pServer, pClient);
+}
+
+/******************** acceptClients **************************************
+static void acceptClients(Server *pServer)
+Purpose:
+    Accepts the connections waiting on the listening socket.
+**************************************************************************/
+static void acceptClients(Server *pServer)
+{
+    ServerClient *pClient;
+    Writer writer;
+    FILE *pFile;
+    int iSocket;
+
+    for (;;)
+    {
+        iSocket = accept4(pServer->iListen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (iSocket < 0 && (errno == EINTR || errno == ECONNABORTED))
+            continue;
+        // EAGAIN when there are no more (other errors are retried later)
+        if (iSocket < 0)
+            return;
+        pClient = calloc(1, sizeof(ServerClient));
+        if (pClient == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory for a client");
+        pClient->iSocket = iSocket;
+        pClient->iEvents = EPOLLIN;
+        pClient->pNext = pServer->pClients;
+        pServer->pClients = pClient;
+        watchEvents(pServer, EPOLL_CTL_ADD, iSocket, pClient->iEvents, pClient);
+        if (iOutputFormat == FORMAT_CSV)
+        {
+            pFile = openClientOutput(pServer, pClient);
+            writer = newWriter(pFile);
+            writeCsvHeading(writer);
+            freeWriter(writer);
+            closeBufferStream(pFile);
+            writeClient(pServer, pClient);
+        }
+    }
+}
+
+/******************** finishJob **************************************
+static void finishJob(Server *pServer, ServerJob *pJob)
+Purpose:
+    Marks a job as done and writes its client's output (or releases the
+    client if it is closed and this was its last running job).
+**************************************************************************/
+static void finishJob(Server *pServer, ServerJob *pJob)
+{
+    ServerClient *pClient = pJob->pClient;
+
+    pJob->bDone = TRUE;
+    pClient->iNumRunning--;
+    if (!pClient->bClosed)
+        writeClient(pServer, pClient);
+    else if (pClient->iNumRunning == 0)
+        releaseClient(pServer, pClient);
+}
+
+/******************** finishDoneJobs **************************************
+static void finishDoneJobs(Server *pServer)
+Purpose:
+    Marks the jobs the workers have done as done and writes their clients'
+    output.
+**************************************************************************/
+static void finishDoneJobs(Server *pServer)
+{
+    ServerJob *pJob;
+    ServerJob *pNextJob;
+    uint64_t lCount;
+
+    // resets the eventfd (it is nonblocking)
+    if (read(pServer->iDoneEvent, &lCount, sizeof(lCount)) < 0)
+        lCount = 0;
+    pthread_mutex_lock(&pServer->lock);
+    pJob = pServer->pDone;
+    pServer->pDone = NULL;
+    pthread_mutex_unlock(&pServer->lock);
+
+    for (; pJob != NULL; pJob = pNextJob)
+    {
+        pNextJob = pJob->pNextQueued;
+        finishJob(pServer, pJob);
+    }
+}
+
+/******************** applyQueuedUpdates **************************************
+static void applyQueuedUpdates(Server *pServer)
+Purpose:
+    Applies the updates at the front of the queue if no worker is
+    processing a job, and then lets the workers take the jobs behind them.
+Notes:
+    - The workers don't take an update (or the jobs behind it), and only
+      the main thread adds jobs to the queue, so the updates are applied
+      without the lock.
+    - finishUpdates is called after the last of the consecutive updates,
+      before the workers can take the next query.
+**************************************************************************/
+static void applyQueuedUpdates(Server *pServer)
+{
+    ServerJob *pJob;
+
+    pthread_mutex_lock(&pServer->lock);
+    while (pServer->iNumActive == 0 && (pJob = pServer->pFirstQueued) != NULL
+        && pJob->bUpdate)
+    {
+        pthread_mutex_unlock(&pServer->lock);
+        applyServerUpdate(pServer, pJob);
+        if (pJob->pNextQueued == NULL || !pJob->pNextQueued->bUpdate)
+            finishUpdates(pServer->store);
+        pthread_mutex_lock(&pServer->lock);
+        pServer->pFirstQueued = pJob->pNextQueued;
+        if (pServer->pFirstQueued != NULL)
+            pthread_cond_broadcast(&pServer->jobReady);
+        pthread_mutex_unlock(&pServer->lock);
+        finishJob(pServer, pJob);
+        pthread_mutex_lock(&pServer->lock);
+    }
+    pthread_mutex_unlock(&pServer->lock);
+}
+
+/******************** serveQueries **************************************
+void serveQueries(CustomerStore store, char *pszSocketFileNm, int iNumThreads)
+Purpose:
+    Answers the queries (and applies the updates) of clients connecting to
+    a Unix domain socket until p2 receives SIGINT or SIGTERM.
+Parameters:
+    I/O CustomerStore store   the customers being queried and updated
+    I char *pszSocketFileNm   file name of the socket
+    I int iNumThreads         number of worker threads
+Notes:
+    - SIGINT and SIGTERM are blocked (and read from a signalfd) while
+      serving.  The clients which are connected are disconnected.
+**************************************************************************/
+void serveQueries(CustomerStore store, char *pszSocketFileNm, int iNumThreads)
+{
+    Server server;
+    pthread_t *threadM = malloc(sizeof(pthread_t) * iNumThreads);
+    struct epoll_event eventM[SERVER_MAX_EVENTS];
+    sigset_t signals;
+    struct signalfd_siginfo signalInfo;
+    ServerClient *pClient;
+    ServerJob *pJob;
+    void *pData;
+    int bServing = TRUE;
+    int iNumEvents;
+    int e;
+    int t;
+
+    if (threadM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the query workers");
+    memset(&server, 0, sizeof(server));
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.jobReady, NULL);
+    server.store = store;
+
+    // the workers inherit the blocked signals
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    server.iSignal = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    server.iDoneEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.iEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (server.iSignal < 0 || server.iDoneEvent < 0 || server.iEpoll < 0)
+        ErrExit(ERR_ALGORITHM, "unable to create the daemon's events: %s"
+            , strerror(errno));
+    server.iListen = openServerSocket(pszSocketFileNm);
+    watchEvents(&server, EPOLL_CTL_ADD, server.iListen, EPOLLIN, &server.iListen);
+    watchEvents(&server, EPOLL_CTL_ADD, server.iDoneEvent, EPOLLIN, &server.iDoneEvent);
+    watchEvents(&server, EPOLL_CTL_ADD, server.iSignal, EPOLLIN, &server.iSignal);
+
+    // the warnings of the customer file precede serving
+    fflush(stdout);
+    for (t = 0; t < iNumThreads; t++)
+        if (pthread_create(&threadM[t], NULL, serverWorker, &server) != 0)
+            ErrExit(ERR_ALGORITHM, "unable to create a query worker");
+
+    while (bServing)
+    {
+        iNumEvents = epoll_wait(server.iEpoll, eventM, SERVER_MAX_EVENTS, -1);
+        if (iNumEvents < 0 && errno == EINTR)
+            continue;
+        if (iNumEvents < 0)
+            ErrExit(ERR_ALGORITHM, "unable to wait for the daemon's events: %s"
+                , strerror(errno));
+        for (e = 0; e < iNumEvents; e++)
+        {
+            pData = eventM[e].data.ptr;
+            if (pData == &server.iListen)
+                acceptClients(&server);
+            else if (pData == &server.iDoneEvent)
+                finishDoneJobs(&server);
+            else if (pData == &server.iSignal)
+            {
+                // read the signal, so it isn't pending when it is unblocked
+                if (read(server.iSignal, &signalInfo, sizeof(signalInfo)) > 0)
+                    bServing = FALSE;
+            }
+            else
+            {
+                pClient = (ServerClient *) pData;
+                if (!pClient->bClosed && (eventM[e].events & EPOLLIN))
+                    readClient(&server, pClient);
+                if (!pClient->bClosed && (eventM[e].events & EPOLLOUT))
+                    writeClient(&server, pClient);
+                if (!pClient->bClosed && (eventM[e].events & (EPOLLERR | EPOLLHUP)))
+                    closeClient(&server, pClient);
+            }
+        }
+        applyQueuedUpdates(&server);
+        while ((pClient = server.pReleased) != NULL)
+        {
+            server.pReleased = pClient->pNext;
+            freeClient(pClient);
+        }
+    }
+
+    pthread_mutex_lock(&server.lock);
+    server.bStop = TRUE;
+    pthread_cond_broadcast(&server.jobReady);
+    pthread_mutex_unlock(&server.lock);
+    for (t = 0; t < iNumThreads; t++)
+        pthread_join(threadM[t], NULL);
+    // every job is in its client's jobs (queued or done) or kept (written)
+    while ((pClient = server.pClients) != NULL)
+    {
+        server.pClients = pClient->pNext;
+        freeClient(pClient);
+    }
+    while ((pJob = server.pFreeJobs) != NULL)
+    {
+        server.pFreeJobs = pJob->pNext;
+        freeJob(pJob);
+    }
+    close(server.iListen);
+    unlink(pszSocketFileNm);
+    close(server.iDoneEvent);
+    close(server.iSignal);
+    close(server.iEpoll);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.jobReady);
+    free(threadM);
+}
@@ -0,0 +1,226 @@
+/******************************************************************************
+cs2123p2Simd.c
+Purpose:
+    Implements the kernels which evaluate a compiled query over one block
+    of customer bitmaps (BLOCK_WORDS words, i.e., 512 customers).  There
+    are three implementations of the kernels:
+        AVX2    256-bit registers (4 BitWords)
+        SSE2    128-bit registers (2 BitWords)
+        scalar  64-bit BitWords
+    selectBlockKernels picks the best one the CPU supports at run time.
+    All of them produce identical bitmaps.
+Notes:
+    1. Setting the environment variable P2_SIMD to "scalar", "sse2" or
+       "avx2" forces that implementation (if the CPU supports it).  This is
+       useful for comparing the implementations.
+    2. Bitmaps aren't required to be aligned, so the vector kernels use
+       unaligned loads and stores.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cs2123p2.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define P2_X86 1
+#include <immintrin.h>
+#endif
+
+/* scalar kernels */
+
+static void copyBlockScalar(BitWord *pDst, const BitWord *pSrc)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w++)
+        pDst[w] = pSrc[w];
+}
+static void notBlockScalar(BitWord *pDst, const BitWord *pSrc)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w++)
+        pDst[w] = ~pSrc[w];
+}
+static void andBlockScalar(BitWord *pDst, const BitWord *pSrc1, const BitWord *pSrc2)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w++)
+        pDst[w] = pSrc1[w] & pSrc2[w];
+}
+static void orBlockScalar(BitWord *pDst, const BitWord *pSrc1, const BitWord *pSrc2)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w++)
+        pDst[w] = pSrc1[w] | pSrc2[w];
+}
+static int zeroBlockScalar(const BitWord *pSrc)
+{
+    BitWord any = 0;
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w++)
+        any |= pSrc[w];
+    return any == 0;
+}
+static int onesBlockScalar(const BitWord *pSrc)
+{
+    BitWord all = ~(BitWord) 0;
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w++)
+        all &= pSrc[w];
+    return all == ~(BitWord) 0;
+}
+
+#ifdef P2_X86
+/* SSE2 kernels */
+
+__attribute__((target("sse2")))
+static void copyBlockSse2(BitWord *pDst, const BitWord *pSrc)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 2)
+        _mm_storeu_si128((__m128i *) (pDst + w)
+            , _mm_loadu_si128((const __m128i *) (pSrc + w)));
+}
+__attribute__((target("sse2")))
+static void notBlockSse2(BitWord *pDst, const BitWord *pSrc)
+{
+    __m128i ones = _mm_set1_epi32(-1);
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 2)
+        _mm_storeu_si128((__m128i *) (pDst + w)
+            , _mm_xor_si128(_mm_loadu_si128((const __m128i *) (pSrc + w)), ones));
+}
+__attribute__((target("sse2")))
+static void andBlockSse2(BitWord *pDst, const BitWord *pSrc1, const BitWord *pSrc2)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 2)
+        _mm_storeu_si128((__m128i *) (pDst + w)
+            , _mm_and_si128(_mm_loadu_si128((const __m128i *) (pSrc1 + w))
+                , _mm_loadu_si128((const __m128i *) (pSrc2 + w))));
+}
+__attribute__((target("sse2")))
+static void orBlockSse2(BitWord *pDst, const BitWord *pSrc1, const BitWord *pSrc2)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 2)
+        _mm_storeu_si128((__m128i *) (pDst + w)
+            , _mm_or_si128(_mm_loadu_si128((const __m128i *) (pSrc1 + w))
+                , _mm_loadu_si128((const __m128i *) (pSrc2 + w))));
+}
+__attribute__((target("sse2")))
+static int zeroBlockSse2(const BitWord *pSrc)
+{
+    __m128i any = _mm_setzero_si128();
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 2)
+        any = _mm_or_si128(any, _mm_loadu_si128((const __m128i *) (pSrc + w)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xffff;
+}
+__attribute__((target("sse2")))
+static int onesBlockSse2(const BitWord *pSrc)
+{
+    __m128i ones = _mm_set1_epi32(-1);
+    __m128i all = ones;
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 2)
+        all = _mm_and_si128(all, _mm_loadu_si128((const __m128i *) (pSrc + w)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(all, ones)) == 0xffff;
+}
+
+/* AVX2 kernels */
+
+__attribute__((target("avx2")))
+static void copyBlockAvx2(BitWord *pDst, const BitWord *pSrc)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 4)
+        _mm256_storeu_si256((__m256i *) (pDst + w)
+            , _mm256_loadu_si256((const __m256i *) (pSrc + w)));
+}
+__attribute__((target("avx2")))
+static void notBlockAvx2(BitWord *pDst, const BitWord *pSrc)
+{
+    __m256i ones = _mm256_set1_epi32(-1);
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 4)
+        _mm256_storeu_si256((__m256i *) (pDst + w)
+            , _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (pSrc + w)), ones));
+}
+__attribute__((target("avx2")))
+static void andBlockAvx2(BitWord *pDst, const BitWord *pSrc1, const BitWord *pSrc2)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 4)
+        _mm256_storeu_si256((__m256i *) (pDst + w)
+            , _mm256_and_si256(_mm256_loadu_si256((const __m256i *) (pSrc1 + w))
+                , _mm256_loadu_si256((const __m256i *) (pSrc2 + w))));
+}
+__attribute__((target("avx2")))
+static void orBlockAvx2(BitWord *pDst, const BitWord *pSrc1, const BitWord *pSrc2)
+{
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 4)
+        _mm256_storeu_si256((__m256i *) (pDst + w)
+            , _mm256_or_si256(_mm256_loadu_si256((const __m256i *) (pSrc1 + w))
+                , _mm256_loadu_si256((const __m256i *) (pSrc2 + w))));
+}
+__attribute__((target("avx2")))
+static int zeroBlockAvx2(const BitWord *pSrc)
+{
+    __m256i any = _mm256_setzero_si256();
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 4)
+        any = _mm256_or_si256(any, _mm256_loadu_si256((const __m256i *) (pSrc + w)));
+    return _mm256_testz_si256(any, any);
+}
+__attribute__((target("avx2")))
+static int onesBlockAvx2(const BitWord *pSrc)
+{
+    __m256i ones = _mm256_set1_epi32(-1);
+    __m256i all = ones;
+    int w;
+    for (w = 0; w < BLOCK_WORDS; w += 4)
+        all = _mm256_and_si256(all, _mm256_loadu_si256((const __m256i *) (pSrc + w)));
+    return _mm256_testc_si256(all, ones);
+}
+#endif
+
+static BlockKernels scalarKernels =
+    { "scalar", copyBlockScalar, notBlockScalar, andBlockScalar, orBlockScalar
+    , zeroBlockScalar, onesBlockScalar };
+#ifdef P2_X86
+static BlockKernels sse2Kernels =
+    { "sse2", copyBlockSse2, notBlockSse2, andBlockSse2, orBlockSse2
+    , zeroBlockSse2, onesBlockSse2 };
+static BlockKernels avx2Kernels =
+    { "avx2", copyBlockAvx2, notBlockAvx2, andBlockAvx2, orBlockAvx2
+    , zeroBlockAvx2, onesBlockAvx2 };
+#endif
+
+/******************** selectBlockKernels **************************************
+BlockKernels *selectBlockKernels()
+Purpose:
+    Returns the block kernels for the best instruction set supported by
+    the CPU (AVX2, SSE2, or scalar).
+Notes:
+    - The P2_SIMD environment variable can force an implementation.  If the
+      CPU doesn't support the forced one, the best supported one is used.
+**************************************************************************/
+BlockKernels *selectBlockKernels()
+{
+    char *pszForce = getenv("P2_SIMD");
+
+    if (pszForce != NULL && strcmp(pszForce, "scalar") == 0)
+        return &scalarKernels;
+#ifdef P2_X86
+    __builtin_cpu_init();
+    if (pszForce != NULL && strcmp(pszForce, "sse2") == 0
+        && __builtin_cpu_supports("sse2"))
+        return &sse2Kernels;
+    if (__builtin_cpu_supports("avx2"))
+        return &avx2Kernels;
+    if (__builtin_cpu_supports("sse2"))
+        return &sse2Kernels;
+#endif
+    return &scalarKernels;
+}
@@ -0,0 +1,574 @@
+/******************************************************************************
+cs2123p2Snap.c
+Purpose:
+    Implements the binary snapshot of the loaded customers.  p2 -S file
+    writes a snapshot after loading the customer file and building the
+    index; p2 -C file loads it by mapping it into memory (mmap) so that the
+    customer file isn't parsed and the index isn't built.  A snapshot has:
+        SnapHeader      magic, version, sizes of the structures, the size
+                        and modification time of the customer file it was
+                        made from, counts, section table and checksums
+        sections        (each starting on a SNAP_ALIGN boundary)
+            SNAP_TYPES      TraitTypeDef of each trait type ID
+            SNAP_VALUES     TraitValueDef of each trait ID
+            SNAP_CUSTOMERS  Customer array.  traitM holds the subscript of
+                            the customer's first trait in SNAP_TRAITS.
+            SNAP_TRAITS     Trait of every customer
+            SNAP_TRAIT_BITS trait bitmaps of the index
+            SNAP_ONLY_BITS  "exactly one" bitmaps of the index
+            SNAP_WARNINGS   warnings printed while loading the customer file
+Notes:
+    1. A snapshot is only used if its version and structure sizes match this
+       program, its checksums are correct and the customer file (p2 -c) has
+       the same size and modification time as when the snapshot was
+       written.  Otherwise, a message is printed to stderr and the customer
+       file is loaded as usual.
+    2. The customers, their traits and the bitmaps are used in place in the
+       mapping.  Only the traitM subscripts are changed to pointers and the
+       (small) trait dictionary is rebuilt.
+    3. A snapshot is written to a temporary file which is renamed, so a
+       reader never sees a partial snapshot.
+    4. The output using a snapshot is the same as using the customer file
+       (including the customer file's warnings).
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cs2123p2.h"
+
+#define SNAP_MAGIC "P2SNAP\n"       // first 8 bytes (including the zero byte)
+#define SNAP_VERSION 1              // incremented when the format changes
+#define SNAP_ALIGN 64               // alignment of each section
+#define SNAP_WRITE_CUSTOMERS 4096   // customers converted per write
+
+// section subscripts of the section table
+#define SNAP_TYPES      0
+#define SNAP_VALUES     1
+#define SNAP_CUSTOMERS  2
+#define SNAP_TRAITS     3
+#define SNAP_TRAIT_BITS 4
+#define SNAP_ONLY_BITS  5
+#define SNAP_WARNINGS   6
+#define SNAP_NUM_SECTIONS 7
+
+// SnapSection typedef is the position of a section in the snapshot
+typedef struct
+{
+    long long lOffset;              // offset from the start of the snapshot
+    long long lSize;                // number of bytes (without padding)
+} SnapSection;
+
+// SnapHeader typedef is the start of a snapshot
+typedef struct
+{
+    char szMagic[8];                // SNAP_MAGIC
+    int iVersion;                   // SNAP_VERSION
+    int iHeaderSize;                // sizeof(SnapHeader)
+    int iCustomerSize;              // sizeof(Customer)
+    int iTraitSize;                 // sizeof(Trait)
+    int iTypeDefSize;               // sizeof(TraitTypeDef)
+    int iValueDefSize;              // sizeof(TraitValueDef)
+    int iBlockWords;                // BLOCK_WORDS of the index bitmaps
+    int iNumTypes;                  // number of trait types
+    int iNumTraits;                 // number of trait IDs
+    int iNumCustomer;               // number of customers
+    int iNumWords;                  // BitWords in each index bitmap
+    int iReserved;                  // zero
+    long long lNumCustomerTraits;   // number of Trait entries of the customers
+    long long lSourceSize;          // size of the customer file (-1 unknown)
+    long long lSourceMtimeSec;      // modification time of the customer file
+    long long lSourceMtimeNsec;
+    long long lFileSize;            // size of the snapshot
+    SnapSection sectionM[SNAP_NUM_SECTIONS];
+    unsigned long long ulBodyChecksum;   // checksum of the bytes after the header
+    unsigned long long ulHeaderChecksum; // checksum of the header before this
+} SnapHeader;
+
+// SnapWriter typedef tracks the position and checksum while writing
+typedef struct
+{
+    FILE *pFile;                    // the temporary snapshot file
+    long long lOffset;              // bytes written
+    unsigned long long ulChecksum;  // checksum of the bytes after the header
+    unsigned char partialM[8];      // bytes of an incomplete checksum word
+    int iPartial;                   // number of bytes in partialM
+    int bError;                     // TRUE if a write failed
+} SnapWriter;
+
+/******************** checksumWords **************************************
+static unsigned long long checksumWords(unsigned long long ulHash
+    , const unsigned char *p, size_t iNumWords)
+Purpose:
+    Adds iNumWords 8-byte words to a checksum (multiply and xor-shift of
+    each word, which is much faster than a byte-wise hash).
+**************************************************************************/
+static unsigned long long checksumWords(unsigned long long ulHash
+    , const unsigned char *p, size_t iNumWords)
+{
+    unsigned long long ulWord;
+    while (iNumWords-- > 0)
+    {
+        memcpy(&ulWord, p, sizeof(ulWord));
+        ulHash = (ulHash ^ ulWord) * 0x9e3779b97f4a7c15ULL;
+        ulHash ^= ulHash >> 29;
+        p += sizeof(ulWord);
+    }
+    return ulHash;
+}
+
+/******************** sourceStat **************************************
+static void sourceStat(FILE *pFileSource, long long *plSize, long long *plSec
+    , long long *plNsec)
+Purpose:
+    Gets the size and modification time of the customer file.  The size
+    is -1 if the customer file isn't a regular file (e.g., a pipe).
+**************************************************************************/
+static void sourceStat(FILE *pFileSource, long long *plSize, long long *plSec
+    , long long *plNsec)
+{
+    struct stat statBuf;
+
+    *plSize = -1;
+    *plSec = 0;
+    *plNsec = 0;
+    if (pFileSource == NULL || fstat(fileno(pFileSource), &statBuf) != 0
+        || !S_ISREG(statBuf.st_mode))
+        return;
+    *plSize = statBuf.st_size;
+    *plSec = statBuf.st_mtim.tv_sec;
+    *plNsec = statBuf.st_mtim.tv_nsec;
+}
+
+/******************** snapWrite **************************************
+static void snapWrite(SnapWriter *pWriter, const void *p, size_t iSize)
+Purpose:
+    Writes bytes of the snapshot body and adds them to its checksum.
+**************************************************************************/
+static void snapWrite(SnapWriter *pWriter, const void *p, size_t iSize)
+{
+    const unsigned char *pByte = (const unsigned char *) p;
+    size_t iCopy;
+
+    if (iSize == 0)
+        return;
+    if (fwrite(p, 1, iSize, pWriter->pFile) != iSize)
+        pWriter->bError = TRUE;
+    pWriter->lOffset += iSize;
+
+    // complete a partial word
+    if (pWriter->iPartial > 0)
+    {
+        iCopy = 8 - pWriter->iPartial;
+        if (iCopy > iSize)
+            iCopy = iSize;
+        memcpy(pWriter->partialM + pWriter->iPartial, pByte, iCopy);
+        pWriter->iPartial += iCopy;
+        pByte += iCopy;
+        iSize -= iCopy;
+        if (pWriter->iPartial < 8)
+            return;
+        pWriter->ulChecksum = checksumWords(pWriter->ulChecksum, pWriter->partialM, 1);
+        pWriter->iPartial = 0;
+    }
+    pWriter->ulChecksum = checksumWords(pWriter->ulChecksum, pByte, iSize / 8);
+    pWriter->iPartial = iSize % 8;
+    memcpy(pWriter->partialM, pByte + iSize - pWriter->iPartial, pWriter->iPartial);
+}
+
+/******************** snapPad **************************************
+static void snapPad(SnapWriter *pWriter)
+Purpose:
+    Writes zero bytes up to the next SNAP_ALIGN boundary.
+**************************************************************************/
+static void snapPad(SnapWriter *pWriter)
+{
+    static const char zeroM[SNAP_ALIGN] = { 0 };
+    snapWrite(pWriter, zeroM, (SNAP_ALIGN - pWriter->lOffset % SNAP_ALIGN) % SNAP_ALIGN);
+}
+
+/******************** snapBeginSection **************************************
+static void snapBeginSection(SnapWriter *pWriter, SnapHeader *pHeader, int iSection)
+Purpose:
+    Pads the snapshot to a SNAP_ALIGN boundary and records the offset of a
+    section.
+**************************************************************************/
+static void snapBeginSection(SnapWriter *pWriter, SnapHeader *pHeader, int iSection)
+{
+    snapPad(pWriter);
+    pHeader->sectionM[iSection].lOffset = pWriter->lOffset;
+}
+
+/******************** snapEndSection **************************************
+static void snapEndSection(SnapWriter *pWriter, SnapHeader *pHeader, int iSection)
+Purpose:
+    Records the size of a section.
+**************************************************************************/
+static void snapEndSection(SnapWriter *pWriter, SnapHeader *pHeader, int iSection)
+{
+    pHeader->sectionM[iSection].lSize = pWriter->lOffset
+        - pHeader->sectionM[iSection].lOffset;
+}
+
+/******************** writeSnapshot **************************************
+int writeSnapshot(char *pszSnapshotFileNm, FILE *pFileSource, CustomerStore store
+    , TraitDict dict, CustomerIndex index)
+Purpose:
+    Writes a snapshot of the customers, the trait dictionary and the index.
+Parameters:
+    I char *pszSnapshotFileNm     name of the snapshot file
+    I FILE *pFileSource           the customer file the customers were loaded from
+    I CustomerStore store         the customers
+    I TraitDict dict              the trait dictionary of the customers
+    I CustomerIndex index         the bitmap index of the customers
+Returns:
+    TRUE  - the snapshot was written
+    FALSE - the snapshot couldn't be created (a message is printed to stderr)
+**************************************************************************/
+int writeSnapshot(char *pszSnapshotFileNm, FILE *pFileSource, CustomerStore store
+    , TraitDict dict, CustomerIndex index)
+{
+    SnapHeader header;
+    SnapWriter writer;
+    Customer customerM[SNAP_WRITE_CUSTOMERS];  // customers with trait subscripts
+    char *pszTempFileNm;
+    long long lTrait = 0;                       // subscript of the next trait
+    int bWritten;                               // FALSE if writing failed
+    int iFirst;
+    int iCount;
+    int i;
+
+    pszTempFileNm = malloc(strlen(pszSnapshotFileNm) + 5);
+    if (pszTempFileNm == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory writing the snapshot");
+    sprintf(pszTempFileNm, "%s.tmp", pszSnapshotFileNm);
+    writer.pFile = fopen(pszTempFileNm, "wb");
+    if (writer.pFile == NULL)
+    {
+        fprintf(stderr, "Warning: unable to create snapshot %s\n", pszSnapshotFileNm);
+        free(pszTempFileNm);
+        return FALSE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.szMagic, SNAP_MAGIC, sizeof(header.szMagic));
+    header.iVersion = SNAP_VERSION;
+    header.iHeaderSize = sizeof(SnapHeader);
+    header.iCustomerSize = sizeof(Customer);
+    header.iTraitSize = sizeof(Trait);
+    header.iTypeDefSize = sizeof(TraitTypeDef);
+    header.iValueDefSize = sizeof(TraitValueDef);
+    header.iBlockWords = BLOCK_WORDS;
+    header.iNumTypes = dict->iNumTypes;
+    header.iNumTraits = dict->iNumTraits;
+    header.iNumCustomer = store->iNumCustomer;
+    header.iNumWords = index->iNumWords;
+    sourceStat(pFileSource, &header.lSourceSize, &header.lSourceMtimeSec
+        , &header.lSourceMtimeNsec);
+
+    // the header is rewritten with the sections and checksums at the end
+    fwrite(&header, sizeof(header), 1, writer.pFile);
+    writer.lOffset = sizeof(header);
+    writer.ulChecksum = 0;
+    writer.iPartial = 0;
+    writer.bError = FALSE;
+
+    snapBeginSection(&writer, &header, SNAP_TYPES);
+    snapWrite(&writer, dict->typeM, sizeof(TraitTypeDef) * dict->iNumTypes);
+    snapEndSection(&writer, &header, SNAP_TYPES);
+
+    snapBeginSection(&writer, &header, SNAP_VALUES);
+    snapWrite(&writer, dict->traitM, sizeof(TraitValueDef) * dict->iNumTraits);
+    snapEndSection(&writer, &header, SNAP_VALUES);
+
+    // the customers' traitM pointers become subscripts of SNAP_TRAITS
+    snapBeginSection(&writer, &header, SNAP_CUSTOMERS);
+    for (iFirst = 0; iFirst < store->iNumCustomer; iFirst += iCount)
+    {
+        iCount = store->iNumCustomer - iFirst;
+        if (iCount > SNAP_WRITE_CUSTOMERS)
+            iCount = SNAP_WRITE_CUSTOMERS;
+        memcpy(customerM, store->customerM + iFirst, sizeof(Customer) * iCount);
+        for (i = 0; i < iCount; i++)
+        {
+            customerM[i].traitM = (Trait *) (uintptr_t) lTrait;
+            lTrait += customerM[i].iNumberOfTraits;
+        }
+        snapWrite(&writer, customerM, sizeof(Customer) * iCount);
+    }
+    snapEndSection(&writer, &header, SNAP_CUSTOMERS);
+    header.lNumCustomerTraits = lTrait;
+
+    snapBeginSection(&writer, &header, SNAP_TRAITS);
+    for (i = 0; i < store->iNumCustomer; i++)
+        snapWrite(&writer, store->customerM[i].traitM
+            , sizeof(Trait) * store->customerM[i].iNumberOfTraits);
+    snapEndSection(&writer, &header, SNAP_TRAITS);
+
+    snapBeginSection(&writer, &header, SNAP_TRAIT_BITS);
+    snapWrite(&writer, index->traitBitsM
+        , sizeof(BitWord) * index->iNumWords * index->iNumTraits);
+    snapEndSection(&writer, &header, SNAP_TRAIT_BITS);
+
+    snapBeginSection(&writer, &header, SNAP_ONLY_BITS);
+    snapWrite(&writer, index->onlyBitsM
+        , sizeof(BitWord) * index->iNumWords * index->iNumTypes);
+    snapEndSection(&writer, &header, SNAP_ONLY_BITS);
+
+    snapBeginSection(&writer, &header, SNAP_WARNINGS);
+    snapWrite(&writer, store->pszLoadWarnings, store->iLoadWarningsSize);
+    snapEndSection(&writer, &header, SNAP_WARNINGS);
+
+    // pad the end so the body is whole checksum words
+    snapPad(&writer);
+    header.lFileSize = writer.lOffset;
+    header.ulBodyChecksum = writer.ulChecksum;
+    header.ulHeaderChecksum = checksumWords(0, (unsigned char *) &header
+        , offsetof(SnapHeader, ulHeaderChecksum) / 8);
+
+    bWritten = !writer.bError && fseek(writer.pFile, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, writer.pFile) == 1;
+    if (fclose(writer.pFile) != 0)
+        bWritten = FALSE;
+    if (bWritten && rename(pszTempFileNm, pszSnapshotFileNm) != 0)
+        bWritten = FALSE;
+    if (!bWritten)
+    {
+        fprintf(stderr, "Warning: unable to write snapshot %s\n", pszSnapshotFileNm);
+        remove(pszTempFileNm);
+        free(pszTempFileNm);
+        return FALSE;
+    }
+    free(pszTempFileNm);
+    return TRUE;
+}
+
+/******************** checkSnapshot **************************************
+static char *checkSnapshot(SnapHeader *pHeader, size_t iSize, FILE *pFileSource)
+Purpose:
+    Checks that a mapped snapshot can be used.
+Returns:
+    NULL if it can be used, otherwise the reason it can't.
+**************************************************************************/
+static char *checkSnapshot(SnapHeader *pHeader, size_t iSize, FILE *pFileSource)
+{
+    long long lSizeM[SNAP_NUM_SECTIONS];    // expected size of each section
+    long long lSourceSize;
+    long long lSourceSec;
+    long long lSourceNsec;
+    int iNumBlocks;
+    int s;
+
+    if (iSize < sizeof(SnapHeader)
+        || memcmp(pHeader->szMagic, SNAP_MAGIC, sizeof(pHeader->szMagic)) != 0)
+        return "is not a snapshot";
+    if (pHeader->iVersion != SNAP_VERSION
+        || pHeader->iHeaderSize != sizeof(SnapHeader)
+        || pHeader->iCustomerSize != sizeof(Customer)
+        || pHeader->iTraitSize != sizeof(Trait)
+        || pHeader->iTypeDefSize != sizeof(TraitTypeDef)
+        || pHeader->iValueDefSize != sizeof(TraitValueDef)
+        || pHeader->iBlockWords != BLOCK_WORDS)
+        return "was written by another version";
+    if (pHeader->ulHeaderChecksum != checksumWords(0, (unsigned char *) pHeader
+        , offsetof(SnapHeader, ulHeaderChecksum) / 8)
+        || pHeader->lFileSize != (long long) iSize
+        || pHeader->lFileSize % 8 != 0)
+        return "is corrupt";
+
+    // the sections must have the sizes implied by the counts
+    iNumBlocks = (BITMAP_WORDS(pHeader->iNumCustomer) + BLOCK_WORDS - 1) / BLOCK_WORDS;
+    if (pHeader->iNumTypes < 0 || pHeader->iNumTraits < 0 || pHeader->iNumCustomer < 0
+        || pHeader->lNumCustomerTraits < 0
+        || pHeader->iNumWords != iNumBlocks * BLOCK_WORDS)
+        return "is corrupt";
+    lSizeM[SNAP_TYPES] = (long long) sizeof(TraitTypeDef) * pHeader->iNumTypes;
+    lSizeM[SNAP_VALUES] = (long long) sizeof(TraitValueDef) * pHeader->iNumTraits;
+    lSizeM[SNAP_CUSTOMERS] = (long long) sizeof(Customer) * pHeader->iNumCustomer;
+    lSizeM[SNAP_TRAITS] = (long long) sizeof(Trait) * pHeader->lNumCustomerTraits;
+    lSizeM[SNAP_TRAIT_BITS] = (long long) sizeof(BitWord) * pHeader->iNumWords
+        * pHeader->iNumTraits;
+    lSizeM[SNAP_ONLY_BITS] = (long long) sizeof(BitWord) * pHeader->iNumWords
+        * pHeader->iNumTypes;
+    lSizeM[SNAP_WARNINGS] = pHeader->sectionM[SNAP_WARNINGS].lSize;
+    for (s = 0; s < SNAP_NUM_SECTIONS; s++)
+    {
+        if (pHeader->sectionM[s].lSize != lSizeM[s]
+            || pHeader->sectionM[s].lOffset < (long long) sizeof(SnapHeader)
+            || pHeader->sectionM[s].lOffset % SNAP_ALIGN != 0
+            || lSizeM[s] < 0
+            || pHeader->sectionM[s].lOffset + lSizeM[s] > pHeader->lFileSize)
+            return "is corrupt";
+    }
+    if (pHeader->ulBodyChecksum != checksumWords(0
+        , (unsigned char *) pHeader + sizeof(SnapHeader)
+        , (iSize - sizeof(SnapHeader)) / 8))
+        return "is corrupt";
+
+    // the customer file must not have changed since the snapshot was written
+    sourceStat(pFileSource, &lSourceSize, &lSourceSec, &lSourceNsec);
+    if (pHeader->lSourceSize < 0 || lSourceSize != pHeader->lSourceSize
+        || lSourceSec != pHeader->lSourceMtimeSec
+        || lSourceNsec != pHeader->lSourceMtimeNsec)
+        return "is stale";
+    return NULL;
+}
+
+/******************** loadSnapshot **************************************
+int loadSnapshot(char *pszSnapshotFileNm, FILE *pFileSource, CustomerStore store
+    , TraitDict *pDict, CustomerIndex *pIndex)
+Purpose:
+    Loads the customers, the trait dictionary and the index from a snapshot
+    and prints the warnings of the customer file it was made from.
+Parameters:
+    I   char *pszSnapshotFileNm   name of the snapshot file
+    I   FILE *pFileSource         the customer file (to check for staleness)
+    I/O CustomerStore store       empty store which receives the customers
+    O   TraitDict *pDict          receives the trait dictionary
+    O   CustomerIndex *pIndex     receives the bitmap index
+Returns:
+    TRUE  - the snapshot was loaded
+    FALSE - the snapshot can't be used (a message is printed to stderr and
+            nothing is changed), so the customer file must be loaded
+Notes:
+    - The snapshot stays mapped until the store is freed.
+**************************************************************************/
+int loadSnapshot(char *pszSnapshotFileNm, FILE *pFileSource, CustomerStore store
+    , TraitDict *pDict, CustomerIndex *pIndex)
+{
+    FILE *pFile = fopen(pszSnapshotFileNm, "rb");
+    struct stat statBuf;
+    char *pMap;                     // the mapped snapshot
+    size_t iSize;                   // size of the snapshot
+    SnapHeader *pHeader;
+    char *pszReason = NULL;         // reason the snapshot can't be used
+    TraitDict dict = NULL;
+    CustomerIndex index;
+    TraitTypeDef *typeM;
+    TraitValueDef *valueM;
+    Customer *customerM;
+    Trait *traitM;
+    uintptr_t uFirst;               // subscript of a customer's first trait
+    int i;
+
+    if (pFile == NULL)
+    {
+        fprintf(stderr, "Warning: unable to open snapshot %s, loading the customer file\n"
+            , pszSnapshotFileNm);
+        return FALSE;
+    }
+    if (fstat(fileno(pFile), &statBuf) != 0 || !S_ISREG(statBuf.st_mode)
+        || statBuf.st_size < (off_t) sizeof(SnapHeader))
+    {
+        fprintf(stderr, "Warning: snapshot %s is not a snapshot, loading the customer file\n"
+            , pszSnapshotFileNm);
+        fclose(pFile);
+        return FALSE;
+    }
+    iSize = statBuf.st_size;
+    pMap = mmap(NULL, iSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(pFile), 0);
+    fclose(pFile);
+    if (pMap == MAP_FAILED)
+    {
+        fprintf(stderr, "Warning: unable to map snapshot %s, loading the customer file\n"
+            , pszSnapshotFileNm);
+        return FALSE;
+    }
+    pHeader = (SnapHeader *) pMap;
+    pszReason = checkSnapshot(pHeader, iSize, pFileSource);
+
+    // rebuild the trait dictionary; the IDs must come out the same
+    if (pszReason == NULL)
+    {
+        typeM = (TraitTypeDef *) (pMap + pHeader->sectionM[SNAP_TYPES].lOffset);
+        valueM = (TraitValueDef *) (pMap + pHeader->sectionM[SNAP_VALUES].lOffset);
+        dict = newTraitDict();
+        for (i = 0; i < pHeader->iNumTypes && pszReason == NULL; i++)
+        {
+            typeM[i].szTraitType[MAX_TRAIT_TYPE] = '\0';
+            if (addTraitType(dict, typeM[i].szTraitType) != i)
+                pszReason = "is corrupt";
+        }
+        for (i = 0; i < pHeader->iNumTraits && pszReason == NULL; i++)
+        {
+            valueM[i].szTraitValue[MAX_TRAIT_VALUE] = '\0';
+            if (valueM[i].iTraitType < 0 || valueM[i].iTraitType >= pHeader->iNumTypes
+                || addTrait(dict, valueM[i].iTraitType, valueM[i].szTraitValue) != i)
+                pszReason = "is corrupt";
+        }
+    }
+
+    // change the customers' trait subscripts to pointers
+    if (pszReason == NULL)
+    {
+        customerM = (Customer *) (pMap + pHeader->sectionM[SNAP_CUSTOMERS].lOffset);
+        traitM = (Trait *) (pMap + pHeader->sectionM[SNAP_TRAITS].lOffset);
+        for (i = 0; i < pHeader->iNumCustomer; i++)
+        {
+            uFirst = (uintptr_t) customerM[i].traitM;
+            if (customerM[i].iNumberOfTraits < 0
+                || uFirst + customerM[i].iNumberOfTraits
+                    > (uintptr_t) pHeader->lNumCustomerTraits)
+            {
+                pszReason = "is corrupt";
+                break;
+            }
+            customerM[i].traitM = traitM + uFirst;
+        }
+    }
+
+    if (pszReason != NULL)
+    {
+        fprintf(stderr, "Warning: snapshot %s %s, loading the customer file\n"
+            , pszSnapshotFileNm, pszReason);
+        freeTraitDict(dict);
+        munmap(pMap, iSize);
+        return FALSE;
+    }
+
+    // the customers and their traits stay in the mapping
+    free(store->customerM);
+    store->customerM = customerM;
+    store->iNumCustomer = pHeader->iNumCustomer;
+    store->iMaxCustomer = pHeader->iNumCustomer;
+    store->pSnapshot = pMap;
+    store->iSnapshotSize = iSize;
+    store->iLoadWarningsSize = pHeader->sectionM[SNAP_WARNINGS].lSize;
+    store->pszLoadWarnings = malloc(store->iLoadWarningsSize + 1);
+    if (store->pszLoadWarnings == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory loading the snapshot");
+    memcpy(store->pszLoadWarnings, pMap + pHeader->sectionM[SNAP_WARNINGS].lOffset
+        , store->iLoadWarningsSize);
+
+    // so do the index's bitmaps
+    index = (CustomerIndex) malloc(sizeof(CustomerIndexImp));
+    if (index == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer index");
+    index->customerM = store->customerM;
+    index->iNumCustomer = store->iNumCustomer;
+    index->iNumWords = pHeader->iNumWords;
+    index->iNumBlocks = pHeader->iNumWords / BLOCK_WORDS;
+    index->pKernels = selectBlockKernels();
+    index->iNumShards = 1;
+    index->pShardPool = NULL;
+    index->bMapped = TRUE;
+    index->iNumTraits = pHeader->iNumTraits;
+    index->iNumTypes = pHeader->iNumTypes;
+    index->iMaxTraits = index->iNumTraits;
+    index->iMaxTypes = index->iNumTypes;
+    index->traitBitsM = (BitWord *) (pMap + pHeader->sectionM[SNAP_TRAIT_BITS].lOffset);
+    index->onlyBitsM = (BitWord *) (pMap + pHeader->sectionM[SNAP_ONLY_BITS].lOffset);
+    index->liveBitsM = NULL;
+    countCustomerIndex(index);
+
+    *pDict = dict;
+    *pIndex = index;
+
+    // print the warnings of the customer file like loading it would
+    fwrite(store->pszLoadWarnings, 1, store->iLoadWarningsSize, warningFile());
+    return TRUE;
+}
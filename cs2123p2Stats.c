@@ -0,0 +1,216 @@
+/******************************************************************************
+cs2123p2Stats.c
+Purpose:
+    Implements the statistics printed by p2 -s.  While a query is processed
+    (processQuery), the thread's pQueryStats points to the query's
+    QueryStats, and the hot paths add to its counters:
+        stack pushes and pops       push, pop and runProgram
+        trait compares              notAny and only
+        customers scanned, matched  evaluatePostfix and fprintQueryMode
+    processQuery times its stages (convertToPostFix, evaluatePostfix and
+    printQueryResult) and main times getCustomerData.  At the end,
+    printStats prints a summary of the stages and counters and a line per
+    query to stderr.
+Notes:
+    1. Without -s, pQueryStats is NULL, so each counter costs a test of a
+       thread-local pointer.  Building with -DP2_STATS=0 removes the
+       counting and timing altogether (STATS_ON is 0), and -s is then an
+       error.
+    2. The stages are timed with clock_gettime(CLOCK_MONOTONIC), which
+       doesn't need a system call on Linux.
+    3. runProgram counts in local variables and adds them once per
+       customer.
+    4. Only queries processed by processQuery (one at a time with or
+       without -t, benchmark mode and the daemon) have statistics, so -s
+       can't be used with batch or streaming mode (-b, -r).
+    5. Benchmark mode (-B) collects the statistics even without -s and
+       reads the stage times of each query with getQueryStats.
+    6. The counters of a query which calls ErrExit aren't recorded.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "cs2123p2.h"
+
+#define STATS_INITIAL_QUERIES 256   // initial size of the record array
+
+// counters of the query the thread is processing (NULL if not counting)
+__thread QueryStats *pQueryStats = NULL;
+
+// TRUE if statistics are collected (p2 -s or -B)
+int bStats = FALSE;
+
+// the recorded statistics subscripted by query number (0 is loading)
+static QueryStats **statsM = NULL;
+static int iMaxStats = 0;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *pszStageNameM[NUM_STAGES] = { "load", "convert", "evaluate", "print" };
+
+/******************** statsNanos **************************************
+long long statsNanos()
+Purpose:
+    Returns the time in nanoseconds of the monotonic clock.
+**************************************************************************/
+long long statsNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/******************** newQueryStats **************************************
+QueryStats *newQueryStats()
+Purpose:
+    Returns zeroed counters for a query (freed by freeStats), or NULL
+    if statistics aren't collected.
+**************************************************************************/
+QueryStats *newQueryStats()
+{
+    QueryStats *pStats;
+
+    // counters left by a query which called ErrExit (in a worker thread)
+    free(pQueryStats);
+    pQueryStats = NULL;
+    if (!bStats)
+        return NULL;
+    pStats = calloc(1, sizeof(QueryStats));
+    if (pStats == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the statistics");
+    return pStats;
+}
+
+/******************** recordQueryStats **************************************
+void recordQueryStats(int iQueryCnt)
+Purpose:
+    Records the thread's counters (pQueryStats) as the statistics of a
+    query (0 for loading the customers) and stops counting.
+Notes:
+    - The query worker threads record their queries concurrently.
+**************************************************************************/
+void recordQueryStats(int iQueryCnt)
+{
+    int iNewMax;
+
+    if (pQueryStats == NULL)
+        return;
+    pthread_mutex_lock(&statsLock);
+    if (iQueryCnt >= iMaxStats)
+    {
+        iNewMax = iMaxStats > 0 ? iMaxStats : STATS_INITIAL_QUERIES;
+        while (iNewMax <= iQueryCnt)
+            iNewMax *= 2;
+        statsM = realloc(statsM, sizeof(QueryStats *) * iNewMax);
+        if (statsM == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory for the statistics");
+        memset(statsM + iMaxStats, 0, sizeof(QueryStats *) * (iNewMax - iMaxStats));
+        iMaxStats = iNewMax;
+    }
+    free(statsM[iQueryCnt]);
+    statsM[iQueryCnt] = pQueryStats;
+    pthread_mutex_unlock(&statsLock);
+    pQueryStats = NULL;
+}
+
+/******************** getQueryStats **************************************
+QueryStats *getQueryStats(int iQueryCnt)
+Purpose:
+    Returns the recorded statistics of a query (0 for loading the
+    customers), or NULL if none were recorded.
+**************************************************************************/
+QueryStats *getQueryStats(int iQueryCnt)
+{
+    QueryStats *pStats = NULL;
+
+    pthread_mutex_lock(&statsLock);
+    if (iQueryCnt < iMaxStats)
+        pStats = statsM[iQueryCnt];
+    pthread_mutex_unlock(&statsLock);
+    return pStats;
+}
+
+/******************** printStats **************************************
+void printStats(FILE *pFile)
+Purpose:
+    Prints the total time of each stage, the totals of the counters and
+    the statistics of each query, and frees them.
+**************************************************************************/
+void printStats(FILE *pFile)
+{
+    QueryStats total;
+    long long lMaxNanosM[NUM_STAGES];   // longest time of each stage
+    QueryStats *pStats;
+    int s;
+    int q;
+
+    memset(&total, 0, sizeof(total));
+    memset(lMaxNanosM, 0, sizeof(lMaxNanosM));
+    for (q = 0; q < iMaxStats; q++)
+    {
+        pStats = statsM[q];
+        if (pStats == NULL)
+            continue;
+        total.lPushes += pStats->lPushes;
+        total.lPops += pStats->lPops;
+        total.lTraitCompares += pStats->lTraitCompares;
+        total.lScanned += pStats->lScanned;
+        total.lMatched += pStats->lMatched;
+        for (s = 0; s < NUM_STAGES; s++)
+        {
+            total.lStageNanosM[s] += pStats->lStageNanosM[s];
+            total.iStageCallsM[s] += pStats->iStageCallsM[s];
+            if (pStats->lStageNanosM[s] > lMaxNanosM[s])
+                lMaxNanosM[s] = pStats->lStageNanosM[s];
+        }
+    }
+
+    fprintf(pFile, "Statistics:\n");
+    fprintf(pFile, "  %-10s %10s %12s %12s %12s\n"
+        , "Stage", "Calls", "Total ms", "Mean us", "Max us");
+    for (s = 0; s < NUM_STAGES; s++)
+        fprintf(pFile, "  %-10s %10d %12.3f %12.3f %12.3f\n", pszStageNameM[s]
+            , total.iStageCallsM[s], total.lStageNanosM[s] / 1e6
+            , total.iStageCallsM[s] > 0
+                ? total.lStageNanosM[s] / 1e3 / total.iStageCallsM[s] : 0.0
+            , lMaxNanosM[s] / 1e3);
+    fprintf(pFile, "  %-18s %14lld\n", "stack pushes", total.lPushes);
+    fprintf(pFile, "  %-18s %14lld\n", "stack pops", total.lPops);
+    fprintf(pFile, "  %-18s %14lld\n", "trait compares", total.lTraitCompares);
+    fprintf(pFile, "  %-18s %14lld\n", "customers scanned", total.lScanned);
+    fprintf(pFile, "  %-18s %14lld\n", "customers matched", total.lMatched);
+
+    fprintf(pFile, "  %6s %11s %11s %11s %10s %10s %12s %10s %10s\n"
+        , "Query", "Convert us", "Eval us", "Print us", "Pushes", "Pops"
+        , "Compares", "Scanned", "Matched");
+    for (q = 1; q < iMaxStats; q++)
+    {
+        pStats = statsM[q];
+        if (pStats == NULL)
+            continue;
+        fprintf(pFile, "  %6d %11.3f %11.3f %11.3f %10lld %10lld %12lld %10lld %10lld\n"
+            , q, pStats->lStageNanosM[STAGE_CONVERT] / 1e3
+            , pStats->lStageNanosM[STAGE_EVALUATE] / 1e3
+            , pStats->lStageNanosM[STAGE_PRINT] / 1e3
+            , pStats->lPushes, pStats->lPops, pStats->lTraitCompares
+            , pStats->lScanned, pStats->lMatched);
+    }
+    freeStats();
+}
+
+/******************** freeStats **************************************
+void freeStats()
+Purpose:
+    Frees the recorded statistics.
+**************************************************************************/
+void freeStats()
+{
+    int q;
+
+    for (q = 0; q < iMaxStats; q++)
+        free(statsM[q]);
+    free(statsM);
+    statsM = NULL;
+    iMaxStats = 0;
+}
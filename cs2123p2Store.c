@@ -0,0 +1,565 @@
+/******************************************************************************
+cs2123p2Store.c
+Purpose:
+    Implements the customer store which replaces the fixed customer array.
+    The customers are kept in one array (customerM) which is doubled when
+    it is full, so customerM[i] indexing is unchanged.  The traits of all
+    customers are kept in an Arena: a list of chunks, each twice the size
+    of the previous one, from which memory is handed out by bumping a
+    pointer.  Each customer's traits are contiguous in a chunk and are
+    referenced by the customer's traitM pointer, so there is neither a
+    fixed number of traits per customer nor a malloc per record.
+Notes:
+    1. Since the trait chunks never move, a customer's traitM pointer stays
+       valid when customerM is reallocated.
+    2. While a customer's traits are being added, they are the last
+       allocation of the arena and grow in place.  If the chunk is full,
+       they are moved to the next chunk.
+    3. A store loaded from a snapshot has customerM and the traits in the
+       snapshot's mapping.  When customerM must grow, it is copied to an
+       allocated array; the mapping is unmapped when the store is freed.
+    4. A customer removed by an update (p2 -u) is a tombstone:  it stays in
+       customerM with iNumberOfTraits set to CUSTOMER_REMOVED, so the
+       subscripts of the other customers (and their index bits) don't
+       change.  Traits which are removed, or moved when a customer grows,
+       are left in the arena and counted in iDeadTraitBytes.
+    5. compactCustomerStore copies the customers which weren't removed and
+       their traits to a new customerM and arena, dropping the tombstones
+       and the dead traits (and the snapshot's mapping).
+    6. findCustomer looks up a customer by ID in a hash table (idHashM)
+       which is built the first time it is needed.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "cs2123p2.h"
+
+#define ARENA_FIRST_CHUNK 4096          // size in bytes of the first arena chunk
+#define ARENA_MAX_CHUNK (64 << 20)      // chunks stop doubling at this size
+#define STORE_INITIAL_CUSTOMERS 64      // initial size of customerM
+#define ID_HASH_MIN_SIZE 64             // smallest size of the customer ID table
+
+/******************** arenaInit **************************************
+void arenaInit(Arena *pArena)
+Purpose:
+    Initializes an empty arena.  The first chunk is allocated when needed.
+**************************************************************************/
+void arenaInit(Arena *pArena)
+{
+    pArena->pChunk = NULL;
+    pArena->iNextSize = ARENA_FIRST_CHUNK;
+}
+
+/******************** arenaFree **************************************
+void arenaFree(Arena *pArena)
+Purpose:
+    Frees every chunk of an arena, leaving it empty.
+**************************************************************************/
+void arenaFree(Arena *pArena)
+{
+    ArenaChunk *pChunk;
+    while (pArena->pChunk != NULL)
+    {
+        pChunk = pArena->pChunk;
+        pArena->pChunk = pChunk->pPrev;
+        free(pChunk);
+    }
+    pArena->iNextSize = ARENA_FIRST_CHUNK;
+}
+
+/******************** arenaReset **************************************
+void arenaReset(Arena *pArena)
+Purpose:
+    Makes all of an arena's memory available again without freeing it.
+Notes:
+    - If the arena has more than one chunk, they are replaced by one chunk
+      of their total size, so the same allocations fit in it next time
+      without another malloc.
+**************************************************************************/
+void arenaReset(Arena *pArena)
+{
+    ArenaChunk *pChunk = pArena->pChunk;
+    size_t iTotal = 0;
+
+    if (pChunk == NULL)
+        return;
+    if (pChunk->pPrev == NULL)
+    {
+        pChunk->iUsed = 0;
+        return;
+    }
+    for (; pChunk != NULL; pChunk = pChunk->pPrev)
+        iTotal += pChunk->iSize;
+    arenaFree(pArena);
+    pArena->iNextSize = iTotal;
+    arenaAlloc(pArena, iTotal);
+    pArena->pChunk->iUsed = 0;
+}
+
+/******************** arenaAdopt **************************************
+void arenaAdopt(Arena *pArena, Arena *pFrom)
+Purpose:
+    Moves every chunk of pFrom into pArena, leaving pFrom empty.  Memory
+    allocated from pFrom stays where it is and is freed with pArena.
+Notes:
+    - The chunks are linked behind pArena's oldest chunk, so pArena's
+      current chunk (and arenaGrowLast of its last allocation) is unchanged.
+**************************************************************************/
+void arenaAdopt(Arena *pArena, Arena *pFrom)
+{
+    ArenaChunk *pOldest = pArena->pChunk;
+
+    if (pFrom->pChunk == NULL)
+        return;
+    if (pOldest == NULL)
+        pArena->pChunk = pFrom->pChunk;
+    else
+    {
+        while (pOldest->pPrev != NULL)
+            pOldest = pOldest->pPrev;
+        pOldest->pPrev = pFrom->pChunk;
+    }
+    arenaInit(pFrom);
+}
+
+/******************** arenaAlloc **************************************
+void *arenaAlloc(Arena *pArena, size_t iSize)
+Purpose:
+    Allocates iSize bytes (aligned to ARENA_ALIGN bytes) from an arena.
+Notes:
+    - When the current chunk doesn't have room, a new chunk which is twice
+      the size of the previous one (or large enough for iSize) is added.
+**************************************************************************/
+void *arenaAlloc(Arena *pArena, size_t iSize)
+{
+    ArenaChunk *pChunk = pArena->pChunk;
+    size_t iChunkSize;
+    void *p;
+
+    iSize = (iSize + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (pChunk == NULL || pChunk->iUsed + iSize > pChunk->iSize)
+    {
+        iChunkSize = pArena->iNextSize;
+        while (iChunkSize < iSize)
+            iChunkSize *= 2;
+        pChunk = malloc(sizeof(ArenaChunk) + iChunkSize);
+        if (pChunk == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory allocating %lu bytes"
+                , (unsigned long) iChunkSize);
+        pChunk->pPrev = pArena->pChunk;
+        pChunk->iSize = iChunkSize;
+        pChunk->iUsed = 0;
+        pArena->pChunk = pChunk;
+        if (pArena->iNextSize < ARENA_MAX_CHUNK)
+            pArena->iNextSize *= 2;
+    }
+    p = pChunk->dataM + pChunk->iUsed;
+    pChunk->iUsed += iSize;
+    return p;
+}
+
+/******************** arenaGrowLast **************************************
+void *arenaGrowLast(Arena *pArena, void *pOld, size_t iOldSize, size_t iNewSize)
+Purpose:
+    Grows an allocation from iOldSize to iNewSize bytes.  If it is the last
+    allocation of the current chunk and the chunk has room, it grows in
+    place; otherwise, a new allocation is made and the old bytes are copied.
+Returns:
+    The address of the grown allocation.
+**************************************************************************/
+void *arenaGrowLast(Arena *pArena, void *pOld, size_t iOldSize, size_t iNewSize)
+{
+    ArenaChunk *pChunk = pArena->pChunk;
+    size_t iOldAligned = (iOldSize + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    size_t iNewAligned = (iNewSize + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    void *pNew;
+
+    if (pOld != NULL && pChunk != NULL
+        && (char *) pOld + iOldAligned == pChunk->dataM + pChunk->iUsed
+        && pChunk->iUsed - iOldAligned + iNewAligned <= pChunk->iSize)
+    {
+        pChunk->iUsed += iNewAligned - iOldAligned;
+        return pOld;
+    }
+    pNew = arenaAlloc(pArena, iNewSize);
+    if (pOld != NULL && iOldSize > 0)
+        memcpy(pNew, pOld, iOldSize);
+    return pNew;
+}
+
+/******************** newCustomerStore **************************************
+CustomerStore newCustomerStore()
+Purpose:
+    Allocates an empty customer store.
+**************************************************************************/
+CustomerStore newCustomerStore()
+{
+    CustomerStore store = (CustomerStore) malloc(sizeof(CustomerStoreImp));
+    if (store == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer store");
+    store->iNumCustomer = 0;
+    store->iMaxCustomer = STORE_INITIAL_CUSTOMERS;
+    store->customerM = malloc(sizeof(Customer) * store->iMaxCustomer);
+    if (store->customerM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer store");
+    arenaInit(&store->traitArena);
+    store->pszLoadWarnings = NULL;
+    store->iLoadWarningsSize = 0;
+    store->pSnapshot = NULL;
+    store->iSnapshotSize = 0;
+    store->iNumRemoved = 0;
+    store->iDeadTraitBytes = 0;
+    store->iIdHashSize = 0;
+    store->idHashM = NULL;
+    return store;
+}
+
+/******************** customersMapped **************************************
+static int customersMapped(CustomerStore store)
+Purpose:
+    Returns TRUE if customerM is in the store's mapped snapshot.
+**************************************************************************/
+static int customersMapped(CustomerStore store)
+{
+    return store->pSnapshot != NULL && (char *) store->customerM >= store->pSnapshot
+        && (char *) store->customerM < store->pSnapshot + store->iSnapshotSize;
+}
+
+/******************** growCustomers **************************************
+static void growCustomers(CustomerStore store, int iMax)
+Purpose:
+    Reallocates customerM to hold iMax customers.  If customerM is in a
+    mapped snapshot, it is copied to an allocated array.
+**************************************************************************/
+static void growCustomers(CustomerStore store, int iMax)
+{
+    Customer *pNew;
+
+    if (customersMapped(store))
+    {
+        pNew = malloc(sizeof(Customer) * iMax);
+        if (pNew != NULL)
+            memcpy(pNew, store->customerM, sizeof(Customer) * store->iNumCustomer);
+    }
+    else
+        pNew = realloc(store->customerM, sizeof(Customer) * iMax);
+    if (pNew == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for %d customers", iMax);
+    store->customerM = pNew;
+    store->iMaxCustomer = iMax;
+}
+
+/******************** freeCustomerStore **************************************
+void freeCustomerStore(CustomerStore store)
+Purpose:
+    Frees the customers and their traits.
+**************************************************************************/
+void freeCustomerStore(CustomerStore store)
+{
+    if (store == NULL)
+        return;
+    if (!customersMapped(store))
+        free(store->customerM);
+    arenaFree(&store->traitArena);
+    free(store->pszLoadWarnings);
+    free(store->idHashM);
+    if (store->pSnapshot != NULL)
+        munmap(store->pSnapshot, store->iSnapshotSize);
+    free(store);
+}
+
+/******************** addCustomer **************************************
+Customer *addCustomer(CustomerStore store)
+Purpose:
+    Adds a customer with an empty ID, name and no traits to the end of
+    the store.
+Returns:
+    The address of the new customer.  It is only valid until the next
+    customer is added since customerM may move.
+**************************************************************************/
+Customer *addCustomer(CustomerStore store)
+{
+    Customer *pCustomer;
+
+    if (store->iNumCustomer >= store->iMaxCustomer)
+    {
+        if (store->iMaxCustomer > MAX_STORE_CUSTOMERS / 2)
+            ErrExit(ERR_TOO_MANY_CUST
+                , "Invalid input file, max customers is %d"
+                , MAX_STORE_CUSTOMERS);
+        growCustomers(store, store->iMaxCustomer > 0
+            ? store->iMaxCustomer * 2 : STORE_INITIAL_CUSTOMERS);
+    }
+    pCustomer = &store->customerM[store->iNumCustomer++];
+    memset(pCustomer, 0, sizeof(Customer));
+    return pCustomer;
+}
+
+/******************** appendCustomerStore **************************************
+void appendCustomerStore(CustomerStore store, CustomerStore from)
+Purpose:
+    Moves all of the customers of the store "from" to the end of "store"
+    and frees "from".
+Notes:
+    - The customers' traits aren't copied.  The chunks of from's trait arena
+      are adopted by store's trait arena.
+**************************************************************************/
+void appendCustomerStore(CustomerStore store, CustomerStore from)
+{
+    int iMax = store->iMaxCustomer > 0 ? store->iMaxCustomer : STORE_INITIAL_CUSTOMERS;
+
+    if (from->iNumCustomer > MAX_STORE_CUSTOMERS - store->iNumCustomer)
+        ErrExit(ERR_TOO_MANY_CUST
+            , "Invalid input file, max customers is %d"
+            , MAX_STORE_CUSTOMERS);
+    while (iMax < store->iNumCustomer + from->iNumCustomer)
+        iMax *= 2;
+    if (iMax != store->iMaxCustomer)
+        growCustomers(store, iMax);
+    memcpy(store->customerM + store->iNumCustomer, from->customerM
+        , sizeof(Customer) * from->iNumCustomer);
+    store->iNumCustomer += from->iNumCustomer;
+    store->iDeadTraitBytes += from->iDeadTraitBytes;
+    arenaAdopt(&store->traitArena, &from->traitArena);
+    freeCustomerStore(from);
+}
+
+/******************** addCustomerTrait **************************************
+void addCustomerTrait(CustomerStore store, Customer *pCustomer, Trait trait)
+Purpose:
+    Adds a trait to a customer's traits in the store's trait arena.
+Notes:
+    - The customer's traits grow in place when they are the last allocation
+      of the arena (which they are when traits are added to the customer
+      most recently given traits).  Otherwise, the old traits are dead.
+**************************************************************************/
+void addCustomerTrait(CustomerStore store, Customer *pCustomer, Trait trait)
+{
+    int iNum = pCustomer->iNumberOfTraits;
+    Trait *pOld = pCustomer->traitM;
+    pCustomer->traitM = arenaGrowLast(&store->traitArena, pCustomer->traitM
+        , sizeof(Trait) * iNum, sizeof(Trait) * (iNum + 1));
+    if (pCustomer->traitM != pOld)
+        store->iDeadTraitBytes += sizeof(Trait) * iNum;
+    pCustomer->traitM[iNum] = trait;
+    pCustomer->iNumberOfTraits = iNum + 1;
+}
+
+/******************** removeCustomerTrait **************************************
+int removeCustomerTrait(CustomerStore store, Customer *pCustomer, Trait trait)
+Purpose:
+    Removes one occurrence of a trait from a customer's traits.
+Returns:
+    TRUE - the trait was removed
+    FALSE - the customer doesn't have the trait
+Notes:
+    - The traits after it are moved down in place, so the customer's last
+      trait slot is dead.
+**************************************************************************/
+int removeCustomerTrait(CustomerStore store, Customer *pCustomer, Trait trait)
+{
+    int j;
+
+    for (j = 0; j < pCustomer->iNumberOfTraits; j++)
+    {
+        if (pCustomer->traitM[j].iTraitId == trait.iTraitId)
+        {
+            memmove(&pCustomer->traitM[j], &pCustomer->traitM[j + 1]
+                , sizeof(Trait) * (pCustomer->iNumberOfTraits - j - 1));
+            pCustomer->iNumberOfTraits--;
+            store->iDeadTraitBytes += sizeof(Trait);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/******************** removeCustomer **************************************
+void removeCustomer(CustomerStore store, int iCustomer)
+Purpose:
+    Makes a customer a tombstone.  Its traits are dead.
+**************************************************************************/
+void removeCustomer(CustomerStore store, int iCustomer)
+{
+    Customer *pCustomer = &store->customerM[iCustomer];
+
+    if (pCustomer->iNumberOfTraits == CUSTOMER_REMOVED)
+        return;
+    store->iDeadTraitBytes += sizeof(Trait) * pCustomer->iNumberOfTraits;
+    pCustomer->iNumberOfTraits = CUSTOMER_REMOVED;
+    pCustomer->traitM = NULL;
+    store->iNumRemoved++;
+}
+
+/******************** arenaUsed **************************************
+size_t arenaUsed(Arena *pArena)
+Purpose:
+    Returns the number of bytes handed out by an arena.
+**************************************************************************/
+size_t arenaUsed(Arena *pArena)
+{
+    ArenaChunk *pChunk;
+    size_t iUsed = 0;
+
+    for (pChunk = pArena->pChunk; pChunk != NULL; pChunk = pChunk->pPrev)
+        iUsed += pChunk->iUsed;
+    return iUsed;
+}
+
+/******************** hashCustomerId **************************************
+static unsigned int hashCustomerId(char *pszCustomerId)
+Purpose:
+    Returns the FNV-1a hash of a customer ID.
+**************************************************************************/
+static unsigned int hashCustomerId(char *pszCustomerId)
+{
+    unsigned int uiHash = 2166136261u;
+    while (*pszCustomerId != '\0')
+    {
+        uiHash ^= (unsigned char) *pszCustomerId++;
+        uiHash *= 16777619u;
+    }
+    return uiHash;
+}
+
+/******************** insertCustomerId **************************************
+static void insertCustomerId(CustomerStore store, int iCustomer)
+Purpose:
+    Adds a customer's subscript to the ID hash table (which has room).
+Notes:
+    - A customer with the ID of an earlier one is found after it (the
+      probes of an ID visit its customers in the order they were added).
+**************************************************************************/
+static void insertCustomerId(CustomerStore store, int iCustomer)
+{
+    unsigned int uiMask = store->iIdHashSize - 1;
+    unsigned int uiSlot = hashCustomerId(store->customerM[iCustomer].szCustomerId)
+        & uiMask;
+
+    while (store->idHashM[uiSlot] != 0)
+        uiSlot = (uiSlot + 1) & uiMask;
+    store->idHashM[uiSlot] = iCustomer + 1;
+}
+
+/******************** buildCustomerIds **************************************
+static void buildCustomerIds(CustomerStore store, int iMinCustomers)
+Purpose:
+    (Re)builds the ID hash table with room for at least iMinCustomers
+    customers (it is at most half full).
+**************************************************************************/
+static void buildCustomerIds(CustomerStore store, int iMinCustomers)
+{
+    int iSize = ID_HASH_MIN_SIZE;
+    int i;
+
+    while (iSize < 2 * iMinCustomers)
+        iSize *= 2;
+    free(store->idHashM);
+    store->idHashM = calloc(iSize, sizeof(int));
+    if (store->idHashM == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for the customer IDs");
+    store->iIdHashSize = iSize;
+    for (i = 0; i < store->iNumCustomer; i++)
+        insertCustomerId(store, i);
+}
+
+/******************** findCustomer **************************************
+int findCustomer(CustomerStore store, char *pszCustomerId)
+Purpose:
+    Returns the subscript of the first customer with an ID which wasn't
+    removed, or CUSTOMER_NOT_FOUND.
+**************************************************************************/
+int findCustomer(CustomerStore store, char *pszCustomerId)
+{
+    unsigned int uiMask;
+    unsigned int uiSlot;
+    Customer *pCustomer;
+
+    if (store->idHashM == NULL)
+        buildCustomerIds(store, store->iNumCustomer);
+    uiMask = store->iIdHashSize - 1;
+    uiSlot = hashCustomerId(pszCustomerId) & uiMask;
+    for (; store->idHashM[uiSlot] != 0; uiSlot = (uiSlot + 1) & uiMask)
+    {
+        pCustomer = &store->customerM[store->idHashM[uiSlot] - 1];
+        if (pCustomer->iNumberOfTraits != CUSTOMER_REMOVED
+            && strcmp(pCustomer->szCustomerId, pszCustomerId) == 0)
+            return store->idHashM[uiSlot] - 1;
+    }
+    return CUSTOMER_NOT_FOUND;
+}
+
+/******************** addCustomerId **************************************
+void addCustomerId(CustomerStore store, int iCustomer)
+Purpose:
+    Adds a customer (whose ID has been set) to the ID hash table after
+    it was added to the store by addCustomer.
+Notes:
+    - Nothing is done if the table hasn't been built yet, since building
+      it adds every customer.
+**************************************************************************/
+void addCustomerId(CustomerStore store, int iCustomer)
+{
+    if (store->idHashM == NULL)
+        return;
+    if (2 * store->iNumCustomer > store->iIdHashSize)
+        buildCustomerIds(store, store->iNumCustomer);
+    else
+        insertCustomerId(store, iCustomer);
+}
+
+/******************** compactCustomerStore **************************************
+void compactCustomerStore(CustomerStore store)
+Purpose:
+    Drops the tombstones and dead traits of the store by copying the
+    remaining customers and their traits to a new customerM and arena.
+Notes:
+    - The subscripts of the customers change, so an index of the store
+      must be rebuilt and cached query results discarded.
+    - If the store was loaded from a snapshot, its mapping is unmapped.
+**************************************************************************/
+void compactCustomerStore(CustomerStore store)
+{
+    CustomerStore compact = newCustomerStore();
+    Customer *pCustomer;
+    Customer *pNew;
+    int iNumTraits;
+    int i;
+
+    growCustomers(compact, store->iNumCustomer - store->iNumRemoved + 1);
+    for (i = 0; i < store->iNumCustomer; i++)
+    {
+        pCustomer = &store->customerM[i];
+        if (pCustomer->iNumberOfTraits == CUSTOMER_REMOVED)
+            continue;
+        iNumTraits = pCustomer->iNumberOfTraits;
+        pNew = addCustomer(compact);
+        *pNew = *pCustomer;
+        pNew->traitM = NULL;
+        if (iNumTraits > 0)
+        {
+            pNew->traitM = arenaAlloc(&compact->traitArena, sizeof(Trait) * iNumTraits);
+            memcpy(pNew->traitM, pCustomer->traitM, sizeof(Trait) * iNumTraits);
+        }
+    }
+
+    // the store takes over compact's customers and traits
+    if (!customersMapped(store))
+        free(store->customerM);
+    arenaFree(&store->traitArena);
+    if (store->pSnapshot != NULL)
+        munmap(store->pSnapshot, store->iSnapshotSize);
+    free(store->idHashM);
+    store->customerM = compact->customerM;
+    store->iNumCustomer = compact->iNumCustomer;
+    store->iMaxCustomer = compact->iMaxCustomer;
+    store->traitArena = compact->traitArena;
+    store->pSnapshot = NULL;
+    store->iSnapshotSize = 0;
+    store->iNumRemoved = 0;
+    store->iDeadTraitBytes = 0;
+    store->iIdHashSize = 0;
+    store->idHashM = NULL;
+    free(compact);
+}
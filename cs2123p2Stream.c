@@ -0,0 +1,528 @@
+/******************************************************************************
+cs2123p2Stream.c
+Purpose:
+    Implements streaming mode (p2 -r) for customer files which don't fit
+    in memory.  All of the queries are read and compiled first.  The
+    customer file is then read through a bounded buffer, a chunk of whole
+    customers at a time.  Each chunk is parsed, its customers are printed
+    to the customer dump and every query is run for them, and the chunk is
+    freed.  The output of each query is written to its own spool, and the
+    spools are printed in order at the end, so the output is the same as
+    loading the customer file.  The memory used depends on the number of
+    queries and the buffer size, not on the number of customers.
+Notes:
+    1. The spools are stdio streams (fopencookie) which fill a segment
+       buffer of SPOOL_SEGMENT bytes.  A full segment is appended to one
+       shared temporary file, and the spool remembers the offsets of its
+       segments.  This doesn't need a file descriptor per query.
+    2. The customer file warnings and the customer dump are spools too,
+       since the warnings are printed before the dump and the dump before
+       the queries.
+    3. A chunk ends before the last line in the buffer which starts with a
+       CUSTOMER record (see lastCustomerLine), so it holds whole customers.
+       If a single customer is bigger than the buffer, the buffer grows.
+    4. The queries are compiled before the trait dictionary has the
+       customers' traits, so their traits are added to it by
+       compileQueryAddTraits.  A query trait which no customer has gives
+       the same result as one which isn't in the dictionary.
+    5. If converting a query calls ErrExit, the queries after it aren't
+       read.  The preceding queries are evaluated and everything is printed
+       up to the error message before the program exits.
+    6. The customers aren't indexed, snapshots aren't used and the results
+       aren't cached.
+    7. In the bitmap output format (-f bitmap), each query's spool gets a
+       word of its bitmap whenever 64 customers have been streamed.  The
+       header of its record (with the number of customers) is printed
+       before the spool at the end.
+    8. A COUNT query only counts its customers (its spool stays empty).  A
+       LIMIT query only spools the customers in its window, and stops
+       running once it has found OFFSET plus LIMIT customers.
+******************************************************************************/
+#define _GNU_SOURCE                 // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "cs2123p2.h"
+
+#define STREAM_BUFFER (1 << 20)     // initial bytes of the customer file buffer
+#define SPOOL_SEGMENT 8192          // bytes of each spool segment
+#define STREAM_INITIAL_QUERIES 64   // initial size of the query array
+
+// SpoolFile typedef is the temporary file holding the full spool segments
+typedef struct
+{
+    FILE *pFile;                    // the temporary file
+    long long lSize;                // bytes written to it
+} SpoolFile;
+
+// Spool typedef is output saved until it can be printed in order
+typedef struct
+{
+    SpoolFile *pSpoolFile;          // where full segments are written
+    char segmentM[SPOOL_SEGMENT];   // the segment being filled
+    int iUsed;                      // bytes of segmentM filled
+    long long *lOffsetM;            // offset of each full segment in pSpoolFile
+    int iNumSegments;               // number of full segments
+    int iMaxSegments;               // allocated size of lOffsetM
+} Spool;
+
+// StreamQuery typedef is one query and its output
+typedef struct
+{
+    OutputBuffer output;            // output printed before the query's result
+    int iQueryCnt;                  // number of the query in the query file
+    ResultMode mode;                // COUNT or LIMIT suffix of the query
+    long long lNumMatches;          // customers found satisfying the query
+    int bPrintResult;               // TRUE if the query's result is printed
+    int bCompiled;                  // TRUE if the query was compiled
+    Program program;                // the compiled query
+    Spool *pSpool;                  // the customers satisfying the query
+    FILE *pResult;                  // stream writing to pSpool
+    BitWord pendingBits;            // bitmap word not written yet (bitmap format)
+} StreamQuery;
+
+// StreamCall typedef is the arguments of convertStreamQuery for callTrapped
+typedef struct
+{
+    FILE *pFile;                    // output of the query
+    StreamQuery *pQuery;
+    char *pszQuery;                 // text line of the query
+    int iQueryCnt;                  // number of the query in the query file
+    Out out;                        // receives the postfix form of the query
+} StreamCall;
+
+// StreamLoop typedef is the arguments of addStreamQuery for readQueries
+typedef struct
+{
+    SpoolFile *pSpoolFile;          // where the result spools are written
+    StreamQuery *queryM;            // the queries read so far
+    int iNumQueries;                // number of queries in queryM
+    int iMaxQueries;                // allocated size of queryM
+    Out out;                        // receives the postfix form of a query
+    int iExitRC;                    // return code of a query calling ErrExit
+} StreamLoop;
+
+/******************** spoolWrite **************************************
+static ssize_t spoolWrite(void *pCookie, const char *pBuf, size_t iSize)
+Purpose:
+    fopencookie write function of a spool.  Copies the bytes to the
+    segment buffer, appending each full segment to the spool file.
+**************************************************************************/
+static ssize_t spoolWrite(void *pCookie, const char *pBuf, size_t iSize)
+{
+    Spool *pSpool = (Spool *) pCookie;
+    size_t iLeft = iSize;
+    size_t iCopy;
+
+    while (iLeft > 0)
+    {
+        iCopy = SPOOL_SEGMENT - pSpool->iUsed;
+        if (iCopy > iLeft)
+            iCopy = iLeft;
+        memcpy(pSpool->segmentM + pSpool->iUsed, pBuf, iCopy);
+        pSpool->iUsed += iCopy;
+        pBuf += iCopy;
+        iLeft -= iCopy;
+        if (pSpool->iUsed < SPOOL_SEGMENT)
+            break;
+
+        // the segment is full, so append it to the spool file
+        if (pSpool->iNumSegments >= pSpool->iMaxSegments)
+        {
+            pSpool->iMaxSegments = pSpool->iMaxSegments > 0
+                ? pSpool->iMaxSegments * 2 : 16;
+            pSpool->lOffsetM = realloc(pSpool->lOffsetM
+                , sizeof(long long) * pSpool->iMaxSegments);
+            if (pSpool->lOffsetM == NULL)
+                ErrExit(ERR_ALGORITHM, "out of memory for an output spool");
+        }
+        if (fseeko(pSpool->pSpoolFile->pFile, pSpool->pSpoolFile->lSize, SEEK_SET) != 0
+            || fwrite(pSpool->segmentM, 1, SPOOL_SEGMENT, pSpool->pSpoolFile->pFile)
+                != SPOOL_SEGMENT)
+            ErrExit(ERR_ALGORITHM, "unable to write an output spool");
+        pSpool->lOffsetM[pSpool->iNumSegments++] = pSpool->pSpoolFile->lSize;
+        pSpool->pSpoolFile->lSize += SPOOL_SEGMENT;
+        pSpool->iUsed = 0;
+    }
+    return iSize;
+}
+
+/******************** openSpool **************************************
+static FILE *openSpool(SpoolFile *pSpoolFile, Spool **ppSpool)
+Purpose:
+    Creates an empty spool and returns the (unbuffered) stream writing
+    to it.
+**************************************************************************/
+static FILE *openSpool(SpoolFile *pSpoolFile, Spool **ppSpool)
+{
+    cookie_io_functions_t functions = { NULL, spoolWrite, NULL, NULL };
+    Spool *pSpool = malloc(sizeof(Spool));
+    FILE *pFile;
+
+    if (pSpool == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for an output spool");
+    pSpool->pSpoolFile = pSpoolFile;
+    pSpool->iUsed = 0;
+    pSpool->lOffsetM = NULL;
+    pSpool->iNumSegments = 0;
+    pSpool->iMaxSegments = 0;
+    pFile = fopencookie(pSpool, "w", functions);
+    if (pFile == NULL)
+        ErrExit(ERR_ALGORITHM, "unable to create an output spool");
+    // the segment is the buffer
+    setvbuf(pFile, NULL, _IONBF, 0);
+    *ppSpool = pSpool;
+    return pFile;
+}
+
+/******************** printSpool **************************************
+static void printSpool(FILE *pFile, Spool *pSpool, FILE *pOutput)
+Purpose:
+    Closes a spool's stream, prints the spool to pOutput and frees it.
+**************************************************************************/
+static void printSpool(FILE *pFile, Spool *pSpool, FILE *pOutput)
+{
+    char segmentM[SPOOL_SEGMENT];
+    int s;
+
+    fclose(pFile);
+    for (s = 0; s < pSpool->iNumSegments; s++)
+    {
+        if (fseeko(pSpool->pSpoolFile->pFile, pSpool->lOffsetM[s], SEEK_SET) != 0
+            || fread(segmentM, 1, SPOOL_SEGMENT, pSpool->pSpoolFile->pFile)
+                != SPOOL_SEGMENT)
+            ErrExit(ERR_ALGORITHM, "unable to read an output spool");
+        fwrite(segmentM, 1, SPOOL_SEGMENT, pOutput);
+    }
+    fwrite(pSpool->segmentM, 1, pSpool->iUsed, pOutput);
+    free(pSpool->lOffsetM);
+    free(pSpool);
+}
+
+/******************** convertStreamQuery **************************************
+static void convertStreamQuery(void *pArg)
+Purpose:
+    Prints the first part of a query's output (like processQuery) and
+    compiles the query.
+**************************************************************************/
+static void convertStreamQuery(void *pArg)
+{
+    StreamCall *pCall = (StreamCall *) pArg;
+    StreamQuery *pQuery = pCall->pQuery;
+    char *szExpr;                   // the query without its suffix
+    ProgramImp program;             // the query compiled from out
+    int rc;
+
+    resetQueryContext();
+    fprintQueryStart(pCall->pFile, pCall->iQueryCnt, pCall->pszQuery);
+    pCall->out->iOutCount = 0;
+    szExpr = queryAlloc(strlen(pCall->pszQuery) + 1);
+    splitResultMode(pCall->pszQuery, szExpr, &pQuery->mode);
+    rc = convertToPostFix(szExpr, pCall->out);
+    switch (rc)
+    {
+    case 0:   // Conversion was successful
+        fprintQueryPostfix(pCall->pFile, pCall->out);
+        pQuery->bCompiled = compileQueryAddTraits(pCall->out, &program);
+        pQuery->program = keepProgram(&program, NULL);
+        pQuery->bPrintResult = fprintQueryCompiled(pCall->pFile, pCall->iQueryCnt
+            , pQuery->bCompiled);
+        break;
+    default:  // WARN_MISSING_LPAREN, WARN_MISSING_RPAREN
+        fprintQueryWarning(pCall->pFile, pCall->iQueryCnt, rc);
+    }
+}
+
+/******************** addStreamQuery **************************************
+static int addStreamQuery(void *pArg, char *pszQuery, int iQueryCnt)
+Purpose:
+    Converts and compiles a query line read by readQueries, adding it to
+    the queries of a StreamLoop with a result spool if its result is printed.
+Returns:
+    TRUE to read the next query, FALSE if converting the query called
+    ErrExit (pLoop->iExitRC is its return code).
+**************************************************************************/
+static int addStreamQuery(void *pArg, char *pszQuery, int iQueryCnt)
+{
+    StreamLoop *pLoop = (StreamLoop *) pArg;
+    StreamCall call;
+
+    if (pLoop->iNumQueries >= pLoop->iMaxQueries)
+    {
+        pLoop->iMaxQueries = pLoop->iMaxQueries > 0 ? pLoop->iMaxQueries * 2
+            : STREAM_INITIAL_QUERIES;
+        pLoop->queryM = realloc(pLoop->queryM, sizeof(StreamQuery) * pLoop->iMaxQueries);
+        if (pLoop->queryM == NULL)
+            ErrExit(ERR_ALGORITHM, "out of memory for the queries");
+    }
+    call.pQuery = &pLoop->queryM[pLoop->iNumQueries++];
+    memset(&call.pQuery->output, 0, sizeof(OutputBuffer));
+    call.pQuery->iQueryCnt = iQueryCnt;
+    call.pQuery->lNumMatches = 0;
+    call.pQuery->bPrintResult = FALSE;
+    call.pQuery->bCompiled = FALSE;
+    call.pQuery->program = NULL;
+    call.pQuery->pSpool = NULL;
+    call.pQuery->pResult = NULL;
+    call.pQuery->pendingBits = 0;
+    call.pFile = openBufferStream(&call.pQuery->output);
+    call.pszQuery = pszQuery;
+    call.iQueryCnt = iQueryCnt;
+    call.out = pLoop->out;
+    pLoop->iExitRC = callTrapped(call.pFile, convertStreamQuery, &call);
+    closeBufferStream(call.pFile);
+
+    if (pLoop->iExitRC != 0)
+        return FALSE;
+    if (call.pQuery->bPrintResult)
+        call.pQuery->pResult = openSpool(pLoop->pSpoolFile, &call.pQuery->pSpool);
+    return TRUE;
+}
+
+/******************** readStreamQueries **************************************
+static StreamQuery *readStreamQueries(SpoolFile *pSpoolFile, int *piNumQueries
+    , int *piExitRC)
+Purpose:
+    Reads, converts and compiles all of the queries, creating a result
+    spool for each query whose result is printed.
+Returns:
+    The array of *piNumQueries queries.  If converting a query called
+    ErrExit, it is the last one and *piExitRC is the return code (else 0).
+**************************************************************************/
+static StreamQuery *readStreamQueries(SpoolFile *pSpoolFile, int *piNumQueries
+    , int *piExitRC)
+{
+    StreamLoop loop;
+
+    loop.pSpoolFile = pSpoolFile;
+    loop.queryM = NULL;
+    loop.iNumQueries = 0;
+    loop.iMaxQueries = 0;
+    loop.out = newOut();
+    loop.iExitRC = 0;
+    readQueries(addStreamQuery, &loop);
+    freeOut(loop.out);
+    *piNumQueries = loop.iNumQueries;
+    *piExitRC = loop.iExitRC;
+    return loop.queryM;
+}
+
+/******************** streamMatch **************************************
+static int streamMatch(StreamQuery *pQuery, Customer *pCustomer)
+Purpose:
+    Runs a query for a customer and counts it if it satisfies the query.
+Returns:
+    TRUE if the customer is in the query's result (for a LIMIT query, it
+    must be in the window), else FALSE.
+**************************************************************************/
+static int streamMatch(StreamQuery *pQuery, Customer *pCustomer)
+{
+    ResultMode *pMode = &pQuery->mode;
+
+    // a LIMIT query which has all of its customers isn't run
+    if (pMode->iMode == RESULT_LIMIT
+        && pQuery->lNumMatches >= (long long) pMode->iOffset + pMode->iLimit)
+        return FALSE;
+    if (!runProgram(pQuery->program, pCustomer))
+        return FALSE;
+    pQuery->lNumMatches++;
+    return pMode->iMode != RESULT_LIMIT || pQuery->lNumMatches > pMode->iOffset;
+}
+
+/******************** streamChunk **************************************
+static int streamChunk(char *pszText, char *pszEnd, FILE *pWarn, FILE *pDump
+    , StreamQuery queryM[], int iNumQueries, long long *plNumCustomer)
+Purpose:
+    Parses a chunk of whole customers of the customer file, prints them
+    to the customer dump and runs the queries for them.  *plNumCustomer
+    is the number of customers before the chunk, and the chunk's customers
+    are added to it.
+Returns:
+    FALSE if a TRAIT record preceded any CUSTOMER record, else TRUE.
+**************************************************************************/
+static int streamChunk(char *pszText, char *pszEnd, FILE *pWarn, FILE *pDump
+    , StreamQuery queryM[], int iNumQueries, long long *plNumCustomer)
+{
+    CustomerStore store = newCustomerStore();
+    StreamQuery *pQuery;
+    Writer writer;
+    long long lBit;                 // customer's bit in the bitmap format
+    int bValid;
+    int bMatch;
+    int q;
+    int i;
+
+    bValid = parseCustomerText(store, traitDict, pszText, pszEnd, pWarn);
+    if (bValid)
+    {
+        if (iOutputFormat == FORMAT_TEXT)
+        {
+            writer = newWriter(pDump);
+            for (i = 0; i < store->iNumCustomer; i++)
+                writeCustomer(writer, &store->customerM[i]);
+            freeWriter(writer);
+        }
+        for (q = 0; q < iNumQueries; q++)
+        {
+            pQuery = &queryM[q];
+            if (pQuery->pResult == NULL || !pQuery->bCompiled)
+                continue;
+            if (pQuery->mode.iMode == RESULT_COUNT)
+            {
+                for (i = 0; i < store->iNumCustomer; i++)
+                    streamMatch(pQuery, &store->customerM[i]);
+                continue;
+            }
+            writer = newWriter(pQuery->pResult);
+            for (i = 0; i < store->iNumCustomer; i++)
+            {
+                bMatch = streamMatch(pQuery, &store->customerM[i]);
+                if (iOutputFormat != FORMAT_BITMAP)
+                {
+                    if (bMatch)
+                        writeQueryMatch(writer, pQuery->iQueryCnt, &store->customerM[i]);
+                    continue;
+                }
+                lBit = *plNumCustomer + i;
+                if (bMatch)
+                    pQuery->pendingBits |= (BitWord) 1 << (lBit % BITS_PER_WORD);
+                if (lBit % BITS_PER_WORD == BITS_PER_WORD - 1)
+                {
+                    writeBitWords(writer, &pQuery->pendingBits, 1);
+                    pQuery->pendingBits = 0;
+                }
+            }
+            freeWriter(writer);
+        }
+        *plNumCustomer += store->iNumCustomer;
+    }
+    freeCustomerStore(store);
+    return bValid;
+}
+
+/******************** readAndProcessQueriesStream **************************************
+void readAndProcessQueriesStream()
+Purpose:
+    Does what getCustomerData, printCustomerData and readAndProcessQueries
+    do, streaming the customer file instead of loading it.
+Notes:
+    - References the globals:  pFileCustomer, pFileQuery, traitDict
+**************************************************************************/
+void readAndProcessQueriesStream()
+{
+    SpoolFile spoolFile;
+    Spool *pWarnSpool;
+    Spool *pDumpSpool;
+    FILE *pWarn;                    // warnings of the customer file
+    FILE *pDump;                    // customer dump
+    StreamQuery *queryM;
+    Writer writer;
+    int iNumQueries;
+    int iExitRC;                    // return code of an ErrExit converting a query
+    char *pszBuffer;                // bounded buffer of customer file text
+    size_t iMaxBuffer = STREAM_BUFFER;
+    size_t iUsed = 0;               // bytes of text in pszBuffer
+    size_t iRead;
+    char *pszSplit;                 // end of the chunk in pszBuffer
+    long long lNumCustomer = 0;     // customers streamed
+    int bEof = FALSE;
+    int bValid = TRUE;              // FALSE if a TRAIT preceded any CUSTOMER
+    int q;
+
+    if (traitDict == NULL)
+        traitDict = newTraitDict();
+    spoolFile.pFile = tmpfile();
+    spoolFile.lSize = 0;
+    pszBuffer = malloc(iMaxBuffer);
+    if (spoolFile.pFile == NULL || pszBuffer == NULL)
+        ErrExit(ERR_ALGORITHM, "unable to create the output spools");
+    pWarn = openSpool(&spoolFile, &pWarnSpool);
+    pDump = openSpool(&spoolFile, &pDumpSpool);
+
+    queryM = readStreamQueries(&spoolFile, &iNumQueries, &iExitRC);
+
+    // stream the customer file a chunk of whole customers at a time
+    while (bValid && !(bEof && iUsed == 0))
+    {
+        if (!bEof)
+        {
+            iRead = fread(pszBuffer + iUsed, 1, iMaxBuffer - iUsed, pFileCustomer);
+            iUsed += iRead;
+            if (iRead == 0)
+            {
+                if (ferror(pFileCustomer))
+                    ErrExit(ERR_BAD_INPUT, "unable to read the customer file");
+                bEof = TRUE;
+            }
+        }
+        if (bEof)
+            pszSplit = pszBuffer + iUsed;
+        else
+        {
+            pszSplit = lastCustomerLine(pszBuffer, pszBuffer + iUsed);
+            if (pszSplit == NULL)
+            {
+                // not even one whole customer in the buffer
+                if (iUsed == iMaxBuffer)
+                {
+                    iMaxBuffer *= 2;
+                    pszBuffer = realloc(pszBuffer, iMaxBuffer);
+                    if (pszBuffer == NULL)
+                        ErrExit(ERR_ALGORITHM, "out of memory for the customer file buffer");
+                }
+                continue;
+            }
+        }
+        bValid = streamChunk(pszBuffer, pszSplit, pWarn, pDump, queryM, iNumQueries
+            , &lNumCustomer);
+        iUsed -= pszSplit - pszBuffer;
+        memmove(pszBuffer, pszSplit, iUsed);
+    }
+    free(pszBuffer);
+
+    // the last word of each bitmap
+    if (iOutputFormat == FORMAT_BITMAP && lNumCustomer % BITS_PER_WORD != 0)
+    {
+        for (q = 0; q < iNumQueries; q++)
+        {
+            if (queryM[q].pResult == NULL || queryM[q].mode.iMode == RESULT_COUNT)
+                continue;
+            writer = newWriter(queryM[q].pResult);
+            writeBitWords(writer, &queryM[q].pendingBits, 1);
+            freeWriter(writer);
+        }
+    }
+
+    // print everything in the order of loading the customer file
+    printSpool(pWarn, pWarnSpool, warningFile());
+    if (!bValid)
+        ErrExit(ERR_BAD_INPUT
+        , "TRAIT record without CUSTOMER");
+    printCustomerData(NULL, 0);
+    printSpool(pDump, pDumpSpool, stdout);
+    for (q = 0; q < iNumQueries; q++)
+    {
+        fwrite(queryM[q].output.pszText, 1, queryM[q].output.iLength, stdout);
+        freeOutputBuffer(&queryM[q].output);
+        if (queryM[q].pResult != NULL)
+        {
+            writer = newWriter(stdout);
+            if (queryM[q].mode.iMode == RESULT_COUNT)
+                writeResultCount(writer, queryM[q].iQueryCnt, lNumCustomer
+                    , queryM[q].lNumMatches);
+            else
+                writeResultHeading(writer, queryM[q].iQueryCnt, lNumCustomer
+                    , resultModeCount(&queryM[q].mode, queryM[q].lNumMatches));
+            freeWriter(writer);
+            printSpool(queryM[q].pResult, queryM[q].pSpool, stdout);
+        }
+        free(queryM[q].program);
+    }
+    if (iExitRC != 0)
+        exit(iExitRC);
+    free(queryM);
+    fclose(spoolFile.pFile);
+    if (iOutputFormat == FORMAT_TEXT)
+        printf("\n");
+}
@@ -0,0 +1,318 @@
+/******************************************************************************
+cs2123p2Update.c
+Purpose:
+    Implements incremental customer updates (p2 -u updateFile, and the
+    update lines a daemon's clients send), so a change to the customers
+    doesn't need them all to be loaded again.  An update file has one
+    update per line:
+        ADD CUSTOMER szCustomerId szName
+        REMOVE CUSTOMER szCustomerId
+        ADD TRAIT szCustomerId szTraitType szTraitValue
+        REMOVE TRAIT szCustomerId szTraitType szTraitValue
+    Each update changes the customer store, the trait dictionary, the index
+    and the query cache in place:
+        ADD CUSTOMER     appends the customer (without traits) to the store
+                         and grows the index if its bitmaps are full
+        REMOVE CUSTOMER  turns off the customer's bits in the index and the
+                         cached results and makes it a tombstone
+        ADD TRAIT        interns a new type or value in the dictionary, adds
+                         the trait to the customer and sets its bits of the
+                         trait's bitmap and its type's "exactly one" bitmap
+        REMOVE TRAIT     removes one occurrence of the trait from the
+                         customer and recomputes those bits
+Notes:
+    1. An update refers to the first customer with the ID which wasn't
+       removed (see findCustomer).  ADD CUSTOMER of an ID which is in the
+       store is rejected.
+    2. An update which can't be applied is printed with a warning (like a
+       bad record of the customer file) and skipped.
+    3. After a file of updates, finishUpdates compacts the store
+       (compactCustomerStore) if at least a quarter of its customers are
+       tombstones or half of its trait memory is dead.  The index is then
+       rebuilt and the cached results are discarded, since the customers'
+       subscripts change.
+    4. The updates aren't made while queries are evaluated, so nothing is
+       locked (the query cache locks itself).  A daemon (p2 -L) applies
+       its clients' updates between the queries, when none of its workers
+       is processing one (see cs2123p2Server.c).
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cs2123p2.h"
+
+#define COMPACT_REMOVED_DIVISOR 4   // compact when 1/4 of the customers are removed
+#define COMPACT_DEAD_DIVISOR 2      // or 1/2 of the trait memory is dead
+
+/******************** applyAddCustomer **************************************
+int applyAddCustomer(CustomerStore store, char *pszCustomerId, char *pszName)
+Purpose:
+    Adds a customer without any traits to the end of the store.
+Returns:
+    UPDATE_OK or UPDATE_DUPLICATE (a customer has the ID)
+Notes:
+    - The ID and name are truncated like the customer file's.
+**************************************************************************/
+int applyAddCustomer(CustomerStore store, char *pszCustomerId, char *pszName)
+{
+    Customer *pCustomer;
+
+    if (findCustomer(store, pszCustomerId) != CUSTOMER_NOT_FOUND)
+        return UPDATE_DUPLICATE;
+    pCustomer = addCustomer(store);
+    strncpy(pCustomer->szCustomerId, pszCustomerId, sizeof(pCustomer->szCustomerId) - 1);
+    strncpy(pCustomer->szCustomerName, pszName, sizeof(pCustomer->szCustomerName) - 1);
+    addCustomerId(store, store->iNumCustomer - 1);
+    if (customerIndex != NULL)
+        resizeCustomerIndex(customerIndex, store->customerM, store->iNumCustomer
+            , traitDict);
+    return UPDATE_OK;
+}
+
+/******************** applyRemoveCustomer **************************************
+int applyRemoveCustomer(CustomerStore store, char *pszCustomerId)
+Purpose:
+    Removes a customer, leaving a tombstone in the store.
+Returns:
+    UPDATE_OK or UPDATE_NO_CUSTOMER
+**************************************************************************/
+int applyRemoveCustomer(CustomerStore store, char *pszCustomerId)
+{
+    int iCustomer = findCustomer(store, pszCustomerId);
+
+    if (iCustomer == CUSTOMER_NOT_FOUND)
+        return UPDATE_NO_CUSTOMER;
+    if (customerIndex != NULL)
+        removeCustomerIndex(customerIndex, iCustomer);
+    removeCustomer(store, iCustomer);
+    invalidateQueryCacheCustomer(queryCache, iCustomer);
+    return UPDATE_OK;
+}
+
+/******************** applyAddTrait **************************************
+int applyAddTrait(CustomerStore store, char *pszCustomerId, char *pszTraitType
+    , char *pszTraitValue)
+Purpose:
+    Adds a trait to a customer.
+Returns:
+    UPDATE_OK or UPDATE_NO_CUSTOMER
+Notes:
+    - A new trait type or value is added to the global traitDict, and
+      bitmaps for it are added to the index.
+**************************************************************************/
+int applyAddTrait(CustomerStore store, char *pszCustomerId, char *pszTraitType
+    , char *pszTraitValue)
+{
+    int iCustomer = findCustomer(store, pszCustomerId);
+    Trait trait;
+
+    if (iCustomer == CUSTOMER_NOT_FOUND)
+        return UPDATE_NO_CUSTOMER;
+    trait.iTraitType = addTraitType(traitDict, pszTraitType);
+    trait.iTraitId = addTrait(traitDict, trait.iTraitType, pszTraitValue);
+    addCustomerTrait(store, &store->customerM[iCustomer], trait);
+    if (customerIndex != NULL)
+    {
+        resizeCustomerIndex(customerIndex, store->customerM, store->iNumCustomer
+            , traitDict);
+        updateCustomerIndex(customerIndex, iCustomer, trait);
+    }
+    invalidateQueryCacheType(queryCache, traitTypeName(traitDict, trait.iTraitType));
+    return UPDATE_OK;
+}
+
+/******************** applyRemoveTrait **************************************
+int applyRemoveTrait(CustomerStore store, char *pszCustomerId
+    , char *pszTraitType, char *pszTraitValue)
+Purpose:
+    Removes one occurrence of a trait from a customer.
+Returns:
+    UPDATE_OK, UPDATE_NO_CUSTOMER or UPDATE_NO_TRAIT
+**************************************************************************/
+int applyRemoveTrait(CustomerStore store, char *pszCustomerId
+    , char *pszTraitType, char *pszTraitValue)
+{
+    int iCustomer = findCustomer(store, pszCustomerId);
+    Trait trait;
+
+    if (iCustomer == CUSTOMER_NOT_FOUND)
+        return UPDATE_NO_CUSTOMER;
+    trait.iTraitType = findTraitType(traitDict, pszTraitType);
+    trait.iTraitId = TRAIT_NOT_FOUND;
+    if (trait.iTraitType != TRAIT_NOT_FOUND)
+        trait.iTraitId = findTrait(traitDict, trait.iTraitType, pszTraitValue);
+    if (trait.iTraitId == TRAIT_NOT_FOUND
+        || !removeCustomerTrait(store, &store->customerM[iCustomer], trait))
+        return UPDATE_NO_TRAIT;
+    if (customerIndex != NULL)
+        updateCustomerIndex(customerIndex, iCustomer, trait);
+    invalidateQueryCacheType(queryCache, pszTraitType);
+    return UPDATE_OK;
+}
+
+/******************** applyUpdate **************************************
+int applyUpdate(CustomerStore store, char *pszRecord)
+Purpose:
+    Parses an update record and applies it.
+Parameters:
+    I/O CustomerStore store   the customers being updated
+    I   char *pszRecord       the update (e.g., "ADD TRAIT 111111 BOOK SCIFI")
+Returns:
+    UPDATE_OK or the reason it wasn't applied (e.g., UPDATE_BAD_RECORD)
+**************************************************************************/
+int applyUpdate(CustomerStore store, char *pszRecord)
+{
+    char szVerb[7];                             // ADD or REMOVE
+    char szKind[9];                             // CUSTOMER or TRAIT
+    char szCustomerId[7];
+    char szName[21];
+    char szTraitType[MAX_TRAIT_TYPE + 1];
+    char szTraitValue[MAX_TRAIT_VALUE + 1];
+    int bAdd;
+    int iOffset = 0;                            // position after the kind
+    char *p;
+
+    if (sscanf(pszRecord, "%6s %8s %n", szVerb, szKind, &iOffset) < 2)
+        return UPDATE_BAD_RECORD;
+    if (strcmp(szVerb, "ADD") == 0)
+        bAdd = TRUE;
+    else if (strcmp(szVerb, "REMOVE") == 0)
+        bAdd = FALSE;
+    else
+        return UPDATE_BAD_RECORD;
+    p = pszRecord + iOffset;
+
+    if (strcmp(szKind, "CUSTOMER") == 0)
+    {
+        if (!bAdd)
+        {
+            if (sscanf(p, "%6s", szCustomerId) < 1)
+                return UPDATE_BAD_RECORD;
+            return applyRemoveCustomer(store, szCustomerId);
+        }
+        if (sscanf(p, "%6s %20[^\r\n]", szCustomerId, szName) < 2)
+            return UPDATE_BAD_RECORD;
+        return applyAddCustomer(store, szCustomerId, szName);
+    }
+    if (strcmp(szKind, "TRAIT") == 0)
+    {
+        if (sscanf(p, "%6s %10s %12s", szCustomerId, szTraitType, szTraitValue) < 3)
+            return UPDATE_BAD_RECORD;
+        if (bAdd)
+            return applyAddTrait(store, szCustomerId, szTraitType, szTraitValue);
+        return applyRemoveTrait(store, szCustomerId, szTraitType, szTraitValue);
+    }
+    return UPDATE_BAD_RECORD;
+}
+
+/******************** isUpdateRecord **************************************
+int isUpdateRecord(char *pszRecord)
+Purpose:
+    Determines whether a line is an update (it starts with ADD or REMOVE
+    followed by CUSTOMER or TRAIT) rather than a query.
+Returns:
+    TRUE if it is an update, else FALSE
+Notes:
+    - A query can't start with two operands, so no query is an update.
+**************************************************************************/
+int isUpdateRecord(char *pszRecord)
+{
+    char szVerb[7];                             // ADD or REMOVE
+    char szKind[9];                             // CUSTOMER or TRAIT
+
+    if (sscanf(pszRecord, "%6s %8s", szVerb, szKind) < 2)
+        return FALSE;
+    return (strcmp(szVerb, "ADD") == 0 || strcmp(szVerb, "REMOVE") == 0)
+        && (strcmp(szKind, "CUSTOMER") == 0 || strcmp(szKind, "TRAIT") == 0);
+}
+
+/******************** updateMessage **************************************
+char *updateMessage(int rc)
+Purpose:
+    Returns the warning for the return code of an update.
+**************************************************************************/
+char *updateMessage(int rc)
+{
+    switch (rc)
+    {
+        case UPDATE_OK:
+            return "Update applied";
+        case UPDATE_NO_CUSTOMER:
+            return "Customer ID not found";
+        case UPDATE_DUPLICATE:
+            return "Customer ID already exists";
+        case UPDATE_NO_TRAIT:
+            return "Customer doesn't have the trait";
+        default:
+            return "Expected ADD or REMOVE of a CUSTOMER or TRAIT";
+    }
+}
+
+/******************** applyUpdateFile **************************************
+int applyUpdateFile(CustomerStore store, FILE *pFileUpdate, FILE *pWarn)
+Purpose:
+    Applies every update of an update file and then compacts the store if
+    it needs it.
+Parameters:
+    I/O CustomerStore store   the customers being updated
+    I   FILE *pFileUpdate     the open update file
+    I/O FILE *pWarn           stream receiving the warnings
+Returns:
+    The number of updates applied.
+**************************************************************************/
+int applyUpdateFile(CustomerStore store, FILE *pFileUpdate, FILE *pWarn)
+{
+    char *pszRecord = NULL;         // the update line (from getline)
+    size_t iRecordSize = 0;         // size of pszRecord
+    int iApplied = 0;
+    int rc;
+
+    while (getline(&pszRecord, &iRecordSize, pFileUpdate) != -1)
+    {
+        // if the line is blank, skip it
+        if (pszRecord[strspn(pszRecord, " \r\n")] == '\0')
+            continue;
+        rc = applyUpdate(store, pszRecord);
+        if (rc == UPDATE_OK)
+        {
+            iApplied++;
+            continue;
+        }
+        fprintf(pWarn, ">> %s", pszRecord);
+        FWARNING(pWarn, "%s", updateMessage(rc));
+    }
+    free(pszRecord);
+    finishUpdates(store);
+    return iApplied;
+}
+
+/******************** finishUpdates **************************************
+int finishUpdates(CustomerStore store)
+Purpose:
+    Compacts the store if enough of it is tombstones or dead traits, and
+    then rebuilds the index and discards the cached results.
+Returns:
+    TRUE if the store was compacted.
+**************************************************************************/
+int finishUpdates(CustomerStore store)
+{
+    size_t iTraitBytes = arenaUsed(&store->traitArena) + store->iSnapshotSize;
+    int iNumShards;
+
+    if (store->iNumRemoved == 0 && store->iDeadTraitBytes == 0)
+        return FALSE;
+    if ((long long) store->iNumRemoved * COMPACT_REMOVED_DIVISOR < store->iNumCustomer
+        && store->iDeadTraitBytes * COMPACT_DEAD_DIVISOR < iTraitBytes)
+        return FALSE;
+    compactCustomerStore(store);
+    if (customerIndex != NULL)
+    {
+        iNumShards = customerIndex->iNumShards;
+        freeCustomerIndex(customerIndex);
+        customerIndex = newCustomerIndex(store->customerM, store->iNumCustomer
+            , traitDict);
+        setIndexShards(customerIndex, iNumShards);
+    }
+    invalidateQueryCache(queryCache);
+    return TRUE;
+}
@@ -0,0 +1,198 @@
+/******************************************************************************
+cs2123p2Writer.c
+Purpose:
+    Implements the Writer used to print the customer dump and the query
+    results.  Those print one line per customer (and per trait), so
+    formatting each line with printf's "%-11s" style padding takes longer
+    than evaluating the queries.  A Writer copies the text and pads it
+    itself into a large buffer, and prints the buffer when it is full or
+    flushed.
+Notes:
+    1. If the Writer's stream has a file descriptor (e.g., stdout), the
+       stream is flushed first (so output printed to it with printf
+       precedes the Writer's) and the buffer is written with one write
+       per flush.  Other streams (e.g., the memory buffers of the query
+       workers and the spools of streaming mode) receive one fwrite per
+       flush.
+    2. Nothing may be printed to the stream between writing to a Writer
+       and flushing it.  freeWriter flushes it, and the functions using a
+       Writer free it before they return, so the output of ErrExit can't
+       precede the Writer's.
+    3. The text isn't truncated to the width (like printf's "%-20s").
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "cs2123p2.h"
+
+#define WRITER_BLANKS 32            // blanks written by one copy when padding
+
+static const char szBlanks[WRITER_BLANKS + 1] = "                                ";
+
+/******************** newWriter **************************************
+Writer newWriter(FILE *pFile)
+Purpose:
+    Allocates a Writer which prints to a stream.
+Parameters:
+    I/O FILE *pFile           stream receiving the output
+Returns:
+    the Writer (freed by freeWriter)
+Notes:
+    - The Writer last freed by the thread is reused (see cs2123p2Context.c).
+**************************************************************************/
+Writer newWriter(FILE *pFile)
+{
+    QueryContext *pContext = queryContext();
+    Writer writer = pContext->spareWriter;
+
+    pContext->spareWriter = NULL;
+    if (writer == NULL)
+        writer = malloc(sizeof(WriterImp));
+    if (writer == NULL)
+        ErrExit(ERR_ALGORITHM, "out of memory for an output buffer");
+    writer->pFile = pFile;
+    writer->iFd = fileno(pFile);    // -1 for a memory or cookie stream
+    writer->iUsed = 0;
+    return writer;
+}
+
+/******************** freeWriter **************************************
+void freeWriter(Writer writer)
+Purpose:
+    Flushes a Writer and frees it.  The thread's context keeps one freed
+    Writer for its next newWriter.
+**************************************************************************/
+void freeWriter(Writer writer)
+{
+    QueryContext *pContext = queryContext();
+
+    flushWriter(writer);
+    if (pContext->spareWriter == NULL)
+        pContext->spareWriter = writer;
+    else
+        free(writer);
+}
+
+/******************** flushWriter **************************************
+void flushWriter(Writer writer)
+Purpose:
+    Prints the text in the Writer's buffer to its stream.
+Notes:
+    - Like printf, an error writing the output is ignored.
+**************************************************************************/
+void flushWriter(Writer writer)
+{
+    char *pText = writer->bufferM;
+    size_t iLeft = writer->iUsed;
+    ssize_t iWritten;
+
+    writer->iUsed = 0;
+    if (iLeft == 0)
+        return;
+    if (writer->iFd < 0)
+    {
+        fwrite(pText, 1, iLeft, writer->pFile);
+        return;
+    }
+    // the stream's own buffered output precedes the Writer's
+    fflush(writer->pFile);
+    while (iLeft > 0)
+    {
+        iWritten = write(writer->iFd, pText, iLeft);
+        if (iWritten < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        pText += iWritten;
+        iLeft -= iWritten;
+    }
+}
+
+/******************** writeText **************************************
+void writeText(Writer writer, const char *pText, size_t iLen)
+Purpose:
+    Adds iLen characters to the Writer's buffer, flushing it when full.
+**************************************************************************/
+void writeText(Writer writer, const char *pText, size_t iLen)
+{
+    size_t iCopy;
+
+    // usual case:  it fits
+    if (iLen <= WRITER_BUFFER - writer->iUsed)
+    {
+        memcpy(writer->bufferM + writer->iUsed, pText, iLen);
+        writer->iUsed += iLen;
+        return;
+    }
+    while (iLen > 0)
+    {
+        if (writer->iUsed == WRITER_BUFFER)
+            flushWriter(writer);
+        iCopy = WRITER_BUFFER - writer->iUsed;
+        if (iCopy > iLen)
+            iCopy = iLen;
+        memcpy(writer->bufferM + writer->iUsed, pText, iCopy);
+        writer->iUsed += iCopy;
+        pText += iCopy;
+        iLen -= iCopy;
+    }
+}
+
+/******************** writeString **************************************
+void writeString(Writer writer, const char *pszText)
+Purpose:
+    Adds a string to the Writer's buffer.
+**************************************************************************/
+void writeString(Writer writer, const char *pszText)
+{
+    writeText(writer, pszText, strlen(pszText));
+}
+
+/******************** writeInteger **************************************
+void writeInteger(Writer writer, long long lValue)
+Purpose:
+    Adds the decimal digits of a number to the Writer's buffer, like
+    printf's "%lld".
+**************************************************************************/
+void writeInteger(Writer writer, long long lValue)
+{
+    char szDigits[24];              // digits of the largest long long and its sign
+    int i = sizeof(szDigits);
+    unsigned long long ulValue = lValue < 0 ? 0 - (unsigned long long) lValue
+        : (unsigned long long) lValue;
+
+    do
+    {
+        szDigits[--i] = '0' + ulValue % 10;
+        ulValue /= 10;
+    } while (ulValue > 0);
+    if (lValue < 0)
+        szDigits[--i] = '-';
+    writeText(writer, szDigits + i, sizeof(szDigits) - i);
+}
+
+/******************** writePadded **************************************
+void writePadded(Writer writer, const char *pszText, int iWidth)
+Purpose:
+    Adds a string to the Writer's buffer followed by blanks to make it at
+    least iWidth characters, like printf's "%-*s".
+**************************************************************************/
+void writePadded(Writer writer, const char *pszText, int iWidth)
+{
+    size_t iLen = strlen(pszText);
+    size_t iPad;
+
+    writeText(writer, pszText, iLen);
+    while ((int) iLen < iWidth)
+    {
+        iPad = iWidth - iLen;
+        if (iPad > WRITER_BLANKS)
+            iPad = WRITER_BLANKS;
+        writeText(writer, szBlanks, iPad);
+        iLen += iPad;
+    }
+}